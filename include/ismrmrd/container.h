@@ -0,0 +1,126 @@
+/* ISMRMRD append-only container file */
+
+/**
+ * @file container.h
+ */
+
+#pragma once
+#ifndef ISMRMRD_CONTAINER_H
+#define ISMRMRD_CONTAINER_H
+
+#include "ismrmrd/dataset_backend.h"
+
+#include <fstream>
+
+namespace ISMRMRD {
+
+/**
+ *   Backend storing the dataset in an append-only container file.
+ *
+ *   Elements are written one after the other in the ISMRMRD streaming protocol
+ *   format (see serialization.h), so appending is a single sequential write.
+ *   A footer index records the offset, message type, variable and (for
+ *   acquisitions) the encoding counters of every element, which makes all
+ *   reads O(1) seeks. The file layout is:
+ *
+ *     - preamble: "ISMRMRDC" magic, uint32 format version, uint32 reserved
+ *     - data: protocol messages in the order they were appended, followed by
+ *       a close message. After skipping the preamble this section can be read
+ *       with the ProtocolDeserializer.
+ *     - index: per element uint64 offset, uint32 variable id, uint16 message id
+ *       and the ISMRMRD_EncodingCounters
+ *     - variable table: uint32 length and name of every image/array variable
+ *     - trailer: uint64 end of data, uint64 index offset, uint64 number of
+ *       elements, uint32 number of variables, uint32 format version,
+ *       "ISMRMRDI" magic. The trailer always ends the file.
+ *
+ *   The index is written by flush() and when a backend that appended is destroyed. If a
+ *   file without a valid index is opened (e.g. because the writer crashed), the
+ *   index is rebuilt by scanning the data section. Variable names are only kept
+ *   in the index, so recovered images and arrays are assigned to the variables
+ *   "images" and "arrays".
+ *
+ *   Unlike HDF5 files, the images (arrays) of one variable do not need to have
+ *   the same dimensions. Such variables cannot be converted to HDF5.
+ */
+class EXPORTISMRMRD ContainerDatasetBackend : public DatasetBackend {
+public:
+    ContainerDatasetBackend(const char *filename, bool create_file_if_needed = true);
+    virtual ~ContainerDatasetBackend();
+
+    /// Checks for the container magic at the start of a file
+    static bool isContainerFile(const char *filename);
+
+    /// Writes the index to the file
+    virtual void flush();
+
+    /// Encoding counters of an acquisition, read from the index only
+    ISMRMRD_EncodingCounters getAcquisitionCounters(uint32_t index);
+
+    virtual void writeHeader(const std::string &xmlstring);
+    virtual void readHeader(std::string &xmlstring);
+    virtual void appendAcquisition(const ISMRMRD_Acquisition *acq);
+    virtual void readAcquisition(uint32_t index, ISMRMRD_Acquisition *acq);
+    virtual uint32_t getNumberOfAcquisitions();
+    virtual void appendWaveform(const ISMRMRD_Waveform *wav);
+    virtual void readWaveform(uint32_t index, ISMRMRD_Waveform *wav);
+    virtual uint32_t getNumberOfWaveforms();
+    virtual void appendImage(const std::string &var, const ISMRMRD_Image *im);
+    virtual void readImage(const std::string &var, uint32_t index, ISMRMRD_Image *im);
+    virtual uint32_t getNumberOfImages(const std::string &var);
+    virtual void appendNDArray(const std::string &var, const ISMRMRD_NDArray *arr);
+    virtual void readNDArray(const std::string &var, uint32_t index, ISMRMRD_NDArray *arr);
+    virtual uint32_t getNumberOfNDArrays(const std::string &var);
+    virtual bool replaceNDArray(const std::string &var, uint32_t index, const ISMRMRD_NDArray *arr);
+    virtual std::vector<std::string> getImageVariables();
+    virtual std::vector<std::string> getNDArrayVariables();
+
+private:
+    // Not copyable, the backend owns the open file
+    ContainerDatasetBackend(const ContainerDatasetBackend &);
+    ContainerDatasetBackend &operator=(const ContainerDatasetBackend &);
+
+    struct Entry {
+        uint64_t offset;
+        uint32_t variable;
+        uint16_t message_id;
+        ISMRMRD_EncodingCounters idx;
+    };
+
+    void loadIndex();
+    void rebuildIndex();
+    void addEntry(const Entry &entry);
+    uint32_t variableId(const std::string &var);
+    const Entry &seriesEntry(const std::string &var, uint16_t message_id, uint32_t index);
+    void beginAppend(Entry &entry, uint16_t message_id, uint32_t variable);
+    void endAppend(const Entry &entry);
+    void seekMessage(const Entry &entry);
+    void write(const void *buffer, size_t count);
+    void read(void *buffer, size_t count);
+
+    // Serializes the calls that move the file position
+    Mutex mutex_;
+    std::vector<char> buffer_;
+    std::fstream file_;
+    bool writable_;
+    bool indexed_;
+    bool appending_;
+    // Set by the first append, the destructor only writes the index then
+    bool appended_;
+    uint64_t write_pos_;
+    uint64_t data_end_;
+    uint64_t file_size_;
+
+    std::vector<Entry> entries_;
+    std::vector<std::string> variables_;
+    std::map<std::string, uint32_t> variable_ids_;
+    std::vector<size_t> headers_;
+    std::vector<size_t> acquisitions_;
+    std::vector<size_t> waveforms_;
+    std::map<uint32_t, std::vector<size_t> > images_;
+    std::map<uint32_t, std::vector<size_t> > arrays_;
+};
+
+} /* ISMRMRD namespace */
+
+#endif /* ISMRMRD_CONTAINER_H */
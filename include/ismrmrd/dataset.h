@@ -13,11 +13,27 @@
 #include <hdf5.h>
 
 #ifdef __cplusplus
+#include "ismrmrd/dataset_backend.h"
+#include "ismrmrd/views.h"
+#include <map>
 #include <string>
+#include <vector>
 namespace ISMRMRD {
 extern "C" {
 #endif
 
+/**
+ *   Storage formats for the samples of acquisitions in an HDF5 file.
+ *
+ *   Acquisitions are always returned as complex floats, the compact formats
+ *   are converted when the file is read.
+ */
+enum ISMRMRD_AcquisitionStorage {
+    ISMRMRD_STORAGE_FLOAT = 0, /**< 32-bit floats, lossless (default) */
+    ISMRMRD_STORAGE_INT16 = 1, /**< 16-bit integers with one scale factor per acquisition */
+    ISMRMRD_STORAGE_HALF = 2   /**< IEEE 754 half precision floats with one power of two scale per acquisition */
+};
+
 /**
  *   Interface for accessing an ISMRMRD Data Set stored on disk in HDF5 format.
  *
@@ -32,6 +48,7 @@ typedef struct ISMRMRD_Dataset {
     char *groupname;
     hid_t fileid;
     hid_t transfer_properties;
+    uint16_t acquisition_storage; /**< ISMRMRD_AcquisitionStorage of appended acquisitions */
 } ISMRMRD_Dataset;
 
 /**
@@ -46,12 +63,29 @@ EXPORTISMRMRD int ismrmrd_init_dataset(ISMRMRD_Dataset *dset, const char *filena
  */
 EXPORTISMRMRD int ismrmrd_open_dataset(ISMRMRD_Dataset *dset, const bool create_if_needed);
 
+/**
+ * Opens an existing ISMRMRD dataset read-only.
+ *
+ * Unlike ismrmrd_open_dataset, this never attempts a read-write open and
+ * disables HDF5 file locking (where supported), so many processes can read
+ * the same file concurrently, including from read-only mounts.
+ */
+EXPORTISMRMRD int ismrmrd_open_dataset_readonly(ISMRMRD_Dataset *dset);
+
 /**
  * Closes all references to the underlying HDF5 file.
  *
  */
 EXPORTISMRMRD int ismrmrd_close_dataset(ISMRMRD_Dataset *dset);
 
+/**
+ * Writes everything appended so far from the HDF5 caches to the file.
+ *
+ * Without flushing, appended data may only reach the file when it is closed.
+ * Flushing is expensive, call this every so often during long acquisitions.
+ */
+EXPORTISMRMRD int ismrmrd_flush_dataset(const ISMRMRD_Dataset *dset);
+
 /**
  *  Writes the XML header string to the dataset.
  *
@@ -75,6 +109,30 @@ EXPORTISMRMRD char * ismrmrd_read_header(const ISMRMRD_Dataset *dset);
  */
 EXPORTISMRMRD int ismrmrd_append_acquisition(const ISMRMRD_Dataset *dset, const ISMRMRD_Acquisition *acq);
 
+/**
+ *  Selects how the samples of acquisitions appended from now on are stored.
+ *
+ *  The compact formats halve the size of the acquisition data at the cost of
+ *  precision: ISMRMRD_STORAGE_INT16 scales every acquisition to the range of
+ *  16-bit integers, ISMRMRD_STORAGE_HALF rounds the samples to half floats
+ *  after scaling them by a power of two, stored with the acquisition, that
+ *  brings the largest sample near the top of the half range. Small and large
+ *  samples alike keep 11 significant bits and nothing overflows.
+ *  Trajectories and headers are stored unchanged. The compact samples are
+ *  tagged opaque HDF5 data, so readers that do not know the formats fail to
+ *  read them rather than returning them unscaled.
+ *
+ *  Opening a dataset picks up the format of the acquisitions already in it.
+ *  All acquisitions of a dataset share one format, so changing it fails once
+ *  acquisitions have been written.
+ */
+EXPORTISMRMRD int ismrmrd_set_acquisition_storage(ISMRMRD_Dataset *dset, const uint16_t storage);
+
+/**
+ *  Returns the format acquisitions are appended in, @see ismrmrd_set_acquisition_storage.
+ */
+EXPORTISMRMRD uint16_t ismrmrd_get_acquisition_storage(const ISMRMRD_Dataset *dset);
+
 /**
  *  Reads the acquisition with the specified index from the dataset.
  */
@@ -124,6 +182,12 @@ EXPORTISMRMRD int ismrmrd_append_image(const ISMRMRD_Dataset *dset, const char *
 EXPORTISMRMRD int ismrmrd_read_image(const ISMRMRD_Dataset *dset, const char *varname,
                                      const uint32_t index, ISMRMRD_Image *im);
 
+/**
+ *   Reads only the header of an image stored with appendImage.
+ */
+EXPORTISMRMRD int ismrmrd_read_image_header(const ISMRMRD_Dataset *dset, const char *varname,
+                                            const uint32_t index, ISMRMRD_ImageHeader *head);
+
 /**
  *  Return the number of images in the variable varname in the dataset.
  */
@@ -145,24 +209,249 @@ EXPORTISMRMRD int ismrmrd_append_array(const ISMRMRD_Dataset *dset, const char *
 
 /**
  *  Reads an array from the data file.
+ *
+ *  The array gets the dimensions it was appended with. Up to version 1.14.3
+ *  the number of stored arrays was returned as an extra last dimension.
  */
 EXPORTISMRMRD int ismrmrd_read_array(const ISMRMRD_Dataset *dataset, const char *varname,
                                      const uint32_t index, ISMRMRD_NDArray *arr);
 
+/**
+ *  Overwrites the array at index with an array of the same data type and
+ *  dimensions, e.g. to update an array that is kept as a single element.
+ */
+EXPORTISMRMRD int ismrmrd_write_array(const ISMRMRD_Dataset *dset, const char *varname, const uint32_t index,
+                                      const ISMRMRD_NDArray *arr);
+
 /**
  *  Return the number of arrays in the variable varname in the dataset.
  */
 EXPORTISMRMRD uint32_t ismrmrd_get_number_of_arrays(const ISMRMRD_Dataset *dset, const char *varname);
 
+/**
+ *  Batched variants of the append and read functions above.
+ *
+ *  Each call extends or reads the underlying HDF5 variables once for the whole
+ *  batch of count elements, rather than once per element. Reading starts at
+ *  index first, and fails if fewer than count elements remain. The output
+ *  elements must be initialized; their memory is reallocated as needed.
+ *
+ *  All images (arrays) appended in one call must have the same size and type,
+ *  as they are stored in one block of the variable varname. Reading fails
+ *  when a stored header does not match the stored data.
+ */
+EXPORTISMRMRD int ismrmrd_append_acquisitions(const ISMRMRD_Dataset *dset, const ISMRMRD_Acquisition *acqs,
+                                              const uint32_t count);
+EXPORTISMRMRD int ismrmrd_read_acquisitions(const ISMRMRD_Dataset *dset, const uint32_t first,
+                                            const uint32_t count, ISMRMRD_Acquisition *acqs);
+EXPORTISMRMRD int ismrmrd_append_waveforms(const ISMRMRD_Dataset *dset, const ISMRMRD_Waveform *wavs,
+                                           const uint32_t count);
+EXPORTISMRMRD int ismrmrd_read_waveforms(const ISMRMRD_Dataset *dset, const uint32_t first,
+                                         const uint32_t count, ISMRMRD_Waveform *wavs);
+EXPORTISMRMRD int ismrmrd_append_images(const ISMRMRD_Dataset *dset, const char *varname,
+                                        const ISMRMRD_Image *ims, const uint32_t count);
+EXPORTISMRMRD int ismrmrd_read_images(const ISMRMRD_Dataset *dset, const char *varname, const uint32_t first,
+                                      const uint32_t count, ISMRMRD_Image *ims);
+EXPORTISMRMRD int ismrmrd_append_arrays(const ISMRMRD_Dataset *dset, const char *varname,
+                                        const ISMRMRD_NDArray *arrs, const uint32_t count);
+EXPORTISMRMRD int ismrmrd_read_arrays(const ISMRMRD_Dataset *dset, const char *varname, const uint32_t first,
+                                      const uint32_t count, ISMRMRD_NDArray *arrs);
+
+/**
+ *  Reads only the headers of count acquisitions starting at index first.
+ *  The samples and trajectories are not read.
+ */
+EXPORTISMRMRD int ismrmrd_read_acquisition_headers(const ISMRMRD_Dataset *dset, const uint32_t first,
+                                                   const uint32_t count, ISMRMRD_AcquisitionHeader *heads);
+
     
 #ifdef __cplusplus
 } /* extern "C" */
 
+/// How an HDF5 file is opened by HDF5DatasetBackend and Dataset
+enum DatasetOpenMode {
+    DATASET_OPEN_OR_CREATE, ///< Open read-write, create the file if it does not exist
+    DATASET_OPEN_EXISTING,  ///< Open read-write, fall back to read-only if that fails
+    DATASET_READ_ONLY       ///< Open read-only, without file locking
+};
+
+/**
+ *   When HDF5DatasetBackend flushes appended data to the file.
+ *
+ *   The default flushes only when the file is closed. Otherwise a flush
+ *   happens once elements elements have been appended since the last one, or
+ *   once seconds have passed since the last one and something was appended,
+ *   whichever comes first. Without the background thread the time is only
+ *   checked when appending.
+ */
+struct EXPORTISMRMRD FlushPolicy {
+    FlushPolicy();
+
+    /// Appended elements (acquisitions, waveforms, images, arrays) between flushes, 0 to not count
+    uint32_t elements;
+    /// Seconds between flushes while there is unflushed data, 0 to not look at the time
+    double seconds;
+    /// Flush on a background thread rather than in the append that triggers it (POSIX only)
+    bool background;
+};
+
+/**
+ *   Backend storing the dataset in a group of an HDF5 file.
+ *
+ *   This is the default backend of the Dataset class and is a thin wrapper
+ *   around the C API above.
+ */
+class EXPORTISMRMRD HDF5DatasetBackend : public DatasetBackend {
+public:
+    HDF5DatasetBackend(const char* filename, const char* groupname, bool create_file_if_needed = true);
+    HDF5DatasetBackend(const char* filename, const char* groupname, DatasetOpenMode mode);
+    virtual ~HDF5DatasetBackend();
+
+    virtual void writeHeader(const std::string &xmlstring);
+    virtual void readHeader(std::string &xmlstring);
+    virtual void appendAcquisition(const ISMRMRD_Acquisition *acq);
+    virtual void readAcquisition(uint32_t index, ISMRMRD_Acquisition *acq);
+    virtual uint32_t getNumberOfAcquisitions();
+    virtual void readAcquisitions(uint32_t first, uint32_t count, ISMRMRD_Acquisition *acqs);
+    virtual void readAcquisitionHeaders(uint32_t first, uint32_t count, ISMRMRD_AcquisitionHeader *heads);
+    virtual void appendWaveform(const ISMRMRD_Waveform *wav);
+    virtual void readWaveform(uint32_t index, ISMRMRD_Waveform *wav);
+    virtual uint32_t getNumberOfWaveforms();
+    virtual void appendImage(const std::string &var, const ISMRMRD_Image *im);
+    virtual void readImage(const std::string &var, uint32_t index, ISMRMRD_Image *im);
+    virtual uint32_t getNumberOfImages(const std::string &var);
+    virtual void appendNDArray(const std::string &var, const ISMRMRD_NDArray *arr);
+    virtual void readNDArray(const std::string &var, uint32_t index, ISMRMRD_NDArray *arr);
+    virtual uint32_t getNumberOfNDArrays(const std::string &var);
+    virtual bool replaceNDArray(const std::string &var, uint32_t index, const ISMRMRD_NDArray *arr);
+    virtual std::vector<std::string> getImageVariables();
+    virtual std::vector<std::string> getNDArrayVariables();
+
+    /// Format of the acquisition samples in the file, see ismrmrd_set_acquisition_storage
+    void setAcquisitionStorage(ISMRMRD_AcquisitionStorage storage);
+    ISMRMRD_AcquisitionStorage getAcquisitionStorage() const;
+
+    /**
+     *  Sets how often appended data is flushed to the file, see FlushPolicy.
+     *  A crash loses at most the data appended since the last flush. Errors of
+     *  a background flush are thrown by the next append or flush; one that is
+     *  still pending when the policy changes or the backend is destroyed is
+     *  pushed onto the ISMRMRD error stack.
+     */
+    void setFlushPolicy(const FlushPolicy &policy);
+    FlushPolicy getFlushPolicy() const;
+    /// Flushes now, whatever the policy
+    virtual void flush();
+
+protected:
+    void open(const char* filename, const char* groupname, DatasetOpenMode mode);
+    void listVariables(std::vector<std::string> &images, std::vector<std::string> &arrays);
+    /// Counts appended elements and flushes when the policy says so
+    void appended(uint32_t count);
+
+    ISMRMRD_Dataset dset_;
+
+private:
+    // Not copyable, the backend owns the open file
+    HDF5DatasetBackend(const HDF5DatasetBackend &);
+    HDF5DatasetBackend &operator=(const HDF5DatasetBackend &);
+
+    struct FlushThread;
+
+    void flushFile();
+    void stopFlushThread();
+
+    FlushPolicy flush_policy_;
+    uint32_t unflushed_;
+    double last_flush_;
+    FlushThread *flush_thread_;
+};
+
+/**
+ *   Lock held by the library around its HDF5 calls.
+ *
+ *   The HDF5 library is usually built without thread safety, so calls into it
+ *   from different threads are serialized, whichever file they touch.
+ *   Applications calling HDF5 directly from several threads while using
+ *   ISMRMRD should hold this lock as well. The lock is recursive.
+ */
+EXPORTISMRMRD Mutex &getHDF5Mutex();
+
+/**
+ *   Bitmap of the k-space lines acquired in one encoding space.
+ *
+ *   Lines are addressed by kspace_encode_step_1, kspace_encode_step_2, slice,
+ *   contrast, phase, repetition and set. Averages and segments of a line are
+ *   not told apart. The mask grows as lines are added.
+ */
+class EXPORTISMRMRD SamplingMask {
+public:
+    SamplingMask();
+
+    /// Number of lines along [E1, E2, SLC, CON, PHS, REP, SET]
+    std::vector<size_t> getDims() const;
+    bool isSampled(const EncodingCounters &idx) const;
+    bool isSampled(uint16_t kspace_encode_step_1, uint16_t kspace_encode_step_2 = 0, uint16_t slice = 0,
+                   uint16_t contrast = 0, uint16_t phase = 0, uint16_t repetition = 0, uint16_t set = 0) const;
+    void setSampled(const EncodingCounters &idx);
+    /// Adds all lines of another mask
+    void merge(const SamplingMask &other);
+    /// Grows the mask to at least dims lines along [E1, E2, SLC, CON, PHS, REP, SET], the new lines not sampled
+    void extend(const std::vector<size_t> &dims);
+    size_t getNumberOfSampledLines() const;
+
+    /**
+     *  The mask as stored in a dataset: one bit per line, 16 lines along E1
+     *  per element, dimensions [(E1 + 15) / 16, E2, SLC, CON, PHS, REP, SET].
+     *  E1 of a mask read back from a bitmap is rounded up to a multiple of 16.
+     */
+    NDArray<uint16_t> getBitmap() const;
+    void setBitmap(const NDArray<uint16_t> &bitmap);
+
+protected:
+    void setSampled(const size_t *pos);
+    void reserve(const size_t *pos);
+
+    size_t dims_[7];
+    size_t capacity_[7];
+    std::vector<uint16_t> bits_;
+};
+
+/// Encoding counters that Dataset::readKSpace selects on or lays out as dimensions
+enum KSpaceCounter {
+    KSPACE_AVERAGE,
+    KSPACE_SLICE,
+    KSPACE_CONTRAST,
+    KSPACE_PHASE,
+    KSPACE_REPETITION,
+    KSPACE_SET,
+    KSPACE_SEGMENT
+};
+
+/// Selects the acquisitions assembled by Dataset::readKSpace and how they are arranged
+struct EXPORTISMRMRD KSpaceFilter {
+    KSpaceFilter();
+
+    /// Counters added as dimensions after [RO, E1, E2, CHA], at most three
+    std::vector<KSpaceCounter> dimensions;
+    /// Only acquisitions whose counters have these values are read
+    std::map<KSpaceCounter, uint16_t> values;
+    /// Smallest size of [RO, E1, E2], e.g. the encoded matrix size. Larger data grows the array.
+    size_t matrix_size[3];
+    /// Include lines acquired only for parallel imaging calibration
+    bool calibration;
+    /// Threads copying channels into place, used when the library is built with OpenMP
+    unsigned int threads;
+};
+
 //  ISMRMRD Dataset C++ Interface
 class EXPORTISMRMRD Dataset {
 public:
     // Constructor and destructor
     Dataset(const char* filename, const char* groupname, bool create_file_if_needed = true);
+    Dataset(const char* filename, const char* groupname, DatasetOpenMode mode);
+    /// Use a specific storage backend. The Dataset takes ownership of the backend.
+    explicit Dataset(DatasetBackend *backend);
     ~Dataset();
     
     // Methods
@@ -171,27 +460,141 @@ public:
     void readHeader(std::string& xmlstring);
     // Acquisitions
     void appendAcquisition(const Acquisition &acq);
+    /// Appends data owned elsewhere without copying it into an Acquisition first
+    void appendAcquisition(const AcquisitionView &acq);
     void readAcquisition(uint32_t index, Acquisition &acq);
     uint32_t getNumberOfAcquisitions();
+    /**
+     *  Assembles the k-space lines of one encoding space into an array of
+     *  [RO, E1, E2, CHA] followed by the counters in filter.dimensions.
+     *
+     *  The acquisition headers are read first to size the array, then the
+     *  selected acquisitions are read in batches and each channel is copied
+     *  straight into place. Positions without data are zero. Acquisitions that
+     *  differ only in counters that are neither a dimension nor a selected
+     *  value land on the same line, the last one read wins.
+     */
+    NDArray<complex_float_t> readKSpace(uint16_t encoding_space, const KSpaceFilter &filter = KSpaceFilter());
     // Images
     template <typename T> void appendImage(const std::string &var, const Image<T> &im);
+    template <typename T> void appendImage(const std::string &var, const ImageView<T> &im);
     void appendImage(const std::string &var, const ISMRMRD_Image *im);
     template <typename T> void readImage(const std::string &var, uint32_t index, Image<T> &im);
     uint32_t getNumberOfImages(const std::string &var);
     // NDArrays
     template <typename T> void appendNDArray(const std::string &var, const NDArray<T> &arr);
+    template <typename T> void appendNDArray(const std::string &var, const NDArrayView<T> &arr);
     void appendNDArray(const std::string &var, const ISMRMRD_NDArray *arr);
     template <typename T> void readNDArray(const std::string &var, uint32_t index, NDArray<T> &arr);
     uint32_t getNumberOfNDArrays(const std::string &var);
 
     //Waveforms
     void appendWaveform(const Waveform &wav);
+    void appendWaveform(const WaveformView &wav);
     void readWaveform(uint32_t index, Waveform & wav);
     uint32_t getNumberOfWaveforms();
+
+    /// Writes the appended data through to storage, see HDF5DatasetBackend::setFlushPolicy
+    void flush();
+
+    // Sampling masks
+    /**
+     *  Records the k-space lines of the acquisitions appended from now on in
+     *  one SamplingMask per encoding space. Noise, navigator, phase correction
+     *  and other non-imaging acquisitions are left out. The masks are stored as
+     *  the array variable "sampling_mask_<encoding space>" by writeSamplingMasks
+     *  or when the Dataset is destroyed, merged with any mask already stored,
+     *  which is overwritten unless the backend can only append.
+     *  A new mask covers the encoding limits of its encoding space in the XML
+     *  header, so that later sessions within the limits can add to it; lines
+     *  outside the stored mask make writeSamplingMasks throw after writing the
+     *  masks of the other encoding spaces. The destructor reports such errors
+     *  through the ISMRMRD error handler.
+     */
+    void trackSamplingMasks(bool enable = true);
+    void writeSamplingMasks();
+    bool hasSamplingMask(uint16_t encoding_space);
+    /// Reads the mask of an encoding space with a single array read, including lines not written yet
+    void readSamplingMask(uint16_t encoding_space, SamplingMask &mask);
+
 protected:
-    ISMRMRD_Dataset dset_;
+    DatasetBackend *backend_;
+    bool track_masks_;
+    std::map<uint16_t, SamplingMask> masks_;
 };
 
+/// Storage options used by repackDataset
+struct EXPORTISMRMRD RepackOptions {
+    RepackOptions();
+
+    /// Elements per chunk along the growth dimension, 0 picks chunks of about 64 KiB
+    uint32_t chunk_elements;
+    /// Deflate compression level from 1 to 9, 0 disables compression
+    unsigned int compression_level;
+    /// Apply the shuffle filter before compression
+    bool shuffle;
+    /// Store datasets contiguously. The result cannot be appended to.
+    bool contiguous;
+    /// Upper bound for the memory used while copying, in bytes
+    size_t buffer_size;
+};
+
+/**
+ *   Rewrites the group of an ISMRMRD file into a new file with different storage options.
+ *
+ *   Files written by appending elements one at a time have one element per
+ *   chunk, which makes reading them slow. The data is copied in batches
+ *   bounded by options.buffer_size and the element count of every dataset is
+ *   checked after copying. The destination must not be the source; it is
+ *   removed again when the repack fails.
+ */
+EXPORTISMRMRD void repackDataset(const std::string &source, const std::string &destination,
+                                 const std::string &groupname, const RepackOptions &options = RepackOptions());
+
+/**
+ *   Concatenates the group of several ISMRMRD files into a new file.
+ *
+ *   Every dataset of the group is stored with the chunking and filters it has
+ *   in the first file holding it. Chunks of later files with the same storage
+ *   are moved without decompressing them, as long as they line up with the
+ *   chunk boundaries of the result. Variable length records (acquisitions,
+ *   waveforms and image attributes) are read and written back in batches of
+ *   at most buffer_size bytes. The XML header is taken from the first file.
+ *   The destination must not be one of the sources; it is removed again when
+ *   the merge fails.
+ */
+EXPORTISMRMRD void mergeDatasets(const std::string &destination, const std::string &groupname,
+                                 const std::vector<std::string> &sources, size_t buffer_size = 64 * 1024 * 1024);
+
+/**
+ *   Copies variables of an ISMRMRD group into a new file.
+ *
+ *   Variables are named relative to the group, e.g. "data", "waveforms" or an
+ *   image or array variable; no variables selects all of them. Elements
+ *   first to first + count - 1 of each variable are copied, count 0 copies to
+ *   the end. Complete variables are copied as HDF5 objects, otherwise chunks
+ *   are moved as stored where possible, as for mergeDatasets. The XML header
+ *   is always copied. The destination must not be the source; it is removed
+ *   again when the split fails.
+ */
+EXPORTISMRMRD void splitDataset(const std::string &source, const std::string &destination,
+                                const std::string &groupname, const std::vector<std::string> &variables,
+                                uint32_t first = 0, uint32_t count = 0, size_t buffer_size = 64 * 1024 * 1024);
+
+/**
+ *   Creates an HDF5 file presenting several ISMRMRD files as a single dataset.
+ *
+ *   Every dataset below the group (acquisitions, waveforms, images and arrays)
+ *   becomes an HDF5 virtual dataset concatenating the elements of the source
+ *   files in the order given, so no data is copied. The XML header is taken
+ *   from the first file. The result is meant to be opened read-only; relative
+ *   source file names are resolved relative to the directory of the virtual file.
+ *   Every dataset of the sources has to be an array of elements, and the file
+ *   is removed again when creating it fails.
+ */
+EXPORTISMRMRD void createVirtualDataset(const std::string &filename, const std::string &groupname,
+                                        const std::vector<std::string> &sources);
+
 } /* ISMRMRD namespace */
 #endif
 
@@ -0,0 +1,184 @@
+/* ISMRMRD Data Set storage backends */
+
+/**
+ * @file dataset_backend.h
+ */
+
+#pragma once
+#ifndef ISMRMRD_DATASET_BACKEND_H
+#define ISMRMRD_DATASET_BACKEND_H
+
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/waveform.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace ISMRMRD {
+
+/**
+ *   Recursive mutex used to make backends safe for concurrent readers.
+ *
+ *   Wraps pthread mutexes or Windows critical sections, the library does not
+ *   rely on C++11 threads.
+ */
+class EXPORTISMRMRD Mutex {
+public:
+    Mutex();
+    ~Mutex();
+    void lock();
+    void unlock();
+
+private:
+    Mutex(const Mutex &);
+    Mutex &operator=(const Mutex &);
+
+    friend class Condition;
+    struct Impl;
+    Impl *impl_;
+};
+
+/**
+ *   Condition variable waiting on a Mutex that is held once.
+ *
+ *   Wraps pthread condition variables or Windows condition variables.
+ */
+class EXPORTISMRMRD Condition {
+public:
+    Condition();
+    ~Condition();
+    void wait(Mutex &mutex);
+    /// Returns false when the time ran out before the condition was signalled
+    bool wait(Mutex &mutex, double seconds);
+    void signal();
+    void broadcast();
+
+private:
+    Condition(const Condition &);
+    Condition &operator=(const Condition &);
+
+    struct Impl;
+    Impl *impl_;
+};
+
+/// Holds a Mutex for the lifetime of the object
+class ScopedLock {
+public:
+    explicit ScopedLock(Mutex &mutex) : mutex_(mutex) { mutex_.lock(); }
+    ~ScopedLock() { mutex_.unlock(); }
+
+private:
+    ScopedLock(const ScopedLock &);
+    ScopedLock &operator=(const ScopedLock &);
+
+    Mutex &mutex_;
+};
+
+/**
+ *   Storage interface used by the Dataset class.
+ *
+ *   A backend stores the XML header, acquisitions, waveforms and named series
+ *   of images and arrays. The Dataset class forwards all of its calls to a
+ *   backend, which allows the same Dataset API to be used with different
+ *   storage implementations (e.g. HDF5 files or plain memory).
+ *
+ *   Backends work on the C structures and report errors by throwing
+ *   std::runtime_error, like the rest of the C++ interface.
+ *
+ *   The read functions and element counts may be called from several threads
+ *   at once, backends synchronize access to shared state themselves. Appends
+ *   and header writes must not overlap with any other call.
+ */
+class EXPORTISMRMRD DatasetBackend {
+public:
+    virtual ~DatasetBackend() {}
+
+    // XML Header
+    virtual void writeHeader(const std::string &xmlstring) = 0;
+    virtual void readHeader(std::string &xmlstring) = 0;
+    // Acquisitions
+    virtual void appendAcquisition(const ISMRMRD_Acquisition *acq) = 0;
+    virtual void readAcquisition(uint32_t index, ISMRMRD_Acquisition *acq) = 0;
+    virtual uint32_t getNumberOfAcquisitions() = 0;
+    /// Reads count acquisitions starting at first, by default one at a time
+    virtual void readAcquisitions(uint32_t first, uint32_t count, ISMRMRD_Acquisition *acqs);
+    /// Reads only the headers of count acquisitions starting at first
+    virtual void readAcquisitionHeaders(uint32_t first, uint32_t count, ISMRMRD_AcquisitionHeader *heads);
+    // Waveforms
+    virtual void appendWaveform(const ISMRMRD_Waveform *wav) = 0;
+    virtual void readWaveform(uint32_t index, ISMRMRD_Waveform *wav) = 0;
+    virtual uint32_t getNumberOfWaveforms() = 0;
+    // Images
+    virtual void appendImage(const std::string &var, const ISMRMRD_Image *im) = 0;
+    virtual void readImage(const std::string &var, uint32_t index, ISMRMRD_Image *im) = 0;
+    virtual uint32_t getNumberOfImages(const std::string &var) = 0;
+    // NDArrays
+    virtual void appendNDArray(const std::string &var, const ISMRMRD_NDArray *arr) = 0;
+    virtual void readNDArray(const std::string &var, uint32_t index, ISMRMRD_NDArray *arr) = 0;
+    virtual uint32_t getNumberOfNDArrays(const std::string &var) = 0;
+    /// Overwrites the array at index with one of the same data type and dimensions. Returns
+    /// false, by default, if the backend can only append.
+    virtual bool replaceNDArray(const std::string &var, uint32_t index, const ISMRMRD_NDArray *arr);
+    // Variables
+    virtual std::vector<std::string> getImageVariables() = 0;
+    virtual std::vector<std::string> getNDArrayVariables() = 0;
+    /// Writes appended data through to storage, by default there is nothing to write
+    virtual void flush() {}
+};
+
+/**
+ *   Backend keeping all data in memory.
+ *
+ *   Nothing is written to disk. This is useful for pipelines that pass a
+ *   Dataset between stages and for unit tests. The same consistency rules as
+ *   for HDF5 files apply: all images (arrays) appended to one variable must have
+ *   the same dimensions and data type.
+ */
+class EXPORTISMRMRD MemoryDatasetBackend : public DatasetBackend {
+public:
+    MemoryDatasetBackend();
+    virtual ~MemoryDatasetBackend();
+
+    virtual void writeHeader(const std::string &xmlstring);
+    virtual void readHeader(std::string &xmlstring);
+    virtual void appendAcquisition(const ISMRMRD_Acquisition *acq);
+    virtual void readAcquisition(uint32_t index, ISMRMRD_Acquisition *acq);
+    virtual uint32_t getNumberOfAcquisitions();
+    virtual void appendWaveform(const ISMRMRD_Waveform *wav);
+    virtual void readWaveform(uint32_t index, ISMRMRD_Waveform *wav);
+    virtual uint32_t getNumberOfWaveforms();
+    virtual void appendImage(const std::string &var, const ISMRMRD_Image *im);
+    virtual void readImage(const std::string &var, uint32_t index, ISMRMRD_Image *im);
+    virtual uint32_t getNumberOfImages(const std::string &var);
+    virtual void appendNDArray(const std::string &var, const ISMRMRD_NDArray *arr);
+    virtual void readNDArray(const std::string &var, uint32_t index, ISMRMRD_NDArray *arr);
+    virtual uint32_t getNumberOfNDArrays(const std::string &var);
+    virtual bool replaceNDArray(const std::string &var, uint32_t index, const ISMRMRD_NDArray *arr);
+    virtual std::vector<std::string> getImageVariables();
+    virtual std::vector<std::string> getNDArrayVariables();
+
+private:
+    // Not copyable, the backend owns the stored elements
+    MemoryDatasetBackend(const MemoryDatasetBackend &);
+    MemoryDatasetBackend &operator=(const MemoryDatasetBackend &);
+
+    bool has_header_;
+    std::string header_;
+    std::vector<ISMRMRD_Acquisition *> acquisitions_;
+    std::vector<ISMRMRD_Waveform *> waveforms_;
+    std::map<std::string, std::vector<ISMRMRD_Image *> > images_;
+    std::map<std::string, std::vector<ISMRMRD_NDArray *> > arrays_;
+};
+
+/**
+ *   Copies the header and all acquisitions, waveforms, images and arrays from
+ *   one backend to another, e.g. to convert between storage formats.
+ *
+ *   Elements are copied as they are stored, without any conversion of data types.
+ */
+EXPORTISMRMRD void copyDataset(DatasetBackend &source, DatasetBackend &destination);
+
+} /* ISMRMRD namespace */
+
+#endif /* ISMRMRD_DATASET_BACKEND_H */
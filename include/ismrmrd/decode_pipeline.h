@@ -0,0 +1,146 @@
+/* ISMRMRD multi-threaded protocol stream decoding */
+
+/**
+ * @file decode_pipeline.h
+ */
+
+#pragma once
+#ifndef ISMRMRD_DECODE_PIPELINE_H
+#define ISMRMRD_DECODE_PIPELINE_H
+
+#include "ismrmrd/meta.h"
+#include "ismrmrd/serialization.h"
+
+#include <stdexcept>
+#include <vector>
+
+namespace ISMRMRD {
+
+/**
+ *   A message decoded by DecodePipeline.
+ *
+ *   The message is taken out with get, using the type it was decoded to:
+ *   ConfigFile, ConfigText, TextMessage, IsmrmrdHeader, Acquisition,
+ *   std::vector<Acquisition> for an ISMRMRD_MESSAGE_ACQUISITION_BATCH,
+ *   Waveform, or Image<T> and NDArray<T> of getDataType.
+ *
+ *   Passing the same DecodedMessage to every DecodePipeline::readNext hands
+ *   its storage back to the pipeline, which decodes into it again when a
+ *   later message has the same type.
+ */
+class EXPORTISMRMRD DecodedMessage {
+public:
+    DecodedMessage();
+    ~DecodedMessage();
+
+    /// ISMRMRD_MESSAGE_* id, ISMRMRD_MESSAGE_UNPEEKED before a message was read
+    uint16_t getId() const;
+    /// ISMRMRD_DataTypes of images and nd arrays
+    uint16_t getDataType() const;
+
+    /// The message, throws std::runtime_error when it was decoded to another type
+    template <typename Message> Message &get() {
+        Holder<Message> *holder = dynamic_cast<Holder<Message> *>(payload_);
+        if (holder == NULL) {
+            throw std::runtime_error("Decoded message is of another type");
+        }
+        return holder->value;
+    }
+
+    /// Meta attributes of an image, empty unless DecodePipelineOptions::parse_image_meta is set
+    const MetaContainer &getMeta() const;
+
+    void swap(DecodedMessage &other);
+
+private:
+    friend class DecodePipeline;
+
+    // Not copyable, messages are passed on with swap
+    DecodedMessage(const DecodedMessage &);
+    DecodedMessage &operator=(const DecodedMessage &);
+
+    struct Payload {
+        virtual ~Payload() {}
+    };
+
+    template <typename Message> struct Holder : Payload {
+        Message value;
+    };
+
+    // The message to decode into, keeping the one held if it is of the same type
+    template <typename Message> Message &reset(uint16_t id, uint16_t data_type) {
+        id_ = id;
+        data_type_ = data_type;
+        if (dynamic_cast<Holder<Message> *>(payload_) == NULL) {
+            delete payload_;
+            payload_ = NULL;
+            payload_ = new Holder<Message>;
+        }
+        return static_cast<Holder<Message> *>(payload_)->value;
+    }
+
+    uint16_t id_;
+    uint16_t data_type_;
+    Payload *payload_;
+    MetaContainer *meta_;
+};
+
+/// Settings of DecodePipeline
+struct EXPORTISMRMRD DecodePipelineOptions {
+    DecodePipelineOptions();
+
+    /// Decoding threads, 0 to decode on the thread calling readNext
+    unsigned int workers;
+    /// Messages read ahead of readNext, framed or decoded
+    size_t queue_size;
+    /// Parse the meta attributes of images on the decoding threads
+    bool parse_image_meta;
+    /// Read the source in blocks with read_some, false to read no further than the message being framed
+    bool read_ahead;
+};
+
+/**
+ *   Reads a protocol stream on a reader thread and decodes its messages on
+ *   worker threads.
+ *
+ *   The reader thread only frames the stream: it reads the source into
+ *   blocks of 1 MiB and the message headers it needs to find the end of each
+ *   message. A worker decodes the message straight from the block, allocating
+ *   the acquisitions, images and arrays and parsing the XML header and, if
+ *   asked to, image meta attributes; the block is used again once all
+ *   messages in it are decoded. readNext returns the messages in stream
+ *   order; at most options.queue_size of them are held between the reader and
+ *   readNext.
+ *
+ *   The pipeline buffers the source itself, do not wrap it in a
+ *   BufferedReadableStreamView. Blocks are read with read_some, which for an
+ *   IStreamView waits for a full block or the end of the stream; on pipes and
+ *   sockets use an FdReadableStreamView, which returns what has arrived, or
+ *   turn off options.read_ahead. Data after the ISMRMRD_MESSAGE_CLOSE message
+ *   may have been read into a block as well.
+ *
+ *   Errors of the reader and the workers are thrown by readNext when the
+ *   message they occurred in is next. The destructor waits for a read of the
+ *   reader thread that is in progress, so it returns once the source has data
+ *   or is closed.
+ */
+class EXPORTISMRMRD DecodePipeline {
+public:
+    explicit DecodePipeline(ReadableStreamView &source, const DecodePipelineOptions &options = DecodePipelineOptions());
+    ~DecodePipeline();
+
+    /// The next message of the stream, returns false at ISMRMRD_MESSAGE_CLOSE
+    bool readNext(DecodedMessage &msg);
+
+private:
+    // Not copyable, the pipeline owns its threads
+    DecodePipeline(const DecodePipeline &);
+    DecodePipeline &operator=(const DecodePipeline &);
+
+    struct Impl;
+    Impl *impl_;
+};
+
+} /* ISMRMRD namespace */
+
+#endif /* ISMRMRD_DECODE_PIPELINE_H */
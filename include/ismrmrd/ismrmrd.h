@@ -604,6 +604,8 @@ static_assert(std::is_standard_layout<AcquisitionHeader>::value, "AcquisitionHea
 /// MR Acquisition type
 class EXPORTISMRMRD Acquisition {
     friend class Dataset;
+    friend class MappedDataset;
+    friend class ParallelAcquisitionReader;
 public:
     // Constructors, assignment, destructor
     Acquisition();
@@ -669,6 +671,16 @@ public:
     size_t getDataSize() const;
     size_t getTrajSize() const;
 
+    /**
+     * Allocates data and trajectory for the given sizes without resizing.
+     * Memory is only given back by the destructor, so an acquisition reused
+     * for messages of at most these sizes is not reallocated.
+     */
+    void reserve(uint16_t num_samples, uint16_t active_channels=1, uint16_t trajectory_dimensions=0);
+    /** Returns the number of data and trajectory elements that fit without reallocating **/
+    size_t getDataCapacity() const;
+    size_t getTrajCapacity() const;
+
     // Header, data and trajectory accessors
     const AcquisitionHeader &getHead() const;
     void setHead(const AcquisitionHeader &other);
@@ -746,7 +758,15 @@ public:
     void setAllChannelsNotActive();
 
 protected:
+    // Grows data and trajectory to the sizes in the header
+    void makeConsistent();
+    // Takes the sizes as capacities after the C library reallocated acq
+    void resetCapacity();
+
     ISMRMRD_Acquisition acq;
+    // In bytes
+    size_t data_capacity;
+    size_t traj_capacity;
 };
 
 /// Header for MR Image type
@@ -781,6 +801,10 @@ public:
 
     // Image dimensions
     void resize(uint16_t matrix_size_x, uint16_t matrix_size_y, uint16_t matrix_size_z, uint16_t channels);
+    /** Allocates data for the given dimensions without resizing, memory is kept when the image shrinks **/
+    void reserve(uint16_t matrix_size_x, uint16_t matrix_size_y, uint16_t matrix_size_z, uint16_t channels);
+    /** Returns the number of data elements that fit without reallocating **/
+    size_t getDataCapacity() const;
     uint16_t getMatrixSizeX() const;
     void setMatrixSizeX(uint16_t matrix_size_x);
     uint16_t getMatrixSizeY() const;
@@ -927,7 +951,16 @@ public:
     T & operator () (uint16_t x, uint16_t y=0, uint16_t z=0 , uint16_t channel =0);
 
 protected:
+    // Grows data and attribute string to the sizes in the header
+    void makeConsistent();
+    void reserveAttributeString(size_t length);
+    // Takes the sizes as capacities after the C library reallocated im
+    void resetCapacity();
+
     ISMRMRD_Image im;
+    // In bytes, the attribute string including its null terminator
+    size_t data_capacity;
+    size_t attribute_capacity;
 };
 
 /// N-Dimensional array type
@@ -948,7 +981,11 @@ public:
     const size_t (&getDims() const)[ISMRMRD_NDARRAY_MAXDIM];
     size_t getDataSize() const;
     void resize(const std::vector<size_t> dimvec);
+    /** Allocates data for the given dimensions without resizing, memory is kept when the array shrinks **/
+    void reserve(const std::vector<size_t> &dimvec);
     size_t getNumberOfElements() const;
+    /** Returns the number of elements that fit without reallocating **/
+    size_t getDataCapacity() const;
     T * getDataPtr();
     const T * getDataPtr() const;
 
@@ -962,7 +999,14 @@ public:
     T & operator () (uint16_t x, uint16_t y=0, uint16_t z=0, uint16_t w=0, uint16_t n=0, uint16_t m=0, uint16_t l=0);
 
 protected:
+    // Grows data to the size of the dimensions
+    void makeConsistent();
+    // Takes the size as capacity after the C library reallocated arr
+    void resetCapacity();
+
     ISMRMRD_NDArray arr;
+    // In bytes
+    size_t data_capacity;
 };
 
 
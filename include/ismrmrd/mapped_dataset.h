@@ -0,0 +1,87 @@
+/* ISMRMRD memory mapped Data Set */
+
+/**
+ * @file mapped_dataset.h
+ */
+
+#pragma once
+#ifndef ISMRMRD_MAPPED_DATASET_H
+#define ISMRMRD_MAPPED_DATASET_H
+
+#include "ismrmrd/dataset.h"
+#include "ismrmrd/views.h"
+
+#include <map>
+#include <string>
+
+namespace ISMRMRD {
+
+/**
+ *   Read-only access to an ISMRMRD HDF5 file through a memory mapping.
+ *
+ *   Image and array data stored contiguously or in uncompressed chunks, in the
+ *   native data type of the machine, is returned as views pointing straight
+ *   into the mapped file. Chunks may hold any number of elements but have to
+ *   span the whole of each element, as Dataset and repackDataset write them. This avoids the copy through the HDF5 conversion
+ *   buffers. The views are valid as long as the MappedDataset exists.
+ *
+ *   Acquisitions and waveforms are variable length records in the HDF5 heap and
+ *   cannot be mapped, they are read into owning objects like with Dataset.
+ *
+ *   Memory mapping is only available on POSIX systems.
+ */
+class EXPORTISMRMRD MappedDataset {
+public:
+    MappedDataset(const char *filename, const char *groupname);
+    ~MappedDataset();
+
+    // XML Header
+    void readHeader(std::string &xmlstring);
+    // Acquisitions
+    void readAcquisition(uint32_t index, Acquisition &acq);
+    uint32_t getNumberOfAcquisitions();
+    // Waveforms
+    void readWaveform(uint32_t index, Waveform &wav);
+    uint32_t getNumberOfWaveforms();
+    // Images
+    template <typename T> ImageView<T> readImage(const std::string &var, uint32_t index);
+    uint32_t getNumberOfImages(const std::string &var);
+    /// Whether the images of a variable can be returned as views
+    bool canMapImages(const std::string &var);
+    // NDArrays
+    template <typename T> NDArrayView<T> readNDArray(const std::string &var, uint32_t index);
+    uint32_t getNumberOfNDArrays(const std::string &var);
+    /// Whether the arrays of a variable can be returned as views
+    bool canMapNDArrays(const std::string &var);
+
+private:
+    // Not copyable, the dataset owns the open file and the mapping
+    MappedDataset(const MappedDataset &);
+    MappedDataset &operator=(const MappedDataset &);
+
+    struct Variable {
+        hid_t dataset;
+        bool mappable;
+        bool chunked;
+        hsize_t chunk_elements;
+        haddr_t offset;
+        uint16_t data_type;
+        uint16_t ndim;
+        size_t dims[ISMRMRD_NDARRAY_MAXDIM];
+        hsize_t element_size;
+        hsize_t count;
+    };
+
+    Variable &variable(const std::string &var);
+    const void *elementData(const Variable &v, uint32_t index);
+
+    ISMRMRD_Dataset dset_;
+    const char *map_;
+    uint64_t map_size_;
+    hsize_t base_address_;
+    std::map<std::string, Variable> variables_;
+};
+
+} /* ISMRMRD namespace */
+
+#endif /* ISMRMRD_MAPPED_DATASET_H */
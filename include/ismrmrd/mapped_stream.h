@@ -0,0 +1,88 @@
+/* ISMRMRD memory mapped protocol stream files */
+
+/**
+ * @file mapped_stream.h
+ */
+
+#pragma once
+#ifndef ISMRMRD_MAPPED_STREAM_H
+#define ISMRMRD_MAPPED_STREAM_H
+
+#include "ismrmrd/serialization.h"
+#include "ismrmrd/views.h"
+
+#include <vector>
+
+namespace ISMRMRD {
+
+/**
+ *   Walks the messages of a recorded protocol stream file through a memory
+ *   mapping.
+ *
+ *   The file holds what a ProtocolSerializer writes, e.g. the output of
+ *   ismrmrd_hdf5_to_stream. Acquisitions, waveforms, images and arrays are
+ *   returned as views pointing into the mapping, so nothing is allocated or
+ *   copied per message. Messages follow each other without padding, so data
+ *   that does not start at a suitably aligned address for its type is copied
+ *   into a buffer of the reader first. A view is valid until the next message
+ *   is read.
+ *
+ *   The other messages are small and are deserialized into their usual types.
+ *
+ *   Batches of acquisitions are returned one acquisition at a time. While a
+ *   batch is being read, peek returns ISMRMRD_MESSAGE_ACQUISITION_BATCH and
+ *   skip moves past the rest of the batch.
+ *
+ *   Memory mapping is only available on POSIX systems.
+ */
+class EXPORTISMRMRD MappedStreamReader {
+public:
+    explicit MappedStreamReader(const char *filename);
+    ~MappedStreamReader();
+
+    void deserialize(ConfigFile &cf);
+    void deserialize(ConfigText &ct);
+    void deserialize(TextMessage &tm);
+    void deserialize(IsmrmrdHeader &hdr);
+    void deserialize(AcquisitionView &acq);
+    template <typename T> void deserialize(ImageView<T> &img);
+    void deserialize(WaveformView &wfm);
+    template <typename T> void deserialize(NDArrayView<T> &arr);
+
+    /// Moves past the next message, or the rest of a batch, without reading it
+    void skip();
+
+    // Peek at the next message type, throws at the end of the file
+    uint16_t peek();
+    int peek_image_data_type();
+    int peek_ndarray_data_type();
+
+    /// Offset of the next message in the file
+    uint64_t offset() const;
+    uint64_t size() const;
+
+private:
+    // Not copyable, the reader owns the mapping
+    MappedStreamReader(const MappedStreamReader &);
+    MappedStreamReader &operator=(const MappedStreamReader &);
+
+    const char *at(uint64_t offset, uint64_t count) const;
+    template <typename T> const T *aligned(uint64_t offset, uint64_t count, unsigned int buffer);
+    uint64_t messageSize();
+    uint64_t readAcquisition(uint64_t offset, const ISMRMRD_AcquisitionHeader &head, AcquisitionView &acq);
+    void expect(uint16_t id, const char *message);
+
+    const char *map_;
+    uint64_t map_size_;
+    uint64_t pos_;
+    // Acquisitions left in the batch being read, where it ends and its first header
+    uint32_t batch_remaining_;
+    uint64_t batch_end_;
+    ISMRMRD_AcquisitionHeader batch_base_;
+    // Copies of misaligned data, one for the samples and one for the trajectory
+    std::vector<double> buffers_[2];
+};
+
+} /* ISMRMRD namespace */
+
+#endif /* ISMRMRD_MAPPED_STREAM_H */
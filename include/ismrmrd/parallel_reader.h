@@ -0,0 +1,78 @@
+/* ISMRMRD multi-process acquisition reader */
+
+/**
+ * @file parallel_reader.h
+ */
+
+#pragma once
+#ifndef ISMRMRD_PARALLEL_READER_H
+#define ISMRMRD_PARALLEL_READER_H
+
+#include "ismrmrd/dataset.h"
+
+#include <string>
+#include <vector>
+
+namespace ISMRMRD {
+
+/// Settings of ParallelAcquisitionReader
+struct EXPORTISMRMRD ParallelReadOptions {
+    ParallelReadOptions();
+
+    /// Number of worker processes
+    unsigned int processes;
+    /// Consecutive acquisitions read by one worker before the next worker takes over
+    uint32_t block_size;
+    /// Shared memory buffer of each worker, in bytes
+    size_t buffer_size;
+};
+
+/**
+ *   Reads the acquisitions of an HDF5 file with several worker processes.
+ *
+ *   Reads within one process are serialized by the HDF5 library (see
+ *   getHDF5Mutex), so this reader forks worker processes that each open the
+ *   file on their own. The index space is dealt out to the workers in blocks
+ *   of options.block_size acquisitions, round robin. Every worker streams its
+ *   acquisitions through a ring buffer in shared memory, and readNext returns
+ *   them in index order.
+ *
+ *   The workers are forked from the calling process and inherit its HDF5
+ *   library state, so the file must not be open in the calling process, for
+ *   instance through a Dataset, while the reader is created; the constructor
+ *   throws if it is. Create the reader before starting other threads, only
+ *   the calling thread exists in the workers. Worker errors are reported by
+ *   readNext.
+ *
+ *   Only available on POSIX systems.
+ */
+class EXPORTISMRMRD ParallelAcquisitionReader {
+public:
+    ParallelAcquisitionReader(const char *filename, const char *groupname,
+                              const ParallelReadOptions &options = ParallelReadOptions());
+    ~ParallelAcquisitionReader();
+
+    uint32_t getNumberOfAcquisitions() const;
+    /// Reads the next acquisition in index order, returns false after the last one
+    bool readNext(Acquisition &acq);
+
+private:
+    // Not copyable, the reader owns the worker processes
+    ParallelAcquisitionReader(const ParallelAcquisitionReader &);
+    ParallelAcquisitionReader &operator=(const ParallelAcquisitionReader &);
+
+    void receive(unsigned int worker, void *buffer, size_t count);
+    void stopWorkers();
+
+    ParallelReadOptions options_;
+    uint32_t count_;
+    uint32_t next_;
+    char *shared_;
+    size_t shared_size_;
+    size_t ring_stride_;
+    std::vector<int> pids_;
+};
+
+} /* ISMRMRD namespace */
+
+#endif /* ISMRMRD_PARALLEL_READER_H */
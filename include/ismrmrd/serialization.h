@@ -3,9 +3,12 @@
 
 #include <exception>
 #include <iostream>
+#include <string.h>
+#include <vector>
 
 #include "ismrmrd/export.h"
 #include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/views.h"
 #include "ismrmrd/waveform.h"
 #include "ismrmrd/xml.h"
 
@@ -34,15 +37,58 @@ enum ISMRMRD_MESSAGE_ID {
     ISMRMRD_MESSAGE_ACQUISITION = 1008,
     ISMRMRD_MESSAGE_IMAGE = 1022,
     ISMRMRD_MESSAGE_WAVEFORM = 1026,
-    ISMRMRD_MESSAGE_NDARRAY = 1030
+    ISMRMRD_MESSAGE_NDARRAY = 1030,
+    // Not in the range the Gadgetron message ids use, 1009 there is an image message
+    ISMRMRD_MESSAGE_ACQUISITION_BATCH = 1100
 };
 
 // A wrapper interface, which we can implement, e.g., for std::istream
 class ReadableStreamView {
 public:
+    ReadableStreamView() : _single_byte_reads(false) {}
+
     virtual void read(char *buffer, size_t count) = 0;
 
     virtual bool eof() = 0;
+
+    // Reads up to count bytes and returns the number read, 0 at the end of the stream. A read that
+    // runs into the end of the stream does not tell how much it returned, so this default reads a
+    // single byte, and BufferedReadableStreamView then reads the view directly instead of ahead.
+    // Views that can tell, or that can return what is available without waiting for all of it,
+    // should override this.
+    virtual size_t read_some(char *buffer, size_t count) {
+        _single_byte_reads = true;
+        if (count == 0) {
+            return 0;
+        }
+        read(buffer, 1);
+        return eof() ? 0 : 1;
+    }
+
+    // True once the default read_some was called, the view cannot read ahead
+    bool single_byte_reads() const {
+        return _single_byte_reads;
+    }
+
+    // Moves count bytes ahead, like a read whose data is dropped. This default reads through a
+    // small buffer; views over seekable sources override it to seek instead.
+    virtual void skip(size_t count) {
+        char buffer[4096];
+        while (count > 0 && !eof()) {
+            size_t n = count < sizeof(buffer) ? count : sizeof(buffer);
+            read(buffer, n);
+            count -= n;
+        }
+    }
+
+private:
+    bool _single_byte_reads;
+};
+
+// One piece of a message written with WritableStreamView::write_pieces
+struct StreamPiece {
+    const char *data;
+    size_t size;
 };
 
 // A wrapper interface, which we can implement, e.g., for std::ostream
@@ -51,6 +97,94 @@ public:
     virtual void write(const char *buffer, size_t count) = 0;
 
     virtual bool bad() = 0;
+
+    // Writes count pieces in order. The serializers hand over all pieces of a message at once,
+    // views that can pass them to the system in one call (see FdWritableStreamView) override this.
+    virtual void write_pieces(const StreamPiece *pieces, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            write(pieces[i].data, pieces[i].size);
+        }
+    }
+};
+
+// Reads ahead from another view in large blocks, so that the many small reads of the protocol
+// are served from memory. Reads at least as large as the buffer go straight to the source.
+// Reading ahead waits as long as the source's read_some does; for IStreamView that is until the
+// buffer is full or the stream ends, so do not use it for request/response conversations.
+// Sources without a read_some of their own are read directly.
+class EXPORTISMRMRD BufferedReadableStreamView : public ReadableStreamView {
+public:
+    explicit BufferedReadableStreamView(ReadableStreamView &source, size_t buffer_size = 1024 * 1024);
+
+    virtual void read(char *buffer, size_t count) {
+        if (count <= static_cast<size_t>(_end - _pos)) {
+            memcpy(buffer, _pos, count);
+            _pos += count;
+        } else {
+            read_slow(buffer, count);
+        }
+    }
+
+    virtual bool eof() {
+        return _eof;
+    }
+
+    virtual size_t read_some(char *buffer, size_t count);
+
+    // Skips within the buffer, larger skips go to the source without reading the data
+    virtual void skip(size_t count);
+
+protected:
+    void read_slow(char *buffer, size_t count);
+    bool refill();
+
+    ReadableStreamView &_source;
+    std::vector<char> _buffer;
+    char *_pos;
+    char *_end;
+    bool _eof;
+
+private:
+    // Not copyable, the read position points into the buffer
+    BufferedReadableStreamView(const BufferedReadableStreamView &);
+    BufferedReadableStreamView &operator=(const BufferedReadableStreamView &);
+};
+
+// Collects writes in a large buffer and hands them to another view when it is full or on
+// flush(). Writes at least as large as the buffer go straight to the sink. Errors of the sink
+// only show after a flush; the destructor flushes but cannot report them.
+class EXPORTISMRMRD BufferedWritableStreamView : public WritableStreamView {
+public:
+    explicit BufferedWritableStreamView(WritableStreamView &sink, size_t buffer_size = 1024 * 1024);
+    virtual ~BufferedWritableStreamView();
+
+    virtual void write(const char *buffer, size_t count) {
+        if (count <= static_cast<size_t>(_end - _pos)) {
+            memcpy(_pos, buffer, count);
+            _pos += count;
+        } else {
+            write_slow(buffer, count);
+        }
+    }
+
+    virtual bool bad() {
+        return _sink.bad();
+    }
+
+    void flush();
+
+protected:
+    void write_slow(const char *buffer, size_t count);
+
+    WritableStreamView &_sink;
+    std::vector<char> _buffer;
+    char *_pos;
+    char *_end;
+
+private:
+    // Not copyable, the write position points into the buffer
+    BufferedWritableStreamView(const BufferedWritableStreamView &);
+    BufferedWritableStreamView &operator=(const BufferedWritableStreamView &);
 };
 
 // We define a few wrapper structs here to make the serialization code a bit
@@ -70,6 +204,13 @@ struct TextMessage {
 // serialize Acquisition to ostream
 EXPORTISMRMRD void serialize(const Acquisition &acq, WritableStreamView &ws);
 
+// serialize several acquisitions as one batch: the length of the rest of the batch (uint64),
+// the number of acquisitions (uint32), the header of the first acquisition, then for each
+// acquisition its header as a delta to that first header, its trajectory and its data. A delta
+// is a mask with one bit per 32-bit word of the header, 3 words, followed by the words that
+// differ. An empty batch has no first header.
+EXPORTISMRMRD void serialize(const std::vector<Acquisition> &acqs, WritableStreamView &ws);
+
 // serialize Image<T> to ostream
 template <typename T>
 EXPORTISMRMRD void serialize(const Image<T> &img, WritableStreamView &ws);
@@ -87,9 +228,20 @@ EXPORTISMRMRD void serialize(const std::string &str, WritableStreamView &ws);
 template <typename T> 
 EXPORTISMRMRD void serialize(const NDArray<T> &arr, WritableStreamView &ws);
 
+// serialize views of data owned elsewhere, in the same format as the owning types
+EXPORTISMRMRD void serialize(const AcquisitionView &acq, WritableStreamView &ws);
+template <typename T>
+EXPORTISMRMRD void serialize(const ImageView<T> &img, WritableStreamView &ws);
+EXPORTISMRMRD void serialize(const WaveformView &wfm, WritableStreamView &ws);
+template <typename T>
+EXPORTISMRMRD void serialize(const NDArrayView<T> &arr, WritableStreamView &ws);
+
 // deserialize Acquisition from istream
 EXPORTISMRMRD void deserialize(Acquisition &acq, ReadableStreamView &rs);
 
+// deserialize a batch of acquisitions, the vector is resized to the number in the batch
+EXPORTISMRMRD void deserialize(std::vector<Acquisition> &acqs, ReadableStreamView &rs);
+
 // deserialize Image<T> from istream
 template <typename T>
 EXPORTISMRMRD void deserialize(Image<T> &img, ReadableStreamView &rs);
@@ -107,8 +259,22 @@ EXPORTISMRMRD void deserialize(std::string &str, ReadableStreamView &rs);
 template <typename T> 
 EXPORTISMRMRD void deserialize(NDArray<T> &arr, ReadableStreamView &rs);
 
+// Bytes of the data of an image message, without its header and attributes. Throws for an unknown
+// data type or a size that does not fit in 64 bits, which only a corrupt header can give.
+EXPORTISMRMRD uint64_t image_data_size(const ISMRMRD_ImageHeader &head);
+
+// Bytes of an acquisition message after its id: the header, trajectory and data
+EXPORTISMRMRD uint64_t acquisition_size(const ISMRMRD_AcquisitionHeader &head);
+
+// deserialize the header delta of an acquisition in a batch, base is the first header of the
+// batch. Returns the size of the delta.
+EXPORTISMRMRD uint64_t deserialize_header_delta(ISMRMRD_AcquisitionHeader &head, const ISMRMRD_AcquisitionHeader &base,
+                                                ReadableStreamView &rs);
+
 class ProtocolStreamClosed : public std::exception {};
 
+class StreamIndex;
+
 class EXPORTISMRMRD ProtocolSerializer {
 public:
     ProtocolSerializer(WritableStreamView &ws);
@@ -117,16 +283,45 @@ public:
     void serialize(const TextMessage &tm);
     void serialize(const IsmrmrdHeader &hdr);
     void serialize(const Acquisition &acq);
+    // Sends the acquisitions as one ISMRMRD_MESSAGE_ACQUISITION_BATCH with a single write. The
+    // first header is sent in full, the acquisitions only send the words of their headers that
+    // differ from it, 12 bytes plus 4 per word instead of 340 bytes. Only readers that know
+    // this message can read the stream.
+    void serialize(const std::vector<Acquisition> &acqs);
     template <typename T> void serialize(const Image<T> &img);
     void serialize(const Waveform &wfm);
     template <typename T> void serialize(const NDArray<T> &arr);
+    void serialize(const AcquisitionView &acq);
+    template <typename T> void serialize(const ImageView<T> &img);
+    void serialize(const WaveformView &wfm);
+    template <typename T> void serialize(const NDArrayView<T> &arr);
+    // Writes the close message and flushes a buffered view
     void close();
 
+    // Adds an entry to the index for every message written from now on. Offsets count
+    // from the given offset of the next message, e.g. 0 at the start of a file.
+    void setIndex(StreamIndex *index, uint64_t offset = 0);
+
 protected:
     void write_msg_id(uint16_t id);
+    // Writes the id and the message with one call to the stream
+    template <typename Message> void write_message(const Message &msg, uint16_t id);
+    // Indexes a message without a header of its own, size is what follows the id
+    void index_message(uint16_t id, uint64_t size);
     WritableStreamView &_ws;
+    // Set when _ws is buffered, its buffer is then written to without virtual calls
+    BufferedWritableStreamView *_buffered;
+    StreamIndex *_index;
+    // Offset of the next message, while there is an index
+    uint64_t _offset;
 };
 
+class ProtocolVisitor;
+
+// The deserialize calls read into the memory the acquisition, image, waveform or array already
+// has and only reallocate when a message is larger than any before. Passing the same object
+// for every message of a type, instead of a new one per message, reads a steady stream
+// without allocating; reserve allocates for the largest message up front.
 class EXPORTISMRMRD ProtocolDeserializer {
 public:
     ProtocolDeserializer(ReadableStreamView &rs);
@@ -134,21 +329,97 @@ public:
     void deserialize(ConfigText &ct);
     void deserialize(TextMessage &tm);
     void deserialize(IsmrmrdHeader &hdr);
+    // Reads a single acquisition or the next acquisition of a batch. While a batch is being
+    // read, peek returns ISMRMRD_MESSAGE_ACQUISITION_BATCH.
     void deserialize(Acquisition &acq);
+    // Reads the rest of a batch, or a single acquisition as a batch of one
+    void deserialize(std::vector<Acquisition> &acqs);
     template <typename T> void deserialize(Image<T> &img);
     void deserialize(Waveform &wfm);
     template <typename T> void deserialize(NDArray<T> &arr);
 
+    // Moves past the next message, or the rest of a batch, without reading its data
+    void skip();
+
+    // Reads the next message, or the next acquisition of a batch, into the object the visitor
+    // keeps for its type and passes it to the matching visit. Returns false at the close message.
+    bool dispatch(ProtocolVisitor &visitor);
+
     // Peek at the next data type in the stream
     uint16_t peek();
     int peek_image_data_type();
     int peek_ndarray_data_type();
 
 protected:
+    void read(char *buffer, size_t count);
+    void skip_bytes(uint64_t count);
+    void read_batched(Acquisition &acq);
+    template <typename T> void dispatch_image(ProtocolVisitor &visitor);
+    template <typename T> void dispatch_ndarray(ProtocolVisitor &visitor);
+
     ReadableStreamView &_rs;
+    // Set when _rs is buffered, its buffer is then read from without virtual calls
+    BufferedReadableStreamView *_buffered;
     uint16_t _peeked;
     ImageHeader _peeked_image_header;
     uint16_t _peeked_ndarray_data_type;
+    // Acquisitions and bytes left in the batch being read, and its first header
+    uint32_t _batch_remaining;
+    uint64_t _batch_bytes;
+    AcquisitionHeader _batch_base;
+};
+
+/**
+ * Receives the messages read by ProtocolDeserializer::dispatch.
+ *
+ * The visitor keeps one object per message type and data type, which dispatch decodes each
+ * message into and passes to the matching visit. The objects are reused for the next message
+ * of their type, so a visit copies or swaps out what it wants to keep. The visit overloads
+ * that are not overridden ignore their message; accept can tell dispatch to skip a message
+ * without decoding it.
+ */
+class EXPORTISMRMRD ProtocolVisitor {
+public:
+    ProtocolVisitor();
+    virtual ~ProtocolVisitor();
+
+    // Whether dispatch decodes a message; data_type is that of images and nd arrays, else 0.
+    // Acquisitions in a batch are asked for as ISMRMRD_MESSAGE_ACQUISITION.
+    virtual bool accept(uint16_t message_id, int data_type);
+
+    virtual void visit(ConfigFile &cf);
+    virtual void visit(ConfigText &ct);
+    virtual void visit(TextMessage &tm);
+    virtual void visit(IsmrmrdHeader &hdr);
+    // Single acquisitions and the acquisitions of a batch, one at a time
+    virtual void visit(Acquisition &acq);
+    virtual void visit(Waveform &wfm);
+    virtual void visit(Image<uint16_t> &img);
+    virtual void visit(Image<int16_t> &img);
+    virtual void visit(Image<uint32_t> &img);
+    virtual void visit(Image<int32_t> &img);
+    virtual void visit(Image<float> &img);
+    virtual void visit(Image<double> &img);
+    virtual void visit(Image<complex_float_t> &img);
+    virtual void visit(Image<complex_double_t> &img);
+    virtual void visit(NDArray<uint16_t> &arr);
+    virtual void visit(NDArray<int16_t> &arr);
+    virtual void visit(NDArray<uint32_t> &arr);
+    virtual void visit(NDArray<int32_t> &arr);
+    virtual void visit(NDArray<float> &arr);
+    virtual void visit(NDArray<double> &arr);
+    virtual void visit(NDArray<complex_float_t> &arr);
+    virtual void visit(NDArray<complex_double_t> &arr);
+
+private:
+    friend class ProtocolDeserializer;
+
+    // Not copyable, it owns the decoded messages
+    ProtocolVisitor(const ProtocolVisitor &);
+    ProtocolVisitor &operator=(const ProtocolVisitor &);
+
+    struct Messages;
+    Messages *_messages;
 };
 
 } // namespace ISMRMRD
@@ -0,0 +1,120 @@
+#pragma once
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <string>
+
+#include <ismrmrd/serialization.h>
+
+namespace ISMRMRD {
+
+// Reads from a POSIX file descriptor, e.g. a pipe or socket. The descriptor is not closed.
+class FdReadableStreamView : public ReadableStreamView {
+public:
+    FdReadableStreamView(int fd) : _fd(fd), _eof(false) {}
+
+    virtual void read(char *buffer, size_t count) {
+        while (count > 0) {
+            size_t n = read_some(buffer, count);
+            if (n == 0) {
+                return;
+            }
+            buffer += n;
+            count -= n;
+        }
+    }
+
+    virtual bool eof() {
+        return _eof;
+    }
+
+    // Returns what a single read(2) delivers, so a buffered view on a pipe does not wait for a full block
+    virtual size_t read_some(char *buffer, size_t count) {
+        ssize_t n;
+        do {
+            n = ::read(_fd, buffer, count);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) {
+            throw std::runtime_error(std::string("Error reading from file descriptor: ") + strerror(errno));
+        }
+        if (n == 0) {
+            _eof = true;
+        }
+        return static_cast<size_t>(n);
+    }
+
+    // Seeks in files, pipes and sockets are read
+    virtual void skip(size_t count) {
+        if (count > 0 && ::lseek(_fd, static_cast<off_t>(count), SEEK_CUR) != static_cast<off_t>(-1)) {
+            return;
+        }
+        ReadableStreamView::skip(count);
+    }
+
+private:
+    int _fd;
+    bool _eof;
+};
+
+// Writes to a POSIX file descriptor. The pieces of a message go out with one writev(2),
+// so headers and sample data are not copied together first. The descriptor is not closed.
+class FdWritableStreamView : public WritableStreamView {
+public:
+    FdWritableStreamView(int fd) : _fd(fd), _bad(false) {}
+
+    virtual void write(const char *buffer, size_t count) {
+        StreamPiece piece = {buffer, count};
+        write_pieces(&piece, 1);
+    }
+
+    virtual bool bad() {
+        return _bad;
+    }
+
+    virtual void write_pieces(const StreamPiece *pieces, size_t count) {
+        const size_t max_pieces = 16; // The smallest IOV_MAX POSIX allows
+        iovec iov[max_pieces];
+        size_t offset = 0; // Bytes of the first piece that are already written
+        while (count > 0 && !_bad) {
+            size_t n = 0;
+            for (; n < count && n < max_pieces; n++) {
+                iov[n].iov_base = const_cast<char *>(pieces[n].data);
+                iov[n].iov_len = pieces[n].size;
+            }
+            iov[0].iov_base = static_cast<char *>(iov[0].iov_base) + offset;
+            iov[0].iov_len -= offset;
+
+            ssize_t written = ::writev(_fd, iov, static_cast<int>(n));
+            if (written < 0) {
+                if (errno != EINTR) {
+                    _bad = true;
+                }
+                continue;
+            }
+
+            // Skip the pieces that are done, a partial write continues within the next one
+            size_t done = static_cast<size_t>(written) + offset;
+            offset = 0;
+            while (count > 0 && done >= pieces[0].size) {
+                done -= pieces[0].size;
+                pieces++;
+                count--;
+            }
+            offset = done;
+        }
+    }
+
+private:
+    int _fd;
+    bool _bad;
+};
+
+} // namespace ISMRMRD
+
+#endif // _WIN32
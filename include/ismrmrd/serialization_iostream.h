@@ -17,6 +17,23 @@ public:
         return _is.eof();
     }
 
+    virtual size_t read_some(char *buffer, size_t count) {
+        _is.read(buffer, count);
+        return static_cast<size_t>(_is.gcount());
+    }
+
+    // Seeks in files, streams that cannot seek (or not that far) are read
+    virtual void skip(size_t count) {
+        if (_is.tellg() != std::streampos(-1)) {
+            _is.seekg(static_cast<std::streamoff>(count), std::ios::cur);
+            if (!_is.fail()) {
+                return;
+            }
+            _is.clear();
+        }
+        ReadableStreamView::skip(count);
+    }
+
 protected:
     std::istream &_is;
 };
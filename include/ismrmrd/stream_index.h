@@ -0,0 +1,134 @@
+/* ISMRMRD index of protocol stream files */
+
+/**
+ * @file stream_index.h
+ */
+
+#pragma once
+#ifndef ISMRMRD_STREAM_INDEX_H
+#define ISMRMRD_STREAM_INDEX_H
+
+#include "ismrmrd/serialization.h"
+#include "ismrmrd/serialization_iostream.h"
+
+#include <fstream>
+#include <vector>
+
+namespace ISMRMRD {
+
+/**
+ *   One message of a stream file.
+ *
+ *   The offset is where the message id starts. Acquisitions sent in a batch
+ *   get one entry each with message_id ISMRMRD_MESSAGE_ACQUISITION_BATCH, and
+ *   their offset is where their header delta starts, as there is no id in
+ *   front of it. The header of the batch they are read with starts after the
+ *   id, length and count at batch_offset.
+ */
+struct StreamIndexEntry {
+    uint64_t offset;
+    uint64_t batch_offset;         /**< Acquisitions in a batch */
+    uint64_t flags;                /**< Acquisition flags */
+    uint32_t scan_counter;         /**< Acquisitions and waveforms */
+    uint32_t time_stamp;           /**< Acquisition, waveform and image time stamps */
+    uint16_t message_id;
+    uint16_t data_type;            /**< Images and nd arrays */
+    ISMRMRD_EncodingCounters idx;  /**< Acquisitions; the matching counters of images */
+};
+
+/**
+ *   Byte offsets, types and counters of the messages in a protocol stream file,
+ *   in the order of the file.
+ *
+ *   The index is written to a sidecar file, by convention the stream file name
+ *   with ".idx" appended. It can be built by scanning a stream file with
+ *   buildStreamIndex, or while the stream is written by passing it to
+ *   ProtocolSerializer::setIndex.
+ *
+ *   The index records the size of its stream and a checksum of the first
+ *   64 KiB, which IndexedStreamReader compares with the stream file it opens.
+ *   The size is that of the file for buildStreamIndex, and ends at the close
+ *   message for an index collected while writing. The checksum is taken from
+ *   the file by buildStreamIndex or setStream; an index of a pipe has none and
+ *   is only compared by size.
+ */
+class EXPORTISMRMRD StreamIndex {
+public:
+    StreamIndex();
+
+    size_t size() const;
+    const StreamIndexEntry &operator[](size_t n) const;
+    void clear();
+
+    /// Takes the size and checksum from the stream file
+    void setStream(const char *stream_filename);
+    /// Whether the stream file has the recorded size and checksum
+    bool matches(const char *stream_filename) const;
+
+    // Entries for a message at the given offset
+    void add(uint64_t offset, uint16_t message_id);
+    void add(uint64_t offset, uint16_t message_id, const AcquisitionHeader &head);
+    void add(uint64_t offset, const AcquisitionHeader &head, uint64_t batch_offset);
+    void add(uint64_t offset, const ImageHeader &head);
+    void add(uint64_t offset, const ISMRMRD_WaveformHeader &head);
+    void add(uint64_t offset, uint16_t message_id, uint16_t data_type);
+
+    void read(const char *filename);
+    void write(const char *filename) const;
+
+private:
+    std::vector<StreamIndexEntry> entries_;
+    // 0 when not recorded
+    uint64_t stream_size_;
+    uint64_t stream_checksum_;
+};
+
+/// Scans a stream file, seeking over the data
+EXPORTISMRMRD void buildStreamIndex(const char *stream_filename, StreamIndex &index);
+
+/**
+ *   Random access to the messages of a stream file through its index.
+ *
+ *   Acquisitions and waveforms are read by number like from a Dataset; any
+ *   other message is read by positioning a ProtocolDeserializer at its entry.
+ *   An index file that does not match the stream file is refused.
+ */
+class EXPORTISMRMRD IndexedStreamReader {
+public:
+    /// Reads the index from index_filename, or scans the stream file when it is NULL
+    explicit IndexedStreamReader(const char *stream_filename, const char *index_filename = NULL);
+    ~IndexedStreamReader();
+
+    const StreamIndex &getIndex() const;
+
+    uint32_t getNumberOfAcquisitions() const;
+    void readAcquisition(uint32_t index, Acquisition &acq);
+    uint32_t getNumberOfWaveforms() const;
+    void readWaveform(uint32_t index, Waveform &wfm);
+
+    /// Positions the deserializer at an entry of the index, e.g. an image, which is read next
+    ProtocolDeserializer &seek(size_t entry);
+
+private:
+    // Not copyable, the deserializer refers to the stream
+    IndexedStreamReader(const IndexedStreamReader &);
+    IndexedStreamReader &operator=(const IndexedStreamReader &);
+
+    void seekBody(const StreamIndexEntry &entry);
+    void readBatched(const StreamIndexEntry &entry, Acquisition &acq);
+
+    std::ifstream stream_;
+    IStreamView view_;
+    StreamIndex index_;
+    // Entries of the acquisitions and waveforms
+    std::vector<size_t> acquisitions_;
+    std::vector<size_t> waveforms_;
+    ProtocolDeserializer *deserializer_;
+    // The first header of the batch last read from
+    uint64_t base_offset_;
+    AcquisitionHeader base_;
+};
+
+} /* ISMRMRD namespace */
+
+#endif /* ISMRMRD_STREAM_INDEX_H */
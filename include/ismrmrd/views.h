@@ -0,0 +1,313 @@
+/* ISMRMRD views of data owned elsewhere */
+
+/**
+ * @file views.h
+ */
+
+#pragma once
+#ifndef ISMRMRD_VIEWS_H
+#define ISMRMRD_VIEWS_H
+
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/waveform.h"
+
+#include <stdexcept>
+#include <string>
+
+namespace ISMRMRD {
+
+/**
+ *   Read-only view of an N-dimensional array.
+ *
+ *   The view does not own the data, which must outlive it. Like the other
+ *   views below it can be built over memory filled elsewhere, e.g. a network
+ *   frame or a mapped file, or over an owning object, and be passed to
+ *   serialize, ProtocolSerializer and the Dataset append functions without
+ *   copying the data into an owning object first.
+ */
+template <typename T> class NDArrayView {
+public:
+    NDArrayView() : ndim_(0), data_(NULL) {
+        for (uint16_t n = 0; n < ISMRMRD_NDARRAY_MAXDIM; n++) {
+            dims_[n] = 0;
+        }
+    }
+
+    NDArrayView(const T *data, uint16_t ndim, const size_t *dims) : ndim_(ndim), data_(data) {
+        if (ndim > ISMRMRD_NDARRAY_MAXDIM) {
+            throw std::runtime_error("Too many dimensions.");
+        }
+        for (uint16_t n = 0; n < ISMRMRD_NDARRAY_MAXDIM; n++) {
+            dims_[n] = n < ndim ? dims[n] : 0;
+        }
+    }
+
+    explicit NDArrayView(const NDArray<T> &arr) : ndim_(arr.getNDim()), data_(arr.getDataPtr()) {
+        for (uint16_t n = 0; n < ISMRMRD_NDARRAY_MAXDIM; n++) {
+            dims_[n] = n < ndim_ ? arr.getDims()[n] : 0;
+        }
+    }
+
+    ISMRMRD_DataTypes getDataType() const { return get_data_type<T>(); }
+    uint16_t getNDim() const { return ndim_; }
+    const size_t (&getDims() const)[ISMRMRD_NDARRAY_MAXDIM] { return dims_; }
+
+    size_t getNumberOfElements() const {
+        if (ndim_ == 0) {
+            return 0;
+        }
+        size_t num = 1;
+        for (uint16_t n = 0; n < ndim_; n++) {
+            num *= dims_[n];
+        }
+        return num;
+    }
+
+    size_t getDataSize() const { return getNumberOfElements() * sizeof(T); }
+
+    const T *getDataPtr() const { return data_; }
+    const T *begin() const { return data_; }
+    const T *end() const { return data_ + getNumberOfElements(); }
+
+    /** Returns a reference to the array data **/
+    const T &operator()(uint16_t x, uint16_t y = 0, uint16_t z = 0, uint16_t w = 0, uint16_t n = 0, uint16_t m = 0, uint16_t l = 0) const {
+        const size_t idx[7] = {x, y, z, w, n, m, l};
+        size_t index = 0, stride = 1;
+        for (uint16_t d = 0; d < ndim_ && d < 7; d++) {
+            index += idx[d] * stride;
+            stride *= dims_[d];
+        }
+        return data_[index];
+    }
+
+protected:
+    uint16_t ndim_;
+    size_t dims_[ISMRMRD_NDARRAY_MAXDIM];
+    const T *data_;
+};
+
+/**
+ *   View of an N-dimensional array whose elements can be modified.
+ */
+template <typename T> class MutableNDArrayView : public NDArrayView<T> {
+public:
+    MutableNDArrayView() {}
+    MutableNDArrayView(T *data, uint16_t ndim, const size_t *dims) : NDArrayView<T>(data, ndim, dims) {}
+    explicit MutableNDArrayView(NDArray<T> &arr) : NDArrayView<T>(arr) {}
+
+    using NDArrayView<T>::getDataPtr;
+    using NDArrayView<T>::begin;
+    using NDArrayView<T>::end;
+    using NDArrayView<T>::operator();
+
+    T *getDataPtr() { return const_cast<T *>(this->data_); }
+    T *begin() { return getDataPtr(); }
+    T *end() { return getDataPtr() + this->getNumberOfElements(); }
+
+    T &operator()(uint16_t x, uint16_t y = 0, uint16_t z = 0, uint16_t w = 0, uint16_t n = 0, uint16_t m = 0, uint16_t l = 0) {
+        const NDArrayView<T> &self = *this;
+        return const_cast<T &>(self(x, y, z, w, n, m, l));
+    }
+};
+
+/**
+ *   Read-only view of the pixels of an image.
+ *
+ *   The header is held by value, the pixel data and the attribute string are
+ *   not owned and must outlive the view.
+ */
+template <typename T> class ImageView {
+public:
+    ImageView() : data_(NULL), attribute_string_(NULL), attribute_string_length_(0) {}
+
+    ImageView(const ISMRMRD_ImageHeader &head, const T *data, const char *attribute_string = NULL,
+              size_t attribute_string_length = 0)
+        : data_(data), attribute_string_(attribute_string), attribute_string_length_(attribute_string_length) {
+        if (head.data_type != get_data_type<T>()) {
+            throw std::runtime_error("Image data type does not match template type");
+        }
+        static_cast<ISMRMRD_ImageHeader &>(head_) = head;
+    }
+
+    explicit ImageView(const Image<T> &img)
+        : head_(img.getHead()), data_(img.getDataPtr()), attribute_string_(img.getAttributeString()),
+          attribute_string_length_(img.getAttributeStringLength()) {}
+
+    const ImageHeader &getHead() const { return head_; }
+    ISMRMRD_DataTypes getDataType() const { return get_data_type<T>(); }
+    uint16_t getMatrixSizeX() const { return head_.matrix_size[0]; }
+    uint16_t getMatrixSizeY() const { return head_.matrix_size[1]; }
+    uint16_t getMatrixSizeZ() const { return head_.matrix_size[2]; }
+    uint16_t getNumberOfChannels() const { return head_.channels; }
+
+    size_t getNumberOfDataElements() const {
+        return size_t(head_.matrix_size[0]) * head_.matrix_size[1] * head_.matrix_size[2] * head_.channels;
+    }
+
+    size_t getDataSize() const { return getNumberOfDataElements() * sizeof(T); }
+
+    const T *getDataPtr() const { return data_; }
+    const T *begin() const { return data_; }
+    const T *end() const { return data_ + getNumberOfDataElements(); }
+
+    void getAttributeString(std::string &attr) const { attr.assign(attribute_string_, attribute_string_length_); }
+    /// The attribute string, which is not null terminated
+    const char *getAttributeStringPtr() const { return attribute_string_; }
+    size_t getAttributeStringLength() const { return attribute_string_length_; }
+
+    /** Returns a reference to the image data **/
+    const T &operator()(uint16_t x, uint16_t y = 0, uint16_t z = 0, uint16_t channel = 0) const {
+        size_t sx = head_.matrix_size[0];
+        size_t sy = head_.matrix_size[1];
+        size_t sz = head_.matrix_size[2];
+        return data_[x + sx * (y + sy * (z + sz * size_t(channel)))];
+    }
+
+protected:
+    ImageHeader head_;
+    const T *data_;
+    const char *attribute_string_;
+    size_t attribute_string_length_;
+};
+
+/**
+ *   View of an image whose pixels can be modified.
+ */
+template <typename T> class MutableImageView : public ImageView<T> {
+public:
+    MutableImageView() {}
+    MutableImageView(const ISMRMRD_ImageHeader &head, T *data, const char *attribute_string = NULL,
+                     size_t attribute_string_length = 0)
+        : ImageView<T>(head, data, attribute_string, attribute_string_length) {}
+    explicit MutableImageView(Image<T> &img) : ImageView<T>(img) {}
+
+    using ImageView<T>::getDataPtr;
+    using ImageView<T>::begin;
+    using ImageView<T>::end;
+    using ImageView<T>::operator();
+
+    T *getDataPtr() { return const_cast<T *>(this->data_); }
+    T *begin() { return getDataPtr(); }
+    T *end() { return getDataPtr() + this->getNumberOfDataElements(); }
+
+    T &operator()(uint16_t x, uint16_t y = 0, uint16_t z = 0, uint16_t channel = 0) {
+        const ImageView<T> &self = *this;
+        return const_cast<T &>(self(x, y, z, channel));
+    }
+};
+
+/**
+ *   Read-only view of an acquisition.
+ *
+ *   The header is held by value, the data and trajectory are not owned and
+ *   must outlive the view. The layout is the same as in Acquisition.
+ */
+class AcquisitionView {
+public:
+    AcquisitionView() : data_(NULL), traj_(NULL) {}
+
+    AcquisitionView(const ISMRMRD_AcquisitionHeader &head, const complex_float_t *data, const float *traj)
+        : data_(data), traj_(traj) {
+        static_cast<ISMRMRD_AcquisitionHeader &>(head_) = head;
+    }
+
+    explicit AcquisitionView(const Acquisition &acq)
+        : head_(acq.getHead()), data_(acq.getDataPtr()), traj_(acq.getTrajPtr()) {}
+
+    const AcquisitionHeader &getHead() const { return head_; }
+    uint16_t number_of_samples() const { return head_.number_of_samples; }
+    uint16_t active_channels() const { return head_.active_channels; }
+    uint16_t trajectory_dimensions() const { return head_.trajectory_dimensions; }
+    bool isFlagSet(uint64_t val) const { return ismrmrd_is_flag_set(head_.flags, val); }
+
+    size_t getNumberOfDataElements() const { return size_t(head_.number_of_samples) * head_.active_channels; }
+    size_t getNumberOfTrajElements() const { return size_t(head_.number_of_samples) * head_.trajectory_dimensions; }
+    size_t getDataSize() const { return getNumberOfDataElements() * sizeof(complex_float_t); }
+    size_t getTrajSize() const { return getNumberOfTrajElements() * sizeof(float); }
+
+    const complex_float_t *getDataPtr() const { return data_; }
+    const complex_float_t *data_begin() const { return data_; }
+    const complex_float_t *data_end() const { return data_ + getNumberOfDataElements(); }
+    const complex_float_t &data(uint16_t sample, uint16_t channel) const {
+        return data_[size_t(sample) + size_t(channel) * head_.number_of_samples];
+    }
+
+    const float *getTrajPtr() const { return traj_; }
+    const float *traj_begin() const { return traj_; }
+    const float *traj_end() const { return traj_ + getNumberOfTrajElements(); }
+    const float &traj(uint16_t dimension, uint16_t sample) const {
+        return traj_[size_t(sample) * head_.trajectory_dimensions + dimension];
+    }
+
+protected:
+    AcquisitionHeader head_;
+    const complex_float_t *data_;
+    const float *traj_;
+};
+
+/**
+ *   View of an acquisition whose data and trajectory can be modified.
+ */
+class MutableAcquisitionView : public AcquisitionView {
+public:
+    MutableAcquisitionView() {}
+    MutableAcquisitionView(const ISMRMRD_AcquisitionHeader &head, complex_float_t *data, float *traj)
+        : AcquisitionView(head, data, traj) {}
+    explicit MutableAcquisitionView(Acquisition &acq) : AcquisitionView(acq) {}
+
+    using AcquisitionView::getDataPtr;
+    using AcquisitionView::data_begin;
+    using AcquisitionView::data_end;
+    using AcquisitionView::data;
+    using AcquisitionView::getTrajPtr;
+    using AcquisitionView::traj_begin;
+    using AcquisitionView::traj_end;
+    using AcquisitionView::traj;
+
+    complex_float_t *getDataPtr() { return const_cast<complex_float_t *>(data_); }
+    complex_float_t *data_begin() { return getDataPtr(); }
+    complex_float_t *data_end() { return getDataPtr() + getNumberOfDataElements(); }
+    complex_float_t &data(uint16_t sample, uint16_t channel) {
+        return getDataPtr()[size_t(sample) + size_t(channel) * head_.number_of_samples];
+    }
+
+    float *getTrajPtr() { return const_cast<float *>(traj_); }
+    float *traj_begin() { return getTrajPtr(); }
+    float *traj_end() { return getTrajPtr() + getNumberOfTrajElements(); }
+    float &traj(uint16_t dimension, uint16_t sample) {
+        return getTrajPtr()[size_t(sample) * head_.trajectory_dimensions + dimension];
+    }
+};
+
+/**
+ *   Read-only view of a waveform.
+ *
+ *   The header is held by value, the samples are not owned and must outlive
+ *   the view.
+ */
+class WaveformView {
+public:
+    WaveformView() : data_(NULL) { ismrmrd_init_waveformheader(&head_); }
+
+    WaveformView(const ISMRMRD_WaveformHeader &head, const uint32_t *data) : data_(data) {
+        static_cast<ISMRMRD_WaveformHeader &>(head_) = head;
+    }
+
+    explicit WaveformView(const Waveform &wfm) : data_(wfm.begin_data()) {
+        static_cast<ISMRMRD_WaveformHeader &>(head_) = wfm.head;
+    }
+
+    const WaveformHeader &getHead() const { return head_; }
+    size_t size() const { return size_t(head_.number_of_samples) * head_.channels; }
+
+    const uint32_t *begin_data() const { return data_; }
+    const uint32_t *end_data() const { return data_ + size(); }
+
+protected:
+    WaveformHeader head_;
+    const uint32_t *data_;
+};
+
+} // namespace ISMRMRD
+
+#endif /* ISMRMRD_VIEWS_H */
@@ -0,0 +1,681 @@
+#include "ismrmrd/container.h"
+#include "ismrmrd/serialization.h"
+
+#include <string.h>
+#include <stdexcept>
+
+namespace ISMRMRD {
+
+namespace {
+
+const char CONTAINER_MAGIC[8] = {'I', 'S', 'M', 'R', 'M', 'R', 'D', 'C'};
+const char INDEX_MAGIC[8] = {'I', 'S', 'M', 'R', 'M', 'R', 'D', 'I'};
+const uint32_t CONTAINER_VERSION = 1;
+const uint32_t NO_VARIABLE = 0xFFFFFFFF;
+
+const uint64_t PREAMBLE_SIZE = 16;
+const uint64_t ENTRY_SIZE = sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint16_t) + sizeof(ISMRMRD_EncodingCounters);
+const uint64_t TRAILER_SIZE = 3 * sizeof(uint64_t) + 2 * sizeof(uint32_t) + sizeof(INDEX_MAGIC);
+
+const size_t CONTAINER_BUFFER_SIZE = 1024 * 1024;
+
+template <typename T> void put(std::vector<char> &buffer, const T &value)
+{
+    const char *bytes = reinterpret_cast<const char *>(&value);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T> T get(const char *&pos)
+{
+    T value;
+    memcpy(&value, pos, sizeof(T));
+    pos += sizeof(T);
+    return value;
+}
+
+} // namespace
+
+//
+// ContainerDatasetBackend class implementation
+//
+ContainerDatasetBackend::ContainerDatasetBackend(const char *filename, bool create_file_if_needed)
+    : buffer_(CONTAINER_BUFFER_SIZE), writable_(true), indexed_(false), appending_(false), appended_(false),
+      write_pos_(0), data_end_(0), file_size_(0)
+{
+    // A large buffer turns the appends into few big writes
+    file_.rdbuf()->pubsetbuf(&buffer_[0], buffer_.size());
+
+    file_.open(filename, std::ios::in | std::ios::out | std::ios::binary);
+    if (!file_.is_open()) {
+        file_.clear();
+        file_.open(filename, std::ios::in | std::ios::binary);
+        writable_ = false;
+    }
+    if (file_.is_open()) {
+        loadIndex();
+        return;
+    }
+
+    if (!create_file_if_needed) {
+        throw std::runtime_error("Failed to open file.");
+    }
+    file_.clear();
+    file_.open(filename, std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!file_.is_open()) {
+        throw std::runtime_error("Failed to create file.");
+    }
+    writable_ = true;
+
+    std::vector<char> preamble;
+    preamble.insert(preamble.end(), CONTAINER_MAGIC, CONTAINER_MAGIC + sizeof(CONTAINER_MAGIC));
+    put(preamble, CONTAINER_VERSION);
+    put(preamble, uint32_t(0));
+    write(&preamble[0], preamble.size());
+    data_end_ = file_size_ = PREAMBLE_SIZE;
+}
+
+ContainerDatasetBackend::~ContainerDatasetBackend()
+{
+    // Readers leave the file as it is, also when its index was rebuilt
+    if (!appended_) {
+        return;
+    }
+    try {
+        flush();
+    } catch (std::exception &) {
+        // Destructors must not throw, the index is rebuilt on the next open
+    }
+}
+
+bool ContainerDatasetBackend::isContainerFile(const char *filename)
+{
+    std::ifstream f(filename, std::ios::in | std::ios::binary);
+    char magic[sizeof(CONTAINER_MAGIC)];
+    f.read(magic, sizeof(magic));
+    return f && memcmp(magic, CONTAINER_MAGIC, sizeof(magic)) == 0;
+}
+
+// Index
+void ContainerDatasetBackend::loadIndex()
+{
+    file_.seekg(0, std::ios::end);
+    file_size_ = static_cast<uint64_t>(file_.tellg());
+    if (file_size_ < PREAMBLE_SIZE) {
+        throw std::runtime_error("Not an ISMRMRD container file.");
+    }
+
+    char preamble[PREAMBLE_SIZE];
+    file_.seekg(0);
+    read(preamble, sizeof(preamble));
+    if (memcmp(preamble, CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC)) != 0) {
+        throw std::runtime_error("Not an ISMRMRD container file.");
+    }
+    const char *pos = preamble + sizeof(CONTAINER_MAGIC);
+    if (get<uint32_t>(pos) > CONTAINER_VERSION) {
+        throw std::runtime_error("Unsupported ISMRMRD container version.");
+    }
+
+    if (file_size_ < PREAMBLE_SIZE + TRAILER_SIZE) {
+        rebuildIndex();
+        return;
+    }
+
+    char trailer[TRAILER_SIZE];
+    file_.seekg(static_cast<std::streamoff>(file_size_ - TRAILER_SIZE));
+    read(trailer, sizeof(trailer));
+    pos = trailer;
+    uint64_t data_end = get<uint64_t>(pos);
+    uint64_t index_offset = get<uint64_t>(pos);
+    uint64_t num_entries = get<uint64_t>(pos);
+    uint32_t num_variables = get<uint32_t>(pos);
+    get<uint32_t>(pos);
+    if (memcmp(pos, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+        data_end < PREAMBLE_SIZE || data_end > index_offset ||
+        index_offset > file_size_ - TRAILER_SIZE ||
+        num_entries > (file_size_ - TRAILER_SIZE - index_offset) / ENTRY_SIZE) {
+        rebuildIndex();
+        return;
+    }
+
+    std::vector<char> index(static_cast<size_t>(file_size_ - TRAILER_SIZE - index_offset));
+    file_.seekg(static_cast<std::streamoff>(index_offset));
+    if (!index.empty()) {
+        read(&index[0], index.size());
+    }
+    pos = index.empty() ? NULL : &index[0];
+    const char *end = pos + index.size();
+    for (uint64_t n = 0; n < num_entries; n++) {
+        Entry entry;
+        entry.offset = get<uint64_t>(pos);
+        entry.variable = get<uint32_t>(pos);
+        entry.message_id = get<uint16_t>(pos);
+        entry.idx = get<ISMRMRD_EncodingCounters>(pos);
+        if (entry.offset >= data_end) {
+            throw std::runtime_error("Corrupt ISMRMRD container index.");
+        }
+        addEntry(entry);
+    }
+    for (uint32_t v = 0; v < num_variables; v++) {
+        if (end - pos < static_cast<ptrdiff_t>(sizeof(uint32_t))) {
+            throw std::runtime_error("Corrupt ISMRMRD container index.");
+        }
+        uint32_t len = get<uint32_t>(pos);
+        if (end - pos < static_cast<ptrdiff_t>(len)) {
+            throw std::runtime_error("Corrupt ISMRMRD container index.");
+        }
+        variable_ids_[std::string(pos, len)] = v;
+        variables_.push_back(std::string(pos, len));
+        pos += len;
+    }
+    for (size_t n = 0; n < entries_.size(); n++) {
+        if (entries_[n].variable != NO_VARIABLE && entries_[n].variable >= variables_.size()) {
+            throw std::runtime_error("Corrupt ISMRMRD container index.");
+        }
+    }
+
+    data_end_ = data_end;
+    indexed_ = true;
+}
+
+void ContainerDatasetBackend::rebuildIndex()
+{
+    uint64_t pos = PREAMBLE_SIZE;
+    bool valid = true;
+    while (valid && pos + sizeof(uint16_t) <= file_size_) {
+        Entry entry;
+        entry.offset = pos;
+        entry.variable = NO_VARIABLE;
+        memset(&entry.idx, 0, sizeof(entry.idx));
+
+        // Size of the message following the message id
+        uint64_t size = 0;
+        try {
+            file_.clear();
+            file_.seekg(static_cast<std::streamoff>(pos));
+            read(&entry.message_id, sizeof(uint16_t));
+
+            switch (entry.message_id) {
+            case ISMRMRD_MESSAGE_HEADER: {
+                uint32_t len;
+                read(&len, sizeof(len));
+                size = sizeof(len) + len;
+                break;
+            }
+            case ISMRMRD_MESSAGE_ACQUISITION: {
+                ISMRMRD_Acquisition acq;
+                read(&acq.head, sizeof(acq.head));
+                entry.idx = acq.head.idx;
+                size = sizeof(acq.head) + ismrmrd_size_of_acquisition_traj(&acq) + ismrmrd_size_of_acquisition_data(&acq);
+                break;
+            }
+            case ISMRMRD_MESSAGE_WAVEFORM: {
+                ISMRMRD_Waveform wav;
+                read(&wav.head, sizeof(wav.head));
+                size = sizeof(wav.head) + ismrmrd_size_of_waveform_data(&wav);
+                break;
+            }
+            case ISMRMRD_MESSAGE_IMAGE: {
+                ISMRMRD_Image im;
+                uint64_t attr_len;
+                read(&im.head, sizeof(im.head));
+                read(&attr_len, sizeof(attr_len));
+                if (ismrmrd_sizeof_data_type(im.head.data_type) == 0) {
+                    valid = false;
+                    break;
+                }
+                entry.variable = variableId("images");
+                size = sizeof(im.head) + sizeof(attr_len) + attr_len + ismrmrd_size_of_image_data(&im);
+                break;
+            }
+            case ISMRMRD_MESSAGE_NDARRAY: {
+                ISMRMRD_NDArray arr;
+                read(&arr.data_type, sizeof(arr.data_type));
+                read(&arr.version, sizeof(arr.version));
+                read(&arr.ndim, sizeof(arr.ndim));
+                if (arr.ndim > ISMRMRD_NDARRAY_MAXDIM || ismrmrd_sizeof_data_type(arr.data_type) == 0) {
+                    valid = false;
+                    break;
+                }
+                read(arr.dims, arr.ndim * sizeof(size_t));
+                entry.variable = variableId("arrays");
+                size = 3 * sizeof(uint16_t) + arr.ndim * sizeof(size_t) + ismrmrd_size_of_ndarray_data(&arr);
+                break;
+            }
+            default:
+                // The close message or the start of a stale index
+                valid = false;
+                break;
+            }
+        } catch (std::runtime_error &) {
+            // Truncated message
+            valid = false;
+        }
+
+        if (valid && pos + sizeof(uint16_t) + size <= file_size_) {
+            addEntry(entry);
+            pos += sizeof(uint16_t) + size;
+        } else {
+            valid = false;
+        }
+    }
+
+    file_.clear();
+    data_end_ = pos;
+    indexed_ = false;
+}
+
+void ContainerDatasetBackend::addEntry(const Entry &entry)
+{
+    size_t n = entries_.size();
+    entries_.push_back(entry);
+    switch (entry.message_id) {
+    case ISMRMRD_MESSAGE_HEADER:
+        headers_.push_back(n);
+        break;
+    case ISMRMRD_MESSAGE_ACQUISITION:
+        acquisitions_.push_back(n);
+        break;
+    case ISMRMRD_MESSAGE_WAVEFORM:
+        waveforms_.push_back(n);
+        break;
+    case ISMRMRD_MESSAGE_IMAGE:
+        images_[entry.variable].push_back(n);
+        break;
+    case ISMRMRD_MESSAGE_NDARRAY:
+        arrays_[entry.variable].push_back(n);
+        break;
+    default:
+        throw std::runtime_error("Unexpected message in ISMRMRD container index.");
+    }
+}
+
+uint32_t ContainerDatasetBackend::variableId(const std::string &var)
+{
+    std::map<std::string, uint32_t>::iterator it = variable_ids_.find(var);
+    if (it != variable_ids_.end()) {
+        return it->second;
+    }
+    if (variables_.size() >= NO_VARIABLE) {
+        throw std::runtime_error("Too many variables.");
+    }
+    uint32_t id = static_cast<uint32_t>(variables_.size());
+    variables_.push_back(var);
+    variable_ids_[var] = id;
+    return id;
+}
+
+const ContainerDatasetBackend::Entry &ContainerDatasetBackend::seriesEntry(const std::string &var, uint16_t message_id, uint32_t index)
+{
+    std::map<uint32_t, std::vector<size_t> > &series = message_id == ISMRMRD_MESSAGE_IMAGE ? images_ : arrays_;
+    std::map<std::string, uint32_t>::iterator var_it = variable_ids_.find(var);
+    if (var_it == variable_ids_.end() || series.find(var_it->second) == series.end()) {
+        throw std::runtime_error("Path to element not found.");
+    }
+    std::vector<size_t> &elements = series[var_it->second];
+    if (index >= elements.size()) {
+        throw std::runtime_error("Index out of range.");
+    }
+    return entries_[elements[index]];
+}
+
+void ContainerDatasetBackend::flush()
+{
+    ScopedLock lock(mutex_);
+    if (!writable_ || indexed_) {
+        return;
+    }
+
+    appending_ = false;
+    file_.clear();
+    file_.seekp(static_cast<std::streamoff>(data_end_));
+    write_pos_ = data_end_;
+
+    std::vector<char> footer;
+    put(footer, uint16_t(ISMRMRD_MESSAGE_CLOSE));
+    uint64_t index_offset = data_end_ + footer.size();
+    footer.reserve(footer.size() + entries_.size() * ENTRY_SIZE);
+    for (size_t n = 0; n < entries_.size(); n++) {
+        put(footer, entries_[n].offset);
+        put(footer, entries_[n].variable);
+        put(footer, entries_[n].message_id);
+        put(footer, entries_[n].idx);
+    }
+    for (size_t v = 0; v < variables_.size(); v++) {
+        put(footer, static_cast<uint32_t>(variables_[v].size()));
+        footer.insert(footer.end(), variables_[v].begin(), variables_[v].end());
+    }
+    // The trailer has to end the file, pad over anything left from an earlier index
+    uint64_t trailer_pos = data_end_ + footer.size();
+    if (trailer_pos + TRAILER_SIZE < file_size_) {
+        footer.resize(static_cast<size_t>(file_size_ - TRAILER_SIZE - data_end_), 0);
+    }
+    put(footer, data_end_);
+    put(footer, index_offset);
+    put(footer, static_cast<uint64_t>(entries_.size()));
+    put(footer, static_cast<uint32_t>(variables_.size()));
+    put(footer, CONTAINER_VERSION);
+    footer.insert(footer.end(), INDEX_MAGIC, INDEX_MAGIC + sizeof(INDEX_MAGIC));
+
+    write(&footer[0], footer.size());
+    file_.flush();
+    if (!file_) {
+        throw std::runtime_error("Failed to write to file.");
+    }
+    if (write_pos_ > file_size_) {
+        file_size_ = write_pos_;
+    }
+    indexed_ = true;
+}
+
+// Low level I/O
+void ContainerDatasetBackend::beginAppend(Entry &entry, uint16_t message_id, uint32_t variable)
+{
+    if (!writable_) {
+        throw std::runtime_error("File is opened read-only.");
+    }
+    if (indexed_) {
+        // The index will be overwritten, make sure it is not trusted anymore
+        char zeros[sizeof(INDEX_MAGIC)] = {0};
+        file_.clear();
+        file_.seekp(static_cast<std::streamoff>(file_size_ - sizeof(zeros)));
+        write(zeros, sizeof(zeros));
+        indexed_ = false;
+        appending_ = false;
+    }
+    if (!appending_) {
+        file_.clear();
+        file_.seekp(static_cast<std::streamoff>(data_end_));
+        write_pos_ = data_end_;
+        appending_ = true;
+    }
+    appended_ = true;
+
+    entry.offset = data_end_;
+    entry.variable = variable;
+    entry.message_id = message_id;
+    memset(&entry.idx, 0, sizeof(entry.idx));
+    write(&message_id, sizeof(message_id));
+}
+
+void ContainerDatasetBackend::endAppend(const Entry &entry)
+{
+    data_end_ = write_pos_;
+    if (data_end_ > file_size_) {
+        file_size_ = data_end_;
+    }
+    addEntry(entry);
+}
+
+void ContainerDatasetBackend::seekMessage(const Entry &entry)
+{
+    appending_ = false;
+    file_.clear();
+    file_.seekg(static_cast<std::streamoff>(entry.offset));
+    uint16_t message_id;
+    read(&message_id, sizeof(message_id));
+    if (message_id != entry.message_id) {
+        throw std::runtime_error("ISMRMRD container index does not match the file.");
+    }
+}
+
+void ContainerDatasetBackend::write(const void *buffer, size_t count)
+{
+    if (count == 0) {
+        return;
+    }
+    file_.write(static_cast<const char *>(buffer), static_cast<std::streamsize>(count));
+    if (!file_) {
+        appending_ = false;
+        throw std::runtime_error("Failed to write to file.");
+    }
+    write_pos_ += count;
+}
+
+void ContainerDatasetBackend::read(void *buffer, size_t count)
+{
+    if (count == 0) {
+        return;
+    }
+    file_.read(static_cast<char *>(buffer), static_cast<std::streamsize>(count));
+    if (!file_) {
+        throw std::runtime_error("Failed to read from file.");
+    }
+}
+
+// XML Header
+void ContainerDatasetBackend::writeHeader(const std::string &xmlstring)
+{
+    ScopedLock lock(mutex_);
+    Entry entry;
+    beginAppend(entry, ISMRMRD_MESSAGE_HEADER, NO_VARIABLE);
+    uint32_t len = static_cast<uint32_t>(xmlstring.size());
+    write(&len, sizeof(len));
+    write(xmlstring.c_str(), len);
+    endAppend(entry);
+}
+
+void ContainerDatasetBackend::readHeader(std::string &xmlstring)
+{
+    ScopedLock lock(mutex_);
+    if (headers_.empty()) {
+        throw std::runtime_error("No XML Header found.");
+    }
+    // The last header written wins
+    seekMessage(entries_[headers_.back()]);
+    uint32_t len;
+    read(&len, sizeof(len));
+    std::string xml(len, '\0');
+    if (len) {
+        read(&xml[0], len);
+    }
+    xmlstring.swap(xml);
+}
+
+// Acquisitions
+void ContainerDatasetBackend::appendAcquisition(const ISMRMRD_Acquisition *acq)
+{
+    ScopedLock lock(mutex_);
+    Entry entry;
+    beginAppend(entry, ISMRMRD_MESSAGE_ACQUISITION, NO_VARIABLE);
+    entry.idx = acq->head.idx;
+    write(&acq->head, sizeof(acq->head));
+    write(acq->traj, ismrmrd_size_of_acquisition_traj(acq));
+    write(acq->data, ismrmrd_size_of_acquisition_data(acq));
+    endAppend(entry);
+}
+
+void ContainerDatasetBackend::readAcquisition(uint32_t index, ISMRMRD_Acquisition *acq)
+{
+    ScopedLock lock(mutex_);
+    if (index >= acquisitions_.size()) {
+        throw std::runtime_error("Index out of range.");
+    }
+    seekMessage(entries_[acquisitions_[index]]);
+    read(&acq->head, sizeof(acq->head));
+    if (ismrmrd_make_consistent_acquisition(acq) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+    read(acq->traj, ismrmrd_size_of_acquisition_traj(acq));
+    read(acq->data, ismrmrd_size_of_acquisition_data(acq));
+}
+
+uint32_t ContainerDatasetBackend::getNumberOfAcquisitions()
+{
+    return static_cast<uint32_t>(acquisitions_.size());
+}
+
+ISMRMRD_EncodingCounters ContainerDatasetBackend::getAcquisitionCounters(uint32_t index)
+{
+    if (index >= acquisitions_.size()) {
+        throw std::runtime_error("Index out of range.");
+    }
+    return entries_[acquisitions_[index]].idx;
+}
+
+// Waveforms
+void ContainerDatasetBackend::appendWaveform(const ISMRMRD_Waveform *wav)
+{
+    ScopedLock lock(mutex_);
+    Entry entry;
+    beginAppend(entry, ISMRMRD_MESSAGE_WAVEFORM, NO_VARIABLE);
+    write(&wav->head, sizeof(wav->head));
+    write(wav->data, ismrmrd_size_of_waveform_data(wav));
+    endAppend(entry);
+}
+
+void ContainerDatasetBackend::readWaveform(uint32_t index, ISMRMRD_Waveform *wav)
+{
+    ScopedLock lock(mutex_);
+    if (index >= waveforms_.size()) {
+        throw std::runtime_error("Index out of range.");
+    }
+    seekMessage(entries_[waveforms_[index]]);
+    read(&wav->head, sizeof(wav->head));
+    if (ismrmrd_make_consistent_waveform(wav) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+    read(wav->data, ismrmrd_size_of_waveform_data(wav));
+}
+
+uint32_t ContainerDatasetBackend::getNumberOfWaveforms()
+{
+    return static_cast<uint32_t>(waveforms_.size());
+}
+
+// Images
+void ContainerDatasetBackend::appendImage(const std::string &var, const ISMRMRD_Image *im)
+{
+    ScopedLock lock(mutex_);
+    Entry entry;
+    beginAppend(entry, ISMRMRD_MESSAGE_IMAGE, variableId(var));
+    uint64_t attr_len = im->head.attribute_string_len;
+    write(&im->head, sizeof(im->head));
+    write(&attr_len, sizeof(attr_len));
+    write(im->attribute_string, ismrmrd_size_of_image_attribute_string(im));
+    write(im->data, ismrmrd_size_of_image_data(im));
+    endAppend(entry);
+}
+
+void ContainerDatasetBackend::readImage(const std::string &var, uint32_t index, ISMRMRD_Image *im)
+{
+    ScopedLock lock(mutex_);
+    seekMessage(seriesEntry(var, ISMRMRD_MESSAGE_IMAGE, index));
+    uint64_t attr_len;
+    read(&im->head, sizeof(im->head));
+    read(&attr_len, sizeof(attr_len));
+    if (attr_len != im->head.attribute_string_len) {
+        throw std::runtime_error("Inconsistent image attribute string length.");
+    }
+    if (ismrmrd_make_consistent_image(im) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+    read(im->attribute_string, ismrmrd_size_of_image_attribute_string(im));
+    read(im->data, ismrmrd_size_of_image_data(im));
+}
+
+uint32_t ContainerDatasetBackend::getNumberOfImages(const std::string &var)
+{
+    std::map<std::string, uint32_t>::iterator var_it = variable_ids_.find(var);
+    if (var_it == variable_ids_.end()) {
+        return 0;
+    }
+    std::map<uint32_t, std::vector<size_t> >::iterator it = images_.find(var_it->second);
+    return it == images_.end() ? 0 : static_cast<uint32_t>(it->second.size());
+}
+
+// NDArrays
+void ContainerDatasetBackend::appendNDArray(const std::string &var, const ISMRMRD_NDArray *arr)
+{
+    ScopedLock lock(mutex_);
+    Entry entry;
+    beginAppend(entry, ISMRMRD_MESSAGE_NDARRAY, variableId(var));
+    write(&arr->data_type, sizeof(arr->data_type));
+    write(&arr->version, sizeof(arr->version));
+    write(&arr->ndim, sizeof(arr->ndim));
+    write(arr->dims, arr->ndim * sizeof(size_t));
+    write(arr->data, ismrmrd_size_of_ndarray_data(arr));
+    endAppend(entry);
+}
+
+void ContainerDatasetBackend::readNDArray(const std::string &var, uint32_t index, ISMRMRD_NDArray *arr)
+{
+    ScopedLock lock(mutex_);
+    seekMessage(seriesEntry(var, ISMRMRD_MESSAGE_NDARRAY, index));
+    read(&arr->data_type, sizeof(arr->data_type));
+    read(&arr->version, sizeof(arr->version));
+    read(&arr->ndim, sizeof(arr->ndim));
+    if (arr->ndim > ISMRMRD_NDARRAY_MAXDIM) {
+        throw std::runtime_error("Too many dimensions.");
+    }
+    for (uint16_t n = arr->ndim; n < ISMRMRD_NDARRAY_MAXDIM; n++) {
+        arr->dims[n] = 0;
+    }
+    read(arr->dims, arr->ndim * sizeof(size_t));
+    if (ismrmrd_make_consistent_ndarray(arr) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+    read(arr->data, ismrmrd_size_of_ndarray_data(arr));
+}
+
+uint32_t ContainerDatasetBackend::getNumberOfNDArrays(const std::string &var)
+{
+    std::map<std::string, uint32_t>::iterator var_it = variable_ids_.find(var);
+    if (var_it == variable_ids_.end()) {
+        return 0;
+    }
+    std::map<uint32_t, std::vector<size_t> >::iterator it = arrays_.find(var_it->second);
+    return it == arrays_.end() ? 0 : static_cast<uint32_t>(it->second.size());
+}
+
+// Messages of the same data type and dimensions have the same size, so the stored one is overwritten
+bool ContainerDatasetBackend::replaceNDArray(const std::string &var, uint32_t index, const ISMRMRD_NDArray *arr)
+{
+    ScopedLock lock(mutex_);
+    if (!writable_) {
+        throw std::runtime_error("File is opened read-only.");
+    }
+    const Entry &entry = seriesEntry(var, ISMRMRD_MESSAGE_NDARRAY, index);
+    seekMessage(entry);
+    uint16_t data_type, version, ndim;
+    read(&data_type, sizeof(data_type));
+    read(&version, sizeof(version));
+    read(&ndim, sizeof(ndim));
+    bool consistent = data_type == arr->data_type && ndim == arr->ndim;
+    for (uint16_t n = 0; consistent && n < ndim; n++) {
+        size_t dim;
+        read(&dim, sizeof(dim));
+        consistent = dim == arr->dims[n];
+    }
+    if (!consistent) {
+        throw std::runtime_error("Dimensions are incorrect.");
+    }
+    // The data follows the message id, data type, version, number of dimensions and dimensions
+    write_pos_ = entry.offset + 4 * sizeof(uint16_t) + ndim * sizeof(size_t);
+    file_.clear();
+    file_.seekp(static_cast<std::streamoff>(write_pos_));
+    write(arr->data, ismrmrd_size_of_ndarray_data(arr));
+    return true;
+}
+
+// Variables
+std::vector<std::string> ContainerDatasetBackend::getImageVariables()
+{
+    std::vector<std::string> vars;
+    std::map<uint32_t, std::vector<size_t> >::iterator it;
+    for (it = images_.begin(); it != images_.end(); ++it) {
+        vars.push_back(variables_[it->first]);
+    }
+    return vars;
+}
+
+std::vector<std::string> ContainerDatasetBackend::getNDArrayVariables()
+{
+    std::vector<std::string> vars;
+    std::map<uint32_t, std::vector<size_t> >::iterator it;
+    for (it = arrays_.begin(); it != arrays_.end(); ++it) {
+        vars.push_back(variables_[it->first]);
+    }
+    return vars;
+}
+
+} // namespace ISMRMRD
@@ -4,18 +4,24 @@
 #include <cstring>
 #include <cstdlib>
 #include <cstdio>
+#include <cfloat>
 #else
 /* C99 compiler */
 #include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <float.h>
 #endif /* __cplusplus */
 
 #include <hdf5.h>
 #include <ismrmrd/waveform.h>
 #include "ismrmrd/dataset.h"
 
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
 #ifdef __cplusplus
 namespace ISMRMRD {
 extern "C" {
@@ -154,9 +160,16 @@ static int delete_var(const ISMRMRD_Dataset *dset, const char *var) {
 
 #define ISMRMRD_READ_BUFFER_SIZE 1024*1024 //HDF5 default buffer size
 
-//Static buffers here means ISMRMRD is not threadsafe. Howevever, neither is HDF5, so we don't loose anything here. 
+/* Shared by all datasets. HDF5 only uses them during a read or write, and those never
+   overlap: thread safe builds of HDF5 serialize all calls, and the C++ API holds the
+   HDF5 lock (ISMRMRD::getHDF5Mutex) around its calls otherwise. */
 static char ismrmrd_conversion_buffer[ISMRMRD_READ_BUFFER_SIZE];
 static char ismrmrd_transfer_buffer[ISMRMRD_READ_BUFFER_SIZE];
+
+/* Every dataset has its own conversion and background buffers, so that
+ * different datasets can be used from different threads. HDF5 itself is
+ * only safe for that when it is built thread-safe, the C++ interface
+ * serializes its HDF5 calls instead. */
 /*********************************************/
 /* Private (Static) Functions for HDF5 Types */
 /*********************************************/
@@ -173,6 +186,15 @@ typedef struct HDF5_Waveform
     hvl_t data;
 } HDF5_Waveform;
 
+/* Acquisition stored with 16-bit samples, see ISMRMRD_AcquisitionStorage */
+typedef struct HDF5_CompactAcquisition
+{
+    ISMRMRD_AcquisitionHeader head;
+    hvl_t traj;
+    hvl_t data;
+    float scale;
+} HDF5_CompactAcquisition;
+
 static hid_t get_hdf5type_uint16(void) {
     hid_t datatype = H5Tcopy(H5T_NATIVE_UINT16);
     return datatype;
@@ -198,6 +220,30 @@ static hid_t get_hdf5type_float(void) {
     return datatype;
 }
 
+/* The samples of compact acquisitions are opaque to HDF5. Readers that do not know the formats then
+   fail to convert them, instead of reading the int16 or half values as floats without their scale. */
+#define ISMRMRD_INT16_TAG "ismrmrd int16 le"
+#define ISMRMRD_HALF_TAG "ismrmrd half le"
+
+static hid_t get_hdf5type_compact_sample(uint16_t storage) {
+    hid_t datatype = H5Tcreate(H5T_OPAQUE, 2);
+    H5Tset_tag(datatype, storage == ISMRMRD_STORAGE_INT16 ? ISMRMRD_INT16_TAG : ISMRMRD_HALF_TAG);
+    return datatype;
+}
+
+/* HDF5 does not convert opaque data, the samples are kept little endian */
+static void swap_compact_samples(uint16_t *samples, size_t n) {
+    const uint16_t one = 1;
+    size_t i;
+
+    if (*(const unsigned char *) &one == 1) {
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        samples[i] = (uint16_t)((samples[i] << 8) | (samples[i] >> 8));
+    }
+}
+
 static hid_t get_hdf5type_double(void) {
     hid_t datatype = H5Tcopy(H5T_NATIVE_DOUBLE);
     return datatype;
@@ -369,6 +415,39 @@ static hid_t get_hdf5type_acquisition(void) {
     return datatype;
 }
 
+static hid_t get_hdf5type_compact_acquisition(uint16_t storage) {
+    hid_t datatype, vartype, vlvartype;
+    herr_t h5status;
+
+    datatype = H5Tcreate(H5T_COMPOUND, sizeof(HDF5_CompactAcquisition));
+    vartype = get_hdf5type_acquisitionheader();
+    h5status = H5Tinsert(datatype, "head", HOFFSET(HDF5_CompactAcquisition, head), vartype);
+    H5Tclose(vartype);
+    vartype =  get_hdf5type_float();
+    vlvartype = H5Tvlen_create(vartype);
+    h5status = H5Tinsert(datatype, "traj", HOFFSET(HDF5_CompactAcquisition, traj), vlvartype);
+    H5Tclose(vartype);
+    H5Tclose(vlvartype);
+
+    /* Integers or half floats that are multiplied by the scale of the acquisition */
+    vartype = get_hdf5type_compact_sample(storage);
+    vlvartype = H5Tvlen_create(vartype);
+    h5status = H5Tinsert(datatype, "data", HOFFSET(HDF5_CompactAcquisition, data), vlvartype);
+    H5Tclose(vartype);
+    H5Tclose(vlvartype);
+
+    /* Both formats keep one scale factor per acquisition */
+    vartype = get_hdf5type_float();
+    h5status = H5Tinsert(datatype, "scale", HOFFSET(HDF5_CompactAcquisition, scale), vartype);
+    H5Tclose(vartype);
+
+    if (h5status < 0) {
+        ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed get compact acquisition data type");
+    }
+
+    return datatype;
+}
+
 static hid_t get_hdf5type_imageheader(void) {
     hid_t datatype;
     herr_t h5status;
@@ -624,9 +703,10 @@ static uint32_t get_number_of_elements(const ISMRMRD_Dataset *dset, const char *
     return num;
 }
 
-static int append_element(const ISMRMRD_Dataset * dset, const char * path,
+/* Appends count elements stored one after the other at elem */
+static int append_elements(const ISMRMRD_Dataset * dset, const char * path,
         void * elem, const hid_t datatype,
-        const uint16_t ndim, const size_t *dims)
+        const uint16_t ndim, const size_t *dims, const uint32_t count)
 {
     hid_t dataset, dataspace, props, filespace, memspace;
     herr_t h5status = 0;
@@ -672,19 +752,19 @@ static int append_element(const ISMRMRD_Dataset * dset, const char * path,
                 return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Dimensions are incorrect.");
             }
         }
-        /* extend it by one */
-        hdfdims[0] += 1;
+        /* extend it by count */
+        hdfdims[0] += count;
         h5status = H5Dset_extent(dataset, hdfdims);
         /* Select the last block */
-        ext_dims[0] = 1;
+        ext_dims[0] = count;
         for (n = 0; n < ndim; n++) {
             offset[n + 1] = 0;
             ext_dims[n + 1] = dims[n];
         }
     } else {
-        hdfdims[0] = 1;
+        hdfdims[0] = count;
         maxdims[0] = H5S_UNLIMITED;
-        ext_dims[0] = 1;
+        ext_dims[0] = count;
         chunk_dims[0] = 1;
         for (n = 0; n < ndim; n++) {
             hdfdims[n + 1] = dims[n];
@@ -721,7 +801,7 @@ static int append_element(const ISMRMRD_Dataset * dset, const char * path,
     }
 
     /* Select the last block */
-    offset[0] = hdfdims[0]-1;
+    offset[0] = hdfdims[0]-count;
     filespace = H5Dget_space(dataset);
     h5status  = H5Sselect_hyperslab (filespace, H5S_SELECT_SET, offset, NULL, ext_dims, NULL);
 	
@@ -739,7 +819,7 @@ static int append_element(const ISMRMRD_Dataset * dset, const char * path,
     free(chunk_dims);
 
     /* Write it */
-    /* since this is a 1 element array we can just pass the pointer to the header */
+    /* the elements are contiguous in memory, so we can just pass the pointer to the first one */
     h5status = H5Dwrite(dataset, datatype, memspace, filespace, dset->transfer_properties, elem);
     if (h5status < 0) {
         H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
@@ -771,6 +851,13 @@ static int append_element(const ISMRMRD_Dataset * dset, const char * path,
     return ISMRMRD_NOERROR;
 }
 
+static int append_element(const ISMRMRD_Dataset * dset, const char * path,
+        void * elem, const hid_t datatype,
+        const uint16_t ndim, const size_t *dims)
+{
+    return append_elements(dset, path, elem, datatype, ndim, dims, 1);
+}
+
 static int get_array_properties(const ISMRMRD_Dataset *dset, const char *path,
         uint16_t *ndim, size_t dims[ISMRMRD_NDARRAY_MAXDIM],
         uint16_t *data_type)
@@ -806,9 +893,10 @@ static int get_array_properties(const ISMRMRD_Dataset *dset, const char *path,
     h5status = H5Sget_simple_extent_dims(filespace, hdfdims, NULL);
 
     /* set the return values - permute dimensions */
+    /* the slowest varying dimension counts the appended arrays */
     *data_type = get_ndarray_data_type(hdf5type);
-    *ndim = rank;
-    for (n=0; n<rank; n++) {
+    *ndim = rank - 1;
+    for (n=0; n<rank-1; n++) {
         dims[n] = hdfdims[rank-n-1];
     }
 
@@ -836,10 +924,11 @@ static int get_array_properties(const ISMRMRD_Dataset *dset, const char *path,
 }
 
 
-int read_element(const ISMRMRD_Dataset *dset, const char *path, void *elem,
-                 const hid_t datatype, const uint32_t index) {
+/* Reads count elements starting at index into consecutive memory at elem */
+static int read_elements(const ISMRMRD_Dataset *dset, const char *path, void *elem,
+                 const hid_t datatype, const uint32_t index, const uint32_t count) {
     hid_t dataset, filespace, memspace;
-    hsize_t *hdfdims = NULL, *offset = NULL, *count = NULL;
+    hsize_t *hdfdims = NULL, *offset = NULL, *counts = NULL;
     herr_t h5status = 0;
     int rank = 0;
     int n;
@@ -864,32 +953,26 @@ int read_element(const ISMRMRD_Dataset *dset, const char *path, void *elem,
 
     hdfdims = (hsize_t *)malloc(rank * sizeof(*hdfdims));
     offset = (hsize_t *)malloc(rank * sizeof(*offset));
-    count = (hsize_t *)malloc(rank * sizeof(*count));
+    counts = (hsize_t *)malloc(rank * sizeof(*counts));
 
     h5status = H5Sget_simple_extent_dims(filespace, hdfdims, NULL);
 
-    if (index >= hdfdims[0]) {
+    if (count == 0 || index >= hdfdims[0] || count > hdfdims[0] - index) {
         ret_code = ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Index out of range.");
         goto cleanup;
     }
 
     offset[0] = index;
-    count[0] = 1;
+    counts[0] = count;
     for (n = 1; n < rank; n++) {
         offset[n] = 0;
-        count[n] = hdfdims[n];
-    }
-
-    if (rank > 1) {
-        h5status = H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL, count, NULL);
-    } else {
-        hsize_t coord = index;
-        h5status = H5Sselect_elements(filespace, H5S_SELECT_SET, 1, &coord);
+        counts[n] = hdfdims[n];
     }
 
+    h5status = H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL, counts, NULL);
 
-    /* create space for one */
-    memspace = H5Screate_simple(rank, count, NULL);
+    /* create space for the elements */
+    memspace = H5Screate_simple(rank, counts, NULL);
 
     h5status = H5Dread(dataset, datatype, memspace, filespace, dset->transfer_properties, elem);
     if (h5status < 0) {
@@ -918,12 +1001,279 @@ int read_element(const ISMRMRD_Dataset *dset, const char *path, void *elem,
     }
 
 cleanup:
-    free(count);
+    free(counts);
     free(offset);
     free(hdfdims);
     return ret_code;
 }
 
+int read_element(const ISMRMRD_Dataset *dset, const char *path, void *elem,
+                 const hid_t datatype, const uint32_t index) {
+    return read_elements(dset, path, elem, datatype, index, 1);
+}
+
+/* Overwrites the element at index with one of the dimensions the stored elements have */
+static int write_element(const ISMRMRD_Dataset *dset, const char *path, const void *elem,
+                 const hid_t datatype, const uint16_t ndim, const size_t *dims, const uint32_t index) {
+    hid_t dataset, filespace, memspace = -1;
+    hsize_t hdfdims[ISMRMRD_NDARRAY_MAXDIM + 1], offset[ISMRMRD_NDARRAY_MAXDIM + 1], counts[ISMRMRD_NDARRAY_MAXDIM + 1];
+    herr_t h5status = 0;
+    int rank, n;
+    int ret_code = ISMRMRD_NOERROR;
+
+    if (NULL == dset) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Dataset pointer should not be NULL.");
+    }
+    if (!link_exists(dset, path)) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Path to element not found.");
+    }
+
+    dataset = H5Dopen2(dset->fileid, path, H5P_DEFAULT);
+    filespace = H5Dget_space(dataset);
+    rank = H5Sget_simple_extent_ndims(filespace);
+    if (rank != ndim + 1) {
+        ret_code = ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Dimensions are incorrect.");
+        goto cleanup;
+    }
+    h5status = H5Sget_simple_extent_dims(filespace, hdfdims, NULL);
+    if (index >= hdfdims[0]) {
+        ret_code = ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Index out of range.");
+        goto cleanup;
+    }
+    offset[0] = index;
+    counts[0] = 1;
+    for (n = 0; n < ndim; n++) {
+        if (dims[n] != hdfdims[n + 1]) {
+            ret_code = ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Dimensions are incorrect.");
+            goto cleanup;
+        }
+        offset[n + 1] = 0;
+        counts[n + 1] = dims[n];
+    }
+
+    h5status = H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL, counts, NULL);
+    memspace = H5Screate_simple(rank, counts, NULL);
+    h5status = H5Dwrite(dataset, datatype, memspace, filespace, dset->transfer_properties, elem);
+    if (h5status < 0) {
+        H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
+        ret_code = ISMRMRD_PUSH_ERR(ISMRMRD_HDF5ERROR, "Failed to write dataset");
+    }
+
+cleanup:
+    if (memspace >= 0) {
+        H5Sclose(memspace);
+    }
+    H5Sclose(filespace);
+    h5status = H5Dclose(dataset);
+    if (h5status < 0 && ret_code == ISMRMRD_NOERROR) {
+        H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
+        ret_code = ISMRMRD_PUSH_ERR(ISMRMRD_HDF5ERROR, "Failed to close dataset.");
+    }
+    return ret_code;
+}
+
+/* Returns true if the dataset holds acquisitions, and the format they are stored in */
+static bool find_acquisition_storage(const ISMRMRD_Dataset *dset, uint16_t *storage) {
+    hid_t dataset, filetype, membertype, basetype;
+    int index;
+    char *path, *tag;
+    bool found = false;
+
+    path = make_path(dset, "data");
+    if (!link_exists(dset, path)) {
+        free(path);
+        return false;
+    }
+    dataset = H5Dopen2(dset->fileid, path, H5P_DEFAULT);
+    free(path);
+    if (dataset < 0) {
+        return false;
+    }
+
+    filetype = H5Dget_type(dataset);
+    index = H5Tget_member_index(filetype, "data");
+    if (index >= 0) {
+        membertype = H5Tget_member_type(filetype, (unsigned) index);
+        basetype = H5Tget_super(membertype);
+        /* Opaque samples of an unknown format are read as floats, which HDF5 refuses */
+        *storage = ISMRMRD_STORAGE_FLOAT;
+        if (H5Tget_class(basetype) == H5T_OPAQUE) {
+            tag = H5Tget_tag(basetype);
+            if (tag != NULL && strcmp(tag, ISMRMRD_INT16_TAG) == 0) {
+                *storage = ISMRMRD_STORAGE_INT16;
+            } else if (tag != NULL && strcmp(tag, ISMRMRD_HALF_TAG) == 0) {
+                *storage = ISMRMRD_STORAGE_HALF;
+            }
+            H5free_memory(tag);
+        }
+        found = true;
+        H5Tclose(basetype);
+        H5Tclose(membertype);
+    }
+    H5Tclose(filetype);
+    H5Dclose(dataset);
+
+    return found;
+}
+
+static uint16_t float_to_half(float value) {
+    union { float f; uint32_t u; } in;
+    uint32_t sign, mantissa, rest, shift;
+    int exponent;
+    uint16_t half;
+
+    in.f = value;
+    sign = (in.u >> 16) & 0x8000;
+    exponent = (int)((in.u >> 23) & 0xff) - 127 + 15;
+    mantissa = in.u & 0x7fffff;
+
+    if (exponent == 128 + 15) {
+        /* infinity and NaN */
+        return (uint16_t)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    }
+    if (exponent >= 31) {
+        return (uint16_t)(sign | 0x7c00);
+    }
+    if (exponent <= 0) {
+        /* subnormal half, rounded to nearest even */
+        if (exponent < -10) {
+            return (uint16_t) sign;
+        }
+        mantissa |= 0x800000;
+        shift = (uint32_t)(14 - exponent);
+        half = (uint16_t)(mantissa >> shift);
+        rest = mantissa & ((1u << shift) - 1);
+        if (rest > (1u << (shift - 1)) || (rest == (1u << (shift - 1)) && (half & 1))) {
+            half++;
+        }
+        return (uint16_t)(sign | half);
+    }
+
+    half = (uint16_t)(sign | ((uint32_t) exponent << 10) | (mantissa >> 13));
+    rest = mantissa & 0x1fff;
+    /* a carry into the exponent is the correct rounding, up to infinity */
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+        half++;
+    }
+    return half;
+}
+
+static float half_to_float(uint16_t half) {
+    union { uint32_t u; float f; } out, magic;
+    uint32_t exponent;
+
+    magic.u = 113u << 23;
+    out.u = (uint32_t)(half & 0x7fff) << 13;
+    exponent = out.u & 0x0f800000;
+    out.u += (127 - 15) << 23;
+    if (exponent == 0x0f800000) {
+        /* infinity and NaN */
+        out.u += (128 - 16) << 23;
+    } else if (exponent == 0) {
+        /* subnormal, renormalized by the FPU */
+        out.u += 1 << 23;
+        out.f -= magic.f;
+    }
+    out.u |= (uint32_t)(half & 0x8000) << 16;
+    return out.f;
+}
+
+#define ISMRMRD_HALF_MAX 65504.0f
+
+/* Scales the samples by a power of two so that the largest lands in the top octave of half floats,
+   returns the scale to undo it. Small samples keep their precision instead of falling into the
+   subnormals, large ones do not overflow, and a power of two adds no rounding. */
+static float encode_half(const float *in, uint16_t *out, size_t n) {
+    float peak = 0.0f, scale = 1.0f, inverse, v;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        v = in[i] < 0.0f ? -in[i] : in[i];
+        if (v > peak) {
+            peak = v;
+        }
+    }
+    /* peak is infinite when the samples are, those stay infinite */
+    if (peak > 0.0f && peak - peak == 0.0f) {
+        while (peak / scale > ISMRMRD_HALF_MAX) {
+            scale *= 2.0f;
+        }
+        /* FLT_MIN keeps the inverse finite */
+        while (scale > FLT_MIN && 2.0f * (peak / scale) <= ISMRMRD_HALF_MAX) {
+            scale *= 0.5f;
+        }
+    }
+    inverse = 1.0f / scale;
+
+    i = 0;
+#if defined(__F16C__)
+    {
+        __m256 factor = _mm256_set1_ps(inverse);
+        for (; i + 8 <= n; i += 8) {
+            _mm_storeu_si128((__m128i *)(out + i),
+                             _mm256_cvtps_ph(_mm256_mul_ps(_mm256_loadu_ps(in + i), factor), _MM_FROUND_TO_NEAREST_INT));
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = float_to_half(in[i] * inverse);
+    }
+    return scale;
+}
+
+static void decode_half(const uint16_t *in, float scale, float *out, size_t n) {
+    size_t i = 0;
+#if defined(__F16C__)
+    {
+        __m256 factor = _mm256_set1_ps(scale);
+        for (; i + 8 <= n; i += 8) {
+            _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(in + i))), factor));
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = half_to_float(in[i]) * scale;
+    }
+}
+
+/* Scales the samples to the full range of int16, returns the scale to undo it */
+static float encode_int16(const float *in, int16_t *out, size_t n) {
+    float peak = 0.0f, scale, inverse, v;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        v = in[i] < 0.0f ? -in[i] : in[i];
+        if (v > peak) {
+            peak = v;
+        }
+    }
+    /* peak is infinite when the samples are */
+    scale = peak > 0.0f && peak - peak == 0.0f ? peak / 32767.0f : 1.0f;
+    inverse = 1.0f / scale;
+
+    for (i = 0; i < n; i++) {
+        v = in[i] * inverse;
+        if (v >= 32767.0f) {
+            out[i] = 32767;
+        } else if (v <= -32767.0f) {
+            out[i] = -32767;
+        } else if (v == v) {
+            out[i] = (int16_t)(v < 0.0f ? v - 0.5f : v + 0.5f);
+        } else {
+            out[i] = 0;
+        }
+    }
+    return scale;
+}
+
+/* Written as a plain loop so that the compiler vectorizes it */
+static void decode_int16(const int16_t *in, float scale, float *out, size_t n) {
+    size_t i;
+    for (i = 0; i < n; i++) {
+        out[i] = (float) in[i] * scale;
+    }
+}
+
 /********************/
 /* Public functions */
 /********************/
@@ -937,6 +1287,10 @@ int ismrmrd_init_dataset(ISMRMRD_Dataset *dset, const char *filename,
     /* Disable HDF5 automatic error prenting */
     H5Eset_auto2(H5E_DEFAULT, NULL, NULL);
 
+    /* Nothing to close yet if an allocation below fails */
+    dset->transfer_properties = 0;
+    dset->acquisition_storage = ISMRMRD_STORAGE_FLOAT;
+
     dset->filename = (char *) malloc(strlen(filename) + 1);
     if (dset->filename == NULL) {
         return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to malloc dataset filename");
@@ -951,7 +1305,6 @@ int ismrmrd_init_dataset(ISMRMRD_Dataset *dset, const char *filename,
 
     dset->fileid = 0;
 
-  
     dset->transfer_properties = H5Pcreate(H5P_DATASET_XFER);
 
     H5Pset_buffer(dset->transfer_properties,
@@ -965,6 +1318,7 @@ int ismrmrd_init_dataset(ISMRMRD_Dataset *dset, const char *filename,
 int ismrmrd_open_dataset(ISMRMRD_Dataset *dset, const bool create_if_needed) {
     /* TODO add a mode for clobbering the dataset if it exists. */
     hid_t fileid;
+    uint16_t storage;
 
     if (NULL == dset) {
         ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "NULL Dataset parameter");
@@ -1010,6 +1364,58 @@ int ismrmrd_open_dataset(ISMRMRD_Dataset *dset, const bool create_if_needed) {
     /* ensure that /groupname exists */
     create_link(dset, dset->groupname);
 
+    /* Keep appending acquisitions in the format they are stored in */
+    if (find_acquisition_storage(dset, &storage)) {
+        dset->acquisition_storage = storage;
+    }
+
+    return ISMRMRD_NOERROR;
+}
+
+int ismrmrd_open_dataset_readonly(ISMRMRD_Dataset *dset) {
+    hid_t fileid, file_access;
+    uint16_t storage;
+    H5AC_cache_config_t mdc_config;
+
+    if (NULL == dset) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "NULL Dataset parameter");
+    }
+
+    file_access = H5Pcreate(H5P_FILE_ACCESS);
+
+    /* Readers never modify the file, skip the locks so that any number of them can share it */
+#if H5_VERSION_GE(1, 10, 7)
+    H5Pset_file_locking(file_access, false, true);
+#endif
+
+    /* Start with a metadata cache large enough for the index of a typical file,
+       all entries are clean so the cache never has to flush */
+    mdc_config.version = H5AC__CURR_CACHE_CONFIG_VERSION;
+    if (H5Pget_mdc_config(file_access, &mdc_config) >= 0) {
+        mdc_config.set_initial_size = true;
+        mdc_config.initial_size = 4 * 1024 * 1024;
+        if (mdc_config.max_size < mdc_config.initial_size) {
+            mdc_config.max_size = mdc_config.initial_size;
+        }
+        if (mdc_config.min_size > mdc_config.initial_size) {
+            mdc_config.min_size = mdc_config.initial_size;
+        }
+        H5Pset_mdc_config(file_access, &mdc_config);
+    }
+
+    fileid = H5Fopen(dset->filename, H5F_ACC_RDONLY, file_access);
+    H5Pclose(file_access);
+
+    if (fileid < 0) {
+        H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to open file.");
+    }
+    dset->fileid = fileid;
+
+    if (find_acquisition_storage(dset, &storage)) {
+        dset->acquisition_storage = storage;
+    }
+
     return ISMRMRD_NOERROR;
 }
 
@@ -1031,6 +1437,10 @@ int ismrmrd_close_dataset(ISMRMRD_Dataset *dset) {
         dset->groupname = NULL;
     }
 
+    if (dset->transfer_properties > 0) {
+        H5Pclose(dset->transfer_properties);
+        dset->transfer_properties = 0;
+    }
 
     /* Check for a valid fileid before trying to close the file */
     if (dset->fileid > 0) {
@@ -1045,6 +1455,22 @@ int ismrmrd_close_dataset(ISMRMRD_Dataset *dset) {
     return ISMRMRD_NOERROR;
 }
 
+int ismrmrd_flush_dataset(const ISMRMRD_Dataset *dset) {
+    herr_t h5status;
+
+    if (NULL == dset) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "NULL Dataset parameter");
+    }
+
+    h5status = H5Fflush(dset->fileid, H5F_SCOPE_LOCAL);
+    if (h5status < 0) {
+        H5Ewalk2(H5E_DEFAULT, H5E_WALK_UPWARD, walk_hdf5_errors, NULL);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to flush dataset.");
+    }
+
+    return ISMRMRD_NOERROR;
+}
+
 int ismrmrd_write_header(const ISMRMRD_Dataset *dset, const char *xmlstring) {
     hid_t dataset, dataspace, datatype, props;
     hsize_t dims[] = {1};
@@ -1177,6 +1603,31 @@ uint32_t ismrmrd_get_number_of_acquisitions(const ISMRMRD_Dataset *dset) {
     return numacq;
 }
 
+int ismrmrd_set_acquisition_storage(ISMRMRD_Dataset *dset, const uint16_t storage) {
+    uint16_t stored;
+
+    if (dset==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Dataset pointer should not be NULL.");
+    }
+    if (storage != ISMRMRD_STORAGE_FLOAT && storage != ISMRMRD_STORAGE_INT16 && storage != ISMRMRD_STORAGE_HALF) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Invalid acquisition storage format.");
+    }
+    if (dset->fileid > 0 && find_acquisition_storage(dset, &stored) && stored != storage) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "The dataset already holds acquisitions in a different format.");
+    }
+
+    dset->acquisition_storage = storage;
+    return ISMRMRD_NOERROR;
+}
+
+uint16_t ismrmrd_get_acquisition_storage(const ISMRMRD_Dataset *dset) {
+    if (dset==NULL) {
+        ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Dataset pointer should not be NULL.");
+        return ISMRMRD_STORAGE_FLOAT;
+    }
+    return dset->acquisition_storage;
+}
+
 int ismrmrd_append_acquisition(const ISMRMRD_Dataset *dset, const ISMRMRD_Acquisition *acq) {
     int status;
     char *path;
@@ -1189,6 +1640,9 @@ int ismrmrd_append_acquisition(const ISMRMRD_Dataset *dset, const ISMRMRD_Acquis
     if (acq==NULL) {
         return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Acquisition pointer should not be NULL.");
     }
+    if (dset->acquisition_storage != ISMRMRD_STORAGE_FLOAT) {
+        return ismrmrd_append_acquisitions(dset, acq, 1);
+    }
 
     /* The path to the acqusition data */    
     path = make_path(dset, "data");
@@ -1234,6 +1688,9 @@ int ismrmrd_read_acquisition(const ISMRMRD_Dataset *dset, uint32_t index, ISMRMR
     if (acq==NULL) {
         return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Acquisition pointer should not be NULL.");
     }
+    if (dset->acquisition_storage != ISMRMRD_STORAGE_FLOAT) {
+        return ismrmrd_read_acquisitions(dset, index, 1, acq);
+    }
 
     ismrmrd_cleanup_acquisition(acq);
 
@@ -1244,6 +1701,11 @@ int ismrmrd_read_acquisition(const ISMRMRD_Dataset *dset, uint32_t index, ISMRMR
     datatype = get_hdf5type_acquisition();
 
     status = read_element(dset, path, &hdf5acq, datatype, index);
+    if (status != ISMRMRD_NOERROR) {
+        free(path);
+        H5Tclose(datatype);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to read acquisition.");
+    }
     memcpy(&acq->head, &hdf5acq.head, sizeof(ISMRMRD_AcquisitionHeader));
     acq->traj = hdf5acq.traj.p;
     acq->data = hdf5acq.data.p;
@@ -1427,6 +1889,39 @@ int ismrmrd_read_image(const ISMRMRD_Dataset *dset, const char *varname,
 }
 
 
+int ismrmrd_read_image_header(const ISMRMRD_Dataset *dset, const char *varname,
+        const uint32_t index, ISMRMRD_ImageHeader *head) {
+
+    int status;
+    hid_t datatype;
+    char *path, *headerpath;
+
+    if (dset==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Dataset pointer should not be NULL.");
+    }
+    if (varname==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Varname should not be NULL.");
+    }
+    if (head==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Image header pointer should not be NULL.");
+    }
+
+    /* /groupname/varname/header */
+    path = make_path(dset, varname);
+    headerpath = append_to_path(dset, path, "header");
+    datatype = get_hdf5type_imageheader();
+    status = read_element(dset, headerpath, (void *) head, datatype, index);
+    H5Tclose(datatype);
+    free(headerpath);
+    free(path);
+    if (status != ISMRMRD_NOERROR) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to read image header.");
+    }
+
+    return ISMRMRD_NOERROR;
+}
+
+
 int ismrmrd_append_waveform(const ISMRMRD_Dataset *dset, const ISMRMRD_Waveform *wav) {
     int status;
     char *path;
@@ -1490,6 +1985,11 @@ int ismrmrd_read_waveform(const ISMRMRD_Dataset *dset, uint32_t index, ISMRMRD_W
     datatype = get_hdf5type_waveform();
 
     status = read_element(dset, path, &hdf5wav, datatype, index);
+    if (status != ISMRMRD_NOERROR) {
+        free(path);
+        H5Tclose(datatype);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to read waveform.");
+    }
     memcpy(&wav->head, &hdf5wav.head, sizeof(ISMRMRD_WaveformHeader));
     ismrmrd_make_consistent_waveform(wav);
     memcpy(wav->data, hdf5wav.data.p, ismrmrd_size_of_waveform_data(wav));
@@ -1570,21 +2070,71 @@ int ismrmrd_append_array(const ISMRMRD_Dataset *dset, const char *varname, const
     return ISMRMRD_NOERROR;
 }
 
-uint32_t ismrmrd_get_number_of_arrays(const ISMRMRD_Dataset *dset, const char *varname) {
+int ismrmrd_write_array(const ISMRMRD_Dataset *dset, const char *varname, const uint32_t index,
+        const ISMRMRD_NDArray *arr) {
+    int status;
+    hid_t datatype;
+    size_t dims[ISMRMRD_NDARRAY_MAXDIM];
+    uint16_t stored_ndim, stored_type;
+    size_t stored_dims[ISMRMRD_NDARRAY_MAXDIM];
+    int n;
     char *path;
-    uint32_t numarrays;
 
     if (dset==NULL) {
-        ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Dataset pointer should not be NULL.");
-        return 0;
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Dataset pointer should not be NULL.");
     }
     if (varname==NULL) {
-        ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Varname should not be NULL.");
-        return 0;
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Varname should not be NULL.");
     }
-
-    /* The group for this set */
-    /* /groupname/varname */
+    if (arr==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Array pointer should not be NULL.");
+    }
+    if (arr->ndim > ISMRMRD_NDARRAY_MAXDIM) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Too many dimensions.");
+    }
+
+    /* /groupname/varname */
+    path = make_path(dset, varname);
+
+    /* The stored data type is kept, only the same type can replace it */
+    if (get_array_properties(dset, path, &stored_ndim, stored_dims, &stored_type) != ISMRMRD_NOERROR) {
+        free(path);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to write array.");
+    }
+    if (stored_type != arr->data_type) {
+        free(path);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Array data type does not match the stored arrays.");
+    }
+
+    /* permute the dimensions in the hdf5 file */
+    for (n=0; n<arr->ndim; n++) {
+        dims[arr->ndim-n-1] = arr->dims[n];
+    }
+    datatype = get_hdf5type_ndarray(arr->data_type);
+    status = write_element(dset, path, arr->data, datatype, arr->ndim, dims, index);
+    H5Tclose(datatype);
+    free(path);
+    if (status != ISMRMRD_NOERROR) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to write array.");
+    }
+    return ISMRMRD_NOERROR;
+}
+
+uint32_t ismrmrd_get_number_of_arrays(const ISMRMRD_Dataset *dset, const char *varname) {
+    char *path;
+    uint32_t numarrays;
+
+    if (dset==NULL) {
+        ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Dataset pointer should not be NULL.");
+        return 0;
+    }
+    if (varname==NULL) {
+        ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Varname should not be NULL.");
+        return 0;
+    }
+
+    /* The group for this set */
+    /* /groupname/varname */
     path = make_path(dset, varname);
     numarrays = get_number_of_elements(dset, path);
     free(path);
@@ -1636,6 +2186,677 @@ int ismrmrd_read_array(const ISMRMRD_Dataset *dset, const char *varname,
 }
 
 
+/* Converts the samples and appends the acquisitions in a single write */
+static int append_compact_acquisitions(const ISMRMRD_Dataset *dset, const ISMRMRD_Acquisition *acqs,
+        const uint32_t count) {
+    int status;
+    char *path;
+    hid_t datatype;
+    HDF5_CompactAcquisition *hdf5acqs;
+    uint16_t storage = dset->acquisition_storage;
+    uint16_t *samples;
+    size_t total = 0, offset = 0, len;
+    uint32_t n;
+
+    for (n = 0; n < count; n++) {
+        total += 2 * (size_t)(acqs[n].head.number_of_samples) * (size_t)(acqs[n].head.active_channels);
+    }
+    hdf5acqs = (HDF5_CompactAcquisition *) malloc(count * sizeof(HDF5_CompactAcquisition));
+    samples = (uint16_t *) malloc(total * sizeof(uint16_t) + 1);
+    if (hdf5acqs == NULL || samples == NULL) {
+        free(hdf5acqs);
+        free(samples);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to allocate acquisitions.");
+    }
+
+    for (n = 0; n < count; n++) {
+        len = 2 * (size_t)(acqs[n].head.number_of_samples) * (size_t)(acqs[n].head.active_channels);
+        hdf5acqs[n].head = acqs[n].head;
+        hdf5acqs[n].traj.len = (size_t)(acqs[n].head.number_of_samples) * (size_t)(acqs[n].head.trajectory_dimensions);
+        hdf5acqs[n].traj.p = acqs[n].traj;
+        hdf5acqs[n].data.len = len;
+        hdf5acqs[n].data.p = samples + offset;
+        if (storage == ISMRMRD_STORAGE_INT16) {
+            hdf5acqs[n].scale = encode_int16((const float *) acqs[n].data, (int16_t *)(samples + offset), len);
+        } else {
+            hdf5acqs[n].scale = encode_half((const float *) acqs[n].data, samples + offset, len);
+        }
+        offset += len;
+    }
+    swap_compact_samples(samples, total);
+
+    path = make_path(dset, "data");
+    datatype = get_hdf5type_compact_acquisition(storage);
+    status = append_elements(dset, path, hdf5acqs, datatype, 0, NULL, count);
+    H5Tclose(datatype);
+    free(path);
+    free(samples);
+    free(hdf5acqs);
+    if (status != ISMRMRD_NOERROR) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to append acquisitions.");
+    }
+
+    return ISMRMRD_NOERROR;
+}
+
+/* Sizes the buffers of acq for head and copies the trajectory read from the file into them */
+static int copy_acquisition(ISMRMRD_Acquisition *acq, const ISMRMRD_AcquisitionHeader *head, const hvl_t *traj) {
+    int status;
+
+    memcpy(&acq->head, head, sizeof(ISMRMRD_AcquisitionHeader));
+    status = ismrmrd_make_consistent_acquisition(acq);
+    if (status != ISMRMRD_NOERROR) {
+        return status;
+    }
+    /* The header stays as stored, also where the above corrects it */
+    acq->head.available_channels = head->available_channels;
+    if (traj->len != ismrmrd_size_of_acquisition_traj(acq) / sizeof(float)) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Acquisition trajectory does not match its header.");
+    }
+    if (traj->len > 0) {
+        memcpy(acq->traj, traj->p, traj->len * sizeof(float));
+    }
+    return ISMRMRD_NOERROR;
+}
+
+/* Reads the acquisitions in a single read and converts the samples back to floats */
+static int read_compact_acquisitions(const ISMRMRD_Dataset *dset, const uint32_t first, const uint32_t count,
+        ISMRMRD_Acquisition *acqs) {
+    int status = ISMRMRD_NOERROR;
+    char *path;
+    hid_t datatype;
+    HDF5_CompactAcquisition *hdf5acqs;
+    uint16_t storage = dset->acquisition_storage;
+    float *data;
+    uint32_t n;
+
+    hdf5acqs = (HDF5_CompactAcquisition *) malloc(count * sizeof(HDF5_CompactAcquisition));
+    if (hdf5acqs == NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to allocate acquisitions.");
+    }
+
+    path = make_path(dset, "data");
+    datatype = get_hdf5type_compact_acquisition(storage);
+    status = read_elements(dset, path, hdf5acqs, datatype, first, count);
+    H5Tclose(datatype);
+    free(path);
+    if (status != ISMRMRD_NOERROR) {
+        free(hdf5acqs);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to read acquisitions.");
+    }
+
+    for (n = 0; n < count; n++) {
+        if (status == ISMRMRD_NOERROR) {
+            status = copy_acquisition(&acqs[n], &hdf5acqs[n].head, &hdf5acqs[n].traj);
+        }
+        if (status == ISMRMRD_NOERROR) {
+            data = (float *) acqs[n].data;
+            if (hdf5acqs[n].data.len != ismrmrd_size_of_acquisition_data(&acqs[n]) / sizeof(float)) {
+                status = ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Acquisition data does not match its header.");
+            } else if (hdf5acqs[n].data.len > 0) {
+                swap_compact_samples((uint16_t *) hdf5acqs[n].data.p, hdf5acqs[n].data.len);
+                if (storage == ISMRMRD_STORAGE_INT16) {
+                    decode_int16((const int16_t *) hdf5acqs[n].data.p, hdf5acqs[n].scale, data, hdf5acqs[n].data.len);
+                } else {
+                    decode_half((const uint16_t *) hdf5acqs[n].data.p, hdf5acqs[n].scale, data, hdf5acqs[n].data.len);
+                }
+            }
+        }
+        free(hdf5acqs[n].traj.p);
+        free(hdf5acqs[n].data.p);
+    }
+    free(hdf5acqs);
+
+    return status;
+}
+
+/*******************/
+/* Batched access  */
+/*******************/
+int ismrmrd_append_acquisitions(const ISMRMRD_Dataset *dset, const ISMRMRD_Acquisition *acqs, const uint32_t count) {
+    int status;
+    char *path;
+    hid_t datatype;
+    HDF5_Acquisition *hdf5acqs;
+    uint32_t n;
+
+    if (dset==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Dataset pointer should not be NULL.");
+    }
+    if (count == 0) {
+        return ISMRMRD_NOERROR;
+    }
+    if (acqs==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Acquisition pointer should not be NULL.");
+    }
+    if (dset->acquisition_storage != ISMRMRD_STORAGE_FLOAT) {
+        return append_compact_acquisitions(dset, acqs, count);
+    }
+
+    hdf5acqs = (HDF5_Acquisition *) malloc(count * sizeof(HDF5_Acquisition));
+    if (hdf5acqs == NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to allocate acquisitions.");
+    }
+    for (n = 0; n < count; n++) {
+        hdf5acqs[n].head = acqs[n].head;
+        hdf5acqs[n].traj.len = (size_t)(acqs[n].head.number_of_samples) * (size_t)(acqs[n].head.trajectory_dimensions);
+        hdf5acqs[n].traj.p = acqs[n].traj;
+        hdf5acqs[n].data.len = 2 * (size_t)(acqs[n].head.number_of_samples) * (size_t)(acqs[n].head.active_channels);
+        hdf5acqs[n].data.p = acqs[n].data;
+    }
+
+    path = make_path(dset, "data");
+    datatype = get_hdf5type_acquisition();
+    status = append_elements(dset, path, hdf5acqs, datatype, 0, NULL, count);
+    H5Tclose(datatype);
+    free(path);
+    free(hdf5acqs);
+    if (status != ISMRMRD_NOERROR) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to append acquisitions.");
+    }
+
+    return ISMRMRD_NOERROR;
+}
+
+int ismrmrd_read_acquisitions(const ISMRMRD_Dataset *dset, const uint32_t first, const uint32_t count,
+        ISMRMRD_Acquisition *acqs) {
+    int status;
+    char *path;
+    hid_t datatype;
+    HDF5_Acquisition *hdf5acqs;
+    uint32_t n;
+
+    if (dset==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Dataset pointer should not be NULL.");
+    }
+    if (count == 0) {
+        return ISMRMRD_NOERROR;
+    }
+    if (acqs==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Acquisition pointer should not be NULL.");
+    }
+    if (dset->acquisition_storage != ISMRMRD_STORAGE_FLOAT) {
+        return read_compact_acquisitions(dset, first, count, acqs);
+    }
+
+    hdf5acqs = (HDF5_Acquisition *) malloc(count * sizeof(HDF5_Acquisition));
+    if (hdf5acqs == NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to allocate acquisitions.");
+    }
+
+    path = make_path(dset, "data");
+    datatype = get_hdf5type_acquisition();
+    status = read_elements(dset, path, hdf5acqs, datatype, first, count);
+    H5Tclose(datatype);
+    free(path);
+    if (status != ISMRMRD_NOERROR) {
+        free(hdf5acqs);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to read acquisitions.");
+    }
+
+    /* Copied into the buffers of the acquisitions, which are reused when they are large enough */
+    for (n = 0; n < count; n++) {
+        if (status == ISMRMRD_NOERROR) {
+            status = copy_acquisition(&acqs[n], &hdf5acqs[n].head, &hdf5acqs[n].traj);
+        }
+        if (status == ISMRMRD_NOERROR) {
+            if (hdf5acqs[n].data.len != ismrmrd_size_of_acquisition_data(&acqs[n]) / sizeof(float)) {
+                status = ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Acquisition data does not match its header.");
+            } else if (hdf5acqs[n].data.len > 0) {
+                memcpy(acqs[n].data, hdf5acqs[n].data.p, hdf5acqs[n].data.len * sizeof(float));
+            }
+        }
+        free(hdf5acqs[n].traj.p);
+        free(hdf5acqs[n].data.p);
+    }
+    free(hdf5acqs);
+
+    return status;
+}
+
+int ismrmrd_read_acquisition_headers(const ISMRMRD_Dataset *dset, const uint32_t first, const uint32_t count,
+        ISMRMRD_AcquisitionHeader *heads) {
+    int status;
+    char *path;
+    hid_t datatype, headtype;
+
+    if (dset==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Dataset pointer should not be NULL.");
+    }
+    if (count == 0) {
+        return ISMRMRD_NOERROR;
+    }
+    if (heads==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Header pointer should not be NULL.");
+    }
+
+    /* Only the head member of the stored records, the samples are not read */
+    datatype = H5Tcreate(H5T_COMPOUND, sizeof(ISMRMRD_AcquisitionHeader));
+    headtype = get_hdf5type_acquisitionheader();
+    H5Tinsert(datatype, "head", 0, headtype);
+    H5Tclose(headtype);
+
+    path = make_path(dset, "data");
+    status = read_elements(dset, path, heads, datatype, first, count);
+    H5Tclose(datatype);
+    free(path);
+    if (status != ISMRMRD_NOERROR) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to read acquisition headers.");
+    }
+
+    return ISMRMRD_NOERROR;
+}
+
+int ismrmrd_append_waveforms(const ISMRMRD_Dataset *dset, const ISMRMRD_Waveform *wavs, const uint32_t count) {
+    int status;
+    char *path;
+    hid_t datatype;
+    HDF5_Waveform *hdf5wavs;
+    uint32_t n;
+
+    if (dset==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Dataset pointer should not be NULL.");
+    }
+    if (count == 0) {
+        return ISMRMRD_NOERROR;
+    }
+    if (wavs==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Waveform pointer should not be NULL.");
+    }
+
+    hdf5wavs = (HDF5_Waveform *) malloc(count * sizeof(HDF5_Waveform));
+    if (hdf5wavs == NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to allocate waveforms.");
+    }
+    for (n = 0; n < count; n++) {
+        hdf5wavs[n].head = wavs[n].head;
+        hdf5wavs[n].data.len = (size_t)(wavs[n].head.number_of_samples) * (size_t)(wavs[n].head.channels);
+        hdf5wavs[n].data.p = wavs[n].data;
+    }
+
+    path = make_path(dset, "waveforms");
+    datatype = get_hdf5type_waveform();
+    status = append_elements(dset, path, hdf5wavs, datatype, 0, NULL, count);
+    H5Tclose(datatype);
+    free(path);
+    free(hdf5wavs);
+    if (status != ISMRMRD_NOERROR) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to append waveforms.");
+    }
+
+    return ISMRMRD_NOERROR;
+}
+
+int ismrmrd_read_waveforms(const ISMRMRD_Dataset *dset, const uint32_t first, const uint32_t count,
+        ISMRMRD_Waveform *wavs) {
+    int status;
+    char *path;
+    hid_t datatype;
+    HDF5_Waveform *hdf5wavs;
+    uint32_t n;
+
+    if (dset==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Dataset pointer should not be NULL.");
+    }
+    if (count == 0) {
+        return ISMRMRD_NOERROR;
+    }
+    if (wavs==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Waveform pointer should not be NULL.");
+    }
+
+    hdf5wavs = (HDF5_Waveform *) malloc(count * sizeof(HDF5_Waveform));
+    if (hdf5wavs == NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to allocate waveforms.");
+    }
+
+    path = make_path(dset, "waveforms");
+    datatype = get_hdf5type_waveform();
+    status = read_elements(dset, path, hdf5wavs, datatype, first, count);
+    H5Tclose(datatype);
+    free(path);
+    if (status != ISMRMRD_NOERROR) {
+        free(hdf5wavs);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to read waveforms.");
+    }
+
+    for (n = 0; n < count; n++) {
+        memcpy(&wavs[n].head, &hdf5wavs[n].head, sizeof(ISMRMRD_WaveformHeader));
+        ismrmrd_make_consistent_waveform(&wavs[n]);
+        memcpy(wavs[n].data, hdf5wavs[n].data.p, ismrmrd_size_of_waveform_data(&wavs[n]));
+        free(hdf5wavs[n].data.p);
+    }
+    free(hdf5wavs);
+
+    return ISMRMRD_NOERROR;
+}
+
+int ismrmrd_append_images(const ISMRMRD_Dataset *dset, const char *varname, const ISMRMRD_Image *ims,
+        const uint32_t count) {
+    int status = ISMRMRD_NOERROR;
+    hid_t datatype;
+    char *path, *headerpath, *attrpath, *datapath;
+    ISMRMRD_ImageHeader *heads;
+    char **attributes;
+    char *data;
+    size_t dims[4], data_size;
+    uint32_t n;
+
+    if (dset==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Dataset pointer should not be NULL.");
+    }
+    if (varname==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Varname should not be NULL.");
+    }
+    if (count == 0) {
+        return ISMRMRD_NOERROR;
+    }
+    if (ims==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Image pointer should not be NULL.");
+    }
+
+    /* The data of all images is written as one block */
+    data_size = ismrmrd_size_of_image_data(&ims[0]);
+    for (n = 1; n < count; n++) {
+        if (ims[n].head.data_type != ims[0].head.data_type ||
+            ims[n].head.channels != ims[0].head.channels ||
+            memcmp(ims[n].head.matrix_size, ims[0].head.matrix_size, sizeof(ims[0].head.matrix_size)) != 0) {
+            return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Images appended together must have the same size and type.");
+        }
+    }
+
+    heads = (ISMRMRD_ImageHeader *) malloc(count * sizeof(ISMRMRD_ImageHeader));
+    attributes = (char **) malloc(count * sizeof(char *));
+    data = (char *) malloc(count * data_size + 1);
+    if (heads == NULL || attributes == NULL || data == NULL) {
+        free(heads);
+        free(attributes);
+        free(data);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to allocate images.");
+    }
+    for (n = 0; n < count; n++) {
+        heads[n] = ims[n].head;
+        attributes[n] = ims[n].attribute_string;
+        memcpy(data + n * data_size, ims[n].data, data_size);
+    }
+
+    /* /groupname/varname */
+    path = make_path(dset, varname);
+    create_link(dset, path);
+
+    headerpath = append_to_path(dset, path, "header");
+    datatype = get_hdf5type_imageheader();
+    status = append_elements(dset, headerpath, heads, datatype, 0, NULL, count);
+    H5Tclose(datatype);
+    free(headerpath);
+
+    if (status == ISMRMRD_NOERROR) {
+        attrpath = append_to_path(dset, path, "attributes");
+        datatype = get_hdf5type_image_attribute_string();
+        status = append_elements(dset, attrpath, attributes, datatype, 0, NULL, count);
+        H5Tclose(datatype);
+        free(attrpath);
+    }
+
+    if (status == ISMRMRD_NOERROR) {
+        datapath = append_to_path(dset, path, "data");
+        datatype = get_hdf5type_ndarray(ims[0].head.data_type);
+        /* permute the dimensions in the hdf5 file */
+        dims[3] = ims[0].head.matrix_size[0];
+        dims[2] = ims[0].head.matrix_size[1];
+        dims[1] = ims[0].head.matrix_size[2];
+        dims[0] = ims[0].head.channels;
+        status = append_elements(dset, datapath, data, datatype, 4, dims, count);
+        H5Tclose(datatype);
+        free(datapath);
+    }
+
+    free(path);
+    free(heads);
+    free(attributes);
+    free(data);
+    if (status != ISMRMRD_NOERROR) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to append images.");
+    }
+
+    return ISMRMRD_NOERROR;
+}
+
+int ismrmrd_read_images(const ISMRMRD_Dataset *dset, const char *varname, const uint32_t first,
+        const uint32_t count, ISMRMRD_Image *ims) {
+    int status;
+    hid_t datatype;
+    char *path, *headerpath, *attrpath, *datapath;
+    ISMRMRD_ImageHeader *heads;
+    char **attributes;
+    char *data;
+    size_t data_size, dims[ISMRMRD_NDARRAY_MAXDIM];
+    uint16_t ndim, data_type;
+    uint32_t n;
+
+    if (dset==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Dataset pointer should not be NULL.");
+    }
+    if (varname==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Varname should not be NULL.");
+    }
+    if (count == 0) {
+        return ISMRMRD_NOERROR;
+    }
+    if (ims==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Image pointer should not be NULL.");
+    }
+
+    heads = (ISMRMRD_ImageHeader *) malloc(count * sizeof(ISMRMRD_ImageHeader));
+    attributes = (char **) malloc(count * sizeof(char *));
+    if (heads == NULL || attributes == NULL) {
+        free(heads);
+        free(attributes);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to allocate images.");
+    }
+
+    /* /groupname/varname */
+    path = make_path(dset, varname);
+
+    headerpath = append_to_path(dset, path, "header");
+    datatype = get_hdf5type_imageheader();
+    status = read_elements(dset, headerpath, heads, datatype, first, count);
+    H5Tclose(datatype);
+    free(headerpath);
+    if (status != ISMRMRD_NOERROR) {
+        free(path);
+        free(heads);
+        free(attributes);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to read image headers.");
+    }
+
+    /* The data is read as one block, which only fits if every header describes the stored images */
+    datapath = append_to_path(dset, path, "data");
+    status = get_array_properties(dset, datapath, &ndim, dims, &data_type);
+    if (status == ISMRMRD_NOERROR && (ndim != 4 || dims[0] != heads[0].matrix_size[0] ||
+        dims[1] != heads[0].matrix_size[1] || dims[2] != heads[0].matrix_size[2] || dims[3] != heads[0].channels)) {
+        status = ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Image headers do not match the stored image data.");
+    }
+    for (n = 1; status == ISMRMRD_NOERROR && n < count; n++) {
+        if (heads[n].data_type != heads[0].data_type || heads[n].channels != heads[0].channels ||
+            memcmp(heads[n].matrix_size, heads[0].matrix_size, sizeof(heads[0].matrix_size)) != 0) {
+            status = ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Image headers do not match the stored image data.");
+        }
+    }
+
+    /* Allocate the memory for the attribute strings and the data */
+    for (n = 0; status == ISMRMRD_NOERROR && n < count; n++) {
+        ims[n].head = heads[n];
+        status = ismrmrd_make_consistent_image(&ims[n]);
+    }
+    free(heads);
+    if (status != ISMRMRD_NOERROR) {
+        free(datapath);
+        free(path);
+        free(attributes);
+        return status;
+    }
+
+    attrpath = append_to_path(dset, path, "attributes");
+    datatype = get_hdf5type_image_attribute_string();
+    status = read_elements(dset, attrpath, attributes, datatype, first, count);
+    H5Tclose(datatype);
+    free(attrpath);
+    free(path);
+    if (status != ISMRMRD_NOERROR) {
+        free(datapath);
+        free(attributes);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to read image attribute strings.");
+    }
+    for (n = 0; n < count; n++) {
+        if (ims[n].head.attribute_string_len > (attributes[n] ? strlen(attributes[n]) : 0)) {
+            status = ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Image attribute string is shorter than its header says.");
+        } else {
+            memcpy(ims[n].attribute_string, attributes[n], ismrmrd_size_of_image_attribute_string(&ims[n]));
+        }
+        free(attributes[n]);
+    }
+    free(attributes);
+    if (status != ISMRMRD_NOERROR) {
+        free(datapath);
+        return status;
+    }
+
+    data_size = ismrmrd_size_of_image_data(&ims[0]);
+    data = (char *) malloc(count * data_size + 1);
+    if (data == NULL) {
+        free(datapath);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to allocate image data.");
+    }
+    datatype = get_hdf5type_ndarray(ims[0].head.data_type);
+    status = read_elements(dset, datapath, data, datatype, first, count);
+    H5Tclose(datatype);
+    free(datapath);
+    if (status != ISMRMRD_NOERROR) {
+        free(data);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to read image data.");
+    }
+    for (n = 0; n < count; n++) {
+        memcpy(ims[n].data, data + n * data_size, data_size);
+    }
+    free(data);
+
+    return ISMRMRD_NOERROR;
+}
+
+int ismrmrd_append_arrays(const ISMRMRD_Dataset *dset, const char *varname, const ISMRMRD_NDArray *arrs,
+        const uint32_t count) {
+    int status;
+    hid_t datatype;
+    size_t dims[ISMRMRD_NDARRAY_MAXDIM], data_size;
+    char *path, *data;
+    uint32_t n;
+    int d;
+
+    if (dset==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Dataset pointer should not be NULL.");
+    }
+    if (varname==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Varname should not be NULL.");
+    }
+    if (count == 0) {
+        return ISMRMRD_NOERROR;
+    }
+    if (arrs==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Array pointer should not be NULL.");
+    }
+
+    for (n = 1; n < count; n++) {
+        if (arrs[n].data_type != arrs[0].data_type || arrs[n].ndim != arrs[0].ndim ||
+            memcmp(arrs[n].dims, arrs[0].dims, arrs[0].ndim * sizeof(size_t)) != 0) {
+            return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Arrays appended together must have the same size and type.");
+        }
+    }
+
+    data_size = ismrmrd_size_of_ndarray_data(&arrs[0]);
+    data = (char *) malloc(count * data_size + 1);
+    if (data == NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to allocate arrays.");
+    }
+    for (n = 0; n < count; n++) {
+        memcpy(data + n * data_size, arrs[n].data, data_size);
+    }
+
+    /* permute the dimensions in the hdf5 file */
+    for (d = 0; d < arrs[0].ndim; d++) {
+        dims[arrs[0].ndim - d - 1] = arrs[0].dims[d];
+    }
+
+    path = make_path(dset, varname);
+    datatype = get_hdf5type_ndarray(arrs[0].data_type);
+    status = append_elements(dset, path, data, datatype, arrs[0].ndim, dims, count);
+    H5Tclose(datatype);
+    free(path);
+    free(data);
+    if (status != ISMRMRD_NOERROR) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to append arrays.");
+    }
+
+    return ISMRMRD_NOERROR;
+}
+
+int ismrmrd_read_arrays(const ISMRMRD_Dataset *dset, const char *varname, const uint32_t first,
+        const uint32_t count, ISMRMRD_NDArray *arrs) {
+    int status;
+    hid_t datatype;
+    uint16_t ndim, data_type;
+    size_t dims[ISMRMRD_NDARRAY_MAXDIM], data_size;
+    char *path, *data;
+    uint32_t n;
+
+    if (dset==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Dataset pointer should not be NULL.");
+    }
+    if (varname==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Varname should not be NULL.");
+    }
+    if (count == 0) {
+        return ISMRMRD_NOERROR;
+    }
+    if (arrs==NULL) {
+        return ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Array pointer should not be NULL.");
+    }
+
+    path = make_path(dset, varname);
+    if (get_array_properties(dset, path, &ndim, dims, &data_type) != ISMRMRD_NOERROR) {
+        free(path);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to read array properties.");
+    }
+    for (n = 0; n < count; n++) {
+        arrs[n].data_type = data_type;
+        arrs[n].ndim = ndim;
+        memcpy(arrs[n].dims, dims, sizeof(dims));
+        ismrmrd_make_consistent_ndarray(&arrs[n]);
+    }
+
+    data_size = ismrmrd_size_of_ndarray_data(&arrs[0]);
+    data = (char *) malloc(count * data_size + 1);
+    if (data == NULL) {
+        free(path);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_MEMORYERROR, "Failed to allocate arrays.");
+    }
+    datatype = get_hdf5type_ndarray(data_type);
+    status = read_elements(dset, path, data, datatype, first, count);
+    H5Tclose(datatype);
+    free(path);
+    if (status != ISMRMRD_NOERROR) {
+        free(data);
+        return ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "Failed to read arrays.");
+    }
+    for (n = 0; n < count; n++) {
+        memcpy(arrs[n].data, data + n * data_size, data_size);
+    }
+    free(data);
+
+    return ISMRMRD_NOERROR;
+}
+
+
 #ifdef __cplusplus
 } /* extern "C" */
 } /* ISMRMRD namespace */
@@ -1,113 +1,1403 @@
 #include "ismrmrd/dataset.h"
+#include "ismrmrd/xml.h"
 
 // for memcpy and free in older compilers
 #include <string.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <sstream>
 #include <stdexcept>
 
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
 namespace ISMRMRD {
+
+namespace {
+
+herr_t collect_link_name(hid_t group, const char *name, const H5L_info_t *info, void *op_data)
+{
+    (void)group;
+    (void)info;
+    static_cast<std::vector<std::string> *>(op_data)->push_back(name);
+    return 0;
+}
+
+// Walks the groups below an ISMRMRD group. Image variables are groups with
+// a header and a data dataset, array variables are plain datasets.
+void find_variables(hid_t group, const std::string &prefix, bool toplevel,
+                    std::vector<std::string> &images, std::vector<std::string> &arrays)
+{
+    std::vector<std::string> names;
+    hsize_t idx = 0;
+    if (H5Literate(group, H5_INDEX_NAME, H5_ITER_INC, &idx, collect_link_name, &names) < 0) {
+        throw std::runtime_error("Failed to iterate over HDF5 group.");
+    }
+
+    for (size_t n = 0; n < names.size(); n++) {
+        // The acquisitions, waveforms and header of the dataset itself
+        if (toplevel && (names[n] == "data" || names[n] == "waveforms" || names[n] == "xml")) {
+            continue;
+        }
+        hid_t obj = H5Oopen(group, names[n].c_str(), H5P_DEFAULT);
+        if (obj < 0) {
+            continue;
+        }
+        H5I_type_t type = H5Iget_type(obj);
+        if (type == H5I_DATASET) {
+            arrays.push_back(prefix + names[n]);
+        } else if (type == H5I_GROUP) {
+            if (H5Lexists(obj, "header", H5P_DEFAULT) > 0 && H5Lexists(obj, "data", H5P_DEFAULT) > 0) {
+                images.push_back(prefix + names[n]);
+            } else {
+                find_variables(obj, prefix + names[n] + "/", false, images, arrays);
+            }
+        }
+        H5Oclose(obj);
+    }
+}
+
+// Collects the paths of all datasets below a group
+void find_datasets(hid_t group, const std::string &prefix, std::vector<std::string> &datasets)
+{
+    std::vector<std::string> names;
+    hsize_t idx = 0;
+    if (H5Literate(group, H5_INDEX_NAME, H5_ITER_INC, &idx, collect_link_name, &names) < 0) {
+        throw std::runtime_error("Failed to iterate over HDF5 group.");
+    }
+
+    for (size_t n = 0; n < names.size(); n++) {
+        hid_t obj = H5Oopen(group, names[n].c_str(), H5P_DEFAULT);
+        if (obj < 0) {
+            continue;
+        }
+        H5I_type_t type = H5Iget_type(obj);
+        if (type == H5I_DATASET) {
+            datasets.push_back(prefix + names[n]);
+        } else if (type == H5I_GROUP) {
+            find_datasets(obj, prefix + names[n] + "/", datasets);
+        }
+        H5Oclose(obj);
+    }
+}
+
+// Closes an HDF5 identifier when it goes out of scope
+class HDF5Handle {
+public:
+    HDF5Handle(hid_t id, herr_t (*close)(hid_t)) : id_(id), close_(close) {}
+    ~HDF5Handle() {
+        if (id_ >= 0) {
+            close_(id_);
+        }
+    }
+    operator hid_t() const { return id_; }
+
+private:
+    HDF5Handle(const HDF5Handle &);
+    HDF5Handle &operator=(const HDF5Handle &);
+
+    hid_t id_;
+    herr_t (*close_)(hid_t);
+};
+
+// One dataset of the virtual dataset and the source files it is mapped from
+struct VirtualVariable {
+    hid_t type;
+    std::vector<hsize_t> dims;
+    std::vector<size_t> sources;
+    std::vector<hsize_t> counts;
+};
+
+// The datasets of a group in several files, stacked along the first dimension
+// as for a virtual dataset or a merge: which files hold how many elements of
+// what. Every dataset has to have the same type and trailing dimensions in all
+// files it appears in. The files are kept open until it goes out of scope.
+class StackedSources {
+public:
+    StackedSources(const std::vector<std::string> &sources, const std::string &group);
+    ~StackedSources() { close(); }
+
+    // Copies the header of the first file that has one
+    void copyHeader(hid_t output, const std::string &group) const;
+
+    const std::vector<std::string> &sources;
+    std::vector<hid_t> files;
+    // The datasets in the order they were first found
+    std::vector<std::string> order;
+    std::map<std::string, VirtualVariable> variables;
+
+private:
+    StackedSources(const StackedSources &);
+    StackedSources &operator=(const StackedSources &);
+
+    void add(size_t i, const std::string &group, const std::string &name);
+    void close();
+};
+
+StackedSources::StackedSources(const std::vector<std::string> &sources, const std::string &group)
+    : sources(sources)
+{
+    try {
+        for (size_t i = 0; i < sources.size(); i++) {
+            hid_t file = H5Fopen(sources[i].c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+            if (file < 0) {
+                throw std::runtime_error("Failed to open " + sources[i]);
+            }
+            files.push_back(file);
+            if (H5Lexists(file, group.c_str(), H5P_DEFAULT) <= 0) {
+                throw std::runtime_error("Group " + group + " not found in " + sources[i]);
+            }
+
+            std::vector<std::string> datasets;
+            {
+                HDF5Handle gid(H5Gopen2(file, group.c_str(), H5P_DEFAULT), H5Gclose);
+                if (gid < 0) {
+                    throw std::runtime_error("Failed to open group " + group + " in " + sources[i]);
+                }
+                find_datasets(gid, "", datasets);
+            }
+            for (size_t n = 0; n < datasets.size(); n++) {
+                // The header is copied from the first file
+                if (datasets[n] != "xml") {
+                    add(i, group, datasets[n]);
+                }
+            }
+        }
+    } catch (...) {
+        close();
+        throw;
+    }
+}
+
+void StackedSources::add(size_t i, const std::string &group, const std::string &name)
+{
+    std::string path = group + "/" + name;
+    HDF5Handle dataset(H5Dopen2(files[i], path.c_str(), H5P_DEFAULT), H5Dclose);
+    if (dataset < 0) {
+        throw std::runtime_error("Failed to open " + path + " in " + sources[i]);
+    }
+    HDF5Handle space(H5Dget_space(dataset), H5Sclose);
+    int rank = space < 0 ? -1 : H5Sget_simple_extent_ndims(space);
+    if (rank == 0) {
+        throw std::runtime_error("Dataset " + path + " in " + sources[i] + " is not an array of elements.");
+    }
+    std::vector<hsize_t> dims(rank > 0 ? rank : 1, 0);
+    if (rank < 0 || H5Sget_simple_extent_dims(space, &dims[0], NULL) < 0) {
+        throw std::runtime_error("Failed to read the extent of " + path + " in " + sources[i]);
+    }
+    // Kept by the variable below, or closed after the comparison
+    hid_t type = H5Dget_type(dataset);
+    if (type < 0) {
+        throw std::runtime_error("Failed to read the type of " + path + " in " + sources[i]);
+    }
+
+    std::map<std::string, VirtualVariable>::iterator it = variables.find(name);
+    if (it == variables.end()) {
+        VirtualVariable v;
+        v.type = type;
+        v.dims = dims;
+        it = variables.insert(std::make_pair(name, v)).first;
+        order.push_back(name);
+    } else {
+        VirtualVariable &v = it->second;
+        // Elements are stacked along the first dimension, everything else has to match
+        bool same = H5Tequal(type, v.type) > 0 && dims.size() == v.dims.size();
+        for (size_t d = 1; same && d < dims.size(); d++) {
+            same = dims[d] == v.dims[d];
+        }
+        H5Tclose(type);
+        if (!same) {
+            throw std::runtime_error("Variable " + name + " in " + sources[i] + " does not match the previous files.");
+        }
+    }
+    if (dims[0] > 0) {
+        it->second.sources.push_back(i);
+        it->second.counts.push_back(dims[0]);
+    }
+}
+
+void StackedSources::copyHeader(hid_t output, const std::string &group) const
+{
+    std::string xml = group + "/xml";
+    for (size_t i = 0; i < files.size(); i++) {
+        if (H5Lexists(files[i], xml.c_str(), H5P_DEFAULT) > 0) {
+            if (H5Ocopy(files[i], xml.c_str(), output, xml.c_str(), H5P_DEFAULT, H5P_DEFAULT) < 0) {
+                throw std::runtime_error("Failed to copy the header from " + sources[i]);
+            }
+            return;
+        }
+    }
+}
+
+void StackedSources::close()
+{
+    for (size_t n = 0; n < files.size(); n++) {
+        H5Fclose(files[n]);
+    }
+    files.clear();
+    std::map<std::string, VirtualVariable>::iterator it;
+    for (it = variables.begin(); it != variables.end(); ++it) {
+        H5Tclose(it->second.type);
+    }
+    variables.clear();
+}
+
+// True when both names refer to the same existing file
+bool same_file(const std::string &a, const std::string &b)
+{
+#ifdef _WIN32
+    char full_a[_MAX_PATH], full_b[_MAX_PATH];
+    return _fullpath(full_a, a.c_str(), _MAX_PATH) && _fullpath(full_b, b.c_str(), _MAX_PATH) &&
+           _stricmp(full_a, full_b) == 0;
+#else
+    struct stat stat_a, stat_b;
+    return stat(a.c_str(), &stat_a) == 0 && stat(b.c_str(), &stat_b) == 0 && stat_a.st_dev == stat_b.st_dev &&
+           stat_a.st_ino == stat_b.st_ino;
+#endif
+}
+
+// A file created for the result of a call. It is removed again unless keep() is
+// reached, so a failed call does not leave a partial file behind.
+class OutputFile {
+public:
+    explicit OutputFile(const std::string &filename)
+        : filename_(filename), id_(H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT))
+    {
+        if (id_ < 0) {
+            throw std::runtime_error("Failed to create " + filename);
+        }
+    }
+    ~OutputFile() {
+        if (id_ >= 0) {
+            H5Fclose(id_);
+            std::remove(filename_.c_str());
+        }
+    }
+    operator hid_t() const { return id_; }
+
+    void keep() {
+        herr_t status = H5Fclose(id_);
+        id_ = -1;
+        if (status < 0) {
+            std::remove(filename_.c_str());
+            throw std::runtime_error("Failed to write " + filename_);
+        }
+    }
+
+private:
+    OutputFile(const OutputFile &);
+    OutputFile &operator=(const OutputFile &);
+
+    std::string filename_;
+    hid_t id_;
+};
+
+herr_t reclaim_vlen(hid_t type, hid_t space, void *buffer)
+{
+#if H5_VERSION_GE(1, 12, 0)
+    return H5Treclaim(type, space, H5P_DEFAULT, buffer);
+#else
+    return H5Dvlen_reclaim(type, space, H5P_DEFAULT, buffer);
+#endif
+}
+
+bool has_vlen_data(hid_t type)
+{
+    return H5Tdetect_class(type, H5T_VLEN) > 0 || H5Tis_variable_str(type) > 0;
+}
+
+// Copies count elements along the first dimension by reading and writing them
+// in batches of about buffer_size bytes, made of whole chunks of the source
+// where they fit. The memory type is the native version of the file type, so
+// no values are converted.
+void copy_elements(hid_t source, hid_t destination, hsize_t source_first, hsize_t destination_first,
+                   hsize_t count, size_t buffer_size)
+{
+    if (count == 0) {
+        return;
+    }
+    HDF5Handle file_type(H5Dget_type(source), H5Tclose);
+    HDF5Handle mem_type(H5Tget_native_type(file_type, H5T_DIR_ASCEND), H5Tclose);
+    HDF5Handle source_space(H5Dget_space(source), H5Sclose);
+    HDF5Handle destination_space(H5Dget_space(destination), H5Sclose);
+
+    int rank = H5Sget_simple_extent_ndims(source_space);
+    std::vector<hsize_t> block(rank);
+    H5Sget_simple_extent_dims(source_space, &block[0], NULL);
+
+    bool has_vlen = has_vlen_data(mem_type);
+    hsize_t element_size = H5Tget_size(mem_type);
+    for (int n = 1; n < rank; n++) {
+        element_size *= block[n];
+    }
+
+    hsize_t chunk_elements = 1;
+    {
+        HDF5Handle dcpl(H5Dget_create_plist(source), H5Pclose);
+        if (H5Pget_layout(dcpl) == H5D_CHUNKED) {
+            std::vector<hsize_t> chunk(rank);
+            H5Pget_chunk(dcpl, rank, &chunk[0]);
+            chunk_elements = chunk[0];
+        }
+    }
+
+    // Variable length records also hold their data in memory while copying,
+    // estimated from the first chunk (at least 16 elements) rather than a pass
+    // over the whole range
+    std::vector<hsize_t> start(rank, 0);
+    hsize_t record_size = element_size;
+    if (has_vlen) {
+        block[0] = chunk_elements > 16 ? chunk_elements : 16;
+        block[0] = count < block[0] ? count : block[0];
+        start[0] = source_first;
+        H5Sselect_hyperslab(source_space, H5S_SELECT_SET, &start[0], NULL, &block[0], NULL);
+        hsize_t vlen_size = 0;
+        H5Dvlen_get_buf_size(source, mem_type, source_space, &vlen_size);
+        record_size += vlen_size / block[0];
+    }
+
+    hsize_t batch = buffer_size / (record_size > 0 ? record_size : 1);
+    if (batch > chunk_elements) {
+        batch -= batch % chunk_elements;
+    }
+    if (batch == 0) {
+        batch = 1;
+    }
+    if (batch > count) {
+        batch = count;
+    }
+    std::vector<char> buffer(static_cast<size_t>(batch * element_size));
+
+    for (hsize_t done = 0; done < count; done += batch) {
+        block[0] = count - done < batch ? count - done : batch;
+        HDF5Handle mem_space(H5Screate_simple(rank, &block[0], NULL), H5Sclose);
+        start[0] = source_first + done;
+        H5Sselect_hyperslab(source_space, H5S_SELECT_SET, &start[0], NULL, &block[0], NULL);
+        start[0] = destination_first + done;
+        H5Sselect_hyperslab(destination_space, H5S_SELECT_SET, &start[0], NULL, &block[0], NULL);
+
+        if (H5Dread(source, mem_type, mem_space, source_space, H5P_DEFAULT, &buffer[0]) < 0) {
+            throw std::runtime_error("Failed to read from dataset.");
+        }
+        herr_t status = H5Dwrite(destination, mem_type, mem_space, destination_space, H5P_DEFAULT, &buffer[0]);
+        if (has_vlen) {
+            reclaim_vlen(mem_type, mem_space, &buffer[0]);
+        }
+        if (status < 0) {
+            throw std::runtime_error("Failed to write to dataset.");
+        }
+    }
+}
+
+// Whether chunks of the source can be written to the destination as they are
+bool same_chunk_storage(hid_t source, hid_t destination)
+{
+    HDF5Handle source_dcpl(H5Dget_create_plist(source), H5Pclose);
+    HDF5Handle destination_dcpl(H5Dget_create_plist(destination), H5Pclose);
+    if (H5Pget_layout(source_dcpl) != H5D_CHUNKED || H5Pget_layout(destination_dcpl) != H5D_CHUNKED) {
+        return false;
+    }
+
+    int rank = H5Pget_chunk(source_dcpl, 0, NULL);
+    if (rank <= 0 || rank != H5Pget_chunk(destination_dcpl, 0, NULL)) {
+        return false;
+    }
+    std::vector<hsize_t> source_chunk(rank), destination_chunk(rank);
+    H5Pget_chunk(source_dcpl, rank, &source_chunk[0]);
+    H5Pget_chunk(destination_dcpl, rank, &destination_chunk[0]);
+    if (source_chunk != destination_chunk) {
+        return false;
+    }
+
+    int nfilters = H5Pget_nfilters(source_dcpl);
+    if (nfilters != H5Pget_nfilters(destination_dcpl)) {
+        return false;
+    }
+    for (int n = 0; n < nfilters; n++) {
+        unsigned int flags[2], values[2][8];
+        size_t nvalues[2] = {8, 8};
+        H5Z_filter_t source_filter =
+            H5Pget_filter2(source_dcpl, n, &flags[0], &nvalues[0], values[0], 0, NULL, NULL);
+        H5Z_filter_t destination_filter =
+            H5Pget_filter2(destination_dcpl, n, &flags[1], &nvalues[1], values[1], 0, NULL, NULL);
+        if (source_filter != destination_filter || nvalues[0] != nvalues[1]) {
+            return false;
+        }
+        for (size_t v = 0; v < nvalues[0] && v < 8; v++) {
+            if (values[0][v] != values[1][v]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Copies count elements along the first dimension. Whole chunks are moved as
+// stored, without running the filters or converting the data, as long as
+// both ends are aligned to the chunk boundaries. Variable length records
+// point into the global heap of their file and are always copied as elements.
+void copy_range(hid_t source, hid_t destination, hsize_t source_first, hsize_t destination_first,
+                hsize_t count, size_t buffer_size)
+{
+    hsize_t done = 0;
+#if H5_VERSION_GE(1, 10, 3)
+    HDF5Handle type(H5Dget_type(source), H5Tclose);
+    if (!has_vlen_data(type) && same_chunk_storage(source, destination)) {
+        HDF5Handle dcpl(H5Dget_create_plist(source), H5Pclose);
+        int rank = H5Pget_chunk(dcpl, 0, NULL);
+        std::vector<hsize_t> chunk(rank);
+        H5Pget_chunk(dcpl, rank, &chunk[0]);
+
+        if (source_first % chunk[0] == 0 && destination_first % chunk[0] == 0) {
+            std::vector<hsize_t> source_offset(rank, 0), destination_offset(rank, 0);
+            std::vector<char> buffer;
+            for (; done + chunk[0] <= count; done += chunk[0]) {
+                source_offset[0] = source_first + done;
+                destination_offset[0] = destination_first + done;
+                hsize_t size = 0;
+                if (H5Dget_chunk_storage_size(source, &source_offset[0], &size) < 0 || size == 0) {
+                    // Never written, leave it to the fill value
+                    continue;
+                }
+                buffer.resize(static_cast<size_t>(size));
+                uint32_t filter_mask = 0;
+                if (H5Dread_chunk(source, H5P_DEFAULT, &source_offset[0], &filter_mask, &buffer[0]) < 0 ||
+                    H5Dwrite_chunk(destination, H5P_DEFAULT, filter_mask, &destination_offset[0],
+                                   static_cast<size_t>(size), &buffer[0]) < 0) {
+                    throw std::runtime_error("Failed to copy chunk.");
+                }
+            }
+        }
+    }
+#endif
+    // Whatever does not fill a whole chunk
+    copy_elements(source, destination, source_first + done, destination_first + done, count - done, buffer_size);
+}
+
+// Copies one dataset into a new layout
+void repack_dataset(hid_t source_file, hid_t destination_file, const std::string &path,
+                    const RepackOptions &options, hid_t lcpl)
+{
+    HDF5Handle source(H5Dopen2(source_file, path.c_str(), H5P_DEFAULT), H5Dclose);
+    if (source < 0) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+    HDF5Handle file_type(H5Dget_type(source), H5Tclose);
+    HDF5Handle mem_type(H5Tget_native_type(file_type, H5T_DIR_ASCEND), H5Tclose);
+    HDF5Handle source_space(H5Dget_space(source), H5Sclose);
+
+    int rank = H5Sget_simple_extent_ndims(source_space);
+    if (rank < 1) {
+        throw std::runtime_error("Dataset " + path + " is not an array of elements.");
+    }
+    std::vector<hsize_t> dims(rank);
+    H5Sget_simple_extent_dims(source_space, &dims[0], NULL);
+
+    hsize_t element_size = H5Tget_size(mem_type);
+    for (int n = 1; n < rank; n++) {
+        element_size *= dims[n];
+    }
+
+    std::vector<hsize_t> maxdims(dims);
+    std::vector<hsize_t> chunk(dims);
+    HDF5Handle dcpl(H5Pcreate(H5P_DATASET_CREATE), H5Pclose);
+    if (options.contiguous) {
+        if (options.compression_level > 0 || options.shuffle) {
+            throw std::runtime_error("Contiguous datasets cannot be compressed.");
+        }
+        H5Pset_layout(dcpl, H5D_CONTIGUOUS);
+    } else {
+        maxdims[0] = H5S_UNLIMITED;
+        chunk[0] = options.chunk_elements;
+        if (chunk[0] == 0) {
+            // Elements are read one at a time and every read loads whole chunks,
+            // keep them small enough for that to stay cheap
+            chunk[0] = (64 * 1024) / (element_size > 0 ? element_size : 1);
+        }
+        if (dims[0] > 0 && chunk[0] > dims[0]) {
+            chunk[0] = dims[0];
+        }
+        if (chunk[0] == 0) {
+            chunk[0] = 1;
+        }
+        H5Pset_chunk(dcpl, rank, &chunk[0]);
+        if (options.shuffle) {
+            H5Pset_shuffle(dcpl);
+        }
+        if (options.compression_level > 0) {
+            H5Pset_deflate(dcpl, options.compression_level);
+        }
+    }
+
+    HDF5Handle destination_space(H5Screate_simple(rank, &dims[0], &maxdims[0]), H5Sclose);
+    HDF5Handle destination(H5Dcreate2(destination_file, path.c_str(), file_type, destination_space, lcpl, dcpl, H5P_DEFAULT),
+                           H5Dclose);
+    if (destination < 0) {
+        throw std::runtime_error("Failed to create " + path);
+    }
+
+    copy_elements(source, destination, 0, 0, dims[0], options.buffer_size);
+
+    // Check that nothing got lost on the way
+    HDF5Handle written_space(H5Dget_space(destination), H5Sclose);
+    std::vector<hsize_t> written(rank);
+    H5Sget_simple_extent_dims(written_space, &written[0], NULL);
+    if (written != dims) {
+        throw std::runtime_error("Element count of " + path + " does not match after repacking.");
+    }
+}
+
+// Sampling masks have the dimensions E1, E2, SLC, CON, PHS, REP, SET
+const size_t MASK_RANK = 7;
+// Lines along E1 packed into one element of the bitmap
+const size_t MASK_WORD_BITS = 16;
+
+std::string sampling_mask_variable(uint16_t encoding_space)
+{
+    std::ostringstream name;
+    name << "sampling_mask_" << encoding_space;
+    return name.str();
+}
+
+// Acquisitions that sample k-space, as opposed to noise, navigators and other reference data
+bool is_kspace_line(uint64_t flags)
+{
+    static const uint64_t reference[] = {
+        ISMRMRD_ACQ_IS_NOISE_MEASUREMENT, ISMRMRD_ACQ_IS_NAVIGATION_DATA, ISMRMRD_ACQ_IS_PHASECORR_DATA,
+        ISMRMRD_ACQ_IS_HPFEEDBACK_DATA, ISMRMRD_ACQ_IS_DUMMYSCAN_DATA, ISMRMRD_ACQ_IS_RTFEEDBACK_DATA,
+        ISMRMRD_ACQ_IS_SURFACECOILCORRECTIONSCAN_DATA, ISMRMRD_ACQ_IS_PHASE_STABILIZATION_REFERENCE,
+        ISMRMRD_ACQ_IS_PHASE_STABILIZATION};
+    for (size_t n = 0; n < sizeof(reference) / sizeof(reference[0]); n++) {
+        if (ismrmrd_is_flag_set(flags, reference[n])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void mask_position(const EncodingCounters &idx, size_t *pos)
+{
+    pos[0] = idx.kspace_encode_step_1;
+    pos[1] = idx.kspace_encode_step_2;
+    pos[2] = idx.slice;
+    pos[3] = idx.contrast;
+    pos[4] = idx.phase;
+    pos[5] = idx.repetition;
+    pos[6] = idx.set;
+}
+
+// Index of the bitmap element holding a line, capacity[0] is a multiple of MASK_WORD_BITS
+size_t mask_element(const size_t *pos, const size_t *capacity)
+{
+    size_t element = 0;
+    for (size_t d = MASK_RANK - 1; d > 0; d--) {
+        element = element * capacity[d] + pos[d];
+    }
+    return element * (capacity[0] / MASK_WORD_BITS) + pos[0] / MASK_WORD_BITS;
+}
+
+// Position of the first line of row r of a mask, counting rows over dims[1] to dims[MASK_RANK - 1]
+void mask_row(size_t r, const size_t *dims, size_t *pos)
+{
+    pos[0] = 0;
+    for (size_t d = 1; d < MASK_RANK; d++) {
+        pos[d] = r % dims[d];
+        r /= dims[d];
+    }
+}
+
+size_t mask_rows(const size_t *dims)
+{
+    size_t rows = 1;
+    for (size_t d = 1; d < MASK_RANK; d++) {
+        rows *= dims[d];
+    }
+    return rows;
+}
+
+// Lines along each mask dimension that the encoding limits in the header declare, 1 where there is no limit
+void declared_mask_dims(DatasetBackend *backend, uint16_t encoding_space, std::vector<size_t> &dims)
+{
+    dims.assign(MASK_RANK, 1);
+    IsmrmrdHeader header;
+    try {
+        std::string xml;
+        backend->readHeader(xml);
+        deserialize(xml.c_str(), header);
+    } catch (std::exception &) {
+        // Without a usable header the mask covers the lines seen
+        return;
+    }
+    if (encoding_space >= header.encoding.size()) {
+        return;
+    }
+    const EncodingLimits &limits = header.encoding[encoding_space].encodingLimits;
+    const Optional<Limit> *declared[MASK_RANK] = {&limits.kspace_encoding_step_1, &limits.kspace_encoding_step_2,
+                                                 &limits.slice, &limits.contrast, &limits.phase,
+                                                 &limits.repetition, &limits.set};
+    for (size_t d = 0; d < MASK_RANK; d++) {
+        if (*declared[d]) {
+            dims[d] = size_t((*declared[d])->maximum) + 1;
+        }
+    }
+}
+
+// Acquisitions per read while assembling k-space
+const uint32_t KSPACE_BATCH_HEADERS = 4096;
+const uint32_t KSPACE_BATCH_ACQUISITIONS = 128;
+
+// A line of k-space selected by readKSpace, with its position along E1, E2 and the extra dimensions
+struct KSpaceLine {
+    uint32_t index;
+    uint16_t pos[2 + ISMRMRD_NDARRAY_MAXDIM - 4];
+};
+
+uint16_t counter_value(const ISMRMRD_EncodingCounters &idx, KSpaceCounter counter)
+{
+    switch (counter) {
+    case KSPACE_AVERAGE:
+        return idx.average;
+    case KSPACE_SLICE:
+        return idx.slice;
+    case KSPACE_CONTRAST:
+        return idx.contrast;
+    case KSPACE_PHASE:
+        return idx.phase;
+    case KSPACE_REPETITION:
+        return idx.repetition;
+    case KSPACE_SET:
+        return idx.set;
+    case KSPACE_SEGMENT:
+        return idx.segment;
+    }
+    return 0;
+}
+
+void cleanup_acquisitions(std::vector<ISMRMRD_Acquisition> &acqs)
+{
+    for (size_t n = 0; n < acqs.size(); n++) {
+        ismrmrd_cleanup_acquisition(&acqs[n]);
+    }
+}
+
+// Seconds on a monotonic clock, for the flush interval
+double seconds_now()
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, now;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&now);
+    return double(now.QuadPart) / double(frequency.QuadPart);
+#else
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+#endif
+}
+
+} // namespace
+
+Mutex &getHDF5Mutex()
+{
+    // Constructed on first use, also by static objects of other translation units
+    static Mutex hdf5_mutex;
+    return hdf5_mutex;
+}
+
+FlushPolicy::FlushPolicy()
+    : elements(0)
+    , seconds(0)
+    , background(false)
+{
+}
+
+#ifndef _WIN32
+/**
+ *   Thread flushing an HDF5DatasetBackend when asked to or when its timer runs out.
+ */
+struct HDF5DatasetBackend::FlushThread {
+    FlushThread(HDF5DatasetBackend *backend, const FlushPolicy &policy);
+    ~FlushThread();
+
+    /// Counts appended elements, first throwing the error of a failed flush
+    void add(uint32_t count);
+    /// Forgets the elements counted so far before a flush by the caller, first throwing the error of a failed flush
+    void reset();
+
+    static void *main(void *arg);
+    void run();
+
+    HDF5DatasetBackend *backend;
+    FlushPolicy policy;
+    Mutex mutex;
+    Condition wake;
+    pthread_t thread;
+    uint32_t pending;
+    bool requested;
+    bool stop;
+    std::string error;
+};
+
+HDF5DatasetBackend::FlushThread::FlushThread(HDF5DatasetBackend *backend, const FlushPolicy &policy)
+    : backend(backend), policy(policy), pending(0), requested(false), stop(false)
+{
+    if (pthread_create(&thread, NULL, &FlushThread::main, this) != 0) {
+        throw std::runtime_error("Failed to start flush thread.");
+    }
+}
+
+HDF5DatasetBackend::FlushThread::~FlushThread()
+{
+    {
+        ScopedLock lock(mutex);
+        stop = true;
+        wake.signal();
+    }
+    pthread_join(thread, NULL);
+    // Nobody is left to throw it to
+    if (!error.empty()) {
+        ISMRMRD_PUSH_ERR(ISMRMRD_FILEERROR, "A background flush failed after the last append.");
+    }
+}
+
+void HDF5DatasetBackend::FlushThread::add(uint32_t count)
+{
+    ScopedLock lock(mutex);
+    if (!error.empty()) {
+        std::string message;
+        message.swap(error);
+        throw std::runtime_error(message);
+    }
+    pending += count;
+    if (policy.elements > 0 && pending >= policy.elements && !requested) {
+        requested = true;
+        wake.signal();
+    }
+}
+
+void HDF5DatasetBackend::FlushThread::reset()
+{
+    add(0);
+    ScopedLock lock(mutex);
+    pending = 0;
+    requested = false;
+}
+
+void *HDF5DatasetBackend::FlushThread::main(void *arg)
+{
+    static_cast<FlushThread *>(arg)->run();
+    return NULL;
+}
+
+void HDF5DatasetBackend::FlushThread::run()
+{
+    ScopedLock lock(mutex);
+    while (!stop) {
+        if (!requested) {
+            if (policy.seconds > 0) {
+                if (!wake.wait(mutex, policy.seconds) && pending > 0) {
+                    requested = true;
+                }
+            } else {
+                wake.wait(mutex);
+            }
+            continue;
+        }
+        requested = false;
+        pending = 0;
+
+        // Appends go on while the file is flushed, as far as the HDF5 lock allows
+        mutex.unlock();
+        std::string message;
+        try {
+            backend->flushFile();
+        } catch (std::exception &e) {
+            message = e.what();
+        }
+        mutex.lock();
+        if (!message.empty()) {
+            error = message;
+        }
+    }
+}
+#endif
+
 //
-// Dataset class implementation
+// HDF5DatasetBackend class implementation
 //
-// Constructor
-Dataset::Dataset(const char* filename, const char* groupname, bool create_file_if_needed)
+// Constructors
+HDF5DatasetBackend::HDF5DatasetBackend(const char* filename, const char* groupname, bool create_file_if_needed)
+    : unflushed_(0), last_flush_(0), flush_thread_(NULL)
 {
-    // TODO error checking and exception throwing
+    open(filename, groupname, create_file_if_needed ? DATASET_OPEN_OR_CREATE : DATASET_OPEN_EXISTING);
+}
+
+HDF5DatasetBackend::HDF5DatasetBackend(const char* filename, const char* groupname, DatasetOpenMode mode)
+    : unflushed_(0), last_flush_(0), flush_thread_(NULL)
+{
+    open(filename, groupname, mode);
+}
+
+void HDF5DatasetBackend::open(const char* filename, const char* groupname, DatasetOpenMode mode)
+{
+    ScopedLock lock(getHDF5Mutex());
     // Initialize the dataset
     int status;
     status = ismrmrd_init_dataset(&dset_, filename, groupname);
     if (status != ISMRMRD_NOERROR) {
         throw std::runtime_error(build_exception_string());
     }
-    // Open the file
-    status = ismrmrd_open_dataset(&dset_, create_file_if_needed);
+    // Open the file
+    if (mode == DATASET_READ_ONLY) {
+        status = ismrmrd_open_dataset_readonly(&dset_);
+    } else {
+        status = ismrmrd_open_dataset(&dset_, mode == DATASET_OPEN_OR_CREATE);
+    }
+    if (status != ISMRMRD_NOERROR) {
+        ismrmrd_close_dataset(&dset_);
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
+// Destructor
+HDF5DatasetBackend::~HDF5DatasetBackend()
+{
+    // The thread may be waiting for the HDF5 lock
+    stopFlushThread();
+    ScopedLock lock(getHDF5Mutex());
+    ismrmrd_close_dataset(&dset_);
+}
+
+// XML Header
+void HDF5DatasetBackend::writeHeader(const std::string &xmlstring)
+{
+    ScopedLock lock(getHDF5Mutex());
+    int status = ismrmrd_write_header(&dset_, xmlstring.c_str());
+    if (status != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
+void HDF5DatasetBackend::readHeader(std::string& xmlstring){
+    ScopedLock lock(getHDF5Mutex());
+    char * temp = ismrmrd_read_header(&dset_);
+    if (NULL == temp) {
+        throw std::runtime_error(build_exception_string());
+    } else {
+        xmlstring = std::string(temp);
+        free(temp);
+    }
+}
+
+// Acquisitions
+void HDF5DatasetBackend::appendAcquisition(const ISMRMRD_Acquisition *acq)
+{
+    ScopedLock lock(getHDF5Mutex());
+    int status = ismrmrd_append_acquisition(&dset_, acq);
+    if (status != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+    appended(1);
+}
+
+void HDF5DatasetBackend::readAcquisition(uint32_t index, ISMRMRD_Acquisition *acq) {
+    ScopedLock lock(getHDF5Mutex());
+    int status = ismrmrd_read_acquisition(&dset_, index, acq);
+    if (status != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
+uint32_t HDF5DatasetBackend::getNumberOfAcquisitions()
+{
+    ScopedLock lock(getHDF5Mutex());
+    return ismrmrd_get_number_of_acquisitions(&dset_);
+}
+
+void HDF5DatasetBackend::readAcquisitions(uint32_t first, uint32_t count, ISMRMRD_Acquisition *acqs)
+{
+    ScopedLock lock(getHDF5Mutex());
+    int status = ismrmrd_read_acquisitions(&dset_, first, count, acqs);
+    if (status != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
+void HDF5DatasetBackend::readAcquisitionHeaders(uint32_t first, uint32_t count, ISMRMRD_AcquisitionHeader *heads)
+{
+    ScopedLock lock(getHDF5Mutex());
+    int status = ismrmrd_read_acquisition_headers(&dset_, first, count, heads);
+    if (status != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
+void HDF5DatasetBackend::setAcquisitionStorage(ISMRMRD_AcquisitionStorage storage)
+{
+    ScopedLock lock(getHDF5Mutex());
+    int status = ismrmrd_set_acquisition_storage(&dset_, storage);
+    if (status != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
+ISMRMRD_AcquisitionStorage HDF5DatasetBackend::getAcquisitionStorage() const
+{
+    ScopedLock lock(getHDF5Mutex());
+    return static_cast<ISMRMRD_AcquisitionStorage>(ismrmrd_get_acquisition_storage(&dset_));
+}
+
+// Flushing
+void HDF5DatasetBackend::setFlushPolicy(const FlushPolicy &policy)
+{
+    stopFlushThread();
+    flush_policy_ = policy;
+    unflushed_ = 0;
+    last_flush_ = seconds_now();
+#ifndef _WIN32
+    if (policy.background && (policy.elements > 0 || policy.seconds > 0)) {
+        flush_thread_ = new FlushThread(this, policy);
+    }
+#endif
+}
+
+FlushPolicy HDF5DatasetBackend::getFlushPolicy() const
+{
+    return flush_policy_;
+}
+
+void HDF5DatasetBackend::flush()
+{
+#ifndef _WIN32
+    if (flush_thread_ != NULL) {
+        flush_thread_->reset();
+    }
+#endif
+    flushFile();
+    unflushed_ = 0;
+    last_flush_ = seconds_now();
+}
+
+void HDF5DatasetBackend::appended(uint32_t count)
+{
+    if (flush_policy_.elements == 0 && flush_policy_.seconds <= 0) {
+        return;
+    }
+#ifndef _WIN32
+    if (flush_thread_ != NULL) {
+        flush_thread_->add(count);
+        return;
+    }
+#endif
+    unflushed_ += count;
+    if ((flush_policy_.elements > 0 && unflushed_ >= flush_policy_.elements) ||
+        (flush_policy_.seconds > 0 && seconds_now() - last_flush_ >= flush_policy_.seconds)) {
+        flush();
+    }
+}
+
+void HDF5DatasetBackend::flushFile()
+{
+    ScopedLock lock(getHDF5Mutex());
+    int status = ismrmrd_flush_dataset(&dset_);
+    if (status != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
+void HDF5DatasetBackend::stopFlushThread()
+{
+#ifndef _WIN32
+    delete flush_thread_;
+    flush_thread_ = NULL;
+#endif
+}
+
+// Waveforms
+void HDF5DatasetBackend::appendWaveform(const ISMRMRD_Waveform *wav) {
+    ScopedLock lock(getHDF5Mutex());
+    int status = ismrmrd_append_waveform(&dset_, wav);
+    if (status != ISMRMRD_NOERROR){
+        throw std::runtime_error(build_exception_string());
+    }
+    appended(1);
+}
+
+void HDF5DatasetBackend::readWaveform(uint32_t index, ISMRMRD_Waveform *wav) {
+    ScopedLock lock(getHDF5Mutex());
+    int status = ismrmrd_read_waveform(&dset_, index, wav);
+    if (status != ISMRMRD_NOERROR){
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
+uint32_t HDF5DatasetBackend::getNumberOfWaveforms() {
+    ScopedLock lock(getHDF5Mutex());
+    return ismrmrd_get_number_of_waveforms(&dset_);
+}
+
+// Images
+void HDF5DatasetBackend::appendImage(const std::string &var, const ISMRMRD_Image *im)
+{
+    ScopedLock lock(getHDF5Mutex());
+    int status = ismrmrd_append_image(&dset_, var.c_str(), im);
+    if (status != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+    appended(1);
+}
+
+void HDF5DatasetBackend::readImage(const std::string &var, uint32_t index, ISMRMRD_Image *im) {
+    ScopedLock lock(getHDF5Mutex());
+    int status = ismrmrd_read_image(&dset_, var.c_str(), index, im);
+    if (status != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
+uint32_t HDF5DatasetBackend::getNumberOfImages(const std::string &var)
+{
+    ScopedLock lock(getHDF5Mutex());
+    return ismrmrd_get_number_of_images(&dset_, var.c_str());
+}
+
+// NDArrays
+void HDF5DatasetBackend::appendNDArray(const std::string &var, const ISMRMRD_NDArray *arr)
+{
+    ScopedLock lock(getHDF5Mutex());
+    int status = ismrmrd_append_array(&dset_, var.c_str(), arr);
+    if (status != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+    appended(1);
+}
+
+void HDF5DatasetBackend::readNDArray(const std::string &var, uint32_t index, ISMRMRD_NDArray *arr) {
+    ScopedLock lock(getHDF5Mutex());
+    int status = ismrmrd_read_array(&dset_, var.c_str(), index, arr);
+    if (status != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
+uint32_t HDF5DatasetBackend::getNumberOfNDArrays(const std::string &var)
+{
+    ScopedLock lock(getHDF5Mutex());
+    return ismrmrd_get_number_of_arrays(&dset_, var.c_str());
+}
+
+bool HDF5DatasetBackend::replaceNDArray(const std::string &var, uint32_t index, const ISMRMRD_NDArray *arr)
+{
+    ScopedLock lock(getHDF5Mutex());
+    int status = ismrmrd_write_array(&dset_, var.c_str(), index, arr);
     if (status != ISMRMRD_NOERROR) {
         throw std::runtime_error(build_exception_string());
     }
+    return true;
+}
+
+// Variables
+std::vector<std::string> HDF5DatasetBackend::getImageVariables()
+{
+    std::vector<std::string> images, arrays;
+    listVariables(images, arrays);
+    return images;
+}
+
+std::vector<std::string> HDF5DatasetBackend::getNDArrayVariables()
+{
+    std::vector<std::string> images, arrays;
+    listVariables(images, arrays);
+    return arrays;
+}
+
+void HDF5DatasetBackend::listVariables(std::vector<std::string> &images, std::vector<std::string> &arrays)
+{
+    ScopedLock lock(getHDF5Mutex());
+    if (H5Lexists(dset_.fileid, dset_.groupname, H5P_DEFAULT) <= 0) {
+        return;
+    }
+    hid_t group = H5Gopen2(dset_.fileid, dset_.groupname, H5P_DEFAULT);
+    if (group < 0) {
+        throw std::runtime_error("Failed to open HDF5 group.");
+    }
+    try {
+        find_variables(group, "", true, images, arrays);
+    } catch (...) {
+        H5Gclose(group);
+        throw;
+    }
+    H5Gclose(group);
+}
+
+//
+// Dataset class implementation
+//
+// Constructors
+Dataset::Dataset(const char* filename, const char* groupname, bool create_file_if_needed)
+    : backend_(new HDF5DatasetBackend(filename, groupname, create_file_if_needed))
+    , track_masks_(false)
+{
+}
+
+Dataset::Dataset(const char* filename, const char* groupname, DatasetOpenMode mode)
+    : backend_(new HDF5DatasetBackend(filename, groupname, mode))
+    , track_masks_(false)
+{
+}
+
+Dataset::Dataset(DatasetBackend *backend)
+    : backend_(backend)
+    , track_masks_(false)
+{
+    if (backend_ == NULL) {
+        throw std::runtime_error("Dataset backend should not be NULL.");
+    }
 }
 
 // Destructor
 Dataset::~Dataset()
 {
-    ismrmrd_close_dataset(&dset_);
+    // Destructors must not throw, call writeSamplingMasks to handle the error
+    try {
+        writeSamplingMasks();
+    } catch (std::exception &) {
+        ISMRMRD_PUSH_ERR(ISMRMRD_RUNTIMEERROR, "Failed to write the sampling masks when closing the dataset.");
+    }
+    delete backend_;
 }
 
 // XML Header
 void Dataset::writeHeader(const std::string &xmlstring)
 {
-    int status = ismrmrd_write_header(&dset_, xmlstring.c_str());
-    if (status != ISMRMRD_NOERROR) {
-        throw std::runtime_error(build_exception_string());
-    }
+    backend_->writeHeader(xmlstring);
 }
 
 void Dataset::readHeader(std::string& xmlstring){
-    char * temp = ismrmrd_read_header(&dset_);
-    if (NULL == temp) {
-        throw std::runtime_error(build_exception_string());
-    } else {
-        xmlstring = std::string(temp);
-        free(temp);
-    }
+    backend_->readHeader(xmlstring);
 }
 
 // Acquisitions
 void Dataset::appendAcquisition(const Acquisition &acq)
 {
-    int status = ismrmrd_append_acquisition(&dset_, &acq.acq);
-    if (status != ISMRMRD_NOERROR) {
-        throw std::runtime_error(build_exception_string());
+    backend_->appendAcquisition(&acq.acq);
+    if (track_masks_ && is_kspace_line(acq.acq.head.flags)) {
+        masks_[acq.encoding_space_ref()].setSampled(acq.idx());
     }
 }
 
-void Dataset::readAcquisition(uint32_t index, Acquisition & acq) {
-    int status = ismrmrd_read_acquisition(&dset_, index, &acq.acq);
-    if (status != ISMRMRD_NOERROR) {
-        throw std::runtime_error(build_exception_string());
+// The backends only read from the C structures, so these can point at the memory of the views
+void Dataset::appendAcquisition(const AcquisitionView &acq)
+{
+    ISMRMRD_Acquisition c_acq;
+    c_acq.head = acq.getHead();
+    c_acq.traj = const_cast<float *>(acq.getTrajPtr());
+    c_acq.data = const_cast<complex_float_t *>(acq.getDataPtr());
+    backend_->appendAcquisition(&c_acq);
+    if (track_masks_ && is_kspace_line(c_acq.head.flags)) {
+        masks_[c_acq.head.encoding_space_ref].setSampled(c_acq.head.idx);
     }
 }
 
+void Dataset::readAcquisition(uint32_t index, Acquisition & acq) {
+    // The backend reallocates to the sizes it reads, the capacity is unknown until it returns
+    acq.data_capacity = acq.traj_capacity = 0;
+    backend_->readAcquisition(index, &acq.acq);
+    acq.resetCapacity();
+}
+
 
 uint32_t Dataset::getNumberOfAcquisitions()
 {
-    uint32_t num = ismrmrd_get_number_of_acquisitions(&dset_);
-    return num;
+    return backend_->getNumberOfAcquisitions();
+}
+
+KSpaceFilter::KSpaceFilter()
+    : calibration(true)
+    , threads(1)
+{
+    matrix_size[0] = 0;
+    matrix_size[1] = 0;
+    matrix_size[2] = 0;
+}
+
+NDArray<complex_float_t> Dataset::readKSpace(uint16_t encoding_space, const KSpaceFilter &filter)
+{
+    const size_t extra = filter.dimensions.size();
+    if (extra > ISMRMRD_NDARRAY_MAXDIM - 4) {
+        throw std::runtime_error("At most three counters can be added as k-space dimensions.");
+    }
+
+    // Select the lines and size the array from the headers alone
+    std::vector<size_t> dims(4 + extra, 0);
+    std::copy(filter.matrix_size, filter.matrix_size + 3, dims.begin());
+    std::vector<KSpaceLine> lines;
+    uint32_t number = backend_->getNumberOfAcquisitions();
+    std::vector<ISMRMRD_AcquisitionHeader> heads(std::min(number, KSPACE_BATCH_HEADERS));
+    for (uint32_t first = 0; first < number; first += KSPACE_BATCH_HEADERS) {
+        uint32_t count = std::min(number - first, KSPACE_BATCH_HEADERS);
+        backend_->readAcquisitionHeaders(first, count, &heads[0]);
+        for (uint32_t n = 0; n < count; n++) {
+            const ISMRMRD_AcquisitionHeader &head = heads[n];
+            if (head.encoding_space_ref != encoding_space || !is_kspace_line(head.flags)) {
+                continue;
+            }
+            if (!filter.calibration && ismrmrd_is_flag_set(head.flags, ISMRMRD_ACQ_IS_PARALLEL_CALIBRATION)) {
+                continue;
+            }
+            bool selected = true;
+            std::map<KSpaceCounter, uint16_t>::const_iterator it;
+            for (it = filter.values.begin(); selected && it != filter.values.end(); ++it) {
+                selected = counter_value(head.idx, it->first) == it->second;
+            }
+            if (!selected) {
+                continue;
+            }
+
+            KSpaceLine line;
+            line.index = first + n;
+            line.pos[0] = head.idx.kspace_encode_step_1;
+            line.pos[1] = head.idx.kspace_encode_step_2;
+            for (size_t d = 0; d < extra; d++) {
+                line.pos[2 + d] = counter_value(head.idx, filter.dimensions[d]);
+            }
+            lines.push_back(line);
+
+            dims[0] = std::max(dims[0], static_cast<size_t>(head.number_of_samples));
+            dims[1] = std::max(dims[1], static_cast<size_t>(line.pos[0]) + 1);
+            dims[2] = std::max(dims[2], static_cast<size_t>(line.pos[1]) + 1);
+            dims[3] = std::max(dims[3], static_cast<size_t>(head.active_channels));
+            for (size_t d = 0; d < extra; d++) {
+                dims[4 + d] = std::max(dims[4 + d], static_cast<size_t>(line.pos[2 + d]) + 1);
+            }
+        }
+    }
+    if (lines.empty()) {
+        throw std::runtime_error("No k-space lines selected.");
+    }
+
+    NDArray<complex_float_t> kspace(dims);
+    std::fill(kspace.begin(), kspace.end(), complex_float_t(0.0f, 0.0f));
+
+    // Offset of the first sample of each line in channel 0
+    const size_t channel_stride = dims[0] * dims[1] * dims[2];
+    std::vector<size_t> offsets(lines.size());
+    for (size_t l = 0; l < lines.size(); l++) {
+        size_t offset = 0;
+        for (size_t d = extra; d > 0; d--) {
+            offset = offset * dims[3 + d] + lines[l].pos[1 + d];
+        }
+        offset = (offset * dims[3] * dims[2] + lines[l].pos[1]) * dims[1] + lines[l].pos[0];
+        offsets[l] = offset * dims[0];
+    }
+
+    // Read runs of consecutive acquisitions and scatter their channels into place
+    std::vector<ISMRMRD_Acquisition> acqs(std::min(static_cast<uint32_t>(lines.size()), KSPACE_BATCH_ACQUISITIONS));
+    for (size_t n = 0; n < acqs.size(); n++) {
+        ismrmrd_init_acquisition(&acqs[n]);
+    }
+    try {
+        size_t l = 0;
+        while (l < lines.size()) {
+            size_t end = l + 1;
+            while (end < lines.size() && end - l < acqs.size() && lines[end].index == lines[end - 1].index + 1) {
+                end++;
+            }
+            const int count = static_cast<int>(end - l);
+            backend_->readAcquisitions(lines[l].index, count, &acqs[0]);
+
+            const int channels = static_cast<int>(dims[3]);
+            complex_float_t *out = kspace.getDataPtr();
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(std::max(1u, filter.threads)) if (filter.threads > 1)
+#endif
+            for (int c = 0; c < channels; c++) {
+                for (int n = 0; n < count; n++) {
+                    const ISMRMRD_Acquisition &acq = acqs[n];
+                    if (c < acq.head.active_channels) {
+                        const complex_float_t *data = acq.data + static_cast<size_t>(c) * acq.head.number_of_samples;
+                        std::copy(data, data + acq.head.number_of_samples, out + offsets[l + n] + c * channel_stride);
+                    }
+                }
+            }
+            l = end;
+        }
+    } catch (...) {
+        cleanup_acquisitions(acqs);
+        throw;
+    }
+    cleanup_acquisitions(acqs);
+
+    return kspace;
 }
 
 // Images
 template <typename T>void Dataset::appendImage(const std::string &var, const Image<T> &im)
 {
-    int status = ismrmrd_append_image(&dset_, var.c_str(), &im.im);
-    if (status != ISMRMRD_NOERROR) {
-        throw std::runtime_error(build_exception_string());
-    }
+    backend_->appendImage(var, &im.im);
 }
 
 void Dataset::appendImage(const std::string &var, const ISMRMRD_Image *im)
 {
-    int status = ismrmrd_append_image(&dset_, var.c_str(), im);
-    if (status != ISMRMRD_NOERROR) {
-        throw std::runtime_error(build_exception_string());
-    }
+    backend_->appendImage(var, im);
+}
+
+template <typename T> void Dataset::appendImage(const std::string &var, const ImageView<T> &im)
+{
+    ISMRMRD_Image c_im;
+    c_im.head = im.getHead();
+    // The HDF5 backend stores the attributes as a null terminated string
+    std::string attributes;
+    im.getAttributeString(attributes);
+    c_im.head.attribute_string_len = static_cast<uint32_t>(attributes.size());
+    c_im.attribute_string = const_cast<char *>(attributes.c_str());
+    c_im.data = const_cast<T *>(im.getDataPtr());
+    backend_->appendImage(var, &c_im);
 }
 
+// Specific instantiations
+template EXPORTISMRMRD void Dataset::appendImage(const std::string &var, const ImageView<uint16_t> &im);
+template EXPORTISMRMRD void Dataset::appendImage(const std::string &var, const ImageView<int16_t> &im);
+template EXPORTISMRMRD void Dataset::appendImage(const std::string &var, const ImageView<uint32_t> &im);
+template EXPORTISMRMRD void Dataset::appendImage(const std::string &var, const ImageView<int32_t> &im);
+template EXPORTISMRMRD void Dataset::appendImage(const std::string &var, const ImageView<float> &im);
+template EXPORTISMRMRD void Dataset::appendImage(const std::string &var, const ImageView<double> &im);
+template EXPORTISMRMRD void Dataset::appendImage(const std::string &var, const ImageView<complex_float_t> &im);
+template EXPORTISMRMRD void Dataset::appendImage(const std::string &var, const ImageView<complex_double_t> &im);
+
 
 void Dataset::appendWaveform(const Waveform &wav) {
-    int status = ismrmrd_append_waveform(&dset_,&wav);
-    if (status != ISMRMRD_NOERROR){
-        throw std::runtime_error(build_exception_string());
-    }
+    backend_->appendWaveform(&wav);
+}
+
+void Dataset::appendWaveform(const WaveformView &wav) {
+    ISMRMRD_Waveform c_wav;
+    c_wav.head = wav.getHead();
+    c_wav.data = const_cast<uint32_t *>(wav.begin_data());
+    backend_->appendWaveform(&c_wav);
 }
 
 void Dataset::readWaveform(uint32_t index, Waveform &wav) {
-    int status = ismrmrd_read_waveform(&dset_,index,&wav);
-    if (status != ISMRMRD_NOERROR){
-        throw std::runtime_error(build_exception_string());
-    }
+    backend_->readWaveform(index, &wav);
 }
 
 uint32_t Dataset::getNumberOfWaveforms() {
-    return ismrmrd_get_number_of_waveforms(&dset_);
+    return backend_->getNumberOfWaveforms();
+}
+
+void Dataset::flush()
+{
+    backend_->flush();
 }
 // Specific instantiations
 template EXPORTISMRMRD void Dataset::appendImage(const std::string &var, const Image<uint16_t> &im);
@@ -121,10 +1411,9 @@ template EXPORTISMRMRD void Dataset::appendImage(const std::string &var, const I
 
 
 template <typename T> void Dataset::readImage(const std::string &var, uint32_t index, Image<T> &im) {
-    int status = ismrmrd_read_image(&dset_, var.c_str(), index, &im.im);
-    if (status != ISMRMRD_NOERROR) {
-        throw std::runtime_error(build_exception_string());
-    }
+    im.data_capacity = im.attribute_capacity = 0;
+    backend_->readImage(var, index, &im.im);
+    im.resetCapacity();
 }
 
 // Specific instantiations
@@ -139,18 +1428,14 @@ template EXPORTISMRMRD void Dataset::readImage(const std::string &var, uint32_t
 
 uint32_t Dataset::getNumberOfImages(const std::string &var)
 {
-    uint32_t num =  ismrmrd_get_number_of_images(&dset_, var.c_str());
-    return num;
+    return backend_->getNumberOfImages(var);
 }
 
 
 // NDArrays
 template <typename T> void Dataset::appendNDArray(const std::string &var, const NDArray<T> &arr)
 {
-    int status = ismrmrd_append_array(&dset_, var.c_str(), &arr.arr);
-    if (status != ISMRMRD_NOERROR) {
-        throw std::runtime_error(build_exception_string());
-    }
+    backend_->appendNDArray(var, &arr.arr);
 }
 
 // Specific instantiations
@@ -165,17 +1450,38 @@ template EXPORTISMRMRD void Dataset::appendNDArray(const std::string &var, const
 
 void Dataset::appendNDArray(const std::string &var, const ISMRMRD_NDArray *arr)
 {
-    int status = ismrmrd_append_array(&dset_, var.c_str(), arr);
-    if (status != ISMRMRD_NOERROR) {
+    backend_->appendNDArray(var, arr);
+}
+
+template <typename T> void Dataset::appendNDArray(const std::string &var, const NDArrayView<T> &arr)
+{
+    ISMRMRD_NDArray c_arr;
+    if (ismrmrd_init_ndarray(&c_arr) != ISMRMRD_NOERROR) {
         throw std::runtime_error(build_exception_string());
     }
+    c_arr.data_type = static_cast<uint16_t>(arr.getDataType());
+    c_arr.ndim = arr.getNDim();
+    for (uint16_t n = 0; n < arr.getNDim(); n++) {
+        c_arr.dims[n] = arr.getDims()[n];
+    }
+    c_arr.data = const_cast<T *>(arr.getDataPtr());
+    backend_->appendNDArray(var, &c_arr);
 }
 
+// Specific instantiations
+template EXPORTISMRMRD void Dataset::appendNDArray(const std::string &var, const NDArrayView<uint16_t> &arr);
+template EXPORTISMRMRD void Dataset::appendNDArray(const std::string &var, const NDArrayView<int16_t> &arr);
+template EXPORTISMRMRD void Dataset::appendNDArray(const std::string &var, const NDArrayView<uint32_t> &arr);
+template EXPORTISMRMRD void Dataset::appendNDArray(const std::string &var, const NDArrayView<int32_t> &arr);
+template EXPORTISMRMRD void Dataset::appendNDArray(const std::string &var, const NDArrayView<float> &arr);
+template EXPORTISMRMRD void Dataset::appendNDArray(const std::string &var, const NDArrayView<double> &arr);
+template EXPORTISMRMRD void Dataset::appendNDArray(const std::string &var, const NDArrayView<complex_float_t> &arr);
+template EXPORTISMRMRD void Dataset::appendNDArray(const std::string &var, const NDArrayView<complex_double_t> &arr);
+
 template <typename T> void Dataset::readNDArray(const std::string &var, uint32_t index, NDArray<T> &arr) {
-    int status = ismrmrd_read_array(&dset_, var.c_str(), index, &arr.arr);
-    if (status != ISMRMRD_NOERROR) {
-        throw std::runtime_error(build_exception_string());
-    }
+    arr.data_capacity = 0;
+    backend_->readNDArray(var, index, &arr.arr);
+    arr.resetCapacity();
 }
 
 // Specific instantiations
@@ -190,8 +1496,521 @@ template EXPORTISMRMRD void Dataset::readNDArray(const std::string &var, uint32_
 
 uint32_t Dataset::getNumberOfNDArrays(const std::string &var)
 {
-    uint32_t num = ismrmrd_get_number_of_arrays(&dset_, var.c_str());
-    return num;
+    return backend_->getNumberOfNDArrays(var);
+}
+
+// Sampling masks
+void Dataset::trackSamplingMasks(bool enable)
+{
+    track_masks_ = enable;
+}
+
+void Dataset::writeSamplingMasks()
+{
+    // Masks that can not be written stay pending, the others are still written
+    std::string failed;
+    std::map<uint16_t, SamplingMask>::iterator it = masks_.begin();
+    while (it != masks_.end()) {
+        std::string var = sampling_mask_variable(it->first);
+        try {
+            // The mask is kept as a single array, which is updated in place. Backends that can
+            // only append add a new array, readers use the last one.
+            SamplingMask mask;
+            uint32_t stored = backend_->getNumberOfNDArrays(var);
+            NDArray<uint16_t> previous;
+            if (stored > 0) {
+                readNDArray(var, stored - 1, previous);
+                mask.setBitmap(previous);
+            } else {
+                std::vector<size_t> dims;
+                declared_mask_dims(backend_, it->first, dims);
+                mask.extend(dims);
+            }
+            mask.merge(it->second);
+
+            NDArray<uint16_t> bitmap = mask.getBitmap();
+            if (stored > 0 && !std::equal(bitmap.getDims(), bitmap.getDims() + MASK_RANK, previous.getDims())) {
+                throw std::runtime_error("it has outgrown the mask stored in the dataset");
+            }
+            if (stored == 0 || !backend_->replaceNDArray(var, stored - 1, &bitmap.arr)) {
+                appendNDArray(var, bitmap);
+            }
+            masks_.erase(it++);
+        } catch (std::runtime_error &e) {
+            failed += (failed.empty() ? "" : "; ") + var + ": " + e.what();
+            ++it;
+        }
+    }
+    if (!failed.empty()) {
+        throw std::runtime_error("Failed to write the sampling masks " + failed);
+    }
+}
+
+bool Dataset::hasSamplingMask(uint16_t encoding_space)
+{
+    return masks_.count(encoding_space) > 0 || backend_->getNumberOfNDArrays(sampling_mask_variable(encoding_space)) > 0;
+}
+
+void Dataset::readSamplingMask(uint16_t encoding_space, SamplingMask &mask)
+{
+    std::string var = sampling_mask_variable(encoding_space);
+    std::map<uint16_t, SamplingMask>::const_iterator pending = masks_.find(encoding_space);
+    uint32_t stored = backend_->getNumberOfNDArrays(var);
+    if (stored == 0 && pending == masks_.end()) {
+        throw std::runtime_error("No sampling mask " + var + " in the dataset.");
+    }
+
+    mask = SamplingMask();
+    if (stored > 0) {
+        NDArray<uint16_t> bitmap;
+        readNDArray(var, stored - 1, bitmap);
+        mask.setBitmap(bitmap);
+    }
+    if (pending != masks_.end()) {
+        mask.merge(pending->second);
+    }
+}
+
+//
+// SamplingMask class implementation
+//
+SamplingMask::SamplingMask()
+{
+    for (size_t d = 0; d < MASK_RANK; d++) {
+        dims_[d] = 0;
+        capacity_[d] = 0;
+    }
+}
+
+std::vector<size_t> SamplingMask::getDims() const
+{
+    return std::vector<size_t>(dims_, dims_ + MASK_RANK);
+}
+
+bool SamplingMask::isSampled(const EncodingCounters &idx) const
+{
+    return isSampled(idx.kspace_encode_step_1, idx.kspace_encode_step_2, idx.slice, idx.contrast, idx.phase,
+                     idx.repetition, idx.set);
+}
+
+bool SamplingMask::isSampled(uint16_t kspace_encode_step_1, uint16_t kspace_encode_step_2, uint16_t slice,
+                             uint16_t contrast, uint16_t phase, uint16_t repetition, uint16_t set) const
+{
+    size_t pos[MASK_RANK] = {kspace_encode_step_1, kspace_encode_step_2, slice, contrast, phase, repetition, set};
+    for (size_t d = 0; d < MASK_RANK; d++) {
+        if (pos[d] >= dims_[d]) {
+            return false;
+        }
+    }
+    return (bits_[mask_element(pos, capacity_)] >> (pos[0] % MASK_WORD_BITS)) & 1;
+}
+
+void SamplingMask::setSampled(const EncodingCounters &idx)
+{
+    size_t pos[MASK_RANK];
+    mask_position(idx, pos);
+    setSampled(pos);
+}
+
+void SamplingMask::setSampled(const size_t *pos)
+{
+    reserve(pos);
+    for (size_t d = 0; d < MASK_RANK; d++) {
+        dims_[d] = std::max(dims_[d], pos[d] + 1);
+    }
+    bits_[mask_element(pos, capacity_)] |= static_cast<uint16_t>(1u << (pos[0] % MASK_WORD_BITS));
+}
+
+// Grows the storage to hold a line, doubling dimensions so that appending line by line stays cheap
+void SamplingMask::reserve(const size_t *pos)
+{
+    size_t capacity[MASK_RANK];
+    bool grow = false;
+    for (size_t d = 0; d < MASK_RANK; d++) {
+        capacity[d] = capacity_[d];
+        if (pos[d] >= capacity[d]) {
+            capacity[d] = std::max(pos[d] + 1, 2 * capacity[d]);
+            grow = true;
+        }
+    }
+    if (!grow) {
+        return;
+    }
+    capacity[0] = (capacity[0] + MASK_WORD_BITS - 1) / MASK_WORD_BITS * MASK_WORD_BITS;
+
+    std::vector<uint16_t> bits((capacity[0] / MASK_WORD_BITS) * mask_rows(capacity), 0);
+    size_t words = (dims_[0] + MASK_WORD_BITS - 1) / MASK_WORD_BITS;
+    size_t rows = words > 0 ? mask_rows(dims_) : 0;
+    size_t row[MASK_RANK];
+    for (size_t r = 0; r < rows; r++) {
+        mask_row(r, dims_, row);
+        std::copy(bits_.begin() + mask_element(row, capacity_), bits_.begin() + mask_element(row, capacity_) + words,
+                  bits.begin() + mask_element(row, capacity));
+    }
+    bits_.swap(bits);
+    std::copy(capacity, capacity + MASK_RANK, capacity_);
+}
+
+void SamplingMask::extend(const std::vector<size_t> &dims)
+{
+    if (dims.size() != MASK_RANK) {
+        throw std::runtime_error("A sampling mask has 7 dimensions.");
+    }
+    size_t pos[MASK_RANK];
+    for (size_t d = 0; d < MASK_RANK; d++) {
+        pos[d] = std::max(std::max(dims[d], dims_[d]), size_t(1)) - 1;
+    }
+    reserve(pos);
+    for (size_t d = 0; d < MASK_RANK; d++) {
+        dims_[d] = pos[d] + 1;
+    }
+}
+
+void SamplingMask::merge(const SamplingMask &other)
+{
+    size_t words = (other.dims_[0] + MASK_WORD_BITS - 1) / MASK_WORD_BITS;
+    size_t rows = words > 0 ? mask_rows(other.dims_) : 0;
+    size_t pos[MASK_RANK];
+    for (size_t r = 0; r < rows; r++) {
+        mask_row(r, other.dims_, pos);
+        size_t first = mask_element(pos, other.capacity_);
+        for (size_t w = 0; w < words; w++) {
+            uint16_t word = other.bits_[first + w];
+            for (size_t b = 0; word != 0; b++, word >>= 1) {
+                if (word & 1) {
+                    pos[0] = w * MASK_WORD_BITS + b;
+                    setSampled(pos);
+                }
+            }
+        }
+    }
+}
+
+size_t SamplingMask::getNumberOfSampledLines() const
+{
+    size_t lines = 0;
+    for (size_t n = 0; n < bits_.size(); n++) {
+        for (uint16_t word = bits_[n]; word != 0; word &= word - 1) {
+            lines++;
+        }
+    }
+    return lines;
+}
+
+NDArray<uint16_t> SamplingMask::getBitmap() const
+{
+    size_t words = (dims_[0] + MASK_WORD_BITS - 1) / MASK_WORD_BITS;
+    std::vector<size_t> dims(dims_, dims_ + MASK_RANK);
+    dims[0] = words;
+
+    NDArray<uint16_t> bitmap(dims);
+    size_t rows = words > 0 ? mask_rows(dims_) : 0;
+    size_t row[MASK_RANK];
+    for (size_t r = 0; r < rows; r++) {
+        mask_row(r, dims_, row);
+        std::copy(bits_.begin() + mask_element(row, capacity_), bits_.begin() + mask_element(row, capacity_) + words,
+                  bitmap.getDataPtr() + r * words);
+    }
+    return bitmap;
+}
+
+void SamplingMask::setBitmap(const NDArray<uint16_t> &bitmap)
+{
+    if (bitmap.getNDim() != MASK_RANK) {
+        throw std::runtime_error("A sampling mask bitmap has 7 dimensions.");
+    }
+    std::copy(bitmap.getDims(), bitmap.getDims() + MASK_RANK, dims_);
+    dims_[0] *= MASK_WORD_BITS;
+    std::copy(dims_, dims_ + MASK_RANK, capacity_);
+    bits_.assign(bitmap.getDataPtr(), bitmap.getDataPtr() + bitmap.getNumberOfElements());
+}
+
+//
+// Virtual datasets
+//
+void createVirtualDataset(const std::string &filename, const std::string &groupname,
+                          const std::vector<std::string> &sources)
+{
+    ScopedLock lock(getHDF5Mutex());
+    if (sources.empty()) {
+        throw std::runtime_error("No source files for the virtual dataset.");
+    }
+    for (size_t i = 0; i < sources.size(); i++) {
+        if (same_file(sources[i], filename)) {
+            throw std::runtime_error("The virtual dataset cannot replace its source " + sources[i]);
+        }
+    }
+
+    std::string group = !groupname.empty() && groupname[0] == '/' ? groupname : "/" + groupname;
+    StackedSources inputs(sources, group);
+
+    OutputFile output(filename);
+    HDF5Handle lcpl(H5Pcreate(H5P_LINK_CREATE), H5Pclose);
+    H5Pset_create_intermediate_group(lcpl, 1);
+    H5Gclose(H5Gcreate2(output, group.c_str(), lcpl, H5P_DEFAULT, H5P_DEFAULT));
+    inputs.copyHeader(output, group);
+
+    for (size_t n = 0; n < inputs.order.size(); n++) {
+        const VirtualVariable &v = inputs.variables[inputs.order[n]];
+        if (v.sources.empty()) {
+            continue;
+        }
+        std::string path = group + "/" + inputs.order[n];
+        int rank = static_cast<int>(v.dims.size());
+
+        std::vector<hsize_t> dims(v.dims);
+        dims[0] = 0;
+        for (size_t k = 0; k < v.counts.size(); k++) {
+            dims[0] += v.counts[k];
+        }
+        HDF5Handle vspace(H5Screate_simple(rank, &dims[0], NULL), H5Sclose);
+
+        // Map every source file onto the next block of elements
+        HDF5Handle dcpl(H5Pcreate(H5P_DATASET_CREATE), H5Pclose);
+        std::vector<hsize_t> start(rank, 0);
+        std::vector<hsize_t> count(v.dims);
+        for (size_t k = 0; k < v.sources.size(); k++) {
+            count[0] = v.counts[k];
+            H5Sselect_hyperslab(vspace, H5S_SELECT_SET, &start[0], NULL, &count[0], NULL);
+            HDF5Handle sspace(H5Screate_simple(rank, &count[0], NULL), H5Sclose);
+            H5Pset_virtual(dcpl, vspace, sources[v.sources[k]].c_str(), path.c_str(), sspace);
+            start[0] += v.counts[k];
+        }
+        H5Sselect_all(vspace);
+
+        HDF5Handle dataset(H5Dcreate2(output, path.c_str(), v.type, vspace, lcpl, dcpl, H5P_DEFAULT), H5Dclose);
+        if (dataset < 0) {
+            throw std::runtime_error("Failed to create virtual dataset " + path);
+        }
+    }
+    output.keep();
+}
+
+//
+// Repacking
+//
+RepackOptions::RepackOptions()
+    : chunk_elements(0), compression_level(0), shuffle(false), contiguous(false), buffer_size(64 * 1024 * 1024)
+{
+}
+
+void repackDataset(const std::string &source, const std::string &destination, const std::string &groupname,
+                   const RepackOptions &options)
+{
+    ScopedLock lock(getHDF5Mutex());
+    std::string group = !groupname.empty() && groupname[0] == '/' ? groupname : "/" + groupname;
+    if (same_file(source, destination)) {
+        throw std::runtime_error("The repacked file cannot replace its source " + source);
+    }
+
+    HDF5Handle source_file(H5Fopen(source.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT), H5Fclose);
+    if (source_file < 0) {
+        throw std::runtime_error("Failed to open " + source);
+    }
+    if (H5Lexists(source_file, group.c_str(), H5P_DEFAULT) <= 0) {
+        throw std::runtime_error("Group " + group + " not found in " + source);
+    }
+
+    std::vector<std::string> datasets;
+    {
+        HDF5Handle gid(H5Gopen2(source_file, group.c_str(), H5P_DEFAULT), H5Gclose);
+        find_datasets(gid, "", datasets);
+    }
+
+    OutputFile destination_file(destination);
+    HDF5Handle lcpl(H5Pcreate(H5P_LINK_CREATE), H5Pclose);
+    H5Pset_create_intermediate_group(lcpl, 1);
+    H5Gclose(H5Gcreate2(destination_file, group.c_str(), lcpl, H5P_DEFAULT, H5P_DEFAULT));
+
+    for (size_t n = 0; n < datasets.size(); n++) {
+        std::string path = group + "/" + datasets[n];
+        if (datasets[n] == "xml") {
+            if (H5Ocopy(source_file, path.c_str(), destination_file, path.c_str(), H5P_DEFAULT, H5P_DEFAULT) < 0) {
+                throw std::runtime_error("Failed to copy the header.");
+            }
+            continue;
+        }
+        repack_dataset(source_file, destination_file, path, options, lcpl);
+    }
+    destination_file.keep();
+}
+
+//
+// Merging and splitting
+//
+void mergeDatasets(const std::string &destination, const std::string &groupname,
+                   const std::vector<std::string> &sources, size_t buffer_size)
+{
+    ScopedLock lock(getHDF5Mutex());
+    if (sources.empty()) {
+        throw std::runtime_error("No source files to merge.");
+    }
+    for (size_t i = 0; i < sources.size(); i++) {
+        if (same_file(sources[i], destination)) {
+            throw std::runtime_error("The merged file cannot replace its source " + sources[i]);
+        }
+    }
+
+    std::string group = !groupname.empty() && groupname[0] == '/' ? groupname : "/" + groupname;
+    StackedSources inputs(sources, group);
+
+    OutputFile output(destination);
+    HDF5Handle lcpl(H5Pcreate(H5P_LINK_CREATE), H5Pclose);
+    H5Pset_create_intermediate_group(lcpl, 1);
+    H5Gclose(H5Gcreate2(output, group.c_str(), lcpl, H5P_DEFAULT, H5P_DEFAULT));
+    inputs.copyHeader(output, group);
+
+    for (size_t n = 0; n < inputs.order.size(); n++) {
+        const VirtualVariable &v = inputs.variables[inputs.order[n]];
+        if (v.sources.empty()) {
+            continue;
+        }
+        std::string path = group + "/" + inputs.order[n];
+        int rank = static_cast<int>(v.dims.size());
+
+        std::vector<hsize_t> dims(v.dims);
+        dims[0] = 0;
+        for (size_t k = 0; k < v.counts.size(); k++) {
+            dims[0] += v.counts[k];
+        }
+
+        // Keep the storage of the first file so its chunks can be moved as they are
+        HDF5Handle first(H5Dopen2(inputs.files[v.sources[0]], path.c_str(), H5P_DEFAULT), H5Dclose);
+        HDF5Handle dcpl(first < 0 ? -1 : H5Dget_create_plist(first), H5Pclose);
+        if (dcpl < 0) {
+            throw std::runtime_error("Failed to read the storage of " + path + " in " + sources[v.sources[0]]);
+        }
+        if (H5Pget_layout(dcpl) != H5D_CHUNKED) {
+            std::vector<hsize_t> chunk(v.dims);
+            chunk[0] = 1;
+            H5Pset_chunk(dcpl, rank, &chunk[0]);
+        }
+        std::vector<hsize_t> maxdims(dims);
+        maxdims[0] = H5S_UNLIMITED;
+        HDF5Handle space(H5Screate_simple(rank, &dims[0], &maxdims[0]), H5Sclose);
+        HDF5Handle dataset(H5Dcreate2(output, path.c_str(), v.type, space, lcpl, dcpl, H5P_DEFAULT), H5Dclose);
+        if (dataset < 0) {
+            throw std::runtime_error("Failed to create " + path);
+        }
+
+        hsize_t offset = 0;
+        for (size_t k = 0; k < v.sources.size(); k++) {
+            HDF5Handle source(H5Dopen2(inputs.files[v.sources[k]], path.c_str(), H5P_DEFAULT), H5Dclose);
+            if (source < 0) {
+                throw std::runtime_error("Failed to open " + path + " in " + sources[v.sources[k]]);
+            }
+            copy_range(source, dataset, 0, offset, v.counts[k], buffer_size);
+            offset += v.counts[k];
+        }
+    }
+    output.keep();
+}
+
+void splitDataset(const std::string &source, const std::string &destination, const std::string &groupname,
+                  const std::vector<std::string> &variables, uint32_t first, uint32_t count, size_t buffer_size)
+{
+    ScopedLock lock(getHDF5Mutex());
+    std::string group = !groupname.empty() && groupname[0] == '/' ? groupname : "/" + groupname;
+    if (same_file(source, destination)) {
+        throw std::runtime_error("The split file cannot replace its source " + source);
+    }
+
+    HDF5Handle source_file(H5Fopen(source.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT), H5Fclose);
+    if (source_file < 0) {
+        throw std::runtime_error("Failed to open " + source);
+    }
+    if (H5Lexists(source_file, group.c_str(), H5P_DEFAULT) <= 0) {
+        throw std::runtime_error("Group " + group + " not found in " + source);
+    }
+
+    // Without a selection everything but the header is copied
+    std::vector<std::string> selected(variables);
+    if (selected.empty()) {
+        HDF5Handle gid(H5Gopen2(source_file, group.c_str(), H5P_DEFAULT), H5Gclose);
+        hsize_t idx = 0;
+        H5Literate(gid, H5_INDEX_NAME, H5_ITER_INC, &idx, collect_link_name, &selected);
+    }
+
+    OutputFile destination_file(destination);
+    HDF5Handle lcpl(H5Pcreate(H5P_LINK_CREATE), H5Pclose);
+    H5Pset_create_intermediate_group(lcpl, 1);
+    H5Gclose(H5Gcreate2(destination_file, group.c_str(), lcpl, H5P_DEFAULT, H5P_DEFAULT));
+
+    std::string xml = group + "/xml";
+    if (H5Lexists(source_file, xml.c_str(), H5P_DEFAULT) > 0) {
+        if (H5Ocopy(source_file, xml.c_str(), destination_file, xml.c_str(), H5P_DEFAULT, H5P_DEFAULT) < 0) {
+            throw std::runtime_error("Failed to copy the header from " + source);
+        }
+    }
+
+    for (size_t v = 0; v < selected.size(); v++) {
+        if (selected[v] == "xml") {
+            continue;
+        }
+        std::string path = group + "/" + selected[v];
+        if (H5Lexists(source_file, path.c_str(), H5P_DEFAULT) <= 0) {
+            throw std::runtime_error("Variable " + selected[v] + " not found in " + source);
+        }
+
+        // A variable is a dataset, or a group of datasets like the header, attributes and data of images
+        std::vector<std::string> datasets;
+        {
+            HDF5Handle obj(H5Oopen(source_file, path.c_str(), H5P_DEFAULT), H5Oclose);
+            if (obj < 0) {
+                throw std::runtime_error("Failed to open " + path + " in " + source);
+            }
+            if (H5Iget_type(obj) == H5I_GROUP) {
+                find_datasets(obj, path + "/", datasets);
+            } else {
+                datasets.push_back(path);
+            }
+        }
+
+        for (size_t n = 0; n < datasets.size(); n++) {
+            HDF5Handle dataset(H5Dopen2(source_file, datasets[n].c_str(), H5P_DEFAULT), H5Dclose);
+            if (dataset < 0) {
+                throw std::runtime_error("Failed to open " + datasets[n] + " in " + source);
+            }
+            HDF5Handle space(H5Dget_space(dataset), H5Sclose);
+            if (space < 0) {
+                throw std::runtime_error("Failed to read the extent of " + datasets[n] + " in " + source);
+            }
+            int rank = H5Sget_simple_extent_ndims(space);
+            if (rank < 1) {
+                throw std::runtime_error("Dataset " + datasets[n] + " is not an array of elements.");
+            }
+            std::vector<hsize_t> dims(rank), maxdims(rank);
+            H5Sget_simple_extent_dims(space, &dims[0], &maxdims[0]);
+
+            hsize_t begin = first < dims[0] ? first : dims[0];
+            hsize_t end = count == 0 || begin + count > dims[0] ? dims[0] : begin + count;
+
+            if (begin == 0 && end == dims[0]) {
+                // The whole dataset, including the heap data of variable length records
+                if (H5Ocopy(source_file, datasets[n].c_str(), destination_file, datasets[n].c_str(), H5P_DEFAULT,
+                            lcpl) < 0) {
+                    throw std::runtime_error("Failed to copy " + datasets[n]);
+                }
+                continue;
+            }
+
+            HDF5Handle type(H5Dget_type(dataset), H5Tclose);
+            HDF5Handle dcpl(H5Dget_create_plist(dataset), H5Pclose);
+            if (type < 0 || dcpl < 0) {
+                throw std::runtime_error("Failed to read the type or storage of " + datasets[n] + " in " + source);
+            }
+            dims[0] = end - begin;
+            HDF5Handle destination_space(H5Screate_simple(rank, &dims[0], &maxdims[0]), H5Sclose);
+            HDF5Handle copy(H5Dcreate2(destination_file, datasets[n].c_str(), type, destination_space, lcpl, dcpl,
+                                       H5P_DEFAULT),
+                            H5Dclose);
+            if (copy < 0) {
+                throw std::runtime_error("Failed to create " + datasets[n]);
+            }
+            copy_range(dataset, copy, begin, 0, end - begin, buffer_size);
+        }
+    }
+    destination_file.keep();
 }
 
 } // namespace ISMRMRD
@@ -0,0 +1,505 @@
+#include "ismrmrd/dataset_backend.h"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#endif
+
+namespace ISMRMRD {
+//
+// Mutex class implementation
+//
+#ifdef _WIN32
+struct Mutex::Impl {
+    CRITICAL_SECTION section;
+};
+
+Mutex::Mutex() : impl_(new Impl)
+{
+    InitializeCriticalSection(&impl_->section);
+}
+
+Mutex::~Mutex()
+{
+    DeleteCriticalSection(&impl_->section);
+    delete impl_;
+}
+
+void Mutex::lock()
+{
+    EnterCriticalSection(&impl_->section);
+}
+
+void Mutex::unlock()
+{
+    LeaveCriticalSection(&impl_->section);
+}
+
+struct Condition::Impl {
+    CONDITION_VARIABLE variable;
+};
+
+Condition::Condition() : impl_(new Impl)
+{
+    InitializeConditionVariable(&impl_->variable);
+}
+
+Condition::~Condition()
+{
+    delete impl_;
+}
+
+void Condition::wait(Mutex &mutex)
+{
+    SleepConditionVariableCS(&impl_->variable, &mutex.impl_->section, INFINITE);
+}
+
+bool Condition::wait(Mutex &mutex, double seconds)
+{
+    DWORD milliseconds = static_cast<DWORD>(seconds * 1000);
+    return SleepConditionVariableCS(&impl_->variable, &mutex.impl_->section, milliseconds) ||
+           GetLastError() != ERROR_TIMEOUT;
+}
+
+void Condition::signal()
+{
+    WakeConditionVariable(&impl_->variable);
+}
+
+void Condition::broadcast()
+{
+    WakeAllConditionVariable(&impl_->variable);
+}
+#else
+struct Mutex::Impl {
+    pthread_mutex_t mutex;
+};
+
+Mutex::Mutex() : impl_(new Impl)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    int status = pthread_mutex_init(&impl_->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (status != 0) {
+        delete impl_;
+        throw std::runtime_error("Failed to create mutex.");
+    }
+}
+
+Mutex::~Mutex()
+{
+    pthread_mutex_destroy(&impl_->mutex);
+    delete impl_;
+}
+
+void Mutex::lock()
+{
+    pthread_mutex_lock(&impl_->mutex);
+}
+
+void Mutex::unlock()
+{
+    pthread_mutex_unlock(&impl_->mutex);
+}
+
+struct Condition::Impl {
+    pthread_cond_t variable;
+};
+
+Condition::Condition() : impl_(new Impl)
+{
+    if (pthread_cond_init(&impl_->variable, NULL) != 0) {
+        delete impl_;
+        throw std::runtime_error("Failed to create condition variable.");
+    }
+}
+
+Condition::~Condition()
+{
+    pthread_cond_destroy(&impl_->variable);
+    delete impl_;
+}
+
+void Condition::wait(Mutex &mutex)
+{
+    pthread_cond_wait(&impl_->variable, &mutex.impl_->mutex);
+}
+
+bool Condition::wait(Mutex &mutex, double seconds)
+{
+    timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    double end = deadline.tv_nsec * 1e-9 + seconds;
+    deadline.tv_sec += static_cast<time_t>(end);
+    deadline.tv_nsec = static_cast<long>((end - static_cast<time_t>(end)) * 1e9);
+    return pthread_cond_timedwait(&impl_->variable, &mutex.impl_->mutex, &deadline) != ETIMEDOUT;
+}
+
+void Condition::signal()
+{
+    pthread_cond_signal(&impl_->variable);
+}
+
+void Condition::broadcast()
+{
+    pthread_cond_broadcast(&impl_->variable);
+}
+#endif
+
+//
+// DatasetBackend default implementations
+//
+void DatasetBackend::readAcquisitions(uint32_t first, uint32_t count, ISMRMRD_Acquisition *acqs)
+{
+    for (uint32_t n = 0; n < count; n++) {
+        readAcquisition(first + n, &acqs[n]);
+    }
+}
+
+void DatasetBackend::readAcquisitionHeaders(uint32_t first, uint32_t count, ISMRMRD_AcquisitionHeader *heads)
+{
+    ISMRMRD_Acquisition acq;
+    ismrmrd_init_acquisition(&acq);
+    try {
+        for (uint32_t n = 0; n < count; n++) {
+            readAcquisition(first + n, &acq);
+            heads[n] = acq.head;
+        }
+    } catch (...) {
+        ismrmrd_cleanup_acquisition(&acq);
+        throw;
+    }
+    ismrmrd_cleanup_acquisition(&acq);
+}
+
+bool DatasetBackend::replaceNDArray(const std::string &, uint32_t, const ISMRMRD_NDArray *)
+{
+    return false;
+}
+
+//
+// MemoryDatasetBackend class implementation
+//
+MemoryDatasetBackend::MemoryDatasetBackend() : has_header_(false) {}
+
+MemoryDatasetBackend::~MemoryDatasetBackend()
+{
+    for (size_t i = 0; i < acquisitions_.size(); i++) {
+        ismrmrd_free_acquisition(acquisitions_[i]);
+    }
+    for (size_t i = 0; i < waveforms_.size(); i++) {
+        ismrmrd_free_waveform(waveforms_[i]);
+    }
+    std::map<std::string, std::vector<ISMRMRD_Image *> >::iterator im_it;
+    for (im_it = images_.begin(); im_it != images_.end(); ++im_it) {
+        for (size_t i = 0; i < im_it->second.size(); i++) {
+            ismrmrd_free_image(im_it->second[i]);
+        }
+    }
+    std::map<std::string, std::vector<ISMRMRD_NDArray *> >::iterator arr_it;
+    for (arr_it = arrays_.begin(); arr_it != arrays_.end(); ++arr_it) {
+        for (size_t i = 0; i < arr_it->second.size(); i++) {
+            ismrmrd_free_ndarray(arr_it->second[i]);
+        }
+    }
+}
+
+// XML Header
+void MemoryDatasetBackend::writeHeader(const std::string &xmlstring)
+{
+    header_ = xmlstring;
+    has_header_ = true;
+}
+
+void MemoryDatasetBackend::readHeader(std::string &xmlstring)
+{
+    if (!has_header_) {
+        throw std::runtime_error("No XML Header found.");
+    }
+    xmlstring = header_;
+}
+
+// Acquisitions
+void MemoryDatasetBackend::appendAcquisition(const ISMRMRD_Acquisition *acq)
+{
+    ISMRMRD_Acquisition *copy = ismrmrd_create_acquisition();
+    if (copy == NULL || ismrmrd_copy_acquisition(copy, acq) != ISMRMRD_NOERROR) {
+        if (copy != NULL) {
+            ismrmrd_free_acquisition(copy);
+        }
+        throw std::runtime_error(build_exception_string());
+    }
+    acquisitions_.push_back(copy);
+}
+
+void MemoryDatasetBackend::readAcquisition(uint32_t index, ISMRMRD_Acquisition *acq)
+{
+    if (index >= acquisitions_.size()) {
+        throw std::runtime_error("Index out of range.");
+    }
+    if (ismrmrd_copy_acquisition(acq, acquisitions_[index]) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
+uint32_t MemoryDatasetBackend::getNumberOfAcquisitions()
+{
+    return static_cast<uint32_t>(acquisitions_.size());
+}
+
+// Waveforms
+void MemoryDatasetBackend::appendWaveform(const ISMRMRD_Waveform *wav)
+{
+    ISMRMRD_Waveform *copy = ismrmrd_create_waveform();
+    if (copy == NULL || ismrmrd_copy_waveform(copy, wav) != ISMRMRD_NOERROR) {
+        if (copy != NULL) {
+            ismrmrd_free_waveform(copy);
+        }
+        throw std::runtime_error(build_exception_string());
+    }
+    waveforms_.push_back(copy);
+}
+
+void MemoryDatasetBackend::readWaveform(uint32_t index, ISMRMRD_Waveform *wav)
+{
+    if (index >= waveforms_.size()) {
+        throw std::runtime_error("Index out of range.");
+    }
+    if (ismrmrd_copy_waveform(wav, waveforms_[index]) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
+uint32_t MemoryDatasetBackend::getNumberOfWaveforms()
+{
+    return static_cast<uint32_t>(waveforms_.size());
+}
+
+// Images
+void MemoryDatasetBackend::appendImage(const std::string &var, const ISMRMRD_Image *im)
+{
+    std::vector<ISMRMRD_Image *> &series = images_[var];
+    if (!series.empty()) {
+        const ISMRMRD_ImageHeader &first = series[0]->head;
+        if (first.data_type != im->head.data_type ||
+            first.matrix_size[0] != im->head.matrix_size[0] ||
+            first.matrix_size[1] != im->head.matrix_size[1] ||
+            first.matrix_size[2] != im->head.matrix_size[2] ||
+            first.channels != im->head.channels) {
+            throw std::runtime_error("Dimensions are incorrect.");
+        }
+    }
+
+    ISMRMRD_Image *copy = ismrmrd_create_image();
+    if (copy == NULL || ismrmrd_copy_image(copy, im) != ISMRMRD_NOERROR) {
+        if (copy != NULL) {
+            ismrmrd_free_image(copy);
+        }
+        throw std::runtime_error(build_exception_string());
+    }
+    series.push_back(copy);
+}
+
+void MemoryDatasetBackend::readImage(const std::string &var, uint32_t index, ISMRMRD_Image *im)
+{
+    std::map<std::string, std::vector<ISMRMRD_Image *> >::iterator it = images_.find(var);
+    if (it == images_.end()) {
+        throw std::runtime_error("Path to element not found.");
+    }
+    if (index >= it->second.size()) {
+        throw std::runtime_error("Index out of range.");
+    }
+    if (ismrmrd_copy_image(im, it->second[index]) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
+uint32_t MemoryDatasetBackend::getNumberOfImages(const std::string &var)
+{
+    std::map<std::string, std::vector<ISMRMRD_Image *> >::iterator it = images_.find(var);
+    if (it == images_.end()) {
+        return 0;
+    }
+    return static_cast<uint32_t>(it->second.size());
+}
+
+// NDArrays
+void MemoryDatasetBackend::appendNDArray(const std::string &var, const ISMRMRD_NDArray *arr)
+{
+    std::vector<ISMRMRD_NDArray *> &series = arrays_[var];
+    if (!series.empty()) {
+        const ISMRMRD_NDArray *first = series[0];
+        bool consistent = first->data_type == arr->data_type && first->ndim == arr->ndim;
+        for (uint16_t n = 0; consistent && n < arr->ndim; n++) {
+            consistent = first->dims[n] == arr->dims[n];
+        }
+        if (!consistent) {
+            throw std::runtime_error("Dimensions are incorrect.");
+        }
+    }
+
+    ISMRMRD_NDArray *copy = ismrmrd_create_ndarray();
+    if (copy == NULL || ismrmrd_copy_ndarray(copy, arr) != ISMRMRD_NOERROR) {
+        if (copy != NULL) {
+            ismrmrd_free_ndarray(copy);
+        }
+        throw std::runtime_error(build_exception_string());
+    }
+    series.push_back(copy);
+}
+
+void MemoryDatasetBackend::readNDArray(const std::string &var, uint32_t index, ISMRMRD_NDArray *arr)
+{
+    std::map<std::string, std::vector<ISMRMRD_NDArray *> >::iterator it = arrays_.find(var);
+    if (it == arrays_.end()) {
+        throw std::runtime_error("Path to element not found.");
+    }
+    if (index >= it->second.size()) {
+        throw std::runtime_error("Index out of range.");
+    }
+    if (ismrmrd_copy_ndarray(arr, it->second[index]) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
+uint32_t MemoryDatasetBackend::getNumberOfNDArrays(const std::string &var)
+{
+    std::map<std::string, std::vector<ISMRMRD_NDArray *> >::iterator it = arrays_.find(var);
+    if (it == arrays_.end()) {
+        return 0;
+    }
+    return static_cast<uint32_t>(it->second.size());
+}
+
+bool MemoryDatasetBackend::replaceNDArray(const std::string &var, uint32_t index, const ISMRMRD_NDArray *arr)
+{
+    std::map<std::string, std::vector<ISMRMRD_NDArray *> >::iterator it = arrays_.find(var);
+    if (it == arrays_.end()) {
+        throw std::runtime_error("Path to element not found.");
+    }
+    if (index >= it->second.size()) {
+        throw std::runtime_error("Index out of range.");
+    }
+    ISMRMRD_NDArray *stored = it->second[index];
+    bool consistent = stored->data_type == arr->data_type && stored->ndim == arr->ndim;
+    for (uint16_t n = 0; consistent && n < arr->ndim; n++) {
+        consistent = stored->dims[n] == arr->dims[n];
+    }
+    if (!consistent) {
+        throw std::runtime_error("Dimensions are incorrect.");
+    }
+    if (ismrmrd_copy_ndarray(stored, arr) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+    return true;
+}
+
+// Variables
+std::vector<std::string> MemoryDatasetBackend::getImageVariables()
+{
+    std::vector<std::string> vars;
+    std::map<std::string, std::vector<ISMRMRD_Image *> >::iterator it;
+    for (it = images_.begin(); it != images_.end(); ++it) {
+        if (!it->second.empty()) {
+            vars.push_back(it->first);
+        }
+    }
+    return vars;
+}
+
+std::vector<std::string> MemoryDatasetBackend::getNDArrayVariables()
+{
+    std::vector<std::string> vars;
+    std::map<std::string, std::vector<ISMRMRD_NDArray *> >::iterator it;
+    for (it = arrays_.begin(); it != arrays_.end(); ++it) {
+        if (!it->second.empty()) {
+            vars.push_back(it->first);
+        }
+    }
+    return vars;
+}
+
+//
+// Copy between backends
+//
+void copyDataset(DatasetBackend &source, DatasetBackend &destination)
+{
+    // The header is optional
+    std::string xml;
+    bool has_header = true;
+    try {
+        source.readHeader(xml);
+    } catch (std::runtime_error &) {
+        has_header = false;
+    }
+    if (has_header) {
+        destination.writeHeader(xml);
+    }
+
+    ISMRMRD_Acquisition *acq = ismrmrd_create_acquisition();
+    try {
+        uint32_t num = source.getNumberOfAcquisitions();
+        for (uint32_t i = 0; i < num; i++) {
+            source.readAcquisition(i, acq);
+            destination.appendAcquisition(acq);
+        }
+    } catch (...) {
+        ismrmrd_free_acquisition(acq);
+        throw;
+    }
+    ismrmrd_free_acquisition(acq);
+
+    ISMRMRD_Waveform *wav = ismrmrd_create_waveform();
+    try {
+        uint32_t num = source.getNumberOfWaveforms();
+        for (uint32_t i = 0; i < num; i++) {
+            source.readWaveform(i, wav);
+            destination.appendWaveform(wav);
+        }
+    } catch (...) {
+        ismrmrd_free_waveform(wav);
+        throw;
+    }
+    ismrmrd_free_waveform(wav);
+
+    std::vector<std::string> vars = source.getImageVariables();
+    ISMRMRD_Image *im = ismrmrd_create_image();
+    try {
+        for (size_t v = 0; v < vars.size(); v++) {
+            uint32_t num = source.getNumberOfImages(vars[v]);
+            for (uint32_t i = 0; i < num; i++) {
+                source.readImage(vars[v], i, im);
+                destination.appendImage(vars[v], im);
+            }
+        }
+    } catch (...) {
+        ismrmrd_free_image(im);
+        throw;
+    }
+    ismrmrd_free_image(im);
+
+    vars = source.getNDArrayVariables();
+    ISMRMRD_NDArray *arr = ismrmrd_create_ndarray();
+    try {
+        for (size_t v = 0; v < vars.size(); v++) {
+            uint32_t num = source.getNumberOfNDArrays(vars[v]);
+            for (uint32_t i = 0; i < num; i++) {
+                source.readNDArray(vars[v], i, arr);
+                destination.appendNDArray(vars[v], arr);
+            }
+        }
+    } catch (...) {
+        ismrmrd_free_ndarray(arr);
+        throw;
+    }
+    ismrmrd_free_ndarray(arr);
+}
+
+} // namespace ISMRMRD
@@ -0,0 +1,661 @@
+#include "ismrmrd/decode_pipeline.h"
+#include "ismrmrd/dataset_backend.h"
+
+#include <string.h>
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#endif
+
+namespace ISMRMRD {
+
+namespace {
+
+// Reads a message that was framed into memory
+class MemoryReadableStreamView : public ReadableStreamView {
+public:
+    MemoryReadableStreamView(const char *data, size_t size) : pos_(data), end_(data + size), eof_(false) {}
+
+    virtual void read(char *buffer, size_t count) {
+        read_some(buffer, count);
+    }
+
+    virtual bool eof() {
+        return eof_;
+    }
+
+    virtual size_t read_some(char *buffer, size_t count) {
+        size_t n = std::min(count, static_cast<size_t>(end_ - pos_));
+        if (n < count) {
+            eof_ = true;
+        }
+        if (n > 0) {
+            memcpy(buffer, pos_, n);
+            pos_ += n;
+        }
+        return n;
+    }
+
+    virtual void skip(size_t count) {
+        size_t n = std::min(count, static_cast<size_t>(end_ - pos_));
+        if (n < count) {
+            eof_ = true;
+        }
+        pos_ += n;
+    }
+
+private:
+    const char *pos_;
+    const char *end_;
+    bool eof_;
+};
+
+// Size of the blocks the source is read in
+const size_t BLOCK_SIZE = 1024 * 1024;
+
+// Data read from the source, used by the reader and by the messages framed in it
+struct Block {
+    explicit Block(size_t size) : data(size), end(0), users(0) {}
+
+    std::vector<char> data;
+    size_t end;
+    unsigned int users;
+};
+
+// A message lying in a block
+struct Frame {
+    Frame() : block(NULL), data(NULL), size(0) {}
+
+    Block *block;
+    const char *data;
+    size_t size;
+};
+
+// Reads the source into blocks as a deserializer frames messages on it. Each message is kept
+// in one piece in a block: one that does not fit behind the messages before it is moved to the
+// front of a new block, so only the start of a message is copied at the end of a block. The
+// blocks are shared with the frames and used again once the messages in them are decoded.
+class FrameRecorder : public ReadableStreamView {
+public:
+    // Reads blocks with read_some, or no further than the message framed without read_ahead.
+    // The users of blocks are counted under mutex, if there is one.
+    FrameRecorder(ReadableStreamView &source, bool read_ahead, Mutex *mutex)
+        : source_(source), read_ahead_(read_ahead), mutex_(mutex), block_(NULL), begin_(0), pos_(0), eof_(false) {}
+
+    ~FrameRecorder() {
+        for (size_t n = 0; n < blocks_.size(); n++) {
+            delete blocks_[n];
+        }
+    }
+
+    // The next message starts here
+    void start() {
+        begin_ = pos_;
+    }
+
+    // The message read and skipped since start, its block is kept until it is released
+    void finish(Frame &frame) {
+        frame.block = block_;
+        frame.data = &block_->data[begin_];
+        frame.size = pos_ - begin_;
+        lock();
+        block_->users++;
+        unlock();
+    }
+
+    // Hands back the block of a decoded message
+    void release(Frame &frame) {
+        if (frame.block != NULL) {
+            lock();
+            frame.block->users--;
+            unlock();
+            frame = Frame();
+        }
+    }
+
+    virtual void read(char *buffer, size_t count) {
+        if (fill(count)) {
+            memcpy(buffer, &block_->data[pos_], count);
+            pos_ += count;
+        }
+    }
+
+    virtual bool eof() {
+        return eof_;
+    }
+
+    // The data of the message, read into the block but not copied from it
+    virtual void skip(size_t count) {
+        if (fill(count)) {
+            pos_ += count;
+        }
+    }
+
+private:
+    // Not copyable, the frames point into the blocks
+    FrameRecorder(const FrameRecorder &);
+    FrameRecorder &operator=(const FrameRecorder &);
+
+    void lock() {
+        if (mutex_ != NULL) {
+            mutex_->lock();
+        }
+    }
+
+    void unlock() {
+        if (mutex_ != NULL) {
+            mutex_->unlock();
+        }
+    }
+
+    // A block no message uses any more, or a new one, of at least size bytes. Only the reader
+    // changes the list of blocks, the workers only count down their users.
+    Block *takeBlock(size_t size) {
+        Block *block = NULL;
+        lock();
+        for (size_t n = 0; n < blocks_.size() && block == NULL; n++) {
+            if (blocks_[n]->users == 0 && blocks_[n] != block_) {
+                block = blocks_[n];
+            }
+        }
+        unlock();
+        if (block == NULL) {
+            block = new Block(size);
+            blocks_.push_back(block);
+        } else if (block->data.size() < size) {
+            block->data.resize(size);
+        }
+        block->end = 0;
+        return block;
+    }
+
+    // Makes count more bytes of the message available at pos_, false at the end of the stream
+    bool fill(size_t count) {
+        if (block_ != NULL && block_->end - pos_ >= count) {
+            return true;
+        }
+        size_t needed = pos_ - begin_ + count;
+        if (block_ == NULL || begin_ + needed > block_->data.size()) {
+            Block *block = takeBlock(std::max(needed, BLOCK_SIZE));
+            if (block_ != NULL && block_->end > begin_) {
+                block->end = block_->end - begin_;
+                memcpy(&block->data[0], &block_->data[begin_], block->end);
+            }
+            pos_ -= begin_;
+            begin_ = 0;
+            block_ = block;
+        }
+        while (block_->end - pos_ < count) {
+            char *end = &block_->data[0] + block_->end;
+            if (!read_ahead_ || source_.single_byte_reads()) {
+                // Sources that cannot read ahead are read no further than the message
+                size_t missing = pos_ + count - block_->end;
+                source_.read(end, missing);
+                if (source_.eof()) {
+                    eof_ = true;
+                    return false;
+                }
+                block_->end += missing;
+            } else {
+                size_t n = source_.read_some(end, block_->data.size() - block_->end);
+                if (n == 0) {
+                    eof_ = true;
+                    return false;
+                }
+                block_->end += n;
+            }
+        }
+        return true;
+    }
+
+    ReadableStreamView &source_;
+    bool read_ahead_;
+    Mutex *mutex_;
+    std::vector<Block *> blocks_;
+    // The block read into, the message framed in it and the read position
+    Block *block_;
+    size_t begin_;
+    size_t pos_;
+    bool eof_;
+};
+
+} // namespace
+
+DecodedMessage::DecodedMessage() : id_(ISMRMRD_MESSAGE_UNPEEKED), data_type_(0), payload_(NULL), meta_(NULL) {}
+
+DecodedMessage::~DecodedMessage() {
+    delete payload_;
+    delete meta_;
+}
+
+uint16_t DecodedMessage::getId() const {
+    return id_;
+}
+
+uint16_t DecodedMessage::getDataType() const {
+    return data_type_;
+}
+
+const MetaContainer &DecodedMessage::getMeta() const {
+    static const MetaContainer empty;
+    return meta_ ? *meta_ : empty;
+}
+
+void DecodedMessage::swap(DecodedMessage &other) {
+    std::swap(id_, other.id_);
+    std::swap(data_type_, other.data_type_);
+    std::swap(payload_, other.payload_);
+    std::swap(meta_, other.meta_);
+}
+
+DecodePipelineOptions::DecodePipelineOptions() : workers(2), queue_size(64), parse_image_meta(false), read_ahead(true) {}
+
+struct DecodePipeline::Impl {
+    /**
+     *   A message on its way from the reader to readNext.
+     *
+     *   The reader frames a slot, a worker decodes it and readNext takes the
+     *   message out. Only one of them uses a slot at a time, so its fields are
+     *   accessed without the lock; the hand-overs happen under it.
+     */
+    struct Slot {
+        Slot() : decoded(false) {}
+
+        Frame frame;
+        DecodedMessage message;
+        std::string error;
+        bool decoded;
+    };
+
+    // The reader or a worker, on pthreads or Windows threads
+    struct Thread {
+        Impl *impl;
+        void (Impl::*run)();
+#ifdef _WIN32
+        HANDLE handle;
+#else
+        pthread_t thread;
+#endif
+    };
+
+    Impl(ReadableStreamView &source, const DecodePipelineOptions &options);
+    ~Impl();
+
+    // Reads the next message into the slot, returns true for the last one
+    bool frame(Slot &slot);
+    void decode(Slot &slot);
+    template <typename T> void decodeImage(ProtocolDeserializer &deserializer, DecodedMessage &msg);
+    template <typename T> void decodeArray(ProtocolDeserializer &deserializer, DecodedMessage &msg);
+
+#ifdef _WIN32
+    static unsigned __stdcall threadMain(void *arg);
+#else
+    static void *threadMain(void *arg);
+#endif
+    bool startThread(void (Impl::*run)());
+    void runReader();
+    void runWorker();
+    void stopThreads();
+
+    DecodePipelineOptions options;
+    Mutex mutex;
+    FrameRecorder recorder;
+    ProtocolDeserializer framer;
+    std::vector<Slot *> slots;
+    // Messages framed, given to a worker and returned by readNext
+    uint64_t framed;
+    uint64_t decoding;
+    uint64_t consumed;
+    bool finished;
+
+    // Room for the reader, messages for the workers, the next message for readNext
+    Condition space;
+    Condition work;
+    Condition ready;
+    bool reader_done;
+    bool stop;
+    std::vector<Thread> threads;
+};
+
+DecodePipeline::Impl::Impl(ReadableStreamView &source, const DecodePipelineOptions &options)
+    : options(options), recorder(source, options.read_ahead, options.workers > 0 ? &mutex : NULL), framer(recorder),
+      framed(0), decoding(0), consumed(0), finished(false), reader_done(false), stop(false) {
+    size_t count = options.workers > 0 ? std::max<size_t>(options.queue_size, 1) : 1;
+    slots.reserve(count);
+    for (size_t n = 0; n < count; n++) {
+        slots.push_back(new Slot);
+    }
+    if (options.workers == 0) {
+        return;
+    }
+
+    // Threads keep a pointer to their entry
+    threads.reserve(options.workers + 1);
+    bool started = startThread(&Impl::runReader);
+    for (unsigned int w = 0; started && w < options.workers; w++) {
+        started = startThread(&Impl::runWorker);
+    }
+    if (!started) {
+        stopThreads();
+        for (size_t n = 0; n < slots.size(); n++) {
+            delete slots[n];
+        }
+        throw std::runtime_error("Failed to start decode threads");
+    }
+}
+
+DecodePipeline::Impl::~Impl() {
+    if (options.workers > 0) {
+        stopThreads();
+    }
+    for (size_t n = 0; n < slots.size(); n++) {
+        delete slots[n];
+    }
+}
+
+bool DecodePipeline::Impl::frame(Slot &slot) {
+    recorder.start();
+    slot.error.clear();
+    try {
+        bool close = framer.peek() == ISMRMRD_MESSAGE_CLOSE;
+        if (!close) {
+            framer.skip();
+            if (recorder.eof()) {
+                throw std::runtime_error("Stream ended inside a message");
+            }
+        }
+        recorder.finish(slot.frame);
+        return close;
+    } catch (std::exception &e) {
+        slot.error = e.what();
+        return true;
+    }
+}
+
+template <typename T>
+void DecodePipeline::Impl::decodeImage(ProtocolDeserializer &deserializer, DecodedMessage &msg) {
+    Image<T> &img = msg.reset<Image<T> >(ISMRMRD_MESSAGE_IMAGE, static_cast<uint16_t>(deserializer.peek_image_data_type()));
+    deserializer.deserialize(img);
+    if (options.parse_image_meta && img.getAttributeStringLength() > 0) {
+        if (msg.meta_ == NULL) {
+            msg.meta_ = new MetaContainer;
+        }
+        ISMRMRD::deserialize(img.getAttributeString(), *msg.meta_);
+    }
+}
+
+template <typename T>
+void DecodePipeline::Impl::decodeArray(ProtocolDeserializer &deserializer, DecodedMessage &msg) {
+    deserializer.deserialize(
+        msg.reset<NDArray<T> >(ISMRMRD_MESSAGE_NDARRAY, static_cast<uint16_t>(deserializer.peek_ndarray_data_type())));
+}
+
+void DecodePipeline::Impl::decode(Slot &slot) {
+    if (!slot.error.empty()) {
+        return;
+    }
+    DecodedMessage &msg = slot.message;
+    if (msg.meta_ != NULL) {
+        *msg.meta_ = MetaContainer();
+    }
+    try {
+        MemoryReadableStreamView view(slot.frame.data, slot.frame.size);
+        ProtocolDeserializer deserializer(view);
+        uint16_t id = deserializer.peek();
+        switch (id) {
+        case ISMRMRD_MESSAGE_CONFIG_FILE:
+            deserializer.deserialize(msg.reset<ConfigFile>(id, 0));
+            break;
+        case ISMRMRD_MESSAGE_CONFIG_TEXT:
+            deserializer.deserialize(msg.reset<ConfigText>(id, 0));
+            break;
+        case ISMRMRD_MESSAGE_TEXT:
+            deserializer.deserialize(msg.reset<TextMessage>(id, 0));
+            break;
+        case ISMRMRD_MESSAGE_HEADER:
+            deserializer.deserialize(msg.reset<IsmrmrdHeader>(id, 0));
+            break;
+        case ISMRMRD_MESSAGE_CLOSE:
+            // Keeps the payload, it is reused by the next message of its type
+            msg.id_ = id;
+            msg.data_type_ = 0;
+            break;
+        case ISMRMRD_MESSAGE_ACQUISITION:
+            deserializer.deserialize(msg.reset<Acquisition>(id, 0));
+            break;
+        case ISMRMRD_MESSAGE_ACQUISITION_BATCH:
+            deserializer.deserialize(msg.reset<std::vector<Acquisition> >(id, 0));
+            break;
+        case ISMRMRD_MESSAGE_WAVEFORM:
+            deserializer.deserialize(msg.reset<Waveform>(id, 0));
+            break;
+        case ISMRMRD_MESSAGE_IMAGE:
+            switch (deserializer.peek_image_data_type()) {
+            case ISMRMRD_USHORT:
+                decodeImage<uint16_t>(deserializer, msg);
+                break;
+            case ISMRMRD_SHORT:
+                decodeImage<int16_t>(deserializer, msg);
+                break;
+            case ISMRMRD_UINT:
+                decodeImage<uint32_t>(deserializer, msg);
+                break;
+            case ISMRMRD_INT:
+                decodeImage<int32_t>(deserializer, msg);
+                break;
+            case ISMRMRD_FLOAT:
+                decodeImage<float>(deserializer, msg);
+                break;
+            case ISMRMRD_DOUBLE:
+                decodeImage<double>(deserializer, msg);
+                break;
+            case ISMRMRD_CXFLOAT:
+                decodeImage<complex_float_t>(deserializer, msg);
+                break;
+            case ISMRMRD_CXDOUBLE:
+                decodeImage<complex_double_t>(deserializer, msg);
+                break;
+            default:
+                throw std::runtime_error("Unknown image type");
+            }
+            break;
+        case ISMRMRD_MESSAGE_NDARRAY:
+            switch (deserializer.peek_ndarray_data_type()) {
+            case ISMRMRD_USHORT:
+                decodeArray<uint16_t>(deserializer, msg);
+                break;
+            case ISMRMRD_SHORT:
+                decodeArray<int16_t>(deserializer, msg);
+                break;
+            case ISMRMRD_UINT:
+                decodeArray<uint32_t>(deserializer, msg);
+                break;
+            case ISMRMRD_INT:
+                decodeArray<int32_t>(deserializer, msg);
+                break;
+            case ISMRMRD_FLOAT:
+                decodeArray<float>(deserializer, msg);
+                break;
+            case ISMRMRD_DOUBLE:
+                decodeArray<double>(deserializer, msg);
+                break;
+            case ISMRMRD_CXFLOAT:
+                decodeArray<complex_float_t>(deserializer, msg);
+                break;
+            case ISMRMRD_CXDOUBLE:
+                decodeArray<complex_double_t>(deserializer, msg);
+                break;
+            default:
+                throw std::runtime_error("Unknown nd array type");
+            }
+            break;
+        default: {
+            std::stringstream ss;
+            ss << "Unknown message type " << id;
+            throw std::runtime_error(ss.str());
+        }
+        }
+    } catch (std::exception &e) {
+        slot.error = e.what();
+    }
+    recorder.release(slot.frame);
+}
+
+#ifdef _WIN32
+unsigned __stdcall DecodePipeline::Impl::threadMain(void *arg) {
+    Thread *thread = static_cast<Thread *>(arg);
+    (thread->impl->*thread->run)();
+    return 0;
+}
+
+bool DecodePipeline::Impl::startThread(void (Impl::*run)()) {
+    Thread thread;
+    thread.impl = this;
+    thread.run = run;
+    threads.push_back(thread);
+    threads.back().handle = reinterpret_cast<HANDLE>(_beginthreadex(NULL, 0, &Impl::threadMain, &threads.back(), 0, NULL));
+    if (threads.back().handle == 0) {
+        threads.pop_back();
+        return false;
+    }
+    return true;
+}
+#else
+void *DecodePipeline::Impl::threadMain(void *arg) {
+    Thread *thread = static_cast<Thread *>(arg);
+    (thread->impl->*thread->run)();
+    return NULL;
+}
+
+bool DecodePipeline::Impl::startThread(void (Impl::*run)()) {
+    Thread thread;
+    thread.impl = this;
+    thread.run = run;
+    threads.push_back(thread);
+    if (pthread_create(&threads.back().thread, NULL, &Impl::threadMain, &threads.back()) != 0) {
+        threads.pop_back();
+        return false;
+    }
+    return true;
+}
+#endif
+
+void DecodePipeline::Impl::runReader() {
+    ScopedLock lock(mutex);
+    while (!stop) {
+        if (framed - consumed >= slots.size()) {
+            space.wait(mutex);
+            continue;
+        }
+        Slot &slot = *slots[framed % slots.size()];
+        mutex.unlock();
+        bool last = frame(slot);
+        mutex.lock();
+        framed++;
+        work.signal();
+        if (last) {
+            break;
+        }
+    }
+    reader_done = true;
+    work.broadcast();
+}
+
+void DecodePipeline::Impl::runWorker() {
+    ScopedLock lock(mutex);
+    while (!stop) {
+        if (decoding == framed) {
+            if (reader_done) {
+                break;
+            }
+            work.wait(mutex);
+            continue;
+        }
+        Slot &slot = *slots[decoding % slots.size()];
+        decoding++;
+        mutex.unlock();
+        decode(slot);
+        mutex.lock();
+        slot.decoded = true;
+        ready.signal();
+    }
+}
+
+void DecodePipeline::Impl::stopThreads() {
+    {
+        ScopedLock lock(mutex);
+        stop = true;
+        space.broadcast();
+        work.broadcast();
+    }
+    for (size_t t = 0; t < threads.size(); t++) {
+#ifdef _WIN32
+        WaitForSingleObject(threads[t].handle, INFINITE);
+        CloseHandle(threads[t].handle);
+#else
+        pthread_join(threads[t].thread, NULL);
+#endif
+    }
+    threads.clear();
+}
+
+DecodePipeline::DecodePipeline(ReadableStreamView &source, const DecodePipelineOptions &options)
+    : impl_(new Impl(source, options)) {}
+
+DecodePipeline::~DecodePipeline() {
+    delete impl_;
+}
+
+bool DecodePipeline::readNext(DecodedMessage &msg) {
+    if (impl_->finished) {
+        return false;
+    }
+    Impl::Slot *slot;
+    if (impl_->options.workers == 0) {
+        slot = impl_->slots[0];
+        impl_->frame(*slot);
+        impl_->decode(*slot);
+    } else {
+        ScopedLock lock(impl_->mutex);
+        slot = impl_->slots[impl_->consumed % impl_->slots.size()];
+        while (impl_->consumed == impl_->framed || !slot->decoded) {
+            impl_->ready.wait(impl_->mutex);
+        }
+    }
+
+    std::string error;
+    error.swap(slot->error);
+    bool close = error.empty() && slot->message.getId() == ISMRMRD_MESSAGE_CLOSE;
+    if (error.empty() && !close) {
+        msg.swap(slot->message);
+    }
+
+    if (impl_->options.workers > 0) {
+        // Hands the slot back to the reader
+        ScopedLock lock(impl_->mutex);
+        slot->decoded = false;
+        impl_->consumed++;
+        impl_->space.signal();
+    }
+
+    if (!error.empty()) {
+        impl_->finished = true;
+        throw std::runtime_error(error);
+    }
+    if (close) {
+        impl_->finished = true;
+        return false;
+    }
+    return true;
+}
+
+} // namespace ISMRMRD
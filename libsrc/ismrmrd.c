@@ -32,9 +32,16 @@ typedef struct ISMRMRD_error_node {
     int code;
 } ISMRMRD_error_node_t;
 
+/* Errors are pushed and popped by the same thread, each thread has its own stack */
+#if defined(_MSC_VER)
+#define ISMRMRD_THREAD_LOCAL __declspec(thread)
+#else
+#define ISMRMRD_THREAD_LOCAL __thread
+#endif
+
 static void ismrmrd_error_default(const char *file, int line,
         const char *func, int code, const char *msg);
-static ISMRMRD_error_node_t *error_stack_head = NULL;
+static ISMRMRD_THREAD_LOCAL ISMRMRD_error_node_t *error_stack_head = NULL;
 static ismrmrd_error_handler_t ismrmrd_error_handler = ismrmrd_error_default;
 
 
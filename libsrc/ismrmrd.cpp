@@ -93,25 +93,39 @@ bool AcquisitionHeader::operator==(const AcquisitionHeader &hdr) const {
            std::equal(ISMRMRD::begin(user_int), ISMRMRD::end(user_int), ISMRMRD::begin(hdr.user_int));
 }
 
+// Reallocates a buffer holding less than size bytes, buffers never shrink
+static void *reserve_buffer(void *buffer, size_t &capacity, size_t size, const char *what) {
+    if (size <= capacity) {
+        return buffer;
+    }
+    void *newPtr = realloc(buffer, size);
+    if (newPtr == NULL) {
+        throw std::runtime_error(std::string("Failed to realloc ") + what);
+    }
+    capacity = size;
+    return newPtr;
+}
+
 //
 // Acquisition class Implementation
 //
 // Constructors, assignment operator, destructor
-Acquisition::Acquisition() {
+Acquisition::Acquisition() : data_capacity(0), traj_capacity(0) {
     if (ismrmrd_init_acquisition(&acq) != ISMRMRD_NOERROR) {
         throw std::runtime_error(build_exception_string());
     }
 }
 
 
-Acquisition::Acquisition(uint16_t num_samples, uint16_t active_channels, uint16_t trajectory_dimensions){
+Acquisition::Acquisition(uint16_t num_samples, uint16_t active_channels, uint16_t trajectory_dimensions)
+    : data_capacity(0), traj_capacity(0) {
     if (ismrmrd_init_acquisition(&acq) != ISMRMRD_NOERROR) {
         throw std::runtime_error(build_exception_string());
     }
     this->resize(num_samples,active_channels,trajectory_dimensions);
 }
 
-Acquisition::Acquisition(const Acquisition &other) {
+Acquisition::Acquisition(const Acquisition &other) : data_capacity(0), traj_capacity(0) {
     int err = 0;
     // This is a deep copy
     err = ismrmrd_init_acquisition(&acq);
@@ -122,22 +136,17 @@ Acquisition::Acquisition(const Acquisition &other) {
     if (err) {
         throw std::runtime_error(build_exception_string());
     }
+    resetCapacity();
 }
 
 Acquisition & Acquisition::operator= (const Acquisition &other) {
-    // Assignment makes a copy
-    int err = 0;
+    // Assignment makes a copy, into the memory this acquisition already has
     if (this != &other )
     {
-        ismrmrd_cleanup_acquisition(&acq);
-        err = ismrmrd_init_acquisition(&acq);
-        if (err) {
-            throw std::runtime_error(build_exception_string());
-        }
-        err = ismrmrd_copy_acquisition(&acq, &other.acq);
-        if (err) {
-            throw std::runtime_error(build_exception_string());
-        }
+        memcpy(&acq.head, &other.acq.head, sizeof(AcquisitionHeader));
+        makeConsistent();
+        memcpy(acq.traj, other.acq.traj, other.getTrajSize());
+        memcpy(acq.data, other.acq.data, other.getDataSize());
     }
     return *this;
 }
@@ -349,18 +358,42 @@ const AcquisitionHeader & Acquisition::getHead() const {
 
 void Acquisition::setHead(const AcquisitionHeader &other) {
     memcpy(&acq.head, &other, sizeof(AcquisitionHeader));
-    if (ismrmrd_make_consistent_acquisition(&acq) != ISMRMRD_NOERROR) {
-        throw std::runtime_error(build_exception_string());
-    }
+    makeConsistent();
 }
 
 void Acquisition::resize(uint16_t num_samples, uint16_t active_channels, uint16_t trajectory_dimensions){
        acq.head.number_of_samples = num_samples;
        acq.head.active_channels = active_channels;
        acq.head.trajectory_dimensions = trajectory_dimensions;
-       if (ismrmrd_make_consistent_acquisition(&acq) != ISMRMRD_NOERROR) {
-           throw std::runtime_error(build_exception_string());
-       }
+       makeConsistent();
+}
+
+void Acquisition::reserve(uint16_t num_samples, uint16_t active_channels, uint16_t trajectory_dimensions) {
+    acq.traj = static_cast<float *>(reserve_buffer(acq.traj, traj_capacity,
+        size_t(num_samples) * trajectory_dimensions * sizeof(float), "acquisition trajectory array"));
+    acq.data = static_cast<complex_float_t *>(reserve_buffer(acq.data, data_capacity,
+        size_t(num_samples) * active_channels * sizeof(complex_float_t), "acquisition data array"));
+}
+
+size_t Acquisition::getDataCapacity() const {
+    return data_capacity / sizeof(complex_float_t);
+}
+
+size_t Acquisition::getTrajCapacity() const {
+    return traj_capacity / sizeof(float);
+}
+
+// Like ismrmrd_make_consistent_acquisition, but keeps memory when the sizes go down
+void Acquisition::makeConsistent() {
+    if (acq.head.available_channels < acq.head.active_channels) {
+        acq.head.available_channels = acq.head.active_channels;
+    }
+    reserve(acq.head.number_of_samples, acq.head.active_channels, acq.head.trajectory_dimensions);
+}
+
+void Acquisition::resetCapacity() {
+    data_capacity = acq.data ? getDataSize() : 0;
+    traj_capacity = acq.traj ? getTrajSize() : 0;
 }
 
 const complex_float_t * Acquisition::getDataPtr() const {
@@ -502,6 +535,7 @@ template <typename T> Image<T>::Image(uint16_t matrix_size_x,
                                       uint16_t matrix_size_y,
                                       uint16_t matrix_size_z,
                                       uint16_t channels)
+    : data_capacity(0), attribute_capacity(0)
 {
     if (ismrmrd_init_image(&im) != ISMRMRD_NOERROR) {
         throw std::runtime_error(build_exception_string());
@@ -510,7 +544,7 @@ template <typename T> Image<T>::Image(uint16_t matrix_size_x,
     resize(matrix_size_x, matrix_size_y, matrix_size_z, channels);
 }
 
-template <typename T> Image<T>::Image(const Image<T> &other) {
+template <typename T> Image<T>::Image(const Image<T> &other) : data_capacity(0), attribute_capacity(0) {
     int err = 0;
     // This is a deep copy
     err = ismrmrd_init_image(&im);
@@ -521,23 +555,20 @@ template <typename T> Image<T>::Image(const Image<T> &other) {
     if (err) {
         throw std::runtime_error(build_exception_string());
     }
+    resetCapacity();
 }
 
 template <typename T> Image<T> & Image<T>::operator= (const Image<T> &other)
 {
-    int err = 0;
-    // Assignment makes a copy
+    // Assignment makes a copy, into the memory this image already has
     if (this != &other )
     {
-        ismrmrd_cleanup_image(&im);
-        err = ismrmrd_init_image(&im);
-        if (err) {
-            throw std::runtime_error(build_exception_string());
-        }
-        err = ismrmrd_copy_image(&im, &other.im);
-        if (err) {
-            throw std::runtime_error(build_exception_string());
+        memcpy(&im.head, &other.im.head, sizeof(ImageHeader));
+        makeConsistent();
+        if (im.head.attribute_string_len > 0) {
+            memcpy(im.attribute_string, other.im.attribute_string, im.head.attribute_string_len);
         }
+        memcpy(im.data, other.im.data, other.getDataSize());
     }
     return *this;
 }
@@ -567,9 +598,46 @@ template <typename T> void Image<T>::resize(uint16_t matrix_size_x,
     im.head.matrix_size[1] = matrix_size_y;
     im.head.matrix_size[2] = matrix_size_z;
     im.head.channels = channels;
-    if (ismrmrd_make_consistent_image(&im) != ISMRMRD_NOERROR) {
-        throw std::runtime_error(build_exception_string());
+    makeConsistent();
+}
+
+template <typename T> void Image<T>::reserve(uint16_t matrix_size_x,
+                                             uint16_t matrix_size_y,
+                                             uint16_t matrix_size_z,
+                                             uint16_t channels)
+{
+    size_t size = size_t(matrix_size_x) * matrix_size_y * matrix_size_z * channels * sizeof(T);
+    im.data = reserve_buffer(im.data, data_capacity, size, "image data array");
+}
+
+template <typename T> size_t Image<T>::getDataCapacity() const
+{
+    return data_capacity / sizeof(T);
+}
+
+// Like ismrmrd_make_consistent_image, but keeps memory when the sizes go down
+template <typename T> void Image<T>::makeConsistent()
+{
+    if (im.head.attribute_string_len > 0) {
+        reserveAttributeString(im.head.attribute_string_len);
+    }
+    // An attribute string that is allocated holds at least the terminator
+    if (im.attribute_string != NULL) {
+        im.attribute_string[im.head.attribute_string_len] = '\0';
     }
+    im.data = reserve_buffer(im.data, data_capacity, ismrmrd_size_of_image_data(&im), "image data array");
+}
+
+template <typename T> void Image<T>::reserveAttributeString(size_t length)
+{
+    im.attribute_string = static_cast<char *>(
+        reserve_buffer(im.attribute_string, attribute_capacity, length + 1, "image attribute string"));
+}
+
+template <typename T> void Image<T>::resetCapacity()
+{
+    data_capacity = im.data ? getDataSize() : 0;
+    attribute_capacity = (im.attribute_string && im.head.attribute_string_len > 0) ? im.head.attribute_string_len + 1 : 0;
 }
 
 template <typename T> uint16_t Image<T>::getMatrixSizeX() const
@@ -581,9 +649,7 @@ template <typename T> void Image<T>::setMatrixSizeX(uint16_t matrix_size_x)
 {
     // TODO what if matrix_size_x = 0?
     im.head.matrix_size[0] = matrix_size_x;
-    if (ismrmrd_make_consistent_image(&im) != ISMRMRD_NOERROR) {
-        throw std::runtime_error(build_exception_string());
-    }
+    makeConsistent();
 }
 
 template <typename T> uint16_t Image<T>::getMatrixSizeY() const
@@ -597,9 +663,7 @@ template <typename T> void Image<T>::setMatrixSizeY(uint16_t matrix_size_y)
         matrix_size_y = 1;
     }
     im.head.matrix_size[1] = matrix_size_y;
-    if (ismrmrd_make_consistent_image(&im) != ISMRMRD_NOERROR) {
-        throw std::runtime_error(build_exception_string());
-    }
+    makeConsistent();
 }
 
 template <typename T> uint16_t Image<T>::getMatrixSizeZ() const
@@ -613,9 +677,7 @@ template <typename T> void Image<T>::setMatrixSizeZ(uint16_t matrix_size_z)
         matrix_size_z = 1;
     }
     im.head.matrix_size[2] = matrix_size_z;
-    if (ismrmrd_make_consistent_image(&im) != ISMRMRD_NOERROR) {
-        throw std::runtime_error(build_exception_string());
-    }
+    makeConsistent();
 }
 
 template <typename T> uint16_t Image<T>::getNumberOfChannels() const
@@ -630,9 +692,7 @@ template <typename T> void Image<T>::setNumberOfChannels(uint16_t channels)
     }
 
     im.head.channels = channels;
-    if (ismrmrd_make_consistent_image(&im) != ISMRMRD_NOERROR) {
-        throw std::runtime_error(build_exception_string());
-    }
+    makeConsistent();
 }
 
 
@@ -1058,9 +1118,7 @@ template <typename T> void Image<T>::setHead(const ImageHeader &other) {
     }
 
     memcpy(&im.head, &other, sizeof(ImageHeader));
-    if (ismrmrd_make_consistent_image(&im) != ISMRMRD_NOERROR) {
-        throw std::runtime_error(build_exception_string());
-    }
+    makeConsistent();
 }
 
 // Attribute string
@@ -1087,14 +1145,8 @@ template <typename T> void Image<T>::setAttributeString(const char *attr)
     // Get the string length
     size_t length = strlen(attr);
 
-    // Allocate space plus a null terminator and check for success
-    char *newPointer = (char *)realloc(im.attribute_string, (length+1) * sizeof(*im.attribute_string));
-    if (NULL==newPointer) {
-        throw std::runtime_error(build_exception_string());
-    }
-
-    // Make changes only if reallocation was successful
-    im.attribute_string = newPointer;
+    // Make sure there is space plus a null terminator
+    reserveAttributeString(length);
     im.head.attribute_string_len = static_cast<uint32_t>(length);
 
     // Set the null terminator and copy the string
@@ -1148,7 +1200,7 @@ template <typename T> T & Image<T>::operator () (uint16_t ix, uint16_t iy, uint1
 //
 // Array class Implementation
 //
-template <typename T> NDArray<T>::NDArray()
+template <typename T> NDArray<T>::NDArray() : data_capacity(0)
 {
     if (ismrmrd_init_ndarray(&arr) != ISMRMRD_NOERROR) {
         throw std::runtime_error(build_exception_string());
@@ -1156,7 +1208,7 @@ template <typename T> NDArray<T>::NDArray()
     arr.data_type = static_cast<uint16_t>(get_data_type<T>());
 }
 
-template <typename T> NDArray<T>::NDArray(const std::vector<size_t> dimvec)
+template <typename T> NDArray<T>::NDArray(const std::vector<size_t> dimvec) : data_capacity(0)
 {
     if (ismrmrd_init_ndarray(&arr) != ISMRMRD_NOERROR) {
         throw std::runtime_error(build_exception_string());
@@ -1165,7 +1217,7 @@ template <typename T> NDArray<T>::NDArray(const std::vector<size_t> dimvec)
     resize(dimvec);
 }
 
-template <typename T> NDArray<T>::NDArray(const NDArray<T> &other)
+template <typename T> NDArray<T>::NDArray(const NDArray<T> &other) : data_capacity(0)
 {
     int err = 0;
     err = ismrmrd_init_ndarray(&arr);
@@ -1176,6 +1228,7 @@ template <typename T> NDArray<T>::NDArray(const NDArray<T> &other)
     if (err) {
         throw std::runtime_error(build_exception_string());
     }
+    resetCapacity();
 }
 
 template <typename T> NDArray<T>::~NDArray()
@@ -1185,17 +1238,17 @@ template <typename T> NDArray<T>::~NDArray()
 
 template <typename T> NDArray<T> & NDArray<T>::operator= (const NDArray<T> &other)
 {
-    int err = 0;
-    // Assignment makes a copy
+    // Assignment makes a copy, into the memory this array already has
     if (this != &other )
     {
-        err = ismrmrd_init_ndarray(&arr);
-        if (err) {
-            throw std::runtime_error(build_exception_string());
+        arr.version = other.arr.version;
+        arr.ndim = other.arr.ndim;
+        for (int n = 0; n < ISMRMRD_NDARRAY_MAXDIM; n++) {
+            arr.dims[n] = other.arr.dims[n];
         }
-        err = ismrmrd_copy_ndarray(&arr, &other.arr);
-        if (err) {
-            throw std::runtime_error(build_exception_string());
+        makeConsistent();
+        if (other.arr.data != NULL) {
+            memcpy(arr.data, other.arr.data, other.getDataSize());
         }
     }
     return *this;
@@ -1225,9 +1278,28 @@ template <typename T> void NDArray<T>::resize(const std::vector<size_t> dimvec)
     for (int n=0; n<arr.ndim; n++) {
         arr.dims[n] = dimvec[n];
     }
-    if (ismrmrd_make_consistent_ndarray(&arr) != ISMRMRD_NOERROR) {
-        throw std::runtime_error(build_exception_string());
+    makeConsistent();
+}
+
+template <typename T> void NDArray<T>::reserve(const std::vector<size_t> &dimvec) {
+    size_t size = sizeof(T);
+    for (size_t n = 0; n < dimvec.size(); n++) {
+        size *= dimvec[n];
     }
+    arr.data = reserve_buffer(arr.data, data_capacity, size, "NDArray data array");
+}
+
+template <typename T> size_t NDArray<T>::getDataCapacity() const {
+    return data_capacity / sizeof(T);
+}
+
+// Like ismrmrd_make_consistent_ndarray, but keeps memory when the sizes go down
+template <typename T> void NDArray<T>::makeConsistent() {
+    arr.data = reserve_buffer(arr.data, data_capacity, ismrmrd_size_of_ndarray_data(&arr), "NDArray data array");
+}
+
+template <typename T> void NDArray<T>::resetCapacity() {
+    data_capacity = arr.data ? getDataSize() : 0;
 }
 
 template <typename T> T * NDArray<T>::getDataPtr() {
@@ -1281,37 +1353,37 @@ template <> EXPORTISMRMRD ISMRMRD_DataTypes get_data_type<uint16_t>()
     return ISMRMRD_USHORT;
 }
 
-template <> EXPORTISMRMRD inline ISMRMRD_DataTypes get_data_type<int16_t>()
+template <> EXPORTISMRMRD ISMRMRD_DataTypes get_data_type<int16_t>()
 {
     return ISMRMRD_SHORT;
 }
 
-template <> EXPORTISMRMRD inline ISMRMRD_DataTypes get_data_type<uint32_t>()
+template <> EXPORTISMRMRD ISMRMRD_DataTypes get_data_type<uint32_t>()
 {
     return ISMRMRD_UINT;
 }
 
-template <> EXPORTISMRMRD inline ISMRMRD_DataTypes get_data_type<int32_t>()
+template <> EXPORTISMRMRD ISMRMRD_DataTypes get_data_type<int32_t>()
 {
     return ISMRMRD_INT;
 }
 
-template <> EXPORTISMRMRD inline ISMRMRD_DataTypes get_data_type<float>()
+template <> EXPORTISMRMRD ISMRMRD_DataTypes get_data_type<float>()
 {
     return ISMRMRD_FLOAT;
 }
 
-template <> EXPORTISMRMRD inline ISMRMRD_DataTypes get_data_type<double>()
+template <> EXPORTISMRMRD ISMRMRD_DataTypes get_data_type<double>()
 {
     return ISMRMRD_DOUBLE;
 }
 
-template <> EXPORTISMRMRD inline ISMRMRD_DataTypes get_data_type<complex_float_t>()
+template <> EXPORTISMRMRD ISMRMRD_DataTypes get_data_type<complex_float_t>()
 {
     return ISMRMRD_CXFLOAT;
 }
 
-template <> EXPORTISMRMRD inline ISMRMRD_DataTypes get_data_type<complex_double_t>()
+template <> EXPORTISMRMRD ISMRMRD_DataTypes get_data_type<complex_double_t>()
 {
     return ISMRMRD_CXDOUBLE;
 }
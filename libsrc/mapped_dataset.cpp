@@ -0,0 +1,373 @@
+#include "ismrmrd/mapped_dataset.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ISMRMRD {
+
+namespace {
+
+// Same memory types as used by the C library when reading and writing
+hid_t native_type(uint16_t data_type)
+{
+    switch (data_type) {
+    case ISMRMRD_USHORT:
+        return H5Tcopy(H5T_NATIVE_UINT16);
+    case ISMRMRD_SHORT:
+        return H5Tcopy(H5T_NATIVE_INT16);
+    case ISMRMRD_UINT:
+        return H5Tcopy(H5T_NATIVE_UINT32);
+    case ISMRMRD_INT:
+        return H5Tcopy(H5T_NATIVE_INT32);
+    case ISMRMRD_FLOAT:
+        return H5Tcopy(H5T_NATIVE_FLOAT);
+    case ISMRMRD_DOUBLE:
+        return H5Tcopy(H5T_NATIVE_DOUBLE);
+    case ISMRMRD_CXFLOAT: {
+        hid_t type = H5Tcreate(H5T_COMPOUND, sizeof(complex_float_t));
+        H5Tinsert(type, "real", 0, H5T_NATIVE_FLOAT);
+        H5Tinsert(type, "imag", sizeof(float), H5T_NATIVE_FLOAT);
+        return type;
+    }
+    case ISMRMRD_CXDOUBLE: {
+        hid_t type = H5Tcreate(H5T_COMPOUND, sizeof(complex_double_t));
+        H5Tinsert(type, "real", 0, H5T_NATIVE_DOUBLE);
+        H5Tinsert(type, "imag", sizeof(double), H5T_NATIVE_DOUBLE);
+        return type;
+    }
+    default:
+        return -1;
+    }
+}
+
+// The ISMRMRD data type if the file type is identical to the memory type, 0 otherwise
+uint16_t native_data_type(hid_t file_type)
+{
+    for (uint16_t data_type = ISMRMRD_USHORT; data_type <= ISMRMRD_CXDOUBLE; data_type++) {
+        hid_t type = native_type(data_type);
+        if (type < 0) {
+            continue;
+        }
+        bool equal = H5Tequal(file_type, type) > 0;
+        H5Tclose(type);
+        if (equal) {
+            return data_type;
+        }
+    }
+    return 0;
+}
+
+} // namespace
+
+//
+// MappedDataset class implementation
+//
+MappedDataset::MappedDataset(const char *filename, const char *groupname)
+    : map_(NULL), map_size_(0), base_address_(0)
+{
+#ifdef _WIN32
+    (void)filename;
+    (void)groupname;
+    throw std::runtime_error("Memory mapped datasets are not supported on this platform.");
+#else
+    ScopedLock lock(getHDF5Mutex());
+    if (ismrmrd_init_dataset(&dset_, filename, groupname) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+    if (ismrmrd_open_dataset_readonly(&dset_) != ISMRMRD_NOERROR) {
+        ismrmrd_close_dataset(&dset_);
+        throw std::runtime_error(build_exception_string());
+    }
+
+    // Addresses in the file are relative to the end of the user block
+    hid_t fcpl = H5Fget_create_plist(dset_.fileid);
+    if (fcpl >= 0) {
+        H5Pget_userblock(fcpl, &base_address_);
+        H5Pclose(fcpl);
+    }
+
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        ismrmrd_close_dataset(&dset_);
+        throw std::runtime_error("Failed to open file for mapping.");
+    }
+    map_size_ = static_cast<uint64_t>(st.st_size);
+    if (map_size_ > 0) {
+        void *map = mmap(NULL, static_cast<size_t>(map_size_), PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            ismrmrd_close_dataset(&dset_);
+            throw std::runtime_error("Failed to map file.");
+        }
+        map_ = static_cast<const char *>(map);
+    }
+    // The mapping stays valid after closing the descriptor
+    close(fd);
+#endif
+}
+
+MappedDataset::~MappedDataset()
+{
+    ScopedLock lock(getHDF5Mutex());
+    std::map<std::string, Variable>::iterator it;
+    for (it = variables_.begin(); it != variables_.end(); ++it) {
+        if (it->second.dataset >= 0) {
+            H5Dclose(it->second.dataset);
+        }
+    }
+#ifndef _WIN32
+    if (map_ != NULL) {
+        munmap(const_cast<char *>(map_), static_cast<size_t>(map_size_));
+    }
+#endif
+    ismrmrd_close_dataset(&dset_);
+}
+
+// Looks up the layout of a dataset below the group, once per variable
+MappedDataset::Variable &MappedDataset::variable(const std::string &var)
+{
+    std::map<std::string, Variable>::iterator it = variables_.find(var);
+    if (it != variables_.end()) {
+        return it->second;
+    }
+
+    Variable v;
+    v.dataset = -1;
+    v.mappable = false;
+    v.chunked = false;
+    v.chunk_elements = 0;
+    v.offset = HADDR_UNDEF;
+    v.data_type = 0;
+    v.ndim = 0;
+    v.element_size = 0;
+    v.count = 0;
+    for (uint16_t n = 0; n < ISMRMRD_NDARRAY_MAXDIM; n++) {
+        v.dims[n] = 0;
+    }
+
+    std::string path = std::string(dset_.groupname) + "/" + var;
+    if (H5Lexists(dset_.fileid, path.c_str(), H5P_DEFAULT) > 0) {
+        v.dataset = H5Dopen2(dset_.fileid, path.c_str(), H5P_DEFAULT);
+    }
+    if (v.dataset < 0) {
+        return variables_[var] = v;
+    }
+
+    hid_t space = H5Dget_space(v.dataset);
+    int rank = H5Sget_simple_extent_ndims(space);
+    if (rank >= 1 && rank - 1 <= ISMRMRD_NDARRAY_MAXDIM) {
+        std::vector<hsize_t> hdfdims(rank);
+        H5Sget_simple_extent_dims(space, &hdfdims[0], NULL);
+        v.count = hdfdims[0];
+        // The slowest varying dimension counts the appended elements
+        v.ndim = static_cast<uint16_t>(rank - 1);
+        for (int n = 0; n < rank - 1; n++) {
+            v.dims[n] = static_cast<size_t>(hdfdims[rank - n - 1]);
+        }
+
+        hid_t type = H5Dget_type(v.dataset);
+        v.data_type = native_data_type(type);
+        H5Tclose(type);
+
+        v.element_size = ismrmrd_sizeof_data_type(v.data_type);
+        for (int n = 1; n < rank; n++) {
+            v.element_size *= hdfdims[n];
+        }
+
+        hid_t dcpl = H5Dget_create_plist(v.dataset);
+        H5D_layout_t layout = H5Pget_layout(dcpl);
+        bool filtered = H5Pget_nfilters(dcpl) != 0;
+        if (v.data_type != 0 && !filtered) {
+            if (layout == H5D_CONTIGUOUS) {
+                v.offset = H5Dget_offset(v.dataset);
+                v.mappable = v.offset != HADDR_UNDEF;
+            } else if (layout == H5D_CHUNKED) {
+#if H5_VERSION_GE(1, 10, 5)
+                // Chunks have to hold whole elements, one after the other
+                std::vector<hsize_t> chunk(rank);
+                H5Pget_chunk(dcpl, rank, &chunk[0]);
+                v.chunked = true;
+                v.chunk_elements = chunk[0];
+                v.mappable = chunk[0] >= 1;
+                for (int n = 1; n < rank; n++) {
+                    v.mappable = v.mappable && chunk[n] == hdfdims[n];
+                }
+#endif
+            }
+        }
+        H5Pclose(dcpl);
+    }
+    H5Sclose(space);
+
+    return variables_[var] = v;
+}
+
+const void *MappedDataset::elementData(const Variable &v, uint32_t index)
+{
+    if (v.dataset < 0) {
+        throw std::runtime_error("Path to element not found.");
+    }
+    if (!v.mappable) {
+        throw std::runtime_error("Data is compressed or needs conversion, it cannot be mapped.");
+    }
+    if (index >= v.count) {
+        throw std::runtime_error("Index out of range.");
+    }
+
+    haddr_t address = HADDR_UNDEF;
+    if (v.chunked) {
+#if H5_VERSION_GE(1, 10, 5)
+        // Chunks at the end of the dataset are stored in full as well
+        std::vector<hsize_t> offset(v.ndim + 1, 0);
+        offset[0] = index - index % v.chunk_elements;
+        unsigned filter_mask = 0;
+        hsize_t size = 0;
+        if (H5Dget_chunk_info_by_coord(v.dataset, &offset[0], &filter_mask, &address, &size) < 0 ||
+            size != v.chunk_elements * v.element_size || address == HADDR_UNDEF) {
+            address = HADDR_UNDEF;
+        } else {
+            address += (index % v.chunk_elements) * v.element_size;
+        }
+#endif
+    } else {
+        address = v.offset + index * v.element_size;
+    }
+
+    if (address == HADDR_UNDEF || base_address_ + address + v.element_size > map_size_) {
+        throw std::runtime_error("Element is not stored in the file.");
+    }
+    return map_ + base_address_ + address;
+}
+
+// XML Header
+void MappedDataset::readHeader(std::string &xmlstring)
+{
+    ScopedLock lock(getHDF5Mutex());
+    char *temp = ismrmrd_read_header(&dset_);
+    if (NULL == temp) {
+        throw std::runtime_error(build_exception_string());
+    }
+    xmlstring = std::string(temp);
+    free(temp);
+}
+
+// Acquisitions
+void MappedDataset::readAcquisition(uint32_t index, Acquisition &acq)
+{
+    ScopedLock lock(getHDF5Mutex());
+    // ismrmrd_read_acquisition reallocates to the sizes it reads
+    acq.data_capacity = acq.traj_capacity = 0;
+    int status = ismrmrd_read_acquisition(&dset_, index, &acq.acq);
+    if (status != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+    acq.resetCapacity();
+}
+
+uint32_t MappedDataset::getNumberOfAcquisitions()
+{
+    ScopedLock lock(getHDF5Mutex());
+    return ismrmrd_get_number_of_acquisitions(&dset_);
+}
+
+// Waveforms
+void MappedDataset::readWaveform(uint32_t index, Waveform &wav)
+{
+    ScopedLock lock(getHDF5Mutex());
+    int status = ismrmrd_read_waveform(&dset_, index, &wav);
+    if (status != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+}
+
+uint32_t MappedDataset::getNumberOfWaveforms()
+{
+    ScopedLock lock(getHDF5Mutex());
+    return ismrmrd_get_number_of_waveforms(&dset_);
+}
+
+// Images
+template <typename T> ImageView<T> MappedDataset::readImage(const std::string &var, uint32_t index)
+{
+    ScopedLock lock(getHDF5Mutex());
+    const Variable &v = variable(var + "/data");
+    const void *data = elementData(v, index);
+    if (v.data_type != get_data_type<T>()) {
+        throw std::runtime_error("Image data type does not match template type");
+    }
+    ISMRMRD_ImageHeader head;
+    if (ismrmrd_read_image_header(&dset_, var.c_str(), index, &head) != ISMRMRD_NOERROR) {
+        throw std::runtime_error(build_exception_string());
+    }
+    return ImageView<T>(head, static_cast<const T *>(data));
+}
+
+uint32_t MappedDataset::getNumberOfImages(const std::string &var)
+{
+    ScopedLock lock(getHDF5Mutex());
+    return ismrmrd_get_number_of_images(&dset_, var.c_str());
+}
+
+bool MappedDataset::canMapImages(const std::string &var)
+{
+    ScopedLock lock(getHDF5Mutex());
+    return variable(var + "/data").mappable;
+}
+
+// NDArrays
+template <typename T> NDArrayView<T> MappedDataset::readNDArray(const std::string &var, uint32_t index)
+{
+    ScopedLock lock(getHDF5Mutex());
+    const Variable &v = variable(var);
+    const void *data = elementData(v, index);
+    if (v.data_type != get_data_type<T>()) {
+        throw std::runtime_error("Array data type does not match template type");
+    }
+    return NDArrayView<T>(static_cast<const T *>(data), v.ndim, v.dims);
+}
+
+uint32_t MappedDataset::getNumberOfNDArrays(const std::string &var)
+{
+    ScopedLock lock(getHDF5Mutex());
+    return ismrmrd_get_number_of_arrays(&dset_, var.c_str());
+}
+
+bool MappedDataset::canMapNDArrays(const std::string &var)
+{
+    ScopedLock lock(getHDF5Mutex());
+    return variable(var).mappable;
+}
+
+// Specific instantiations
+template EXPORTISMRMRD ImageView<uint16_t> MappedDataset::readImage(const std::string &var, uint32_t index);
+template EXPORTISMRMRD ImageView<int16_t> MappedDataset::readImage(const std::string &var, uint32_t index);
+template EXPORTISMRMRD ImageView<uint32_t> MappedDataset::readImage(const std::string &var, uint32_t index);
+template EXPORTISMRMRD ImageView<int32_t> MappedDataset::readImage(const std::string &var, uint32_t index);
+template EXPORTISMRMRD ImageView<float> MappedDataset::readImage(const std::string &var, uint32_t index);
+template EXPORTISMRMRD ImageView<double> MappedDataset::readImage(const std::string &var, uint32_t index);
+template EXPORTISMRMRD ImageView<complex_float_t> MappedDataset::readImage(const std::string &var, uint32_t index);
+template EXPORTISMRMRD ImageView<complex_double_t> MappedDataset::readImage(const std::string &var, uint32_t index);
+
+template EXPORTISMRMRD NDArrayView<uint16_t> MappedDataset::readNDArray(const std::string &var, uint32_t index);
+template EXPORTISMRMRD NDArrayView<int16_t> MappedDataset::readNDArray(const std::string &var, uint32_t index);
+template EXPORTISMRMRD NDArrayView<uint32_t> MappedDataset::readNDArray(const std::string &var, uint32_t index);
+template EXPORTISMRMRD NDArrayView<int32_t> MappedDataset::readNDArray(const std::string &var, uint32_t index);
+template EXPORTISMRMRD NDArrayView<float> MappedDataset::readNDArray(const std::string &var, uint32_t index);
+template EXPORTISMRMRD NDArrayView<double> MappedDataset::readNDArray(const std::string &var, uint32_t index);
+template EXPORTISMRMRD NDArrayView<complex_float_t> MappedDataset::readNDArray(const std::string &var, uint32_t index);
+template EXPORTISMRMRD NDArrayView<complex_double_t> MappedDataset::readNDArray(const std::string &var, uint32_t index);
+
+} // namespace ISMRMRD
@@ -0,0 +1,412 @@
+#include "ismrmrd/mapped_stream.h"
+#include "ismrmrd/xml.h"
+
+#include <string.h>
+#include <stdexcept>
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ISMRMRD {
+
+namespace {
+
+// Alignment of T, without C++11 alignof
+template <typename T> struct AlignmentOf {
+    struct Probe {
+        char c;
+        T t;
+    };
+    static const size_t value = sizeof(Probe) - sizeof(T);
+};
+
+// Reads the small messages with the stream deserializers
+class MemoryReadableStreamView : public ReadableStreamView {
+public:
+    MemoryReadableStreamView(const char *data, size_t size) : _data(data), _size(size), _eof(false) {}
+
+    virtual void read(char *buffer, size_t count) {
+        if (count > _size) {
+            count = _size;
+            _eof = true;
+        }
+        memcpy(buffer, _data, count);
+        _data += count;
+        _size -= count;
+    }
+
+    virtual bool eof() {
+        return _eof;
+    }
+
+private:
+    const char *_data;
+    size_t _size;
+    bool _eof;
+};
+
+template <typename T> T load(const char *p) {
+    T value;
+    memcpy(&value, p, sizeof(T));
+    return value;
+}
+
+} // namespace
+
+MappedStreamReader::MappedStreamReader(const char *filename)
+    : map_(NULL), map_size_(0), pos_(0), batch_remaining_(0), batch_end_(0)
+{
+#ifdef _WIN32
+    (void)filename;
+    throw std::runtime_error("Memory mapped stream files are not supported on this platform.");
+#else
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        throw std::runtime_error(std::string("Failed to open stream file ") + filename);
+    }
+    map_size_ = static_cast<uint64_t>(st.st_size);
+    if (map_size_ > 0) {
+        void *map = mmap(NULL, static_cast<size_t>(map_size_), PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Failed to map stream file.");
+        }
+        map_ = static_cast<const char *>(map);
+        // The messages are read front to back
+        madvise(map, static_cast<size_t>(map_size_), MADV_SEQUENTIAL);
+    }
+    // The mapping stays valid after closing the descriptor
+    close(fd);
+#endif
+}
+
+MappedStreamReader::~MappedStreamReader()
+{
+#ifndef _WIN32
+    if (map_ != NULL) {
+        munmap(const_cast<char *>(map_), static_cast<size_t>(map_size_));
+    }
+#endif
+}
+
+uint64_t MappedStreamReader::offset() const
+{
+    return pos_;
+}
+
+uint64_t MappedStreamReader::size() const
+{
+    return map_size_;
+}
+
+// Bounds checked access to the mapping
+const char *MappedStreamReader::at(uint64_t offset, uint64_t count) const
+{
+    if (offset > map_size_ || count > map_size_ - offset) {
+        throw std::runtime_error("Unexpected end of stream file");
+    }
+    return map_ + offset;
+}
+
+// Points into the mapping if the data is aligned for T, copies it into one of the buffers otherwise
+template <typename T>
+const T *MappedStreamReader::aligned(uint64_t offset, uint64_t count, unsigned int buffer)
+{
+    if (count == 0) {
+        return NULL;
+    }
+    const char *p = at(offset, count * sizeof(T));
+    if (reinterpret_cast<uintptr_t>(p) % AlignmentOf<T>::value == 0) {
+        return reinterpret_cast<const T *>(p);
+    }
+    std::vector<double> &copy = buffers_[buffer];
+    size_t needed = static_cast<size_t>((count * sizeof(T) + sizeof(double) - 1) / sizeof(double));
+    if (copy.size() < needed) {
+        copy.resize(needed);
+    }
+    memcpy(&copy[0], p, static_cast<size_t>(count * sizeof(T)));
+    return reinterpret_cast<const T *>(&copy[0]);
+}
+
+uint16_t MappedStreamReader::peek()
+{
+    if (batch_remaining_ > 0) {
+        return ISMRMRD_MESSAGE_ACQUISITION_BATCH;
+    }
+    uint16_t id = load<uint16_t>(at(pos_, sizeof(uint16_t)));
+    // An empty batch carries nothing, go on to the next message
+    while (id == ISMRMRD_MESSAGE_ACQUISITION_BATCH &&
+           load<uint32_t>(at(pos_ + sizeof(uint16_t) + sizeof(uint64_t), sizeof(uint32_t))) == 0) {
+        pos_ += messageSize();
+        id = load<uint16_t>(at(pos_, sizeof(uint16_t)));
+    }
+    return id;
+}
+
+int MappedStreamReader::peek_image_data_type()
+{
+    if (peek() != ISMRMRD_MESSAGE_IMAGE) {
+        throw std::runtime_error("Cannot peak image data type if not peeking an image");
+    }
+    return load<ISMRMRD_ImageHeader>(at(pos_ + sizeof(uint16_t), sizeof(ISMRMRD_ImageHeader))).data_type;
+}
+
+int MappedStreamReader::peek_ndarray_data_type()
+{
+    if (peek() != ISMRMRD_MESSAGE_NDARRAY) {
+        throw std::runtime_error("Cannot peak nd array data type if not peeking a nd array");
+    }
+    return load<uint16_t>(at(pos_ + sizeof(uint16_t), sizeof(uint16_t)));
+}
+
+// Size of the next message including its id, as written by ProtocolSerializer
+uint64_t MappedStreamReader::messageSize()
+{
+    const uint64_t body = pos_ + sizeof(uint16_t);
+    switch (load<uint16_t>(at(pos_, sizeof(uint16_t)))) {
+    case ISMRMRD_MESSAGE_CONFIG_FILE:
+        return sizeof(uint16_t) + sizeof(ConfigFile().config);
+    case ISMRMRD_MESSAGE_CONFIG_TEXT:
+    case ISMRMRD_MESSAGE_HEADER:
+    case ISMRMRD_MESSAGE_TEXT:
+        return sizeof(uint16_t) + sizeof(uint32_t) + load<uint32_t>(at(body, sizeof(uint32_t)));
+    case ISMRMRD_MESSAGE_CLOSE:
+        return sizeof(uint16_t);
+    case ISMRMRD_MESSAGE_ACQUISITION:
+        return sizeof(uint16_t) + acquisition_size(load<ISMRMRD_AcquisitionHeader>(at(body, sizeof(ISMRMRD_AcquisitionHeader))));
+    case ISMRMRD_MESSAGE_ACQUISITION_BATCH: {
+        uint64_t length = load<uint64_t>(at(body, sizeof(uint64_t)));
+        if (length < sizeof(uint32_t) || length > map_size_) {
+            throw std::runtime_error("Invalid acquisition batch in stream file");
+        }
+        return sizeof(uint16_t) + sizeof(uint64_t) + length;
+    }
+    case ISMRMRD_MESSAGE_IMAGE: {
+        ISMRMRD_ImageHeader head = load<ISMRMRD_ImageHeader>(at(body, sizeof(head)));
+        uint64_t attr_length = load<uint64_t>(at(body + sizeof(head), sizeof(uint64_t)));
+        uint64_t data_size = image_data_size(head);
+        if (attr_length > map_size_ || data_size > map_size_) {
+            throw std::runtime_error("Invalid image in stream file");
+        }
+        return sizeof(uint16_t) + sizeof(head) + sizeof(uint64_t) + attr_length + data_size;
+    }
+    case ISMRMRD_MESSAGE_WAVEFORM: {
+        ISMRMRD_WaveformHeader head = load<ISMRMRD_WaveformHeader>(at(body, sizeof(head)));
+        return sizeof(uint16_t) + sizeof(head) + uint64_t(head.number_of_samples) * head.channels * sizeof(uint32_t);
+    }
+    case ISMRMRD_MESSAGE_NDARRAY: {
+        // Data type, version and number of dimensions, then the dimensions
+        const char *p = at(body, 3 * sizeof(uint16_t));
+        size_t element_size = ismrmrd_sizeof_data_type(load<uint16_t>(p));
+        uint16_t ndim = load<uint16_t>(p + 2 * sizeof(uint16_t));
+        if (element_size == 0 || ndim > ISMRMRD_NDARRAY_MAXDIM) {
+            throw std::runtime_error("Invalid nd array in stream file");
+        }
+        const char *dims = at(body + 3 * sizeof(uint16_t), ndim * sizeof(size_t));
+        uint64_t count = 1;
+        for (uint16_t n = 0; n < ndim; n++) {
+            count *= load<size_t>(dims + n * sizeof(size_t));
+            if (count > map_size_) {
+                throw std::runtime_error("Invalid nd array in stream file");
+            }
+        }
+        return sizeof(uint16_t) + 3 * sizeof(uint16_t) + ndim * sizeof(size_t) + count * element_size;
+    }
+    default:
+        throw std::runtime_error("Unknown message id in stream file");
+    }
+}
+
+void MappedStreamReader::skip()
+{
+    if (batch_remaining_ > 0) {
+        pos_ = batch_end_;
+        batch_remaining_ = 0;
+        return;
+    }
+    peek();
+    uint64_t size = messageSize();
+    at(pos_, size);
+    pos_ += size;
+}
+
+void MappedStreamReader::expect(uint16_t id, const char *message)
+{
+    uint16_t next = peek();
+    if (next == ISMRMRD_MESSAGE_CLOSE && id != ISMRMRD_MESSAGE_CLOSE) {
+        throw ProtocolStreamClosed();
+    }
+    if (next != id) {
+        throw std::runtime_error(message);
+    }
+}
+
+void MappedStreamReader::deserialize(ConfigFile &cf)
+{
+    expect(ISMRMRD_MESSAGE_CONFIG_FILE, "Expected config file message");
+    uint64_t size = messageSize();
+    memcpy(cf.config, at(pos_ + sizeof(uint16_t), sizeof(cf.config)), sizeof(cf.config));
+    pos_ += size;
+}
+
+void MappedStreamReader::deserialize(ConfigText &ct)
+{
+    expect(ISMRMRD_MESSAGE_CONFIG_TEXT, "Expected config text message");
+    uint64_t size = messageSize();
+    MemoryReadableStreamView rs(at(pos_ + sizeof(uint16_t), size - sizeof(uint16_t)), size - sizeof(uint16_t));
+    ISMRMRD::deserialize(ct.config_text, rs);
+    pos_ += size;
+}
+
+void MappedStreamReader::deserialize(TextMessage &tm)
+{
+    expect(ISMRMRD_MESSAGE_TEXT, "Expected text message");
+    uint64_t size = messageSize();
+    MemoryReadableStreamView rs(at(pos_ + sizeof(uint16_t), size - sizeof(uint16_t)), size - sizeof(uint16_t));
+    ISMRMRD::deserialize(tm.message, rs);
+    pos_ += size;
+}
+
+void MappedStreamReader::deserialize(IsmrmrdHeader &hdr)
+{
+    expect(ISMRMRD_MESSAGE_HEADER, "Expected ISMRMRD_MESSAGE_HEADER");
+    uint64_t size = messageSize();
+    const uint64_t length = size - sizeof(uint16_t) - sizeof(uint32_t);
+    std::string str(at(pos_ + sizeof(uint16_t) + sizeof(uint32_t), length), static_cast<size_t>(length));
+    ISMRMRD::deserialize(str.c_str(), hdr);
+    pos_ += size;
+}
+
+// Reads the trajectory and data of an acquisition at offset and returns their size
+uint64_t MappedStreamReader::readAcquisition(uint64_t offset, const ISMRMRD_AcquisitionHeader &head, AcquisitionView &acq)
+{
+    const uint64_t traj_elements = uint64_t(head.number_of_samples) * head.trajectory_dimensions;
+    const uint64_t data_elements = uint64_t(head.number_of_samples) * head.active_channels;
+    const uint64_t size = traj_elements * sizeof(float) + data_elements * sizeof(complex_float_t);
+    at(offset, size);
+    const float *traj = aligned<float>(offset, traj_elements, 1);
+    offset += traj_elements * sizeof(float);
+    const complex_float_t *data = aligned<complex_float_t>(offset, data_elements, 0);
+    acq = AcquisitionView(head, data, traj);
+    return size;
+}
+
+void MappedStreamReader::deserialize(AcquisitionView &acq)
+{
+    if (batch_remaining_ == 0 && peek() == ISMRMRD_MESSAGE_ACQUISITION_BATCH) {
+        batch_end_ = pos_ + messageSize();
+        at(pos_, batch_end_ - pos_);
+        batch_remaining_ = load<uint32_t>(map_ + pos_ + sizeof(uint16_t) + sizeof(uint64_t));
+        pos_ += sizeof(uint16_t) + sizeof(uint64_t) + sizeof(uint32_t);
+        batch_base_ = load<ISMRMRD_AcquisitionHeader>(at(pos_, sizeof(batch_base_)));
+        pos_ += sizeof(batch_base_);
+        if (pos_ > batch_end_) {
+            throw std::runtime_error("Acquisition batch length does not match its acquisitions");
+        }
+    }
+    if (batch_remaining_ > 0) {
+        MemoryReadableStreamView rs(map_ + pos_, static_cast<size_t>(batch_end_ - pos_));
+        ISMRMRD_AcquisitionHeader head;
+        pos_ += deserialize_header_delta(head, batch_base_, rs);
+        if (rs.eof()) {
+            throw std::runtime_error("Acquisition batch length does not match its acquisitions");
+        }
+        pos_ += readAcquisition(pos_, head, acq);
+        batch_remaining_--;
+        if (pos_ > batch_end_ || (batch_remaining_ == 0 && pos_ != batch_end_)) {
+            throw std::runtime_error("Acquisition batch length does not match its acquisitions");
+        }
+        return;
+    }
+    expect(ISMRMRD_MESSAGE_ACQUISITION, "Expected ISMRMRD_MESSAGE_ACQUISITION");
+    const uint64_t body = pos_ + sizeof(uint16_t);
+    ISMRMRD_AcquisitionHeader head = load<ISMRMRD_AcquisitionHeader>(at(body, sizeof(head)));
+    pos_ = body + sizeof(head) + readAcquisition(body + sizeof(head), head, acq);
+}
+
+template <typename T>
+void MappedStreamReader::deserialize(ImageView<T> &img)
+{
+    expect(ISMRMRD_MESSAGE_IMAGE, "Expected ISMRMRD_MESSAGE_IMAGE");
+    uint64_t size = messageSize();
+    at(pos_, size);
+    uint64_t offset = pos_ + sizeof(uint16_t);
+    ISMRMRD_ImageHeader head = load<ISMRMRD_ImageHeader>(map_ + offset);
+    if (head.data_type != get_data_type<T>()) {
+        throw std::runtime_error("Image data type does not match template type");
+    }
+    offset += sizeof(head);
+    uint64_t attr_length = load<uint64_t>(map_ + offset);
+    offset += sizeof(uint64_t);
+    const char *attr = map_ + offset;
+    offset += attr_length;
+    const T *data = aligned<T>(offset, image_data_size(head) / sizeof(T), 0);
+    img = ImageView<T>(head, data, attr, static_cast<size_t>(attr_length));
+    pos_ += size;
+}
+
+void MappedStreamReader::deserialize(WaveformView &wfm)
+{
+    expect(ISMRMRD_MESSAGE_WAVEFORM, "Expected ISMRMRD_MESSAGE_WAVEFORM");
+    uint64_t size = messageSize();
+    at(pos_, size);
+    uint64_t offset = pos_ + sizeof(uint16_t);
+    ISMRMRD_WaveformHeader head = load<ISMRMRD_WaveformHeader>(map_ + offset);
+    offset += sizeof(head);
+    const uint32_t *data = aligned<uint32_t>(offset, uint64_t(head.number_of_samples) * head.channels, 0);
+    wfm = WaveformView(head, data);
+    pos_ += size;
+}
+
+template <typename T>
+void MappedStreamReader::deserialize(NDArrayView<T> &arr)
+{
+    expect(ISMRMRD_MESSAGE_NDARRAY, "Expected ISMRMRD_MESSAGE_NDARRAY");
+    if (peek_ndarray_data_type() != get_data_type<T>()) {
+        throw std::runtime_error("Error mismatched data type in deserliazing nd array");
+    }
+    uint64_t size = messageSize();
+    at(pos_, size);
+    uint64_t offset = pos_ + 2 * sizeof(uint16_t) + sizeof(uint16_t);
+    uint16_t ndim = load<uint16_t>(map_ + offset);
+    offset += sizeof(uint16_t);
+    size_t dims[ISMRMRD_NDARRAY_MAXDIM];
+    uint64_t count = 1;
+    for (uint16_t n = 0; n < ndim; n++) {
+        dims[n] = load<size_t>(map_ + offset);
+        count *= dims[n];
+        offset += sizeof(size_t);
+    }
+    arr = NDArrayView<T>(aligned<T>(offset, count, 0), ndim, dims);
+    pos_ += size;
+}
+
+// template instantiations
+template EXPORTISMRMRD void MappedStreamReader::deserialize(ImageView<uint16_t> &img);
+template EXPORTISMRMRD void MappedStreamReader::deserialize(ImageView<uint32_t> &img);
+template EXPORTISMRMRD void MappedStreamReader::deserialize(ImageView<int16_t> &img);
+template EXPORTISMRMRD void MappedStreamReader::deserialize(ImageView<int32_t> &img);
+template EXPORTISMRMRD void MappedStreamReader::deserialize(ImageView<float> &img);
+template EXPORTISMRMRD void MappedStreamReader::deserialize(ImageView<double> &img);
+template EXPORTISMRMRD void MappedStreamReader::deserialize(ImageView<std::complex<float> > &img);
+template EXPORTISMRMRD void MappedStreamReader::deserialize(ImageView<std::complex<double> > &img);
+
+template EXPORTISMRMRD void MappedStreamReader::deserialize(NDArrayView<uint16_t> &arr);
+template EXPORTISMRMRD void MappedStreamReader::deserialize(NDArrayView<uint32_t> &arr);
+template EXPORTISMRMRD void MappedStreamReader::deserialize(NDArrayView<int16_t> &arr);
+template EXPORTISMRMRD void MappedStreamReader::deserialize(NDArrayView<int32_t> &arr);
+template EXPORTISMRMRD void MappedStreamReader::deserialize(NDArrayView<float> &arr);
+template EXPORTISMRMRD void MappedStreamReader::deserialize(NDArrayView<double> &arr);
+template EXPORTISMRMRD void MappedStreamReader::deserialize(NDArrayView<std::complex<float> > &arr);
+template EXPORTISMRMRD void MappedStreamReader::deserialize(NDArrayView<std::complex<double> > &arr);
+
+} // namespace ISMRMRD
@@ -0,0 +1,344 @@
+#include "ismrmrd/parallel_reader.h"
+
+#include <string.h>
+#include <algorithm>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+namespace ISMRMRD {
+
+#ifndef _WIN32
+namespace {
+
+/**
+ *   Single producer, single consumer byte ring in shared memory.
+ *
+ *   The worker only advances written and the reader only advances consumed,
+ *   so the two processes synchronize through these counters alone. They are
+ *   kept on separate cache lines, the data follows the structure.
+ */
+struct Ring {
+    uint64_t written;
+    char written_padding[56];
+    uint64_t consumed;
+    char consumed_padding[56];
+
+    char *data() { return reinterpret_cast<char *>(this + 1); }
+};
+
+// Kinds of records sent by the workers
+const uint32_t RECORD_ACQUISITION = 1;
+const uint32_t RECORD_ERROR = 2;
+
+// Waits between checks whether the other process is still alive
+const unsigned int LIVENESS_INTERVAL = 1024;
+
+struct RecordHeader {
+    uint32_t kind;
+    uint32_t size;
+};
+
+uint64_t load_acquire(const uint64_t *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_ACQUIRE);
+}
+
+void store_release(uint64_t *counter, uint64_t value)
+{
+    __atomic_store_n(counter, value, __ATOMIC_RELEASE);
+}
+
+// Yields first and sleeps once the other side has been slow for a while
+void wait_for_peer(unsigned int &waits)
+{
+    if (++waits < 64) {
+        sched_yield();
+    } else {
+        timespec pause = {0, 50000};
+        nanosleep(&pause, NULL);
+    }
+}
+
+Ring *ring(char *shared, size_t stride, unsigned int worker)
+{
+    return reinterpret_cast<Ring *>(shared + worker * stride);
+}
+
+// Worker side of the ring, blocks while the ring is full
+void send(Ring *ring, size_t capacity, const void *buffer, size_t count, pid_t parent)
+{
+    const char *in = static_cast<const char *>(buffer);
+    uint64_t written = ring->written;
+    unsigned int waits = 0;
+    while (count > 0) {
+        size_t space = capacity - static_cast<size_t>(written - load_acquire(&ring->consumed));
+        if (space == 0) {
+            // Nobody will empty the ring once the reader is gone
+            if (waits % LIVENESS_INTERVAL == 0 && getppid() != parent) {
+                _exit(1);
+            }
+            wait_for_peer(waits);
+            continue;
+        }
+        waits = 0;
+        size_t n = std::min(count, space);
+        size_t offset = static_cast<size_t>(written % capacity);
+        size_t first = std::min(n, capacity - offset);
+        memcpy(ring->data() + offset, in, first);
+        memcpy(ring->data(), in + first, n - first);
+        written += n;
+        store_release(&ring->written, written);
+        in += n;
+        count -= n;
+    }
+}
+
+// True when HDF5 has the file open in this process. The workers would inherit
+// that state and share the open file with the caller behind its back.
+bool is_open_in_process(const char *filename)
+{
+    struct stat target;
+    if (stat(filename, &target) != 0) {
+        return false;
+    }
+    ScopedLock lock(getHDF5Mutex());
+    ssize_t count = H5Fget_obj_count(H5F_OBJ_ALL, H5F_OBJ_FILE);
+    if (count <= 0) {
+        return false;
+    }
+    std::vector<hid_t> files(count);
+    count = H5Fget_obj_ids(H5F_OBJ_ALL, H5F_OBJ_FILE, files.size(), &files[0]);
+    for (ssize_t n = 0; n < count; n++) {
+        ssize_t length = H5Fget_name(files[n], NULL, 0);
+        if (length <= 0) {
+            continue;
+        }
+        std::vector<char> name(length + 1);
+        struct stat open_file;
+        if (H5Fget_name(files[n], &name[0], name.size()) > 0 && stat(&name[0], &open_file) == 0 &&
+            open_file.st_dev == target.st_dev && open_file.st_ino == target.st_ino) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Reads the blocks of one worker and streams them to the reader
+void run_worker(const std::string &filename, const std::string &groupname, unsigned int worker,
+                const ParallelReadOptions &options, uint32_t count, Ring *ring,
+                pid_t parent)
+{
+    try {
+        HDF5DatasetBackend dataset(filename.c_str(), groupname.c_str(), DATASET_READ_ONLY);
+        std::vector<ISMRMRD_Acquisition> acqs(options.block_size);
+        for (size_t n = 0; n < acqs.size(); n++) {
+            ismrmrd_init_acquisition(&acqs[n]);
+        }
+        const uint64_t stride = static_cast<uint64_t>(options.block_size) * options.processes;
+        for (uint64_t first = static_cast<uint64_t>(worker) * options.block_size; first < count; first += stride) {
+            uint32_t n = static_cast<uint32_t>(std::min<uint64_t>(options.block_size, count - first));
+            dataset.readAcquisitions(static_cast<uint32_t>(first), n, &acqs[0]);
+            for (uint32_t k = 0; k < n; k++) {
+                const ISMRMRD_Acquisition &acq = acqs[k];
+                RecordHeader record = {RECORD_ACQUISITION, 0};
+                send(ring, options.buffer_size, &record, sizeof(record), parent);
+                send(ring, options.buffer_size, &acq.head, sizeof(acq.head), parent);
+                send(ring, options.buffer_size, acq.traj, ismrmrd_size_of_acquisition_traj(&acq), parent);
+                send(ring, options.buffer_size, acq.data, ismrmrd_size_of_acquisition_data(&acq), parent);
+            }
+        }
+        for (size_t n = 0; n < acqs.size(); n++) {
+            ismrmrd_cleanup_acquisition(&acqs[n]);
+        }
+    } catch (std::exception &e) {
+        std::string message = e.what();
+        RecordHeader record = {RECORD_ERROR, static_cast<uint32_t>(message.size())};
+        send(ring, options.buffer_size, &record, sizeof(record), parent);
+        send(ring, options.buffer_size, message.c_str(), message.size(), parent);
+    }
+}
+
+} // namespace
+#endif
+
+ParallelReadOptions::ParallelReadOptions()
+    : processes(4)
+    , block_size(64)
+    , buffer_size(16 * 1024 * 1024)
+{
+}
+
+ParallelAcquisitionReader::ParallelAcquisitionReader(const char *filename, const char *groupname,
+                                                     const ParallelReadOptions &options)
+    : options_(options), count_(0), next_(0), shared_(NULL), shared_size_(0), ring_stride_(0)
+{
+#ifdef _WIN32
+    (void)filename;
+    (void)groupname;
+    throw std::runtime_error("Parallel reading is not supported on this platform.");
+#else
+    if (options_.processes == 0 || options_.block_size == 0) {
+        throw std::runtime_error("Parallel reading needs at least one process and one acquisition per block.");
+    }
+    if (options_.buffer_size < 4096) {
+        throw std::runtime_error("Parallel read buffers should be at least 4 KiB.");
+    }
+
+    if (is_open_in_process(filename)) {
+        throw std::runtime_error(std::string("Close ") + filename +
+                                 " before reading it in parallel, the workers cannot share an open HDF5 file.");
+    }
+
+    // Fail in this process if the file cannot be read at all
+    {
+        HDF5DatasetBackend dataset(filename, groupname, DATASET_READ_ONLY);
+        count_ = dataset.getNumberOfAcquisitions();
+    }
+
+    ring_stride_ = sizeof(Ring) + (options_.buffer_size + 63) / 64 * 64;
+    shared_size_ = ring_stride_ * options_.processes;
+    void *shared = mmap(NULL, shared_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        throw std::runtime_error("Failed to allocate shared memory for parallel reading.");
+    }
+    shared_ = static_cast<char *>(shared);
+
+    const std::string file(filename), group(groupname);
+    const pid_t parent = getpid();
+    // Only this thread is copied into the workers, so no other thread may be
+    // holding the HDF5 lock now (see the class documentation)
+    for (unsigned int w = 0; w < options_.processes; w++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            stopWorkers();
+            munmap(shared_, shared_size_);
+            throw std::runtime_error("Failed to start parallel read worker.");
+        }
+        if (pid == 0) {
+            run_worker(file, group, w, options_, count_, ring(shared_, ring_stride_, w), parent);
+            _exit(0);
+        }
+        pids_.push_back(pid);
+    }
+#endif
+}
+
+ParallelAcquisitionReader::~ParallelAcquisitionReader()
+{
+#ifndef _WIN32
+    stopWorkers();
+    if (shared_ != NULL) {
+        munmap(shared_, shared_size_);
+    }
+#endif
+}
+
+uint32_t ParallelAcquisitionReader::getNumberOfAcquisitions() const
+{
+    return count_;
+}
+
+bool ParallelAcquisitionReader::readNext(Acquisition &acq)
+{
+#ifdef _WIN32
+    (void)acq;
+    return false;
+#else
+    if (next_ >= count_) {
+        return false;
+    }
+    unsigned int worker = (next_ / options_.block_size) % options_.processes;
+
+    RecordHeader record;
+    receive(worker, &record, sizeof(record));
+    if (record.kind == RECORD_ERROR) {
+        std::string message(record.size, '\0');
+        if (record.size) {
+            receive(worker, &message[0], record.size);
+        }
+        throw std::runtime_error("Parallel read worker failed: " + message);
+    }
+
+    receive(worker, &acq.acq.head, sizeof(acq.acq.head));
+    acq.makeConsistent();
+    receive(worker, acq.acq.traj, ismrmrd_size_of_acquisition_traj(&acq.acq));
+    receive(worker, acq.acq.data, ismrmrd_size_of_acquisition_data(&acq.acq));
+    next_++;
+    return true;
+#endif
+}
+
+// Reader side of the ring, blocks until the worker has sent enough
+void ParallelAcquisitionReader::receive(unsigned int worker, void *buffer, size_t count)
+{
+#ifdef _WIN32
+    (void)worker;
+    (void)buffer;
+    (void)count;
+#else
+    Ring *r = ring(shared_, ring_stride_, worker);
+    char *out = static_cast<char *>(buffer);
+    const size_t capacity = options_.buffer_size;
+    uint64_t consumed = r->consumed;
+    unsigned int waits = 0;
+    while (count > 0) {
+        size_t available = static_cast<size_t>(load_acquire(&r->written) - consumed);
+        if (available == 0) {
+            if (waits % LIVENESS_INTERVAL == 0 && pids_[worker] > 0) {
+                int status;
+                if (waitpid(pids_[worker], &status, WNOHANG) == pids_[worker]) {
+                    pids_[worker] = -1;
+                }
+            }
+            // Whatever the worker sent before exiting is still in the ring
+            if (pids_[worker] <= 0 && load_acquire(&r->written) == consumed) {
+                throw std::runtime_error("Parallel read worker exited unexpectedly.");
+            }
+            wait_for_peer(waits);
+            continue;
+        }
+        waits = 0;
+        size_t n = std::min(count, available);
+        size_t offset = static_cast<size_t>(consumed % capacity);
+        size_t first = std::min(n, capacity - offset);
+        memcpy(out, r->data() + offset, first);
+        memcpy(out + first, r->data(), n - first);
+        consumed += n;
+        store_release(&r->consumed, consumed);
+        out += n;
+        count -= n;
+    }
+#endif
+}
+
+void ParallelAcquisitionReader::stopWorkers()
+{
+#ifndef _WIN32
+    for (size_t w = 0; w < pids_.size(); w++) {
+        if (pids_[w] <= 0) {
+            continue;
+        }
+        // Workers that are done have exited already, the others may be waiting for room in the ring
+        kill(pids_[w], SIGKILL);
+        while (waitpid(pids_[w], NULL, 0) < 0 && errno == EINTR) {
+        }
+        pids_[w] = -1;
+    }
+#endif
+}
+
+} // namespace ISMRMRD
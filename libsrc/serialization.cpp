@@ -1,45 +1,611 @@
+#include <algorithm>
+#include <limits>
 #include <sstream>
 #include <string>
+#include <string.h>
 
 #include "ismrmrd/serialization.h"
+#include "ismrmrd/stream_index.h"
+#include "ismrmrd/version.h"
 #include "ismrmrd/xml.h"
 
 namespace ISMRMRD {
 
-void serialize(const Acquisition &acq, WritableStreamView &ws) {
-    AcquisitionHeader ahead = acq.getHead();
-    ws.write(reinterpret_cast<const char *>(&ahead), sizeof(AcquisitionHeader));
-    ws.write(reinterpret_cast<const char *>(acq.getTrajPtr()), ahead.trajectory_dimensions * ahead.number_of_samples * sizeof(float));
-    ws.write(reinterpret_cast<const char *>(acq.getDataPtr()), ahead.number_of_samples * ahead.active_channels * 2 * sizeof(float));
+BufferedReadableStreamView::BufferedReadableStreamView(ReadableStreamView &source, size_t buffer_size)
+    : _source(source), _buffer(buffer_size > 0 ? buffer_size : 1), _eof(false) {
+    _pos = _end = &_buffer[0];
+}
+
+bool BufferedReadableStreamView::refill() {
+    _pos = _end = &_buffer[0];
+    size_t n = _source.read_some(&_buffer[0], _buffer.size());
+    _end += n;
+    return n > 0;
+}
+
+void BufferedReadableStreamView::read_slow(char *buffer, size_t count) {
+    size_t available = static_cast<size_t>(_end - _pos);
+    memcpy(buffer, _pos, available);
+    buffer += available;
+    count -= available;
+    _pos = _end = &_buffer[0];
+
+    while (count > 0) {
+        if (_source.single_byte_reads()) {
+            // The source cannot read ahead, the rest comes straight from it
+            _source.read(buffer, count);
+            if (_source.eof()) {
+                _eof = true;
+            }
+            return;
+        }
+        // Large reads skip the copy through the buffer
+        if (count >= _buffer.size()) {
+            size_t n = _source.read_some(buffer, count);
+            if (n == 0) {
+                _eof = true;
+                return;
+            }
+            buffer += n;
+            count -= n;
+            continue;
+        }
+        if (!refill()) {
+            _eof = true;
+            return;
+        }
+        size_t n = std::min(count, static_cast<size_t>(_end - _pos));
+        memcpy(buffer, _pos, n);
+        _pos += n;
+        buffer += n;
+        count -= n;
+    }
+}
+
+size_t BufferedReadableStreamView::read_some(char *buffer, size_t count) {
+    if (_pos == _end && count < _buffer.size() && !_source.single_byte_reads() && !refill()) {
+        _eof = true;
+        return 0;
+    }
+    if (_pos == _end) {
+        size_t n = _source.read_some(buffer, count);
+        if (n == 0) {
+            _eof = true;
+        }
+        return n;
+    }
+    size_t n = std::min(count, static_cast<size_t>(_end - _pos));
+    memcpy(buffer, _pos, n);
+    _pos += n;
+    return n;
+}
+
+void BufferedReadableStreamView::skip(size_t count) {
+    size_t available = static_cast<size_t>(_end - _pos);
+    if (count <= available) {
+        _pos += count;
+        return;
+    }
+    count -= available;
+    _pos = _end = &_buffer[0];
+    if (count >= _buffer.size() || _source.single_byte_reads()) {
+        _source.skip(count);
+        if (_source.eof()) {
+            _eof = true;
+        }
+        return;
+    }
+    while (count > 0) {
+        if (!refill()) {
+            _eof = true;
+            return;
+        }
+        size_t n = std::min(count, static_cast<size_t>(_end - _pos));
+        _pos += n;
+        count -= n;
+    }
+}
+
+BufferedWritableStreamView::BufferedWritableStreamView(WritableStreamView &sink, size_t buffer_size)
+    : _sink(sink), _buffer(buffer_size > 0 ? buffer_size : 1) {
+    _pos = &_buffer[0];
+    _end = _pos + _buffer.size();
+}
+
+BufferedWritableStreamView::~BufferedWritableStreamView() {
+    try {
+        flush();
+    } catch (...) {
+    }
+}
+
+void BufferedWritableStreamView::flush() {
+    if (_pos != &_buffer[0]) {
+        _sink.write(&_buffer[0], static_cast<size_t>(_pos - &_buffer[0]));
+        _pos = &_buffer[0];
+    }
+}
+
+void BufferedWritableStreamView::write_slow(const char *buffer, size_t count) {
+    if (count >= _buffer.size()) {
+        // The buffered data and the large block leave together
+        StreamPiece pieces[2] = {{&_buffer[0], static_cast<size_t>(_pos - &_buffer[0])}, {buffer, count}};
+        if (pieces[0].size > 0) {
+            _sink.write_pieces(pieces, 2);
+        } else {
+            _sink.write(buffer, count);
+        }
+        _pos = &_buffer[0];
+    } else {
+        flush();
+        memcpy(_pos, buffer, count);
+        _pos += count;
+    }
+}
+
+uint64_t image_data_size(const ISMRMRD_ImageHeader &head) {
+    size_t element_size = ismrmrd_sizeof_data_type(head.data_type);
+    if (element_size == 0) {
+        throw std::runtime_error("Unknown image data type");
+    }
+    const uint64_t factors[] = {head.matrix_size[1], head.matrix_size[2], head.channels, element_size};
+    uint64_t size = head.matrix_size[0];
+    for (size_t i = 0; i < sizeof(factors) / sizeof(factors[0]); i++) {
+        if (factors[i] != 0 && size > std::numeric_limits<uint64_t>::max() / factors[i]) {
+            throw std::runtime_error("Image data size does not fit in 64 bits");
+        }
+        size *= factors[i];
+    }
+    return size;
+}
+
+uint64_t acquisition_size(const ISMRMRD_AcquisitionHeader &head) {
+    return sizeof(ISMRMRD_AcquisitionHeader) +
+           uint64_t(head.trajectory_dimensions) * head.number_of_samples * sizeof(float) +
+           uint64_t(head.number_of_samples) * head.active_channels * sizeof(complex_float_t);
+}
+
+namespace {
+
+// The protocol classes use these to call buffered views without virtual dispatch
+class BufferedReader {
+public:
+    explicit BufferedReader(BufferedReadableStreamView &rs) : _rs(rs) {}
+    void read(char *buffer, size_t count) { _rs.BufferedReadableStreamView::read(buffer, count); }
+    bool eof() { return _rs.BufferedReadableStreamView::eof(); }
+    void skip(size_t count) { _rs.BufferedReadableStreamView::skip(count); }
+
+private:
+    BufferedReadableStreamView &_rs;
+};
+
+class BufferedWriter {
+public:
+    explicit BufferedWriter(BufferedWritableStreamView &ws) : _ws(ws) {}
+    void write(const char *buffer, size_t count) { _ws.BufferedWritableStreamView::write(buffer, count); }
+    bool bad() { return _ws.BufferedWritableStreamView::bad(); }
+
+private:
+    BufferedWritableStreamView &_ws;
+};
+
+void put(WritableStreamView &ws, const StreamPiece *pieces, size_t count) {
+    ws.write_pieces(pieces, count);
+}
+
+void put(BufferedWriter &ws, const StreamPiece *pieces, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        ws.write(pieces[i].data, pieces[i].size);
+    }
+}
+
+// The pieces of one message, handed to the stream in a single call
+class MessagePieces {
+public:
+    explicit MessagePieces(const uint16_t *msg_id) : _count(0) {
+        if (msg_id) {
+            add(msg_id, sizeof(uint16_t));
+        }
+    }
+
+    void add(const void *data, size_t size) {
+        if (size > 0) {
+            _pieces[_count].data = static_cast<const char *>(data);
+            _pieces[_count].size = size;
+            _count++;
+        }
+    }
+
+    template <typename Stream>
+    void write(Stream &ws) const {
+        put(ws, _pieces, _count);
+    }
+
+private:
+    StreamPiece _pieces[8];
+    size_t _count;
+};
+
+// Accessors that differ between the owning types and the views
+const ISMRMRD_WaveformHeader &waveform_head(const Waveform &wfm) {
+    return wfm.head;
+}
+
+const ISMRMRD_WaveformHeader &waveform_head(const WaveformView &wfm) {
+    return wfm.getHead();
+}
+
+template <typename T>
+const char *attribute_string(const Image<T> &img) {
+    return img.getAttributeString();
+}
+
+template <typename T>
+const char *attribute_string(const ImageView<T> &img) {
+    return img.getAttributeStringPtr();
+}
+
+template <typename T>
+uint16_t ndarray_version(const NDArray<T> &arr) {
+    return arr.getVersion();
+}
+
+template <typename T>
+uint16_t ndarray_version(const NDArrayView<T> &) {
+    return ISMRMRD_VERSION_MAJOR;
+}
+
+// Shared by the free functions and the protocol serializer, which passes the message id
+// so that it goes out with the rest of the message. They take the owning types and the views.
+template <typename Acq, typename Stream>
+void write_acquisition(const Acq &acq, Stream &ws, const uint16_t *msg_id = NULL) {
+    const AcquisitionHeader &ahead = acq.getHead();
+    MessagePieces pieces(msg_id);
+    pieces.add(&ahead, sizeof(AcquisitionHeader));
+    pieces.add(acq.getTrajPtr(), ahead.trajectory_dimensions * ahead.number_of_samples * sizeof(float));
+    pieces.add(acq.getDataPtr(), ahead.number_of_samples * ahead.active_channels * 2 * sizeof(float));
+    pieces.write(ws);
     if (ws.bad()) {
         throw std::runtime_error("Error writing acquisition to stream");
     }
 }
 
-template <typename T>
-void serialize(const Image<T> &img, WritableStreamView &ws) {
+void add_piece(std::vector<StreamPiece> &pieces, const void *data, size_t size) {
+    if (size > 0) {
+        StreamPiece piece = {static_cast<const char *>(data), size};
+        pieces.push_back(piece);
+    }
+}
+
+// The header deltas of batched acquisitions, see serialize(const std::vector<Acquisition> &, ...)
+const size_t HEADER_WORDS = sizeof(AcquisitionHeader) / sizeof(uint32_t);
+const size_t DELTA_MASK_WORDS = (HEADER_WORDS + 31) / 32;
+#if __cplusplus > 199711L
+static_assert(sizeof(AcquisitionHeader) % sizeof(uint32_t) == 0, "Acquisition header is not a whole number of words");
+#endif
+
+// Writes the mask and the words of head that differ from base to delta, returns the number of words
+size_t encode_header_delta(const ISMRMRD_AcquisitionHeader &head, const ISMRMRD_AcquisitionHeader &base, uint32_t *delta) {
+    uint32_t words[HEADER_WORDS], base_words[HEADER_WORDS];
+    memcpy(words, &head, sizeof(words));
+    memcpy(base_words, &base, sizeof(base_words));
+    memset(delta, 0, DELTA_MASK_WORDS * sizeof(uint32_t));
+    size_t count = DELTA_MASK_WORDS;
+    for (size_t w = 0; w < HEADER_WORDS; w++) {
+        if (words[w] != base_words[w]) {
+            delta[w / 32] |= uint32_t(1) << (w % 32);
+            delta[count++] = words[w];
+        }
+    }
+    return count;
+}
+
+// Reads a header delta and returns its size
+template <typename Stream>
+uint64_t read_header_delta(ISMRMRD_AcquisitionHeader &head, const ISMRMRD_AcquisitionHeader &base, Stream &rs) {
+    uint32_t delta[DELTA_MASK_WORDS + HEADER_WORDS];
+    rs.read(reinterpret_cast<char *>(delta), DELTA_MASK_WORDS * sizeof(uint32_t));
+    if (rs.eof() || (HEADER_WORDS % 32 != 0 && delta[DELTA_MASK_WORDS - 1] >> (HEADER_WORDS % 32) != 0)) {
+        throw std::runtime_error("Error reading acquisition header in batch");
+    }
+    size_t count = 0;
+    for (size_t w = 0; w < HEADER_WORDS; w++) {
+        count += (delta[w / 32] >> (w % 32)) & 1;
+    }
+    rs.read(reinterpret_cast<char *>(delta + DELTA_MASK_WORDS), count * sizeof(uint32_t));
+    uint32_t words[HEADER_WORDS];
+    memcpy(words, &base, sizeof(words));
+    const uint32_t *changed = delta + DELTA_MASK_WORDS;
+    for (size_t w = 0; w < HEADER_WORDS; w++) {
+        if ((delta[w / 32] >> (w % 32)) & 1) {
+            words[w] = *changed++;
+        }
+    }
+    memcpy(&head, words, sizeof(words));
+    return (DELTA_MASK_WORDS + count) * sizeof(uint32_t);
+}
+
+// All acquisitions of a batch go to the stream in one call
+template <typename Stream>
+void write_acquisition_batch(const std::vector<Acquisition> &acqs, Stream &ws, const uint16_t *msg_id = NULL) {
+    if (acqs.size() > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error("Too many acquisitions in batch");
+    }
+    uint32_t count = static_cast<uint32_t>(acqs.size());
+    uint64_t length = sizeof(uint32_t);
+    std::vector<StreamPiece> pieces;
+    pieces.reserve(3 * acqs.size() + 4);
+    if (msg_id) {
+        add_piece(pieces, msg_id, sizeof(uint16_t));
+    }
+    add_piece(pieces, &length, sizeof(uint64_t));
+    add_piece(pieces, &count, sizeof(uint32_t));
+    // The pieces point into the deltas, which are sized for the largest ones up front
+    std::vector<uint32_t> deltas(acqs.size() * (DELTA_MASK_WORDS + HEADER_WORDS));
+    if (!acqs.empty()) {
+        const AcquisitionHeader &base = acqs[0].getHead();
+        add_piece(pieces, &base, sizeof(AcquisitionHeader));
+        length += sizeof(AcquisitionHeader);
+        uint32_t *delta = &deltas[0];
+        for (size_t i = 0; i < acqs.size(); i++) {
+            const AcquisitionHeader &ahead = acqs[i].getHead();
+            size_t words = encode_header_delta(ahead, base, delta);
+            add_piece(pieces, delta, words * sizeof(uint32_t));
+            delta += words;
+            add_piece(pieces, acqs[i].getTrajPtr(), ahead.trajectory_dimensions * ahead.number_of_samples * sizeof(float));
+            add_piece(pieces, acqs[i].getDataPtr(), ahead.number_of_samples * ahead.active_channels * 2 * sizeof(float));
+            length += words * sizeof(uint32_t) + acquisition_size(ahead) - sizeof(AcquisitionHeader);
+        }
+    }
+    put(ws, &pieces[0], pieces.size());
+    if (ws.bad()) {
+        throw std::runtime_error("Error writing acquisition batch to stream");
+    }
+}
+
+template <typename Wfm, typename Stream>
+void write_waveform(const Wfm &wfm, Stream &ws, const uint16_t *msg_id = NULL) {
+    const ISMRMRD_WaveformHeader &head = waveform_head(wfm);
+    MessagePieces pieces(msg_id);
+    pieces.add(&head, sizeof(ISMRMRD_WaveformHeader));
+    pieces.add(wfm.begin_data(), head.number_of_samples * head.channels * sizeof(uint32_t));
+    pieces.write(ws);
+    if (ws.bad()) {
+        throw std::runtime_error("Error writing waveform to stream");
+    }
+}
+
+template <typename Img, typename Stream>
+void write_image(const Img &img, Stream &ws, const uint16_t *msg_id = NULL) {
     ImageHeader ihead = img.getHead();
-    if (ismrmrd_sizeof_data_type(ihead.data_type) != sizeof(T)) {
+    if (ismrmrd_sizeof_data_type(ihead.data_type) != sizeof(*img.getDataPtr())) {
         throw std::runtime_error("Image data type does not match template type");
     }
-    ws.write(reinterpret_cast<const char *>(&ihead), sizeof(ImageHeader));
     uint64_t attr_length = img.getAttributeStringLength();
-    ws.write(reinterpret_cast<char *>(&attr_length), sizeof(uint64_t));
+    ihead.attribute_string_len = static_cast<uint32_t>(attr_length);
+    MessagePieces pieces(msg_id);
+    pieces.add(&ihead, sizeof(ImageHeader));
+    pieces.add(&attr_length, sizeof(uint64_t));
     if (attr_length) {
-        ws.write(img.getAttributeString(), ihead.attribute_string_len);
+        pieces.add(attribute_string(img), attr_length);
     }
-    ws.write(reinterpret_cast<const char *>(img.getDataPtr()), img.getDataSize());
+    pieces.add(img.getDataPtr(), img.getDataSize());
+    pieces.write(ws);
     if (ws.bad()) {
         throw std::runtime_error("Error writing image to stream");
     }
 }
 
-void serialize(const Waveform &wfm, WritableStreamView &ws) {
-    ws.write(reinterpret_cast<const char *>(&wfm.head), sizeof(ISMRMRD_WaveformHeader));
-    ws.write(reinterpret_cast<const char *>(wfm.begin_data()), wfm.head.number_of_samples * wfm.head.channels * sizeof(uint32_t));
+template <typename Arr, typename Stream>
+void write_ndarray(const Arr &arr, Stream &ws, const uint16_t *msg_id = NULL) {
+    uint16_t ver = ndarray_version(arr);
+    uint16_t dtype = static_cast<uint16_t>(arr.getDataType());
+    uint16_t ndim = arr.getNDim();
+    MessagePieces pieces(msg_id);
+    pieces.add(&dtype, sizeof(uint16_t));
+    pieces.add(&ver, sizeof(uint16_t));
+    pieces.add(&ndim, sizeof(uint16_t));
+    pieces.add(arr.getDims(), sizeof(size_t) * ndim);
+    pieces.add(arr.getDataPtr(), arr.getDataSize());
+    pieces.write(ws);
     if (ws.bad()) {
-        throw std::runtime_error("Error writing waveform to stream");
+        throw std::runtime_error("Error writing NDArray to stream");
+    }
+}
+
+// Picks the writer for ProtocolSerializer::write_message
+template <typename Stream>
+void write_body(const Acquisition &acq, Stream &ws, const uint16_t *msg_id) {
+    write_acquisition(acq, ws, msg_id);
+}
+
+template <typename Stream>
+void write_body(const AcquisitionView &acq, Stream &ws, const uint16_t *msg_id) {
+    write_acquisition(acq, ws, msg_id);
+}
+
+template <typename T, typename Stream>
+void write_body(const Image<T> &img, Stream &ws, const uint16_t *msg_id) {
+    write_image(img, ws, msg_id);
+}
+
+template <typename T, typename Stream>
+void write_body(const ImageView<T> &img, Stream &ws, const uint16_t *msg_id) {
+    write_image(img, ws, msg_id);
+}
+
+template <typename Stream>
+void write_body(const Waveform &wfm, Stream &ws, const uint16_t *msg_id) {
+    write_waveform(wfm, ws, msg_id);
+}
+
+template <typename Stream>
+void write_body(const WaveformView &wfm, Stream &ws, const uint16_t *msg_id) {
+    write_waveform(wfm, ws, msg_id);
+}
+
+template <typename T, typename Stream>
+void write_body(const NDArray<T> &arr, Stream &ws, const uint16_t *msg_id) {
+    write_ndarray(arr, ws, msg_id);
+}
+
+template <typename T, typename Stream>
+void write_body(const NDArrayView<T> &arr, Stream &ws, const uint16_t *msg_id) {
+    write_ndarray(arr, ws, msg_id);
+}
+
+// Adds the index entry of a message and returns its size after the message id
+template <typename Acq>
+uint64_t index_acquisition(StreamIndex &index, uint64_t offset, const Acq &acq) {
+    index.add(offset, ISMRMRD_MESSAGE_ACQUISITION, acq.getHead());
+    return acquisition_size(acq.getHead());
+}
+
+uint64_t index_body(StreamIndex &index, uint64_t offset, const Acquisition &acq) {
+    return index_acquisition(index, offset, acq);
+}
+
+uint64_t index_body(StreamIndex &index, uint64_t offset, const AcquisitionView &acq) {
+    return index_acquisition(index, offset, acq);
+}
+
+template <typename Img>
+uint64_t index_image(StreamIndex &index, uint64_t offset, const Img &img) {
+    index.add(offset, img.getHead());
+    return sizeof(ImageHeader) + sizeof(uint64_t) + img.getAttributeStringLength() + img.getDataSize();
+}
+
+template <typename T>
+uint64_t index_body(StreamIndex &index, uint64_t offset, const Image<T> &img) {
+    return index_image(index, offset, img);
+}
+
+template <typename T>
+uint64_t index_body(StreamIndex &index, uint64_t offset, const ImageView<T> &img) {
+    return index_image(index, offset, img);
+}
+
+template <typename Wfm>
+uint64_t index_waveform(StreamIndex &index, uint64_t offset, const Wfm &wfm) {
+    const ISMRMRD_WaveformHeader &head = waveform_head(wfm);
+    index.add(offset, head);
+    return sizeof(ISMRMRD_WaveformHeader) + uint64_t(head.number_of_samples) * head.channels * sizeof(uint32_t);
+}
+
+uint64_t index_body(StreamIndex &index, uint64_t offset, const Waveform &wfm) {
+    return index_waveform(index, offset, wfm);
+}
+
+uint64_t index_body(StreamIndex &index, uint64_t offset, const WaveformView &wfm) {
+    return index_waveform(index, offset, wfm);
+}
+
+template <typename Arr>
+uint64_t index_ndarray(StreamIndex &index, uint64_t offset, const Arr &arr) {
+    index.add(offset, ISMRMRD_MESSAGE_NDARRAY, static_cast<uint16_t>(arr.getDataType()));
+    return 3 * sizeof(uint16_t) + sizeof(size_t) * arr.getNDim() + arr.getDataSize();
+}
+
+template <typename T>
+uint64_t index_body(StreamIndex &index, uint64_t offset, const NDArray<T> &arr) {
+    return index_ndarray(index, offset, arr);
+}
+
+template <typename T>
+uint64_t index_body(StreamIndex &index, uint64_t offset, const NDArrayView<T> &arr) {
+    return index_ndarray(index, offset, arr);
+}
+
+// Reads the trajectory and data that follow the header
+template <typename Stream>
+void read_acquisition_data(Acquisition &acq, const AcquisitionHeader &ahead, Stream &rs) {
+    acq.setHead(ahead);
+    rs.read(reinterpret_cast<char *>(acq.getTrajPtr()), ahead.trajectory_dimensions * ahead.number_of_samples * sizeof(float));
+    rs.read(reinterpret_cast<char *>(acq.getDataPtr()), ahead.number_of_samples * ahead.active_channels * 2 * sizeof(float));
+    if (rs.eof()) {
+        throw std::runtime_error("Error reading acquisition");
+    }
+}
+
+template <typename Stream>
+void read_acquisition(Acquisition &acq, Stream &rs) {
+    AcquisitionHeader ahead;
+    rs.read(reinterpret_cast<char *>(&ahead), sizeof(AcquisitionHeader));
+    read_acquisition_data(acq, ahead, rs);
+}
+
+// Reads an acquisition of a batch and returns its size
+template <typename Stream>
+uint64_t read_batched_acquisition(Acquisition &acq, const AcquisitionHeader &base, Stream &rs) {
+    AcquisitionHeader ahead;
+    uint64_t delta_size = read_header_delta(ahead, base, rs);
+    read_acquisition_data(acq, ahead, rs);
+    return delta_size + acquisition_size(ahead) - sizeof(AcquisitionHeader);
+}
+
+// Reads what follows the length of a batch
+template <typename Stream>
+void read_acquisition_batch(std::vector<Acquisition> &acqs, uint64_t length, Stream &rs) {
+    uint32_t count;
+    rs.read(reinterpret_cast<char *>(&count), sizeof(uint32_t));
+    AcquisitionHeader base;
+    uint64_t head_size = sizeof(uint32_t);
+    if (count > 0) {
+        rs.read(reinterpret_cast<char *>(&base), sizeof(AcquisitionHeader));
+        head_size += sizeof(AcquisitionHeader);
+    }
+    if (rs.eof() || length < head_size ||
+        count > (length - head_size) / (DELTA_MASK_WORDS * sizeof(uint32_t))) {
+        throw std::runtime_error("Error reading acquisition batch");
+    }
+    length -= head_size;
+    acqs.resize(count);
+    for (size_t i = 0; i < acqs.size(); i++) {
+        uint64_t size = read_batched_acquisition(acqs[i], base, rs);
+        if (size > length) {
+            throw std::runtime_error("Acquisition batch length does not match its acquisitions");
+        }
+        length -= size;
+    }
+    if (length != 0) {
+        throw std::runtime_error("Acquisition batch length does not match its acquisitions");
+    }
+}
+
+template <typename Stream>
+void read_waveform(Waveform &wfm, Stream &rs) {
+#if __cplusplus > 199711L
+    static_assert(std::is_same<decltype(wfm.head), ISMRMRD_WaveformHeader>::value, "Waveform header type mismatch");
+#endif
+    // Waveforms have no capacity, but the data is only reallocated when it grows
+    const size_t size = wfm.data ? wfm.size() : 0;
+    rs.read(reinterpret_cast<char *>(&wfm.head), sizeof(ISMRMRD_WaveformHeader));
+    if (wfm.size() > size) {
+        ismrmrd_make_consistent_waveform(&wfm);
     }
+    rs.read(reinterpret_cast<char *>(wfm.begin_data()), wfm.head.number_of_samples * wfm.head.channels * sizeof(uint32_t));
+    if (rs.eof()) {
+        throw std::runtime_error("Error reading waveform");
+    }
+}
+
+} // namespace
+
+void serialize(const Acquisition &acq, WritableStreamView &ws) {
+    write_acquisition(acq, ws);
+}
+
+void serialize(const std::vector<Acquisition> &acqs, WritableStreamView &ws) {
+    write_acquisition_batch(acqs, ws);
+}
+
+template <typename T>
+void serialize(const Image<T> &img, WritableStreamView &ws) {
+    write_image(img, ws);
+}
+
+void serialize(const Waveform &wfm, WritableStreamView &ws) {
+    write_waveform(wfm, ws);
 }
 
 void serialize(const ConfigFile &cfg, WritableStreamView &ws) {
@@ -60,43 +626,57 @@ void serialize(const std::string &str, WritableStreamView &ws) {
 
 template <typename T>
 void serialize(const NDArray<T> &arr, WritableStreamView &ws) {
-    uint16_t ver = arr.getVersion();
-    uint16_t dtype = static_cast<uint16_t>(arr.getDataType());
-    uint16_t ndim = arr.getNDim();
-    const size_t* dims = arr.getDims();
+    write_ndarray(arr, ws);
+}
 
-    ws.write(reinterpret_cast<char *>(&dtype), sizeof(uint16_t));
-    ws.write(reinterpret_cast<char *>(&ver), sizeof(uint16_t));
-    ws.write(reinterpret_cast<char *>(&ndim), sizeof(uint16_t));
-    ws.write(reinterpret_cast<const char *>(dims), sizeof(size_t)*ndim);
+void serialize(const AcquisitionView &acq, WritableStreamView &ws) {
+    write_acquisition(acq, ws);
+}
 
-    ws.write(reinterpret_cast<const char *>(arr.getDataPtr()), arr.getDataSize());
-    if (ws.bad()) {
-        throw std::runtime_error("Error writing NDArray to stream");
-    }
+template <typename T>
+void serialize(const ImageView<T> &img, WritableStreamView &ws) {
+    write_image(img, ws);
+}
+
+void serialize(const WaveformView &wfm, WritableStreamView &ws) {
+    write_waveform(wfm, ws);
+}
+
+template <typename T>
+void serialize(const NDArrayView<T> &arr, WritableStreamView &ws) {
+    write_ndarray(arr, ws);
 }
 
 void deserialize(Acquisition &acq, ReadableStreamView &rs) {
-    AcquisitionHeader ahead;
-    rs.read(reinterpret_cast<char *>(&ahead), sizeof(AcquisitionHeader));
-    acq.setHead(ahead);
-    rs.read(reinterpret_cast<char *>(acq.getTrajPtr()), ahead.trajectory_dimensions * ahead.number_of_samples * sizeof(float));
-    rs.read(reinterpret_cast<char *>(acq.getDataPtr()), ahead.number_of_samples * ahead.active_channels * 2 * sizeof(float));
-    if (rs.eof()) {
-        throw std::runtime_error("Error reading acquisition");
-    }
+    read_acquisition(acq, rs);
+}
+
+void deserialize(std::vector<Acquisition> &acqs, ReadableStreamView &rs) {
+    uint64_t length;
+    rs.read(reinterpret_cast<char *>(&length), sizeof(uint64_t));
+    read_acquisition_batch(acqs, length, rs);
+}
+
+uint64_t deserialize_header_delta(ISMRMRD_AcquisitionHeader &head, const ISMRMRD_AcquisitionHeader &base,
+                                  ReadableStreamView &rs) {
+    return read_header_delta(head, base, rs);
 }
 
-// Helper function that deserializes attributes and pixels
+// Helper function that deserializes attributes and pixels into the memory the image has
 template <typename T>
-void deserialize_attr_and_pixels(Image<T> &img, ReadableStreamView &rs) {
+void deserialize_attr_and_pixels(Image<T> &img, ImageHeader ihead, ReadableStreamView &rs) {
     uint64_t attr_length;
     rs.read(reinterpret_cast<char *>(&attr_length), sizeof(uint64_t));
+    if (attr_length > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error("Error reading image attributes");
+    }
+    ihead.attribute_string_len = static_cast<uint32_t>(attr_length);
+    img.setHead(ihead);
     if (attr_length) {
-        std::vector<char> attr(attr_length + 1);
-        rs.read(&attr[0], attr_length);
-        attr[attr_length] = '\0';
-        img.setAttributeString(&attr[0]);
+        // setHead sized and terminated the attribute string
+        char *attr = const_cast<char *>(img.getAttributeString());
+        rs.read(attr, attr_length);
+        img.getHead().attribute_string_len = static_cast<uint32_t>(strlen(attr));
     }
     rs.read(reinterpret_cast<char *>(img.getDataPtr()), img.getDataSize());
     if (rs.eof()) {
@@ -114,20 +694,11 @@ void deserialize(Image<T> &img, ReadableStreamView &rs) {
     if (ismrmrd_sizeof_data_type(ihead.data_type) != sizeof(T)) {
         throw std::runtime_error("Image data type does not match template type");
     }
-    img.setHead(ihead);
-    deserialize_attr_and_pixels(img, rs);
+    deserialize_attr_and_pixels(img, ihead, rs);
 }
 
 void deserialize(Waveform &wfm, ReadableStreamView &rs) {
-#if __cplusplus > 199711L
-    static_assert(std::is_same<decltype(wfm.head), ISMRMRD_WaveformHeader>::value, "Waveform header type mismatch");
-#endif
-    rs.read(reinterpret_cast<char *>(&wfm.head), sizeof(ISMRMRD_WaveformHeader));
-    ismrmrd_make_consistent_waveform(&wfm);
-    rs.read(reinterpret_cast<char *>(wfm.begin_data()), wfm.head.number_of_samples * wfm.head.channels * sizeof(uint32_t));
-    if (rs.eof()) {
-        throw std::runtime_error("Error reading waveform");
-    }
+    read_waveform(wfm, rs);
 }
 
 void deserialize(ConfigFile &cfg, ReadableStreamView &rs) {
@@ -179,25 +750,45 @@ void deserialize(NDArray<T> &arr, ReadableStreamView &rs) {
     deserialize_ndarray_data(arr, rs);
 }
 
-ProtocolSerializer::ProtocolSerializer(WritableStreamView &ws) : _ws(ws) {}
+ProtocolSerializer::ProtocolSerializer(WritableStreamView &ws)
+    : _ws(ws), _buffered(dynamic_cast<BufferedWritableStreamView *>(&ws)), _index(NULL), _offset(0) {}
+
+void ProtocolSerializer::setIndex(StreamIndex *index, uint64_t offset) {
+    _index = index;
+    _offset = offset;
+}
+
+void ProtocolSerializer::index_message(uint16_t id, uint64_t size) {
+    if (_index) {
+        _index->add(_offset, id);
+        _offset += sizeof(uint16_t) + size;
+    }
+}
 
 void ProtocolSerializer::write_msg_id(uint16_t id) {
-    _ws.write(reinterpret_cast<const char *>(&id), sizeof(uint16_t));
+    if (_buffered) {
+        BufferedWriter(*_buffered).write(reinterpret_cast<const char *>(&id), sizeof(uint16_t));
+    } else {
+        _ws.write(reinterpret_cast<const char *>(&id), sizeof(uint16_t));
+    }
 }
 
 void ProtocolSerializer::serialize(const ConfigFile &cf) {
     write_msg_id(ISMRMRD_MESSAGE_CONFIG_FILE);
     ISMRMRD::serialize(cf, _ws);
+    index_message(ISMRMRD_MESSAGE_CONFIG_FILE, sizeof(cf.config));
 }
 
 void ProtocolSerializer::serialize(const ConfigText &ct) {
     write_msg_id(ISMRMRD_MESSAGE_CONFIG_TEXT);
     ISMRMRD::serialize(ct.config_text, _ws);
+    index_message(ISMRMRD_MESSAGE_CONFIG_TEXT, sizeof(uint32_t) + ct.config_text.size());
 }
 
 void ProtocolSerializer::serialize(const TextMessage &tm) {
     write_msg_id(ISMRMRD_MESSAGE_TEXT);
     ISMRMRD::serialize(tm.message, _ws);
+    index_message(ISMRMRD_MESSAGE_TEXT, sizeof(uint32_t) + tm.message.size());
 }
 
 void ProtocolSerializer::serialize(const IsmrmrdHeader &hdr) {
@@ -211,48 +802,219 @@ void ProtocolSerializer::serialize(const IsmrmrdHeader &hdr) {
     if (_ws.bad()) {
         throw std::runtime_error("Error writing header to stream");
     }
+    index_message(ISMRMRD_MESSAGE_HEADER, sizeof(uint32_t) + as_str.size());
+}
+
+template <typename Message>
+void ProtocolSerializer::write_message(const Message &msg, uint16_t id) {
+    if (_buffered) {
+        BufferedWriter ws(*_buffered);
+        write_body(msg, ws, &id);
+    } else {
+        write_body(msg, _ws, &id);
+    }
+    if (_index) {
+        _offset += sizeof(uint16_t) + index_body(*_index, _offset, msg);
+    }
 }
 
 void ProtocolSerializer::serialize(const Acquisition &acq) {
-    write_msg_id(ISMRMRD_MESSAGE_ACQUISITION);
-    ISMRMRD::serialize(acq, _ws);
+    write_message(acq, ISMRMRD_MESSAGE_ACQUISITION);
+}
+
+void ProtocolSerializer::serialize(const std::vector<Acquisition> &acqs) {
+    uint16_t id = ISMRMRD_MESSAGE_ACQUISITION_BATCH;
+    if (_buffered) {
+        BufferedWriter ws(*_buffered);
+        write_acquisition_batch(acqs, ws, &id);
+    } else {
+        write_acquisition_batch(acqs, _ws, &id);
+    }
+    if (_index) {
+        // The members are indexed at their header deltas, after the id, length, count and first
+        // header of the batch
+        const uint64_t batch_offset = _offset;
+        _offset += sizeof(uint16_t) + sizeof(uint64_t) + sizeof(uint32_t);
+        if (!acqs.empty()) {
+            _offset += sizeof(AcquisitionHeader);
+        }
+        uint32_t delta[DELTA_MASK_WORDS + HEADER_WORDS];
+        for (size_t i = 0; i < acqs.size(); i++) {
+            const AcquisitionHeader &ahead = acqs[i].getHead();
+            _index->add(_offset, ahead, batch_offset);
+            _offset += encode_header_delta(ahead, acqs[0].getHead(), delta) * sizeof(uint32_t) +
+                       acquisition_size(ahead) - sizeof(AcquisitionHeader);
+        }
+    }
 }
 
 template <typename T>
 void ProtocolSerializer::serialize(const Image<T> &img) {
-    write_msg_id(ISMRMRD_MESSAGE_IMAGE);
-    ISMRMRD::serialize(img, _ws);
+    write_message(img, ISMRMRD_MESSAGE_IMAGE);
 }
 
 void ProtocolSerializer::serialize(const Waveform &wfm) {
-    write_msg_id(ISMRMRD_MESSAGE_WAVEFORM);
-    ISMRMRD::serialize(wfm, _ws);
+    write_message(wfm, ISMRMRD_MESSAGE_WAVEFORM);
 }
 
 template <typename T>
 void ProtocolSerializer::serialize(const NDArray<T> &arr) {
-    write_msg_id(ISMRMRD_MESSAGE_NDARRAY);
-    ISMRMRD::serialize(arr, _ws);
+    write_message(arr, ISMRMRD_MESSAGE_NDARRAY);
+}
+
+void ProtocolSerializer::serialize(const AcquisitionView &acq) {
+    write_message(acq, ISMRMRD_MESSAGE_ACQUISITION);
+}
+
+template <typename T>
+void ProtocolSerializer::serialize(const ImageView<T> &img) {
+    write_message(img, ISMRMRD_MESSAGE_IMAGE);
+}
+
+void ProtocolSerializer::serialize(const WaveformView &wfm) {
+    write_message(wfm, ISMRMRD_MESSAGE_WAVEFORM);
+}
+
+template <typename T>
+void ProtocolSerializer::serialize(const NDArrayView<T> &arr) {
+    write_message(arr, ISMRMRD_MESSAGE_NDARRAY);
 }
 
 void ProtocolSerializer::close() {
     write_msg_id(ISMRMRD_MESSAGE_CLOSE);
+    index_message(ISMRMRD_MESSAGE_CLOSE, 0);
+    if (_buffered) {
+        _buffered->flush();
+        if (_buffered->bad()) {
+            throw std::runtime_error("Error writing to stream");
+        }
+    }
 }
 
-ProtocolDeserializer::ProtocolDeserializer(ReadableStreamView &rs) : _rs(rs), _peeked(ISMRMRD_MESSAGE_UNPEEKED), _peeked_ndarray_data_type(ISMRMRD_MESSAGE_UNPEEKED) {}
+ProtocolDeserializer::ProtocolDeserializer(ReadableStreamView &rs)
+    : _rs(rs), _buffered(dynamic_cast<BufferedReadableStreamView *>(&rs)), _peeked(ISMRMRD_MESSAGE_UNPEEKED), _peeked_ndarray_data_type(ISMRMRD_MESSAGE_UNPEEKED),
+      _batch_remaining(0), _batch_bytes(0) {}
+
+void ProtocolDeserializer::read(char *buffer, size_t count) {
+    if (_buffered) {
+        BufferedReader(*_buffered).read(buffer, count);
+    } else {
+        _rs.read(buffer, count);
+    }
+}
+
+void ProtocolDeserializer::skip_bytes(uint64_t count) {
+    if (_buffered) {
+        BufferedReader(*_buffered).skip(static_cast<size_t>(count));
+    } else {
+        _rs.skip(static_cast<size_t>(count));
+    }
+}
+
+// Reads only what is needed to know the size of the message
+void ProtocolDeserializer::skip() {
+    switch (peek()) {
+    case ISMRMRD_MESSAGE_CONFIG_FILE:
+        skip_bytes(sizeof(ConfigFile().config));
+        break;
+    case ISMRMRD_MESSAGE_CONFIG_TEXT:
+    case ISMRMRD_MESSAGE_HEADER:
+    case ISMRMRD_MESSAGE_TEXT: {
+        uint32_t len;
+        read(reinterpret_cast<char *>(&len), sizeof(uint32_t));
+        skip_bytes(len);
+        break;
+    }
+    case ISMRMRD_MESSAGE_CLOSE:
+        break;
+    case ISMRMRD_MESSAGE_ACQUISITION: {
+        AcquisitionHeader ahead;
+        read(reinterpret_cast<char *>(&ahead), sizeof(AcquisitionHeader));
+        skip_bytes(acquisition_size(ahead) - sizeof(AcquisitionHeader));
+        break;
+    }
+    case ISMRMRD_MESSAGE_ACQUISITION_BATCH:
+        skip_bytes(_batch_bytes);
+        _batch_remaining = 0;
+        _batch_bytes = 0;
+        break;
+    case ISMRMRD_MESSAGE_IMAGE: {
+        uint64_t attr_length;
+        read(reinterpret_cast<char *>(&attr_length), sizeof(uint64_t));
+        uint64_t data_size = image_data_size(_peeked_image_header);
+        skip_bytes(attr_length);
+        skip_bytes(data_size);
+        break;
+    }
+    case ISMRMRD_MESSAGE_WAVEFORM: {
+        ISMRMRD_WaveformHeader head;
+        read(reinterpret_cast<char *>(&head), sizeof(ISMRMRD_WaveformHeader));
+        skip_bytes(uint64_t(head.number_of_samples) * head.channels * sizeof(uint32_t));
+        break;
+    }
+    case ISMRMRD_MESSAGE_NDARRAY: {
+        uint16_t ver_ndim[2];
+        read(reinterpret_cast<char *>(ver_ndim), sizeof(ver_ndim));
+        size_t element_size = ismrmrd_sizeof_data_type(_peeked_ndarray_data_type);
+        if (element_size == 0 || ver_ndim[1] > ISMRMRD_NDARRAY_MAXDIM) {
+            throw std::runtime_error("Error reading nd array");
+        }
+        size_t dims[ISMRMRD_NDARRAY_MAXDIM];
+        read(reinterpret_cast<char *>(dims), sizeof(size_t) * ver_ndim[1]);
+        uint64_t count = 1;
+        for (uint16_t n = 0; n < ver_ndim[1]; n++) {
+            count *= dims[n];
+        }
+        skip_bytes(count * element_size);
+        break;
+    }
+    default: {
+        std::stringstream ss;
+        ss << "Cannot skip unknown message type " << _peeked;
+        throw std::runtime_error(ss.str());
+    }
+    }
+    if (_rs.eof()) {
+        throw std::runtime_error("Error skipping message");
+    }
+    _peeked = ISMRMRD_MESSAGE_UNPEEKED;
+}
 
 uint16_t ProtocolDeserializer::peek() {
-    if (_peeked == ISMRMRD_MESSAGE_UNPEEKED) {
-        _rs.read(reinterpret_cast<char *>(&_peeked), sizeof(uint16_t));
+    while (_peeked == ISMRMRD_MESSAGE_UNPEEKED) {
+        read(reinterpret_cast<char *>(&_peeked), sizeof(uint16_t));
         if (_peeked == ISMRMRD_MESSAGE_IMAGE) {
-            _rs.read(reinterpret_cast<char *>(&_peeked_image_header), sizeof(ImageHeader));
+            read(reinterpret_cast<char *>(&_peeked_image_header), sizeof(ImageHeader));
         }
         if (_peeked == ISMRMRD_MESSAGE_NDARRAY) {
-            _rs.read(reinterpret_cast<char *>(&_peeked_ndarray_data_type), sizeof(uint16_t));
+            read(reinterpret_cast<char *>(&_peeked_ndarray_data_type), sizeof(uint16_t));
+        }
+        uint64_t batch_head_size = sizeof(uint32_t);
+        if (_peeked == ISMRMRD_MESSAGE_ACQUISITION_BATCH) {
+            read(reinterpret_cast<char *>(&_batch_bytes), sizeof(uint64_t));
+            read(reinterpret_cast<char *>(&_batch_remaining), sizeof(uint32_t));
+            if (_batch_remaining > 0) {
+                read(reinterpret_cast<char *>(&_batch_base), sizeof(AcquisitionHeader));
+                batch_head_size += sizeof(AcquisitionHeader);
+            }
         }
         if (_rs.eof()) {
             throw std::runtime_error("Error reading message ID");
         }
+        if (_peeked == ISMRMRD_MESSAGE_ACQUISITION_BATCH) {
+            if (_batch_bytes < batch_head_size ||
+                _batch_remaining > (_batch_bytes - batch_head_size) / (DELTA_MASK_WORDS * sizeof(uint32_t))) {
+                throw std::runtime_error("Error reading acquisition batch");
+            }
+            _batch_bytes -= batch_head_size;
+            // An empty batch carries nothing, go on to the next message
+            if (_batch_remaining == 0) {
+                if (_batch_bytes != 0) {
+                    throw std::runtime_error("Acquisition batch length does not match its acquisitions");
+                }
+                _peeked = ISMRMRD_MESSAGE_UNPEEKED;
+            }
+        }
     }
     return _peeked;
 }
@@ -305,9 +1067,9 @@ void ProtocolDeserializer::deserialize(IsmrmrdHeader &hdr) {
         throw std::runtime_error("Expected ISMRMRD_MESSAGE_HEADER");
     }
     uint32_t size;
-    _rs.read(reinterpret_cast<char *>(&size), sizeof(uint32_t));
+    read(reinterpret_cast<char *>(&size), sizeof(uint32_t));
     std::string str(size, '\0');
-    _rs.read(&str[0], size);
+    read(&str[0], size);
     ISMRMRD::deserialize(str.c_str(), hdr);
     _peeked = ISMRMRD_MESSAGE_UNPEEKED;
 }
@@ -316,13 +1078,61 @@ void ProtocolDeserializer::deserialize(Acquisition &acq) {
     if (peek() == ISMRMRD_MESSAGE_CLOSE) {
         throw ProtocolStreamClosed();
     }
+    if (peek() == ISMRMRD_MESSAGE_ACQUISITION_BATCH) {
+        read_batched(acq);
+        return;
+    }
     if (peek() != ISMRMRD_MESSAGE_ACQUISITION) {
         throw std::runtime_error("Expected ISMRMRD_MESSAGE_ACQUISITION");
     }
-    ISMRMRD::deserialize(acq, _rs);
+    if (_buffered) {
+        BufferedReader rs(*_buffered);
+        read_acquisition(acq, rs);
+    } else {
+        read_acquisition(acq, _rs);
+    }
     _peeked = ISMRMRD_MESSAGE_UNPEEKED;
 }
 
+void ProtocolDeserializer::deserialize(std::vector<Acquisition> &acqs) {
+    if (peek() == ISMRMRD_MESSAGE_CLOSE) {
+        throw ProtocolStreamClosed();
+    }
+    if (peek() == ISMRMRD_MESSAGE_ACQUISITION) {
+        acqs.resize(1);
+        deserialize(acqs[0]);
+        return;
+    }
+    if (peek() != ISMRMRD_MESSAGE_ACQUISITION_BATCH) {
+        throw std::runtime_error("Expected ISMRMRD_MESSAGE_ACQUISITION_BATCH");
+    }
+    acqs.resize(_batch_remaining);
+    for (size_t i = 0; i < acqs.size(); i++) {
+        read_batched(acqs[i]);
+    }
+}
+
+// Reads the next acquisition of the current batch
+void ProtocolDeserializer::read_batched(Acquisition &acq) {
+    uint64_t size;
+    if (_buffered) {
+        BufferedReader rs(*_buffered);
+        size = read_batched_acquisition(acq, _batch_base, rs);
+    } else {
+        size = read_batched_acquisition(acq, _batch_base, _rs);
+    }
+    if (size > _batch_bytes) {
+        throw std::runtime_error("Acquisition batch length does not match its acquisitions");
+    }
+    _batch_bytes -= size;
+    if (--_batch_remaining == 0) {
+        if (_batch_bytes != 0) {
+            throw std::runtime_error("Acquisition batch length does not match its acquisitions");
+        }
+        _peeked = ISMRMRD_MESSAGE_UNPEEKED;
+    }
+}
+
 template <typename T>
 void ProtocolDeserializer::deserialize(Image<T> &img) {
     if (peek() == ISMRMRD_MESSAGE_CLOSE) {
@@ -331,8 +1141,7 @@ void ProtocolDeserializer::deserialize(Image<T> &img) {
     if (peek() != ISMRMRD_MESSAGE_IMAGE) {
         throw std::runtime_error("Expected ISMRMRD_MESSAGE_IMAGE");
     }
-    img.setHead(_peeked_image_header);
-    deserialize_attr_and_pixels(img, _rs);
+    deserialize_attr_and_pixels(img, _peeked_image_header, _rs);
     _peeked = ISMRMRD_MESSAGE_UNPEEKED;
 }
 
@@ -343,7 +1152,12 @@ void ProtocolDeserializer::deserialize(Waveform &wfm) {
     if (peek() != ISMRMRD_MESSAGE_WAVEFORM) {
         throw std::runtime_error("Expected ISMRMRD_MESSAGE_WAVEFORM");
     }
-    ISMRMRD::deserialize(wfm, _rs);
+    if (_buffered) {
+        BufferedReader rs(*_buffered);
+        read_waveform(wfm, rs);
+    } else {
+        read_waveform(wfm, _rs);
+    }
     _peeked = ISMRMRD_MESSAGE_UNPEEKED;
 }
 
@@ -359,6 +1173,167 @@ void ProtocolDeserializer::deserialize(NDArray<T> &arr) {
     _peeked = ISMRMRD_MESSAGE_UNPEEKED;
 }
 
+namespace {
+
+// The image and nd array of one data type kept by a ProtocolVisitor
+template <typename T>
+struct TypedMessages {
+    Image<T> image;
+    NDArray<T> array;
+};
+
+} // namespace
+
+struct ProtocolVisitor::Messages : TypedMessages<uint16_t>, TypedMessages<int16_t>, TypedMessages<uint32_t>,
+                                   TypedMessages<int32_t>, TypedMessages<float>, TypedMessages<double>,
+                                   TypedMessages<complex_float_t>, TypedMessages<complex_double_t> {
+    ConfigFile config_file;
+    ConfigText config_text;
+    TextMessage text;
+    IsmrmrdHeader header;
+    Acquisition acquisition;
+    Waveform waveform;
+};
+
+ProtocolVisitor::ProtocolVisitor() : _messages(new Messages) {}
+
+ProtocolVisitor::~ProtocolVisitor() {
+    delete _messages;
+}
+
+bool ProtocolVisitor::accept(uint16_t, int) {
+    return true;
+}
+
+void ProtocolVisitor::visit(ConfigFile &) {}
+void ProtocolVisitor::visit(ConfigText &) {}
+void ProtocolVisitor::visit(TextMessage &) {}
+void ProtocolVisitor::visit(IsmrmrdHeader &) {}
+void ProtocolVisitor::visit(Acquisition &) {}
+void ProtocolVisitor::visit(Waveform &) {}
+void ProtocolVisitor::visit(Image<uint16_t> &) {}
+void ProtocolVisitor::visit(Image<int16_t> &) {}
+void ProtocolVisitor::visit(Image<uint32_t> &) {}
+void ProtocolVisitor::visit(Image<int32_t> &) {}
+void ProtocolVisitor::visit(Image<float> &) {}
+void ProtocolVisitor::visit(Image<double> &) {}
+void ProtocolVisitor::visit(Image<complex_float_t> &) {}
+void ProtocolVisitor::visit(Image<complex_double_t> &) {}
+void ProtocolVisitor::visit(NDArray<uint16_t> &) {}
+void ProtocolVisitor::visit(NDArray<int16_t> &) {}
+void ProtocolVisitor::visit(NDArray<uint32_t> &) {}
+void ProtocolVisitor::visit(NDArray<int32_t> &) {}
+void ProtocolVisitor::visit(NDArray<float> &) {}
+void ProtocolVisitor::visit(NDArray<double> &) {}
+void ProtocolVisitor::visit(NDArray<complex_float_t> &) {}
+void ProtocolVisitor::visit(NDArray<complex_double_t> &) {}
+
+template <typename T>
+void ProtocolDeserializer::dispatch_image(ProtocolVisitor &visitor) {
+    Image<T> &img = static_cast<TypedMessages<T> &>(*visitor._messages).image;
+    deserialize(img);
+    visitor.visit(img);
+}
+
+template <typename T>
+void ProtocolDeserializer::dispatch_ndarray(ProtocolVisitor &visitor) {
+    NDArray<T> &arr = static_cast<TypedMessages<T> &>(*visitor._messages).array;
+    deserialize(arr);
+    visitor.visit(arr);
+}
+
+bool ProtocolDeserializer::dispatch(ProtocolVisitor &visitor) {
+    typedef void (ProtocolDeserializer::*Dispatch)(ProtocolVisitor &);
+    // Indexed by ISMRMRD_DataTypes
+    static const Dispatch image_dispatch[] = {
+        NULL,
+        &ProtocolDeserializer::dispatch_image<uint16_t>,
+        &ProtocolDeserializer::dispatch_image<int16_t>,
+        &ProtocolDeserializer::dispatch_image<uint32_t>,
+        &ProtocolDeserializer::dispatch_image<int32_t>,
+        &ProtocolDeserializer::dispatch_image<float>,
+        &ProtocolDeserializer::dispatch_image<double>,
+        &ProtocolDeserializer::dispatch_image<complex_float_t>,
+        &ProtocolDeserializer::dispatch_image<complex_double_t>,
+    };
+    static const Dispatch ndarray_dispatch[] = {
+        NULL,
+        &ProtocolDeserializer::dispatch_ndarray<uint16_t>,
+        &ProtocolDeserializer::dispatch_ndarray<int16_t>,
+        &ProtocolDeserializer::dispatch_ndarray<uint32_t>,
+        &ProtocolDeserializer::dispatch_ndarray<int32_t>,
+        &ProtocolDeserializer::dispatch_ndarray<float>,
+        &ProtocolDeserializer::dispatch_ndarray<double>,
+        &ProtocolDeserializer::dispatch_ndarray<complex_float_t>,
+        &ProtocolDeserializer::dispatch_ndarray<complex_double_t>,
+    };
+    const int data_types = sizeof(image_dispatch) / sizeof(image_dispatch[0]);
+
+    uint16_t id = peek();
+    if (id == ISMRMRD_MESSAGE_CLOSE) {
+        return false;
+    }
+    int data_type = 0;
+    if (id == ISMRMRD_MESSAGE_IMAGE) {
+        data_type = _peeked_image_header.data_type;
+    } else if (id == ISMRMRD_MESSAGE_NDARRAY) {
+        data_type = _peeked_ndarray_data_type;
+    }
+    if (!visitor.accept(id == ISMRMRD_MESSAGE_ACQUISITION_BATCH ? uint16_t(ISMRMRD_MESSAGE_ACQUISITION) : id, data_type)) {
+        skip();
+        return true;
+    }
+
+    ProtocolVisitor::Messages &messages = *visitor._messages;
+    switch (id) {
+    case ISMRMRD_MESSAGE_CONFIG_FILE:
+        deserialize(messages.config_file);
+        visitor.visit(messages.config_file);
+        break;
+    case ISMRMRD_MESSAGE_CONFIG_TEXT:
+        deserialize(messages.config_text);
+        visitor.visit(messages.config_text);
+        break;
+    case ISMRMRD_MESSAGE_TEXT:
+        deserialize(messages.text);
+        visitor.visit(messages.text);
+        break;
+    case ISMRMRD_MESSAGE_HEADER:
+        // Parsing adds to what the header holds
+        messages.header = IsmrmrdHeader();
+        deserialize(messages.header);
+        visitor.visit(messages.header);
+        break;
+    case ISMRMRD_MESSAGE_ACQUISITION:
+    case ISMRMRD_MESSAGE_ACQUISITION_BATCH:
+        deserialize(messages.acquisition);
+        visitor.visit(messages.acquisition);
+        break;
+    case ISMRMRD_MESSAGE_WAVEFORM:
+        deserialize(messages.waveform);
+        visitor.visit(messages.waveform);
+        break;
+    case ISMRMRD_MESSAGE_IMAGE:
+        if (data_type <= 0 || data_type >= data_types) {
+            throw std::runtime_error("Unknown image data type");
+        }
+        (this->*image_dispatch[data_type])(visitor);
+        break;
+    case ISMRMRD_MESSAGE_NDARRAY:
+        if (data_type <= 0 || data_type >= data_types) {
+            throw std::runtime_error("Unknown nd array data type");
+        }
+        (this->*ndarray_dispatch[data_type])(visitor);
+        break;
+    default: {
+        std::stringstream ss;
+        ss << "Cannot dispatch unknown message type " << id;
+        throw std::runtime_error(ss.str());
+    }
+    }
+    return true;
+}
+
 // template instantiations
 template EXPORTISMRMRD void serialize(const Image<uint16_t> &img, WritableStreamView &ws);
 template EXPORTISMRMRD void serialize(const Image<uint32_t> &img, WritableStreamView &ws);
@@ -430,4 +1405,38 @@ template EXPORTISMRMRD void ProtocolDeserializer::deserialize(NDArray<double> &a
 template EXPORTISMRMRD void ProtocolDeserializer::deserialize(NDArray< std::complex<float> > &arr);
 template EXPORTISMRMRD void ProtocolDeserializer::deserialize(NDArray< std::complex<double> > &arr);
 
+template EXPORTISMRMRD void serialize(const ImageView<uint16_t> &img, WritableStreamView &ws);
+template EXPORTISMRMRD void serialize(const ImageView<uint32_t> &img, WritableStreamView &ws);
+template EXPORTISMRMRD void serialize(const ImageView<int16_t> &img, WritableStreamView &ws);
+template EXPORTISMRMRD void serialize(const ImageView<int32_t> &img, WritableStreamView &ws);
+template EXPORTISMRMRD void serialize(const ImageView<float> &img, WritableStreamView &ws);
+template EXPORTISMRMRD void serialize(const ImageView<double> &img, WritableStreamView &ws);
+template EXPORTISMRMRD void serialize(const ImageView<std::complex<float> > &img, WritableStreamView &ws);
+template EXPORTISMRMRD void serialize(const ImageView<std::complex<double> > &img, WritableStreamView &ws);
+template EXPORTISMRMRD void ProtocolSerializer::serialize(const ImageView<uint16_t> &img);
+template EXPORTISMRMRD void ProtocolSerializer::serialize(const ImageView<uint32_t> &img);
+template EXPORTISMRMRD void ProtocolSerializer::serialize(const ImageView<int16_t> &img);
+template EXPORTISMRMRD void ProtocolSerializer::serialize(const ImageView<int32_t> &img);
+template EXPORTISMRMRD void ProtocolSerializer::serialize(const ImageView<float> &img);
+template EXPORTISMRMRD void ProtocolSerializer::serialize(const ImageView<double> &img);
+template EXPORTISMRMRD void ProtocolSerializer::serialize(const ImageView<std::complex<float> > &img);
+template EXPORTISMRMRD void ProtocolSerializer::serialize(const ImageView<std::complex<double> > &img);
+
+template EXPORTISMRMRD void serialize(const NDArrayView<uint16_t> &arr, WritableStreamView &ws);
+template EXPORTISMRMRD void serialize(const NDArrayView<uint32_t> &arr, WritableStreamView &ws);
+template EXPORTISMRMRD void serialize(const NDArrayView<int16_t> &arr, WritableStreamView &ws);
+template EXPORTISMRMRD void serialize(const NDArrayView<int32_t> &arr, WritableStreamView &ws);
+template EXPORTISMRMRD void serialize(const NDArrayView<float> &arr, WritableStreamView &ws);
+template EXPORTISMRMRD void serialize(const NDArrayView<double> &arr, WritableStreamView &ws);
+template EXPORTISMRMRD void serialize(const NDArrayView<std::complex<float> > &arr, WritableStreamView &ws);
+template EXPORTISMRMRD void serialize(const NDArrayView<std::complex<double> > &arr, WritableStreamView &ws);
+template EXPORTISMRMRD void ProtocolSerializer::serialize(const NDArrayView<uint16_t> &arr);
+template EXPORTISMRMRD void ProtocolSerializer::serialize(const NDArrayView<uint32_t> &arr);
+template EXPORTISMRMRD void ProtocolSerializer::serialize(const NDArrayView<int16_t> &arr);
+template EXPORTISMRMRD void ProtocolSerializer::serialize(const NDArrayView<int32_t> &arr);
+template EXPORTISMRMRD void ProtocolSerializer::serialize(const NDArrayView<float> &arr);
+template EXPORTISMRMRD void ProtocolSerializer::serialize(const NDArrayView<double> &arr);
+template EXPORTISMRMRD void ProtocolSerializer::serialize(const NDArrayView<std::complex<float> > &arr);
+template EXPORTISMRMRD void ProtocolSerializer::serialize(const NDArrayView<std::complex<double> > &arr);
+
 } // namespace ISMRMRD
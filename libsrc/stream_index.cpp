@@ -0,0 +1,385 @@
+#include "ismrmrd/stream_index.h"
+
+#include <string.h>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+namespace ISMRMRD {
+
+namespace {
+
+// Index files start with this, then the format version, the size of an entry, and the size
+// and checksum of the stream
+const char INDEX_MAGIC[8] = {'I', 'S', 'M', 'R', 'M', 'R', 'D', 'X'};
+const uint32_t INDEX_VERSION = 3;
+const size_t INDEX_HEADER_SIZE = sizeof(INDEX_MAGIC) + 2 * sizeof(uint32_t) + 2 * sizeof(uint64_t);
+// Bytes at the start of the stream that go into the checksum
+const size_t CHECKSUM_BYTES = 65536;
+
+// FNV-1a of the first CHECKSUM_BYTES of the file, and its size
+void stream_signature(const char *stream_filename, uint64_t &size, uint64_t &checksum) {
+    std::ifstream is(stream_filename, std::ios::binary);
+    if (!is) {
+        throw std::runtime_error(std::string("Failed to open stream file ") + stream_filename);
+    }
+    is.seekg(0, std::ios::end);
+    size = static_cast<uint64_t>(is.tellg());
+    is.seekg(0, std::ios::beg);
+    std::vector<char> bytes(static_cast<size_t>(size < CHECKSUM_BYTES ? size : CHECKSUM_BYTES));
+    if (!bytes.empty()) {
+        is.read(&bytes[0], bytes.size());
+    }
+    if (!is) {
+        throw std::runtime_error(std::string("Failed to read stream file ") + stream_filename);
+    }
+    checksum = 14695981039346656037ULL;
+    for (size_t n = 0; n < bytes.size(); n++) {
+        checksum ^= static_cast<unsigned char>(bytes[n]);
+        checksum *= 1099511628211ULL;
+    }
+}
+
+StreamIndexEntry empty_entry(uint64_t offset, uint16_t message_id) {
+    StreamIndexEntry entry;
+    // Zeroes the padding as well, entries are written as they are
+    memset(&entry, 0, sizeof(entry));
+    entry.offset = offset;
+    entry.message_id = message_id;
+    return entry;
+}
+
+void read_or_throw(std::istream &is, void *buffer, size_t count) {
+    is.read(static_cast<char *>(buffer), count);
+    if (!is) {
+        throw std::runtime_error("Unexpected end of stream file");
+    }
+}
+
+// Seeking past the end of a file does not fail, so the position is checked against its size
+void skip_or_throw(IStreamView &view, std::istream &is, uint64_t count, uint64_t file_size) {
+    view.skip(static_cast<size_t>(count));
+    if (!is || static_cast<uint64_t>(is.tellg()) > file_size) {
+        throw std::runtime_error("Unexpected end of stream file");
+    }
+}
+
+} // namespace
+
+StreamIndex::StreamIndex() : stream_size_(0), stream_checksum_(0) {}
+
+size_t StreamIndex::size() const {
+    return entries_.size();
+}
+
+const StreamIndexEntry &StreamIndex::operator[](size_t n) const {
+    return entries_[n];
+}
+
+void StreamIndex::clear() {
+    entries_.clear();
+    stream_size_ = 0;
+    stream_checksum_ = 0;
+}
+
+void StreamIndex::setStream(const char *stream_filename) {
+    stream_signature(stream_filename, stream_size_, stream_checksum_);
+}
+
+bool StreamIndex::matches(const char *stream_filename) const {
+    uint64_t size, checksum;
+    stream_signature(stream_filename, size, checksum);
+    return size == stream_size_ && (stream_checksum_ == 0 || checksum == stream_checksum_);
+}
+
+void StreamIndex::add(uint64_t offset, uint16_t message_id) {
+    entries_.push_back(empty_entry(offset, message_id));
+    // The stream ends with the close message, also when it is indexed while it is written
+    if (message_id == ISMRMRD_MESSAGE_CLOSE) {
+        stream_size_ = offset + sizeof(uint16_t);
+    }
+}
+
+void StreamIndex::add(uint64_t offset, uint16_t message_id, const AcquisitionHeader &head) {
+    StreamIndexEntry entry = empty_entry(offset, message_id);
+    entry.flags = head.flags;
+    entry.scan_counter = head.scan_counter;
+    entry.time_stamp = head.acquisition_time_stamp;
+    entry.idx = head.idx;
+    entries_.push_back(entry);
+}
+
+void StreamIndex::add(uint64_t offset, const AcquisitionHeader &head, uint64_t batch_offset) {
+    add(offset, ISMRMRD_MESSAGE_ACQUISITION_BATCH, head);
+    entries_.back().batch_offset = batch_offset;
+}
+
+void StreamIndex::add(uint64_t offset, const ImageHeader &head) {
+    StreamIndexEntry entry = empty_entry(offset, ISMRMRD_MESSAGE_IMAGE);
+    entry.flags = head.flags;
+    entry.time_stamp = head.acquisition_time_stamp;
+    entry.data_type = head.data_type;
+    entry.idx.average = head.average;
+    entry.idx.slice = head.slice;
+    entry.idx.contrast = head.contrast;
+    entry.idx.phase = head.phase;
+    entry.idx.repetition = head.repetition;
+    entry.idx.set = head.set;
+    entries_.push_back(entry);
+}
+
+void StreamIndex::add(uint64_t offset, const ISMRMRD_WaveformHeader &head) {
+    StreamIndexEntry entry = empty_entry(offset, ISMRMRD_MESSAGE_WAVEFORM);
+    entry.flags = head.flags;
+    entry.scan_counter = head.scan_counter;
+    entry.time_stamp = head.time_stamp;
+    entries_.push_back(entry);
+}
+
+void StreamIndex::add(uint64_t offset, uint16_t message_id, uint16_t data_type) {
+    StreamIndexEntry entry = empty_entry(offset, message_id);
+    entry.data_type = data_type;
+    entries_.push_back(entry);
+}
+
+void StreamIndex::read(const char *filename) {
+    std::ifstream is(filename, std::ios::binary);
+    if (!is) {
+        throw std::runtime_error(std::string("Failed to open stream index ") + filename);
+    }
+    char magic[sizeof(INDEX_MAGIC)];
+    uint32_t version = 0, entry_size = 0;
+    is.read(magic, sizeof(magic));
+    is.read(reinterpret_cast<char *>(&version), sizeof(uint32_t));
+    is.read(reinterpret_cast<char *>(&entry_size), sizeof(uint32_t));
+    if (!is || memcmp(magic, INDEX_MAGIC, sizeof(magic)) != 0 || version != INDEX_VERSION ||
+        entry_size != sizeof(StreamIndexEntry)) {
+        throw std::runtime_error(std::string("Not a stream index or unsupported version: ") + filename);
+    }
+    is.read(reinterpret_cast<char *>(&stream_size_), sizeof(uint64_t));
+    is.read(reinterpret_cast<char *>(&stream_checksum_), sizeof(uint64_t));
+
+    is.seekg(0, std::ios::end);
+    uint64_t size = static_cast<uint64_t>(is.tellg()) - INDEX_HEADER_SIZE;
+    is.seekg(INDEX_HEADER_SIZE, std::ios::beg);
+    entries_.resize(static_cast<size_t>(size / sizeof(StreamIndexEntry)));
+    if (!entries_.empty()) {
+        is.read(reinterpret_cast<char *>(&entries_[0]), entries_.size() * sizeof(StreamIndexEntry));
+    }
+    if (!is || size % sizeof(StreamIndexEntry) != 0) {
+        clear();
+        throw std::runtime_error(std::string("Stream index is truncated: ") + filename);
+    }
+}
+
+void StreamIndex::write(const char *filename) const {
+    std::ofstream os(filename, std::ios::binary | std::ios::trunc);
+    uint32_t version = INDEX_VERSION, entry_size = sizeof(StreamIndexEntry);
+    os.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    os.write(reinterpret_cast<const char *>(&version), sizeof(uint32_t));
+    os.write(reinterpret_cast<const char *>(&entry_size), sizeof(uint32_t));
+    os.write(reinterpret_cast<const char *>(&stream_size_), sizeof(uint64_t));
+    os.write(reinterpret_cast<const char *>(&stream_checksum_), sizeof(uint64_t));
+    if (!entries_.empty()) {
+        os.write(reinterpret_cast<const char *>(&entries_[0]), entries_.size() * sizeof(StreamIndexEntry));
+    }
+    os.close();
+    if (!os) {
+        throw std::runtime_error(std::string("Failed to write stream index ") + filename);
+    }
+}
+
+void buildStreamIndex(const char *stream_filename, StreamIndex &index) {
+    std::ifstream is(stream_filename, std::ios::binary);
+    if (!is) {
+        throw std::runtime_error(std::string("Failed to open stream file ") + stream_filename);
+    }
+    is.seekg(0, std::ios::end);
+    const uint64_t file_size = static_cast<uint64_t>(is.tellg());
+    is.seekg(0, std::ios::beg);
+    IStreamView view(is);
+    index.clear();
+
+    while (true) {
+        const uint64_t offset = static_cast<uint64_t>(is.tellg());
+        uint16_t id;
+        is.read(reinterpret_cast<char *>(&id), sizeof(uint16_t));
+        if (is.gcount() == 0 && is.eof()) {
+            break;
+        }
+        if (!is) {
+            throw std::runtime_error("Unexpected end of stream file");
+        }
+
+        // The headers that go into the index are read here, everything else is skipped
+        if (id == ISMRMRD_MESSAGE_ACQUISITION) {
+            AcquisitionHeader head;
+            read_or_throw(is, &head, sizeof(head));
+            index.add(offset, id, head);
+            skip_or_throw(view, is, acquisition_size(head) - sizeof(head), file_size);
+        } else if (id == ISMRMRD_MESSAGE_ACQUISITION_BATCH) {
+            uint64_t length;
+            uint32_t count;
+            AcquisitionHeader base;
+            read_or_throw(is, &length, sizeof(length));
+            read_or_throw(is, &count, sizeof(count));
+            if (count > 0) {
+                read_or_throw(is, &base, sizeof(base));
+            }
+            for (uint32_t n = 0; n < count; n++) {
+                const uint64_t member = static_cast<uint64_t>(is.tellg());
+                AcquisitionHeader head;
+                deserialize_header_delta(head, base, view);
+                if (!is) {
+                    throw std::runtime_error("Unexpected end of stream file");
+                }
+                index.add(member, head, offset);
+                skip_or_throw(view, is, acquisition_size(head) - sizeof(head), file_size);
+            }
+            if (static_cast<uint64_t>(is.tellg()) != offset + sizeof(uint16_t) + sizeof(uint64_t) + length) {
+                throw std::runtime_error("Acquisition batch length does not match its acquisitions");
+            }
+        } else if (id == ISMRMRD_MESSAGE_IMAGE) {
+            ImageHeader head;
+            uint64_t attr_length;
+            read_or_throw(is, &head, sizeof(head));
+            read_or_throw(is, &attr_length, sizeof(attr_length));
+            uint64_t data_size = image_data_size(head);
+            if (attr_length > file_size || data_size > file_size) {
+                throw std::runtime_error("Invalid image in stream file");
+            }
+            index.add(offset, head);
+            skip_or_throw(view, is, attr_length + data_size, file_size);
+        } else if (id == ISMRMRD_MESSAGE_WAVEFORM) {
+            ISMRMRD_WaveformHeader head;
+            read_or_throw(is, &head, sizeof(head));
+            index.add(offset, head);
+            skip_or_throw(view, is, uint64_t(head.number_of_samples) * head.channels * sizeof(uint32_t), file_size);
+        } else {
+            // The remaining messages are skipped by the deserializer from their start
+            is.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+            ProtocolDeserializer deserializer(view);
+            if (deserializer.peek() == ISMRMRD_MESSAGE_NDARRAY) {
+                index.add(offset, id, static_cast<uint16_t>(deserializer.peek_ndarray_data_type()));
+            } else {
+                index.add(offset, id);
+            }
+            deserializer.skip();
+            if (static_cast<uint64_t>(is.tellg()) > file_size) {
+                throw std::runtime_error("Unexpected end of stream file");
+            }
+        }
+    }
+    index.setStream(stream_filename);
+}
+
+IndexedStreamReader::IndexedStreamReader(const char *stream_filename, const char *index_filename)
+    : stream_(stream_filename, std::ios::binary), view_(stream_), deserializer_(NULL),
+      base_offset_(std::numeric_limits<uint64_t>::max()) {
+    if (!stream_) {
+        throw std::runtime_error(std::string("Failed to open stream file ") + stream_filename);
+    }
+    if (index_filename) {
+        index_.read(index_filename);
+        if (!index_.matches(stream_filename)) {
+            throw std::runtime_error(std::string("Stream index ") + index_filename + " is not the index of " +
+                                     stream_filename);
+        }
+    } else {
+        buildStreamIndex(stream_filename, index_);
+    }
+    for (size_t n = 0; n < index_.size(); n++) {
+        if (index_[n].message_id == ISMRMRD_MESSAGE_ACQUISITION ||
+            index_[n].message_id == ISMRMRD_MESSAGE_ACQUISITION_BATCH) {
+            acquisitions_.push_back(n);
+        } else if (index_[n].message_id == ISMRMRD_MESSAGE_WAVEFORM) {
+            waveforms_.push_back(n);
+        }
+    }
+}
+
+IndexedStreamReader::~IndexedStreamReader() {
+    delete deserializer_;
+}
+
+const StreamIndex &IndexedStreamReader::getIndex() const {
+    return index_;
+}
+
+uint32_t IndexedStreamReader::getNumberOfAcquisitions() const {
+    return static_cast<uint32_t>(acquisitions_.size());
+}
+
+uint32_t IndexedStreamReader::getNumberOfWaveforms() const {
+    return static_cast<uint32_t>(waveforms_.size());
+}
+
+// Positions the stream after the message id of the entry
+void IndexedStreamReader::seekBody(const StreamIndexEntry &entry) {
+    stream_.clear();
+    stream_.seekg(static_cast<std::streamoff>(entry.offset + sizeof(uint16_t)), std::ios::beg);
+}
+
+// Reads the first header of the batch, unless it was read for the previous acquisition, then
+// the header delta and data of the acquisition
+void IndexedStreamReader::readBatched(const StreamIndexEntry &entry, Acquisition &acq) {
+    if (entry.batch_offset != base_offset_) {
+        stream_.clear();
+        stream_.seekg(static_cast<std::streamoff>(entry.batch_offset + sizeof(uint16_t) + sizeof(uint64_t) + sizeof(uint32_t)),
+                      std::ios::beg);
+        view_.read(reinterpret_cast<char *>(&base_), sizeof(base_));
+        if (view_.eof()) {
+            throw std::runtime_error("Unexpected end of stream file");
+        }
+        base_offset_ = entry.batch_offset;
+    }
+    stream_.clear();
+    stream_.seekg(static_cast<std::streamoff>(entry.offset), std::ios::beg);
+    AcquisitionHeader head;
+    deserialize_header_delta(head, base_, view_);
+    acq.setHead(head);
+    view_.read(reinterpret_cast<char *>(acq.getTrajPtr()), acq.getNumberOfTrajElements() * sizeof(float));
+    view_.read(reinterpret_cast<char *>(acq.getDataPtr()), acq.getNumberOfDataElements() * sizeof(complex_float_t));
+    if (view_.eof()) {
+        throw std::runtime_error("Unexpected end of stream file");
+    }
+}
+
+void IndexedStreamReader::readAcquisition(uint32_t index, Acquisition &acq) {
+    if (index >= acquisitions_.size()) {
+        throw std::runtime_error("Acquisition index out of range");
+    }
+    const StreamIndexEntry &entry = index_[acquisitions_[index]];
+    if (entry.message_id == ISMRMRD_MESSAGE_ACQUISITION_BATCH) {
+        readBatched(entry, acq);
+        return;
+    }
+    seekBody(entry);
+    ISMRMRD::deserialize(acq, view_);
+}
+
+void IndexedStreamReader::readWaveform(uint32_t index, Waveform &wfm) {
+    if (index >= waveforms_.size()) {
+        throw std::runtime_error("Waveform index out of range");
+    }
+    seekBody(index_[waveforms_[index]]);
+    ISMRMRD::deserialize(wfm, view_);
+}
+
+ProtocolDeserializer &IndexedStreamReader::seek(size_t entry) {
+    if (entry >= index_.size()) {
+        throw std::runtime_error("Stream index entry out of range");
+    }
+    if (index_[entry].message_id == ISMRMRD_MESSAGE_ACQUISITION_BATCH) {
+        throw std::runtime_error("Acquisitions in a batch are read with readAcquisition");
+    }
+    stream_.clear();
+    stream_.seekg(static_cast<std::streamoff>(index_[entry].offset), std::ios::beg);
+    // A new deserializer, the old one may have peeked at another message
+    delete deserializer_;
+    deserializer_ = NULL;
+    deserializer_ = new ProtocolDeserializer(view_);
+    return *deserializer_;
+}
+
+} // namespace ISMRMRD
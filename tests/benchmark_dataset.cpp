@@ -1,7 +1,9 @@
 #include <boost/filesystem.hpp>
 #include <boost/random.hpp>
 #include <chrono>
+#include <cmath>
 #include <iostream>
+#include <thread>
 #include <ismrmrd/dataset.h>
 #include <ismrmrd/ismrmrd.h>
 
@@ -48,5 +50,40 @@ int main(int argc, char **argv) {
         std::cout << "Read duration: " << duration.count() << "s" << std::endl;
     }
 
+    // Worker threads sharing one dataset. The HDF5 reads are serialized, the
+    // work done on the acquisitions outside the library runs in parallel.
+    std::cout << "Hardware threads: " << std::thread::hardware_concurrency() << std::endl;
+    for (int work = 0; work < 2; work++) {
+        std::cout << (work ? "Concurrent read and process" : "Concurrent read") << std::endl;
+        double single = 0;
+        for (unsigned int threads = 1; threads <= 8; threads *= 2) {
+            Dataset dataset = Dataset(temp.string().c_str(), "/test", DATASET_READ_ONLY);
+            std::vector<double> sums(threads, 0.0);
+            auto start = std::chrono::high_resolution_clock::now();
+            std::vector<std::thread> workers;
+            for (unsigned int t = 0; t < threads; t++) {
+                workers.push_back(std::thread([&, t]() {
+                    Acquisition acq;
+                    double sum = 0;
+                    for (size_t i = t; i < acqs.size(); i += threads) {
+                        dataset.readAcquisition(uint32_t(i), acq);
+                        for (int pass = 0; pass < work * 8; pass++) {
+                            for (const complex_float_t *it = acq.data_begin(); it != acq.data_end(); ++it)
+                                sum += std::sqrt(std::norm(*it) + pass);
+                        }
+                    }
+                    sums[t] = sum;
+                }));
+            }
+            for (auto &worker : workers)
+                worker.join();
+            auto duration = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start);
+            if (threads == 1)
+                single = duration.count();
+            std::cout << "  " << threads << " threads: " << duration.count() << "s, speedup "
+                      << single / duration.count() << std::endl;
+        }
+    }
+
     boost::filesystem::remove(temp);
 }
\ No newline at end of file
@@ -0,0 +1,103 @@
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <ismrmrd/decode_pipeline.h>
+#include <ismrmrd/meta.h>
+#include <ismrmrd/serialization_iostream.h>
+
+using namespace ISMRMRD;
+
+// Acquisitions with a reconstructed image every 64 of them, which carries meta attributes
+std::string create_stream() {
+    std::stringstream out(std::ios::out | std::ios::binary);
+    OStreamView os(out);
+    BufferedWritableStreamView ws(os);
+    ProtocolSerializer serializer(ws);
+
+    Acquisition acq(256, 8, 2);
+    for (size_t i = 0; i < acq.getNumberOfDataElements(); i++) {
+        acq.getDataPtr()[i] = complex_float_t(float(i), -float(i));
+    }
+    Image<float> img(128, 128, 1, 1);
+    MetaContainer meta;
+    for (int n = 0; n < 40; n++) {
+        std::stringstream name;
+        name << "attribute_" << n;
+        meta.set(name.str().c_str(), n * 0.5);
+        meta.append(name.str().c_str(), "value");
+    }
+    std::stringstream meta_xml;
+    serialize(meta, meta_xml);
+    img.setAttributeString(meta_xml.str());
+
+    for (uint32_t n = 0; n < 16384; n++) {
+        acq.scan_counter() = n;
+        serializer.serialize(acq);
+        if (n % 64 == 63) {
+            serializer.serialize(img);
+        }
+    }
+    serializer.close();
+    return out.str();
+}
+
+// The loop of ismrmrd_stream_to_hdf5, a fresh object for each message
+size_t decode_loop(const std::string &contents) {
+    std::stringstream ss(contents, std::ios::in | std::ios::binary);
+    IStreamView is(ss);
+    BufferedReadableStreamView rs(is);
+    ProtocolDeserializer deserializer(rs);
+    size_t messages = 0;
+    while (deserializer.peek() != ISMRMRD_MESSAGE_CLOSE) {
+        if (deserializer.peek() == ISMRMRD_MESSAGE_ACQUISITION) {
+            Acquisition acq;
+            deserializer.deserialize(acq);
+        } else if (deserializer.peek() == ISMRMRD_MESSAGE_IMAGE &&
+                   deserializer.peek_image_data_type() == ISMRMRD_FLOAT) {
+            Image<float> img;
+            deserializer.deserialize(img);
+            MetaContainer meta;
+            deserialize(img.getAttributeString(), meta);
+        } else {
+            deserializer.skip();
+        }
+        messages++;
+    }
+    return messages;
+}
+
+size_t decode_pipeline(const std::string &contents, unsigned int workers) {
+    std::stringstream ss(contents, std::ios::in | std::ios::binary);
+    IStreamView is(ss);
+    DecodePipelineOptions options;
+    options.workers = workers;
+    options.parse_image_meta = true;
+    DecodePipeline pipeline(is, options);
+    DecodedMessage msg;
+    size_t messages = 0;
+    while (pipeline.readNext(msg)) {
+        messages++;
+    }
+    return messages;
+}
+
+int main() {
+    std::string contents = create_stream();
+    std::cout << "Stream of " << contents.size() / (1024 * 1024) << " MiB" << std::endl;
+    std::cout << "Hardware threads: " << std::thread::hardware_concurrency() << std::endl;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    size_t messages = decode_loop(contents);
+    double single = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "Deserialize loop: " << messages << " messages in " << single << "s" << std::endl;
+
+    for (unsigned int workers = 0; workers <= 8; workers = workers ? workers * 2 : 1) {
+        start = std::chrono::high_resolution_clock::now();
+        messages = decode_pipeline(contents, workers);
+        double duration = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        std::cout << "Pipeline, " << workers << " workers: " << messages << " messages in " << duration
+                  << "s, speedup " << single / duration << std::endl;
+    }
+}
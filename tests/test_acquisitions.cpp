@@ -105,6 +105,43 @@ BOOST_AUTO_TEST_CASE(test_acquisition_make_consistent)
     ismrmrd_cleanup_acquisition(&acq);
 }
 
+BOOST_AUTO_TEST_CASE(test_acquisition_capacity)
+{
+    Acquisition acq(512, 8, 2);
+    BOOST_CHECK_EQUAL(acq.getDataCapacity(), 512u * 8);
+    BOOST_CHECK_EQUAL(acq.getTrajCapacity(), 512u * 2);
+    const complex_float_t *data = acq.getDataPtr();
+    const float *traj = acq.getTrajPtr();
+
+    // Shrinking keeps the memory
+    acq.resize(256, 4, 2);
+    BOOST_CHECK_EQUAL(acq.getNumberOfDataElements(), 256u * 4);
+    BOOST_CHECK_EQUAL(acq.getDataCapacity(), 512u * 8);
+    BOOST_CHECK(acq.getDataPtr() == data);
+    BOOST_CHECK(acq.getTrajPtr() == traj);
+
+    AcquisitionHeader head = acq.getHead();
+    head.number_of_samples = 512;
+    head.active_channels = 8;
+    acq.setHead(head);
+    BOOST_CHECK(acq.getDataPtr() == data);
+    BOOST_CHECK_EQUAL(acq.available_channels(), 8);
+
+    // Assignment copies into the memory that is there
+    Acquisition small(128, 2, 2);
+    small.data(127, 1) = complex_float_t(1, 2);
+    acq = small;
+    BOOST_CHECK(acq.getDataPtr() == data);
+    BOOST_CHECK_EQUAL(acq.number_of_samples(), 128);
+    BOOST_CHECK(acq.data(127, 1) == complex_float_t(1, 2));
+
+    acq.reserve(1024, 8, 3);
+    BOOST_CHECK_EQUAL(acq.getDataCapacity(), 1024u * 8);
+    BOOST_CHECK_EQUAL(acq.getTrajCapacity(), 1024u * 3);
+    BOOST_CHECK_EQUAL(acq.number_of_samples(), 128);
+    BOOST_CHECK(acq.data(127, 1) == complex_float_t(1, 2));
+}
+
 static void check_header(ISMRMRD_AcquisitionHeader* chead)
 {
     BOOST_CHECK_EQUAL(chead->version, ISMRMRD_VERSION_MAJOR);
@@ -0,0 +1,265 @@
+#include "ismrmrd/container.h"
+#include "ismrmrd/dataset.h"
+#include "ismrmrd/serialization.h"
+#include "ismrmrd/serialization_iostream.h"
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+#include <fstream>
+
+using namespace ISMRMRD;
+
+namespace {
+
+Acquisition make_acquisition(uint16_t line) {
+    Acquisition acq(64, 4, 2);
+    acq.idx().kspace_encode_step_1 = line;
+    acq.scan_counter() = line;
+    for (size_t i = 0; i < acq.getNumberOfDataElements(); i++) {
+        acq.getDataPtr()[i] = complex_float_t(float(i), float(line));
+    }
+    for (size_t i = 0; i < acq.getNumberOfTrajElements(); i++) {
+        acq.getTrajPtr()[i] = float(i + line);
+    }
+    return acq;
+}
+
+void check_acquisition(const Acquisition &acq, uint16_t line) {
+    Acquisition ref = make_acquisition(line);
+    BOOST_REQUIRE(acq.getHead() == ref.getHead());
+    BOOST_CHECK(std::equal(acq.data_begin(), acq.data_end(), ref.data_begin()));
+    BOOST_CHECK(std::equal(acq.traj_begin(), acq.traj_end(), ref.traj_begin()));
+}
+
+void write_test_data(Dataset &dataset) {
+    dataset.writeHeader("<ismrmrdHeader/>");
+    for (uint16_t i = 0; i < 10; i++) {
+        dataset.appendAcquisition(make_acquisition(i));
+    }
+
+    Waveform wav(32, 2);
+    for (uint32_t *p = wav.begin_data(); p != wav.end_data(); ++p) {
+        *p = uint32_t(p - wav.begin_data());
+    }
+    dataset.appendWaveform(wav);
+
+    Image<float> im(16, 8, 1, 2);
+    im.setAttributeString("<ismrmrdMeta/>");
+    for (size_t i = 0; i < im.getNumberOfDataElements(); i++) {
+        im.getDataPtr()[i] = float(i);
+    }
+    dataset.appendImage("recon", im);
+    dataset.appendImage("recon", im);
+
+    std::vector<size_t> dims;
+    dims.push_back(3);
+    dims.push_back(4);
+    NDArray<double> arr(dims);
+    for (size_t i = 0; i < arr.getNumberOfElements(); i++) {
+        arr.getDataPtr()[i] = double(i);
+    }
+    dataset.appendNDArray("map", arr);
+}
+
+void check_test_data(Dataset &dataset, const std::string &image_var, const std::string &array_var) {
+    std::string xml;
+    dataset.readHeader(xml);
+    BOOST_CHECK_EQUAL(xml, "<ismrmrdHeader/>");
+
+    BOOST_REQUIRE_EQUAL(dataset.getNumberOfAcquisitions(), 10u);
+    // Random access, in reverse order
+    for (uint32_t i = 10; i-- > 0;) {
+        Acquisition acq;
+        dataset.readAcquisition(i, acq);
+        check_acquisition(acq, uint16_t(i));
+    }
+
+    BOOST_REQUIRE_EQUAL(dataset.getNumberOfWaveforms(), 1u);
+    Waveform wav;
+    dataset.readWaveform(0, wav);
+    BOOST_REQUIRE_EQUAL(wav.size(), 64u);
+    BOOST_CHECK_EQUAL(wav.begin_data()[63], 63u);
+
+    BOOST_REQUIRE_EQUAL(dataset.getNumberOfImages(image_var), 2u);
+    Image<float> im;
+    dataset.readImage(image_var, 1, im);
+    BOOST_CHECK_EQUAL(im.getMatrixSizeX(), 16u);
+    BOOST_CHECK_EQUAL(im.getNumberOfChannels(), 2u);
+    BOOST_CHECK_EQUAL(im.getAttributeString(), std::string("<ismrmrdMeta/>"));
+    BOOST_CHECK_EQUAL(im.getDataPtr()[100], 100.0f);
+
+    BOOST_REQUIRE_EQUAL(dataset.getNumberOfNDArrays(array_var), 1u);
+    NDArray<double> arr;
+    dataset.readNDArray(array_var, 0, arr);
+    BOOST_CHECK_EQUAL(arr.getNDim(), 2u);
+    BOOST_CHECK_EQUAL(arr.getDims()[1], 4u);
+    BOOST_CHECK_EQUAL(arr.getDataPtr()[11], 11.0);
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(ContainerTest)
+
+BOOST_AUTO_TEST_CASE(test_container_read_write) {
+    boost::filesystem::path temp = boost::filesystem::unique_path();
+
+    {
+        Dataset dataset(new ContainerDatasetBackend(temp.string().c_str()));
+        write_test_data(dataset);
+        // Readable while the file is still being written
+        check_test_data(dataset, "recon", "map");
+    }
+
+    BOOST_CHECK(ContainerDatasetBackend::isContainerFile(temp.string().c_str()));
+
+    {
+        ContainerDatasetBackend *backend = new ContainerDatasetBackend(temp.string().c_str(), false);
+        Dataset dataset(backend);
+        check_test_data(dataset, "recon", "map");
+        BOOST_CHECK_EQUAL(backend->getAcquisitionCounters(7).kspace_encode_step_1, 7);
+
+        // Arrays are overwritten in place, and only by arrays of the same size
+        ISMRMRD_NDArray arr;
+        ismrmrd_init_ndarray(&arr);
+        arr.data_type = ISMRMRD_DOUBLE;
+        arr.ndim = 2;
+        arr.dims[0] = 3;
+        arr.dims[1] = 4;
+        ismrmrd_make_consistent_ndarray(&arr);
+        for (size_t i = 0; i < 12; i++) {
+            static_cast<double *>(arr.data)[i] = double(i);
+        }
+        static_cast<double *>(arr.data)[11] = -11.0;
+        const uintmax_t size = boost::filesystem::file_size(temp);
+        BOOST_CHECK(backend->replaceNDArray("map", 0, &arr));
+        arr.dims[1] = 2;
+        BOOST_CHECK_THROW(backend->replaceNDArray("map", 0, &arr), std::runtime_error);
+        ismrmrd_cleanup_ndarray(&arr);
+        NDArray<double> read;
+        dataset.readNDArray("map", 0, read);
+        BOOST_CHECK_EQUAL(read.getDataPtr()[11], -11.0);
+        BOOST_CHECK_EQUAL(read.getDataPtr()[10], 10.0);
+        BOOST_CHECK_EQUAL(boost::filesystem::file_size(temp), size);
+
+        // Append to the existing file
+        dataset.appendAcquisition(make_acquisition(10));
+    }
+
+    {
+        Dataset dataset(new ContainerDatasetBackend(temp.string().c_str(), false));
+        BOOST_REQUIRE_EQUAL(dataset.getNumberOfAcquisitions(), 11u);
+        Acquisition acq;
+        dataset.readAcquisition(10, acq);
+        check_acquisition(acq, 10);
+        dataset.readAcquisition(3, acq);
+        check_acquisition(acq, 3);
+        NDArray<double> arr;
+        dataset.readNDArray("map", 0, arr);
+        BOOST_CHECK_EQUAL(arr.getDataPtr()[11], -11.0);
+    }
+
+    boost::filesystem::remove(temp);
+}
+
+BOOST_AUTO_TEST_CASE(test_container_is_protocol_stream) {
+    boost::filesystem::path temp = boost::filesystem::unique_path();
+
+    {
+        Dataset dataset(new ContainerDatasetBackend(temp.string().c_str()));
+        for (uint16_t i = 0; i < 5; i++) {
+            dataset.appendAcquisition(make_acquisition(i));
+        }
+    }
+
+    std::ifstream file(temp.string().c_str(), std::ios::in | std::ios::binary);
+    file.seekg(16);
+    IStreamView rs(file);
+    ProtocolDeserializer deserializer(rs);
+    uint16_t line = 0;
+    while (deserializer.peek() != ISMRMRD_MESSAGE_CLOSE) {
+        Acquisition acq;
+        deserializer.deserialize(acq);
+        check_acquisition(acq, line++);
+    }
+    BOOST_CHECK_EQUAL(line, 5);
+    file.close();
+
+    boost::filesystem::remove(temp);
+}
+
+BOOST_AUTO_TEST_CASE(test_container_recover_index) {
+    boost::filesystem::path temp = boost::filesystem::unique_path();
+    boost::filesystem::path truncated = boost::filesystem::unique_path();
+
+    {
+        Dataset dataset(new ContainerDatasetBackend(temp.string().c_str()));
+        write_test_data(dataset);
+    }
+
+    // Keep the data and drop the index, like after a crash of the writer
+    {
+        std::ifstream in(temp.string().c_str(), std::ios::in | std::ios::binary);
+        std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::ofstream out(truncated.string().c_str(), std::ios::out | std::ios::binary);
+        out.write(&bytes[0], bytes.size() - 40);
+    }
+
+    const uintmax_t truncated_size = boost::filesystem::file_size(truncated);
+    {
+        Dataset dataset(new ContainerDatasetBackend(truncated.string().c_str(), false));
+        check_test_data(dataset, "images", "arrays");
+    }
+
+    // Reading does not write the rebuilt index, flush does
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(truncated), truncated_size);
+    {
+        Dataset dataset(new ContainerDatasetBackend(truncated.string().c_str(), false));
+        dataset.flush();
+    }
+    BOOST_CHECK_GT(boost::filesystem::file_size(truncated), truncated_size);
+    {
+        Dataset dataset(new ContainerDatasetBackend(truncated.string().c_str(), false));
+        check_test_data(dataset, "images", "arrays");
+    }
+
+    boost::filesystem::remove(temp);
+    boost::filesystem::remove(truncated);
+}
+
+BOOST_AUTO_TEST_CASE(test_container_hdf5_conversion) {
+    boost::filesystem::path hdf5_file = boost::filesystem::unique_path();
+    boost::filesystem::path container_file = boost::filesystem::unique_path();
+    boost::filesystem::path hdf5_copy = boost::filesystem::unique_path();
+
+    {
+        Dataset dataset(hdf5_file.string().c_str(), "dataset", true);
+        write_test_data(dataset);
+    }
+
+    {
+        HDF5DatasetBackend source(hdf5_file.string().c_str(), "dataset", false);
+        ContainerDatasetBackend destination(container_file.string().c_str());
+        copyDataset(source, destination);
+    }
+
+    {
+        Dataset dataset(new ContainerDatasetBackend(container_file.string().c_str(), false));
+        check_test_data(dataset, "recon", "map");
+    }
+
+    {
+        ContainerDatasetBackend source(container_file.string().c_str(), false);
+        HDF5DatasetBackend destination(hdf5_copy.string().c_str(), "dataset", true);
+        copyDataset(source, destination);
+    }
+
+    {
+        Dataset dataset(hdf5_copy.string().c_str(), "dataset", false);
+        check_test_data(dataset, "recon", "map");
+    }
+
+    boost::filesystem::remove(hdf5_file);
+    boost::filesystem::remove(container_file);
+    boost::filesystem::remove(hdf5_copy);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,9 +1,17 @@
+#include "ismrmrd/container.h"
 #include "ismrmrd/dataset.h"
 #include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/mapped_dataset.h"
+#include "ismrmrd/parallel_reader.h"
 #include "ismrmrd/version.h"
+#include "ismrmrd/xml.h"
 #include <boost/filesystem.hpp>
 #include <boost/random.hpp>
 #include <boost/test/unit_test.hpp>
+#include <cmath>
+#if __cplusplus >= 201103L
+#include <thread>
+#endif
 
 using namespace ISMRMRD;
 
@@ -53,4 +61,1277 @@ BOOST_AUTO_TEST_CASE(test_read_write) {
     boost::filesystem::remove(temp);
 }
 
+BOOST_AUTO_TEST_CASE(test_read_only) {
+
+    boost::filesystem::path temp = boost::filesystem::unique_path();
+
+    BOOST_CHECK_THROW(Dataset(temp.string().c_str(), "/test", DATASET_READ_ONLY), std::runtime_error);
+    BOOST_CHECK(!boost::filesystem::exists(temp));
+
+    Acquisition acq = Acquisition(32, 4, 2);
+    std::generate((float *)acq.data_begin(), (float *)acq.data_end(), create_random_float);
+
+    {
+        Dataset dataset = Dataset(temp.string().c_str(), "/test", DATASET_OPEN_OR_CREATE);
+        dataset.appendAcquisition(acq);
+    }
+
+    {
+        // Several readers can have the file open at the same time
+        Dataset first(temp.string().c_str(), "/test", DATASET_READ_ONLY);
+        Dataset second(temp.string().c_str(), "/test", DATASET_READ_ONLY);
+
+        BOOST_REQUIRE_EQUAL(first.getNumberOfAcquisitions(), 1u);
+        BOOST_REQUIRE_EQUAL(second.getNumberOfAcquisitions(), 1u);
+
+        Acquisition acq_read;
+        second.readAcquisition(0, acq_read);
+        BOOST_CHECK(acq_read.getHead() == acq.getHead());
+        BOOST_CHECK(std::equal(acq.data_begin(), acq.data_end(), acq_read.data_begin()));
+
+        BOOST_CHECK_THROW(first.appendAcquisition(acq), std::runtime_error);
+    }
+
+    boost::filesystem::remove(temp);
+}
+
+BOOST_AUTO_TEST_CASE(test_virtual_dataset) {
+
+    std::vector<std::string> sources;
+    std::vector<Acquisition> acqs;
+    std::vector<Image<float> > images;
+
+    for (size_t f = 0; f < 3; f++) {
+        sources.push_back(boost::filesystem::unique_path().string());
+        Dataset dataset = Dataset(sources[f].c_str(), "/test", true);
+        dataset.writeHeader("<ismrmrdHeader/>");
+        for (size_t i = 0; i < f + 2; i++) {
+            Acquisition acq(32, 2, 0);
+            std::generate((float *)acq.data_begin(), (float *)acq.data_end(), create_random_float);
+            acq.scan_counter() = uint32_t(acqs.size());
+            acqs.push_back(acq);
+            dataset.appendAcquisition(acq);
+        }
+        // The second file has no images
+        if (f != 1) {
+            Image<float> im(8, 8, 1, 1);
+            std::generate(im.begin(), im.end(), create_random_float);
+            images.push_back(im);
+            dataset.appendImage("series/images", im);
+        }
+    }
+
+    boost::filesystem::path temp = boost::filesystem::unique_path();
+    createVirtualDataset(temp.string(), "/test", sources);
+
+    {
+        Dataset dataset = Dataset(temp.string().c_str(), "/test", DATASET_READ_ONLY);
+
+        std::string xml;
+        dataset.readHeader(xml);
+        BOOST_CHECK_EQUAL(xml, "<ismrmrdHeader/>");
+
+        BOOST_REQUIRE_EQUAL(dataset.getNumberOfAcquisitions(), acqs.size());
+        for (size_t i = 0; i < acqs.size(); i++) {
+            Acquisition acq;
+            dataset.readAcquisition(uint32_t(i), acq);
+            BOOST_CHECK(acq.getHead() == acqs[i].getHead());
+            BOOST_CHECK(std::equal(acq.data_begin(), acq.data_end(), acqs[i].data_begin()));
+        }
+
+        BOOST_REQUIRE_EQUAL(dataset.getNumberOfImages("series/images"), images.size());
+        for (size_t i = 0; i < images.size(); i++) {
+            Image<float> im;
+            dataset.readImage("series/images", uint32_t(i), im);
+            BOOST_CHECK(std::equal(im.begin(), im.end(), images[i].begin()));
+        }
+    }
+
+    // Variables have to be stored with the same layout in every file
+    std::string mismatch = boost::filesystem::unique_path().string();
+    {
+        Dataset dataset = Dataset(mismatch.c_str(), "/test", true);
+        dataset.appendImage("series/images", Image<float>(4, 4, 1, 1));
+    }
+    sources.push_back(mismatch);
+    boost::filesystem::path failed = boost::filesystem::unique_path();
+    BOOST_CHECK_THROW(createVirtualDataset(failed.string(), "/test", sources), std::runtime_error);
+
+    boost::filesystem::remove(temp);
+    boost::filesystem::remove(failed);
+    for (size_t f = 0; f < sources.size(); f++) {
+        boost::filesystem::remove(sources[f]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_repack) {
+
+    boost::filesystem::path temp = boost::filesystem::unique_path();
+
+    std::vector<Acquisition> acqs;
+    std::vector<Image<float> > images;
+    {
+        Dataset dataset = Dataset(temp.string().c_str(), "/test", true);
+        dataset.writeHeader("<ismrmrdHeader/>");
+        for (size_t i = 0; i < 25; i++) {
+            Acquisition acq(32, 4, 2);
+            std::generate((float *)acq.data_begin(), (float *)acq.data_end(), create_random_float);
+            std::generate((float *)acq.traj_begin(), (float *)acq.traj_end(), create_random_float);
+            acqs.push_back(acq);
+            dataset.appendAcquisition(acq);
+        }
+        for (size_t i = 0; i < 7; i++) {
+            Image<float> im(16, 16, 1, 2);
+            std::generate(im.begin(), im.end(), create_random_float);
+            im.setAttributeString("<ismrmrdMeta/>");
+            images.push_back(im);
+            dataset.appendImage("images", im);
+        }
+    }
+
+    RepackOptions options;
+    options.chunk_elements = 8;
+    options.compression_level = 4;
+    options.shuffle = true;
+    // Force several batches
+    options.buffer_size = 4096;
+
+    boost::filesystem::path chunked = boost::filesystem::unique_path();
+    repackDataset(temp.string(), chunked.string(), "/test", options);
+
+    options = RepackOptions();
+    options.contiguous = true;
+    boost::filesystem::path contiguous = boost::filesystem::unique_path();
+    repackDataset(temp.string(), contiguous.string(), "/test", options);
+
+    const boost::filesystem::path *outputs[] = {&chunked, &contiguous};
+    for (size_t f = 0; f < 2; f++) {
+        Dataset dataset = Dataset(outputs[f]->string().c_str(), "/test", DATASET_READ_ONLY);
+
+        std::string xml;
+        dataset.readHeader(xml);
+        BOOST_CHECK_EQUAL(xml, "<ismrmrdHeader/>");
+
+        BOOST_REQUIRE_EQUAL(dataset.getNumberOfAcquisitions(), acqs.size());
+        for (size_t i = 0; i < acqs.size(); i++) {
+            Acquisition acq;
+            dataset.readAcquisition(uint32_t(i), acq);
+            BOOST_CHECK(acq.getHead() == acqs[i].getHead());
+            BOOST_CHECK(std::equal(acq.data_begin(), acq.data_end(), acqs[i].data_begin()));
+            BOOST_CHECK(std::equal(acq.traj_begin(), acq.traj_end(), acqs[i].traj_begin()));
+        }
+
+        BOOST_REQUIRE_EQUAL(dataset.getNumberOfImages("images"), images.size());
+        for (size_t i = 0; i < images.size(); i++) {
+            Image<float> im;
+            dataset.readImage("images", uint32_t(i), im);
+            BOOST_CHECK(std::equal(im.begin(), im.end(), images[i].begin()));
+            std::string attributes;
+            im.getAttributeString(attributes);
+            BOOST_CHECK_EQUAL(attributes, "<ismrmrdMeta/>");
+        }
+    }
+
+    // Chunked files can still be appended to
+    {
+        Dataset dataset = Dataset(chunked.string().c_str(), "/test", false);
+        dataset.appendAcquisition(acqs[0]);
+        BOOST_CHECK_EQUAL(dataset.getNumberOfAcquisitions(), acqs.size() + 1);
+    }
+
+#ifndef _WIN32
+    {
+        MappedDataset dataset(contiguous.string().c_str(), "/test");
+        BOOST_CHECK(dataset.canMapImages("images"));
+    }
+
+    // Uncompressed chunks of several images, the last one partly filled
+    RepackOptions uncompressed_options;
+    uncompressed_options.chunk_elements = 3;
+    boost::filesystem::path uncompressed = boost::filesystem::unique_path();
+    repackDataset(temp.string(), uncompressed.string(), "/test", uncompressed_options);
+    {
+        MappedDataset dataset(uncompressed.string().c_str(), "/test");
+        BOOST_REQUIRE(dataset.canMapImages("images"));
+        for (size_t i = 0; i < images.size(); i++) {
+            ImageView<float> view = dataset.readImage<float>("images", uint32_t(i));
+            BOOST_CHECK(std::equal(view.begin(), view.end(), images[i].begin()));
+        }
+    }
+    boost::filesystem::remove(uncompressed);
+#endif
+
+    options.compression_level = 1;
+    boost::filesystem::path failed = boost::filesystem::unique_path();
+    BOOST_CHECK_THROW(repackDataset(temp.string(), failed.string(), "/test", options), std::runtime_error);
+    // A failed repack leaves no partial file behind
+    BOOST_CHECK(!boost::filesystem::exists(failed));
+
+    BOOST_CHECK_THROW(repackDataset(temp.string(), temp.string(), "/test", RepackOptions()), std::runtime_error);
+    {
+        Dataset dataset = Dataset(temp.string().c_str(), "/test", false);
+        BOOST_CHECK_EQUAL(dataset.getNumberOfAcquisitions(), acqs.size());
+    }
+
+    boost::filesystem::remove(temp);
+    boost::filesystem::remove(chunked);
+    boost::filesystem::remove(contiguous);
+    boost::filesystem::remove(failed);
+}
+
+BOOST_AUTO_TEST_CASE(test_merge_split) {
+
+    boost::filesystem::path temp = boost::filesystem::unique_path();
+
+    std::vector<Acquisition> acqs;
+    std::vector<Image<float> > images;
+    {
+        Dataset dataset = Dataset(temp.string().c_str(), "/test", true);
+        dataset.writeHeader("<ismrmrdHeader/>");
+        for (size_t i = 0; i < 5; i++) {
+            Acquisition acq(32, 2, 0);
+            std::generate((float *)acq.data_begin(), (float *)acq.data_end(), create_random_float);
+            acqs.push_back(acq);
+            dataset.appendAcquisition(acq);
+        }
+        for (size_t i = 0; i < 8; i++) {
+            Image<float> im(8, 8, 1, 1);
+            std::generate(im.begin(), im.end(), create_random_float);
+            im.setImageIndex(uint16_t(i));
+            images.push_back(im);
+            dataset.appendImage("images", im);
+        }
+    }
+
+    // Compressed chunks of two images, which merging moves without decompressing
+    RepackOptions options;
+    options.chunk_elements = 2;
+    options.compression_level = 6;
+    boost::filesystem::path packed = boost::filesystem::unique_path();
+    repackDataset(temp.string(), packed.string(), "/test", options);
+
+    boost::filesystem::path merged = boost::filesystem::unique_path();
+    std::vector<std::string> sources;
+    sources.push_back(packed.string());
+    sources.push_back(temp.string());
+    sources.push_back(packed.string());
+    mergeDatasets(merged.string(), "/test", sources, 1024);
+
+    {
+        Dataset dataset = Dataset(merged.string().c_str(), "/test", DATASET_READ_ONLY);
+        std::string xml;
+        dataset.readHeader(xml);
+        BOOST_CHECK_EQUAL(xml, "<ismrmrdHeader/>");
+
+        BOOST_REQUIRE_EQUAL(dataset.getNumberOfAcquisitions(), 3 * acqs.size());
+        for (size_t i = 0; i < 3 * acqs.size(); i++) {
+            Acquisition acq;
+            dataset.readAcquisition(uint32_t(i), acq);
+            BOOST_CHECK(std::equal(acq.data_begin(), acq.data_end(), acqs[i % acqs.size()].data_begin()));
+        }
+        BOOST_REQUIRE_EQUAL(dataset.getNumberOfImages("images"), 3 * images.size());
+        for (size_t i = 0; i < 3 * images.size(); i++) {
+            Image<float> im;
+            dataset.readImage("images", uint32_t(i), im);
+            BOOST_CHECK_EQUAL(im.getImageIndex(), i % images.size());
+            BOOST_CHECK(std::equal(im.begin(), im.end(), images[i % images.size()].begin()));
+        }
+    }
+
+    // Images 2 to 4 and all acquisitions
+    boost::filesystem::path split = boost::filesystem::unique_path();
+    std::vector<std::string> variables;
+    variables.push_back("images");
+    splitDataset(packed.string(), split.string(), "/test", variables, 2, 3);
+    {
+        Dataset dataset = Dataset(split.string().c_str(), "/test", DATASET_READ_ONLY);
+        BOOST_CHECK_EQUAL(dataset.getNumberOfAcquisitions(), 0u);
+        BOOST_REQUIRE_EQUAL(dataset.getNumberOfImages("images"), 3u);
+        for (size_t i = 0; i < 3; i++) {
+            Image<float> im;
+            dataset.readImage("images", uint32_t(i), im);
+            BOOST_CHECK_EQUAL(im.getImageIndex(), i + 2);
+            BOOST_CHECK(std::equal(im.begin(), im.end(), images[i + 2].begin()));
+        }
+    }
+
+    variables.clear();
+    variables.push_back("data");
+    splitDataset(temp.string(), split.string(), "/test", variables);
+    {
+        Dataset dataset = Dataset(split.string().c_str(), "/test", DATASET_READ_ONLY);
+        BOOST_CHECK_EQUAL(dataset.getNumberOfImages("images"), 0u);
+        BOOST_REQUIRE_EQUAL(dataset.getNumberOfAcquisitions(), acqs.size());
+        Acquisition acq;
+        dataset.readAcquisition(4, acq);
+        BOOST_CHECK(std::equal(acq.data_begin(), acq.data_end(), acqs[4].data_begin()));
+    }
+
+    variables.push_back("missing");
+    BOOST_CHECK_THROW(splitDataset(temp.string(), split.string(), "/test", variables), std::runtime_error);
+    BOOST_CHECK(!boost::filesystem::exists(split));
+
+    // Writing over an input is refused before anything is opened
+    uintmax_t size = boost::filesystem::file_size(packed);
+    BOOST_CHECK_THROW(mergeDatasets(packed.string(), "/test", sources), std::runtime_error);
+    BOOST_CHECK_THROW(splitDataset(packed.string(), packed.string(), "/test", variables), std::runtime_error);
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(packed), size);
+    BOOST_CHECK_EQUAL(Dataset(packed.string().c_str(), "/test", DATASET_READ_ONLY).getNumberOfImages("images"),
+                      images.size());
+
+    boost::filesystem::remove(temp);
+    boost::filesystem::remove(packed);
+    boost::filesystem::remove(merged);
+    boost::filesystem::remove(split);
+}
+
+// ismrmrd_read_array returns the dimensions the array was appended with, not the stacking dimension
+BOOST_AUTO_TEST_CASE(test_read_array_c_api) {
+
+    boost::filesystem::path temp = boost::filesystem::unique_path();
+
+    ISMRMRD_Dataset dset;
+    BOOST_REQUIRE_EQUAL(ismrmrd_init_dataset(&dset, temp.string().c_str(), "/test"), ISMRMRD_NOERROR);
+    BOOST_REQUIRE_EQUAL(ismrmrd_open_dataset(&dset, true), ISMRMRD_NOERROR);
+
+    ISMRMRD_NDArray arr;
+    ismrmrd_init_ndarray(&arr);
+    arr.data_type = ISMRMRD_FLOAT;
+    arr.ndim = 2;
+    arr.dims[0] = 5;
+    arr.dims[1] = 3;
+    ismrmrd_make_consistent_ndarray(&arr);
+    for (uint32_t i = 0; i < 3; i++) {
+        for (size_t n = 0; n < 15; n++)
+            ((float *)arr.data)[n] = float(i * 15 + n);
+        BOOST_REQUIRE_EQUAL(ismrmrd_append_array(&dset, "arrays", &arr), ISMRMRD_NOERROR);
+    }
+
+    ISMRMRD_NDArray read;
+    ismrmrd_init_ndarray(&read);
+    BOOST_REQUIRE_EQUAL(ismrmrd_read_array(&dset, "arrays", 1, &read), ISMRMRD_NOERROR);
+    BOOST_CHECK_EQUAL(read.data_type, ISMRMRD_FLOAT);
+    BOOST_REQUIRE_EQUAL(read.ndim, 2u);
+    BOOST_CHECK_EQUAL(read.dims[0], 5u);
+    BOOST_CHECK_EQUAL(read.dims[1], 3u);
+    BOOST_CHECK_EQUAL(ismrmrd_size_of_ndarray_data(&read), 15 * sizeof(float));
+    for (size_t n = 0; n < 15; n++)
+        BOOST_CHECK_EQUAL(((float *)read.data)[n], float(15 + n));
+
+    BOOST_CHECK_EQUAL(ismrmrd_close_dataset(&dset), ISMRMRD_NOERROR);
+    ismrmrd_cleanup_ndarray(&arr);
+    ismrmrd_cleanup_ndarray(&read);
+    boost::filesystem::remove(temp);
+}
+
+BOOST_AUTO_TEST_CASE(test_batched_c_api) {
+
+    boost::filesystem::path temp = boost::filesystem::unique_path();
+    const uint32_t count = 6;
+
+    std::vector<ISMRMRD_Acquisition> acqs(count);
+    std::vector<ISMRMRD_Waveform> wavs(count);
+    std::vector<ISMRMRD_Image> ims(count);
+    std::vector<ISMRMRD_NDArray> arrs(count);
+    for (uint32_t i = 0; i < count; i++) {
+        ismrmrd_init_acquisition(&acqs[i]);
+        acqs[i].head.scan_counter = i;
+        acqs[i].head.number_of_samples = 16 + i;
+        acqs[i].head.active_channels = 2;
+        acqs[i].head.available_channels = 2;
+        acqs[i].head.trajectory_dimensions = i % 2;
+        ismrmrd_make_consistent_acquisition(&acqs[i]);
+        std::generate((float *)acqs[i].data, (float *)acqs[i].data + 2 * 2 * (16 + i), create_random_float);
+        std::generate(acqs[i].traj, acqs[i].traj + (16 + i) * (i % 2), create_random_float);
+
+        ismrmrd_init_waveform(&wavs[i]);
+        wavs[i].head.number_of_samples = 8 + i;
+        wavs[i].head.channels = 3;
+        ismrmrd_make_consistent_waveform(&wavs[i]);
+        for (uint32_t n = 0; n < (8 + i) * 3; n++)
+            wavs[i].data[n] = i * 100 + n;
+
+        ismrmrd_init_image(&ims[i]);
+        ims[i].head.data_type = ISMRMRD_FLOAT;
+        ims[i].head.matrix_size[0] = 8;
+        ims[i].head.matrix_size[1] = 4;
+        ims[i].head.matrix_size[2] = 1;
+        ims[i].head.channels = 2;
+        ims[i].head.image_index = i;
+        ims[i].head.attribute_string_len = i;
+        ismrmrd_make_consistent_image(&ims[i]);
+        memset(ims[i].attribute_string, 'a' + i, i);
+        std::generate((float *)ims[i].data, (float *)ims[i].data + 8 * 4 * 2, create_random_float);
+
+        ismrmrd_init_ndarray(&arrs[i]);
+        arrs[i].data_type = ISMRMRD_DOUBLE;
+        arrs[i].ndim = 2;
+        arrs[i].dims[0] = 5;
+        arrs[i].dims[1] = 3;
+        ismrmrd_make_consistent_ndarray(&arrs[i]);
+        for (size_t n = 0; n < 15; n++)
+            ((double *)arrs[i].data)[n] = i * 15.0 + n;
+    }
+
+    ISMRMRD_Dataset dset;
+    BOOST_REQUIRE_EQUAL(ismrmrd_init_dataset(&dset, temp.string().c_str(), "/test"), ISMRMRD_NOERROR);
+    BOOST_REQUIRE_EQUAL(ismrmrd_open_dataset(&dset, true), ISMRMRD_NOERROR);
+    // Batches extend what is already there
+    BOOST_CHECK_EQUAL(ismrmrd_append_acquisition(&dset, &acqs[0]), ISMRMRD_NOERROR);
+    BOOST_CHECK_EQUAL(ismrmrd_append_acquisitions(&dset, &acqs[1], count - 1), ISMRMRD_NOERROR);
+    BOOST_CHECK_EQUAL(ismrmrd_append_waveforms(&dset, &wavs[0], count), ISMRMRD_NOERROR);
+    BOOST_CHECK_EQUAL(ismrmrd_append_images(&dset, "images", &ims[0], 2), ISMRMRD_NOERROR);
+    BOOST_CHECK_EQUAL(ismrmrd_append_images(&dset, "images", &ims[2], count - 2), ISMRMRD_NOERROR);
+    BOOST_CHECK_EQUAL(ismrmrd_append_arrays(&dset, "arrays", &arrs[0], count), ISMRMRD_NOERROR);
+    BOOST_CHECK_EQUAL(ismrmrd_append_arrays(&dset, "arrays", &arrs[0], 0), ISMRMRD_NOERROR);
+
+    // Images of different sizes do not fit one block
+    ISMRMRD_Image odd;
+    ismrmrd_init_image(&odd);
+    odd.head = ims[0].head;
+    odd.head.matrix_size[0] = 16;
+    ismrmrd_make_consistent_image(&odd);
+    ISMRMRD_Image mixed[2] = {ims[0], odd};
+    BOOST_CHECK_NE(ismrmrd_append_images(&dset, "images", mixed, 2), ISMRMRD_NOERROR);
+    ismrmrd_cleanup_image(&odd);
+
+    BOOST_CHECK_EQUAL(ismrmrd_get_number_of_acquisitions(&dset), count);
+    BOOST_CHECK_EQUAL(ismrmrd_get_number_of_waveforms(&dset), count);
+    BOOST_CHECK_EQUAL(ismrmrd_get_number_of_images(&dset, "images"), count);
+    BOOST_CHECK_EQUAL(ismrmrd_get_number_of_arrays(&dset, "arrays"), count);
+
+    const uint32_t first = 1, n = count - 2;
+    std::vector<ISMRMRD_Acquisition> racqs(n);
+    std::vector<ISMRMRD_Waveform> rwavs(n);
+    std::vector<ISMRMRD_Image> rims(n);
+    std::vector<ISMRMRD_NDArray> rarrs(n);
+    for (uint32_t i = 0; i < n; i++) {
+        ismrmrd_init_acquisition(&racqs[i]);
+        ismrmrd_init_waveform(&rwavs[i]);
+        ismrmrd_init_image(&rims[i]);
+        ismrmrd_init_ndarray(&rarrs[i]);
+    }
+    BOOST_CHECK_EQUAL(ismrmrd_read_acquisitions(&dset, first, n, &racqs[0]), ISMRMRD_NOERROR);
+    BOOST_CHECK_EQUAL(ismrmrd_read_waveforms(&dset, first, n, &rwavs[0]), ISMRMRD_NOERROR);
+    BOOST_CHECK_EQUAL(ismrmrd_read_images(&dset, "images", first, n, &rims[0]), ISMRMRD_NOERROR);
+    BOOST_CHECK_EQUAL(ismrmrd_read_arrays(&dset, "arrays", first, n, &rarrs[0]), ISMRMRD_NOERROR);
+    BOOST_CHECK_NE(ismrmrd_read_acquisitions(&dset, first, count, &racqs[0]), ISMRMRD_NOERROR);
+
+    // Headers alone, without touching the data
+    std::vector<ISMRMRD_AcquisitionHeader> rheads(n);
+    BOOST_CHECK_EQUAL(ismrmrd_read_acquisition_headers(&dset, first, n, &rheads[0]), ISMRMRD_NOERROR);
+    BOOST_CHECK_NE(ismrmrd_read_acquisition_headers(&dset, first, count, &rheads[0]), ISMRMRD_NOERROR);
+    for (uint32_t i = 0; i < n; i++)
+        BOOST_CHECK_EQUAL(memcmp(&rheads[i], &acqs[first + i].head, sizeof(ISMRMRD_AcquisitionHeader)), 0);
+
+    for (uint32_t i = 0; i < n; i++) {
+        const ISMRMRD_Acquisition &a = acqs[first + i];
+        BOOST_CHECK_EQUAL(racqs[i].head.scan_counter, a.head.scan_counter);
+        BOOST_CHECK_EQUAL(racqs[i].head.number_of_samples, a.head.number_of_samples);
+        BOOST_CHECK_EQUAL(ismrmrd_size_of_acquisition_data(&racqs[i]), ismrmrd_size_of_acquisition_data(&a));
+        BOOST_CHECK_EQUAL(memcmp(racqs[i].data, a.data, ismrmrd_size_of_acquisition_data(&a)), 0);
+        BOOST_CHECK_EQUAL(memcmp(racqs[i].traj, a.traj, ismrmrd_size_of_acquisition_traj(&a)), 0);
+
+        const ISMRMRD_Waveform &w = wavs[first + i];
+        BOOST_CHECK_EQUAL(rwavs[i].head.number_of_samples, w.head.number_of_samples);
+        BOOST_CHECK_EQUAL(memcmp(rwavs[i].data, w.data, ismrmrd_size_of_waveform_data(&w)), 0);
+
+        const ISMRMRD_Image &im = ims[first + i];
+        BOOST_CHECK_EQUAL(rims[i].head.image_index, im.head.image_index);
+        BOOST_CHECK_EQUAL(std::string(rims[i].attribute_string), std::string(im.attribute_string, first + i));
+        BOOST_CHECK_EQUAL(memcmp(rims[i].data, im.data, ismrmrd_size_of_image_data(&im)), 0);
+
+        // The batch agrees with single element reads
+        ISMRMRD_Image single;
+        ismrmrd_init_image(&single);
+        BOOST_CHECK_EQUAL(ismrmrd_read_image(&dset, "images", first + i, &single), ISMRMRD_NOERROR);
+        BOOST_CHECK_EQUAL(memcmp(single.data, rims[i].data, ismrmrd_size_of_image_data(&im)), 0);
+        ismrmrd_cleanup_image(&single);
+
+        BOOST_CHECK_EQUAL(rarrs[i].ndim, 2);
+        BOOST_CHECK_EQUAL(rarrs[i].dims[0], 5u);
+        BOOST_CHECK_EQUAL(rarrs[i].dims[1], 3u);
+        BOOST_CHECK_EQUAL(memcmp(rarrs[i].data, arrs[first + i].data, ismrmrd_size_of_ndarray_data(&arrs[0])), 0);
+    }
+
+    // Reading into acquisitions that already hold other ones resizes their buffers
+    BOOST_CHECK_EQUAL(ismrmrd_read_acquisitions(&dset, first + 1, n, &racqs[0]), ISMRMRD_NOERROR);
+    for (uint32_t i = 0; i < n; i++) {
+        const ISMRMRD_Acquisition &a = acqs[first + 1 + i];
+        BOOST_CHECK_EQUAL(racqs[i].head.number_of_samples, a.head.number_of_samples);
+        BOOST_CHECK_EQUAL(memcmp(racqs[i].data, a.data, ismrmrd_size_of_acquisition_data(&a)), 0);
+        BOOST_CHECK_EQUAL(memcmp(racqs[i].traj, a.traj, ismrmrd_size_of_acquisition_traj(&a)), 0);
+    }
+
+    BOOST_CHECK_EQUAL(ismrmrd_close_dataset(&dset), ISMRMRD_NOERROR);
+
+    // Image headers that do not describe what is stored are refused instead of overrunning the buffers:
+    // image 1 claims a longer attribute string, image 2 a smaller matrix
+    {
+        hid_t file = H5Fopen(temp.string().c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+        BOOST_REQUIRE(file >= 0);
+        hid_t header = H5Dopen2(file, "/test/images/header", H5P_DEFAULT);
+        hid_t filespace = H5Dget_space(header);
+        hsize_t start = 1, one = 1, three = 3;
+        hid_t memspace = H5Screate_simple(1, &one, NULL);
+
+        hid_t lentype = H5Tcreate(H5T_COMPOUND, sizeof(uint32_t));
+        H5Tinsert(lentype, "attribute_string_len", 0, H5T_NATIVE_UINT32);
+        uint32_t length = 100;
+        H5Sselect_hyperslab(filespace, H5S_SELECT_SET, &start, NULL, &one, NULL);
+        BOOST_CHECK_GE(H5Dwrite(header, lentype, memspace, filespace, H5P_DEFAULT, &length), 0);
+
+        hid_t sizetype = H5Tarray_create2(H5T_NATIVE_UINT16, 1, &three);
+        hid_t matrixtype = H5Tcreate(H5T_COMPOUND, 3 * sizeof(uint16_t));
+        H5Tinsert(matrixtype, "matrix_size", 0, sizetype);
+        uint16_t matrix[3] = {4, 4, 1};
+        start = 2;
+        H5Sselect_hyperslab(filespace, H5S_SELECT_SET, &start, NULL, &one, NULL);
+        BOOST_CHECK_GE(H5Dwrite(header, matrixtype, memspace, filespace, H5P_DEFAULT, matrix), 0);
+
+        H5Tclose(matrixtype);
+        H5Tclose(sizetype);
+        H5Tclose(lentype);
+        H5Sclose(memspace);
+        H5Sclose(filespace);
+        H5Dclose(header);
+        H5Fclose(file);
+    }
+    BOOST_REQUIRE_EQUAL(ismrmrd_init_dataset(&dset, temp.string().c_str(), "/test"), ISMRMRD_NOERROR);
+    BOOST_REQUIRE_EQUAL(ismrmrd_open_dataset(&dset, false), ISMRMRD_NOERROR);
+    std::vector<ISMRMRD_Image> bad(count);
+    for (uint32_t i = 0; i < count; i++) {
+        ismrmrd_init_image(&bad[i]);
+    }
+    BOOST_CHECK_EQUAL(ismrmrd_read_images(&dset, "images", 0, 1, &bad[0]), ISMRMRD_NOERROR);
+    BOOST_CHECK_NE(ismrmrd_read_images(&dset, "images", 1, 1, &bad[0]), ISMRMRD_NOERROR);
+    BOOST_CHECK_NE(ismrmrd_read_images(&dset, "images", 2, 1, &bad[0]), ISMRMRD_NOERROR);
+    BOOST_CHECK_NE(ismrmrd_read_images(&dset, "images", 0, 3, &bad[0]), ISMRMRD_NOERROR);
+    BOOST_CHECK_EQUAL(ismrmrd_read_images(&dset, "images", 3, count - 3, &bad[0]), ISMRMRD_NOERROR);
+    BOOST_CHECK_EQUAL(bad[0].head.image_index, 3);
+    for (uint32_t i = 0; i < count; i++) {
+        ismrmrd_cleanup_image(&bad[i]);
+    }
+    BOOST_CHECK_EQUAL(ismrmrd_close_dataset(&dset), ISMRMRD_NOERROR);
+
+    for (uint32_t i = 0; i < count; i++) {
+        ismrmrd_cleanup_acquisition(&acqs[i]);
+        free(wavs[i].data);
+        ismrmrd_cleanup_image(&ims[i]);
+        ismrmrd_cleanup_ndarray(&arrs[i]);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        ismrmrd_cleanup_acquisition(&racqs[i]);
+        free(rwavs[i].data);
+        ismrmrd_cleanup_image(&rims[i]);
+        ismrmrd_cleanup_ndarray(&rarrs[i]);
+    }
+    boost::filesystem::remove(temp);
+}
+
+BOOST_AUTO_TEST_CASE(test_compact_acquisitions) {
+
+    boost::filesystem::path plain = boost::filesystem::unique_path();
+    boost::filesystem::path compact = boost::filesystem::unique_path();
+    boost::filesystem::path half = boost::filesystem::unique_path();
+
+    std::vector<Acquisition> acqs(20, Acquisition(256, 8, 2));
+    for (size_t i = 0; i < acqs.size(); i++) {
+        acqs[i].scan_counter() = i;
+        std::generate((float *)acqs[i].data_begin(), (float *)acqs[i].data_end(), create_random_float);
+        std::generate((float *)acqs[i].traj_begin(), (float *)acqs[i].traj_end(), create_random_float);
+        // Scale and sign vary between readouts, from raw k-space magnitudes far below the
+        // normal half floats up to beyond their range
+        for (complex_float_t *d = acqs[i].data_begin(); d != acqs[i].data_end(); ++d)
+            *d = (*d - complex_float_t(0.5f, 0.5f)) * std::ldexp(1.0f, 3 * int(i) - 36);
+    }
+
+    {
+        Dataset dataset(plain.string().c_str(), "/test", true);
+        for (size_t i = 0; i < acqs.size(); i++)
+            dataset.appendAcquisition(acqs[i]);
+    }
+    {
+        HDF5DatasetBackend *backend = new HDF5DatasetBackend(compact.string().c_str(), "/test", true);
+        backend->setAcquisitionStorage(ISMRMRD_STORAGE_INT16);
+        Dataset dataset(backend);
+        for (size_t i = 0; i < acqs.size(); i++)
+            dataset.appendAcquisition(acqs[i]);
+        // All acquisitions of a dataset share one format
+        BOOST_CHECK_THROW(backend->setAcquisitionStorage(ISMRMRD_STORAGE_HALF), std::runtime_error);
+    }
+    {
+        HDF5DatasetBackend *backend = new HDF5DatasetBackend(half.string().c_str(), "/test", true);
+        backend->setAcquisitionStorage(ISMRMRD_STORAGE_HALF);
+        Dataset dataset(backend);
+        for (size_t i = 0; i < acqs.size(); i++)
+            dataset.appendAcquisition(acqs[i]);
+    }
+
+    // The samples take half the space
+    BOOST_CHECK_LT(boost::filesystem::file_size(compact), boost::filesystem::file_size(plain) * 3 / 4);
+    BOOST_CHECK_LT(boost::filesystem::file_size(half), boost::filesystem::file_size(plain) * 3 / 4);
+
+    {
+        // Reopening continues in the stored format
+        HDF5DatasetBackend *backend = new HDF5DatasetBackend(compact.string().c_str(), "/test", false);
+        BOOST_CHECK_EQUAL(backend->getAcquisitionStorage(), ISMRMRD_STORAGE_INT16);
+        Dataset dataset(backend);
+        dataset.appendAcquisition(acqs[0]);
+        BOOST_CHECK_EQUAL(dataset.getNumberOfAcquisitions(), acqs.size() + 1);
+    }
+
+    // Readers that do not know the compact formats fail to convert the samples to floats
+    for (int f = 0; f < 2; f++) {
+        hid_t file = H5Fopen(f == 0 ? compact.string().c_str() : half.string().c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+        BOOST_REQUIRE(file >= 0);
+        hid_t data = H5Dopen2(file, "/test/data", H5P_DEFAULT);
+        hid_t samples = H5Tvlen_create(H5T_NATIVE_FLOAT);
+        hid_t memtype = H5Tcreate(H5T_COMPOUND, sizeof(hvl_t));
+        H5Tinsert(memtype, "data", 0, samples);
+        hsize_t start = 0, one = 1;
+        hid_t filespace = H5Dget_space(data);
+        H5Sselect_hyperslab(filespace, H5S_SELECT_SET, &start, NULL, &one, NULL);
+        hid_t memspace = H5Screate_simple(1, &one, NULL);
+        hvl_t read = {0, NULL};
+        H5E_auto2_t func;
+        void *client_data;
+        H5Eget_auto2(H5E_DEFAULT, &func, &client_data);
+        H5Eset_auto2(H5E_DEFAULT, NULL, NULL);
+        BOOST_CHECK_LT(H5Dread(data, memtype, memspace, filespace, H5P_DEFAULT, &read), 0);
+        H5Eset_auto2(H5E_DEFAULT, func, client_data);
+        H5Sclose(memspace);
+        H5Sclose(filespace);
+        H5Tclose(memtype);
+        H5Tclose(samples);
+        H5Dclose(data);
+        H5Fclose(file);
+    }
+
+    for (int f = 0; f < 2; f++) {
+        Dataset dataset(f == 0 ? compact.string().c_str() : half.string().c_str(), "/test", DATASET_READ_ONLY);
+        for (uint32_t i = 0; i < acqs.size(); i++) {
+            Acquisition acq;
+            dataset.readAcquisition(i, acq);
+            BOOST_CHECK_EQUAL(acq.scan_counter(), acqs[i].scan_counter());
+            BOOST_REQUIRE_EQUAL(acq.getNumberOfDataElements(), acqs[i].getNumberOfDataElements());
+            BOOST_CHECK(std::equal(acq.traj_begin(), acq.traj_end(), acqs[i].traj_begin()));
+
+            // int16 is accurate relative to the largest sample of the readout, half to every sample
+            float peak = 0;
+            for (const complex_float_t *d = acqs[i].data_begin(); d != acqs[i].data_end(); ++d)
+                peak = std::max(peak, std::max(std::abs(d->real()), std::abs(d->imag())));
+            const float *a = (const float *)acq.data_begin();
+            const float *b = (const float *)acqs[i].data_begin();
+            for (size_t n = 0; n < 2 * acq.getNumberOfDataElements(); n++) {
+                float tolerance =
+                    f == 0 ? peak / 32767.0f : std::max(std::abs(b[n]) / 1024.0f, peak * 1e-9f);
+                BOOST_CHECK_SMALL(a[n] - b[n], tolerance);
+            }
+        }
+    }
+
+    boost::filesystem::remove(plain);
+    boost::filesystem::remove(compact);
+    boost::filesystem::remove(half);
+}
+
+BOOST_AUTO_TEST_CASE(test_sampling_mask) {
+
+    boost::filesystem::path temp = boost::filesystem::unique_path();
+
+    Acquisition acq(16, 1, 0);
+    {
+        Dataset dataset(temp.string().c_str(), "/test", true);
+        dataset.trackSamplingMasks();
+
+        // Only the second encoding space declares its slices and repetitions
+        IsmrmrdHeader header;
+        header.encoding.resize(2);
+        header.encoding[1].encodingLimits.slice = Limit(0, 5, 0);
+        header.encoding[1].encodingLimits.repetition = Limit(0, 3, 0);
+        std::ostringstream xml;
+        serialize(header, xml);
+        dataset.writeHeader(xml.str());
+
+        acq.setFlag(ISMRMRD_ACQ_IS_NOISE_MEASUREMENT);
+        acq.idx().kspace_encode_step_1 = 200;
+        dataset.appendAcquisition(acq);
+        acq.clearAllFlags();
+
+        // Every third line of two slices and three repetitions, every line in the second encoding space
+        for (uint16_t r = 0; r < 3; r++) {
+            for (uint16_t s = 0; s < 2; s++) {
+                for (uint16_t e1 = r; e1 < 40; e1 += 3) {
+                    acq.idx().kspace_encode_step_1 = e1;
+                    acq.idx().slice = s;
+                    acq.idx().repetition = r;
+                    acq.encoding_space_ref() = 0;
+                    dataset.appendAcquisition(acq);
+                    acq.encoding_space_ref() = 1;
+                    dataset.appendAcquisition(acq);
+                }
+            }
+        }
+
+        // Lines not written yet are visible
+        BOOST_CHECK(dataset.hasSamplingMask(0));
+        BOOST_CHECK(!dataset.hasSamplingMask(2));
+        SamplingMask mask;
+        dataset.readSamplingMask(0, mask);
+        BOOST_CHECK(mask.isSampled(39, 0, 1, 0, 0, 0));
+        BOOST_CHECK_THROW(dataset.readSamplingMask(2, mask), std::runtime_error);
+    }
+
+    {
+        Dataset dataset(temp.string().c_str(), "/test", DATASET_READ_ONLY);
+        SamplingMask mask;
+        dataset.readSamplingMask(0, mask);
+        std::vector<size_t> dims = mask.getDims();
+        BOOST_CHECK_EQUAL(dims.size(), 7u);
+        BOOST_CHECK_EQUAL(dims[0], 48u); // 40 lines rounded up to whole elements
+        BOOST_CHECK_EQUAL(dims[1], 1u);
+        BOOST_CHECK_EQUAL(dims[2], 2u);
+        BOOST_CHECK_EQUAL(dims[5], 3u);
+        for (uint16_t r = 0; r < 3; r++)
+            for (uint16_t s = 0; s < 2; s++)
+                for (uint16_t e1 = 0; e1 < 48; e1++)
+                    BOOST_CHECK_EQUAL(mask.isSampled(e1, 0, s, 0, 0, r), e1 < 40 && e1 % 3 == r);
+        BOOST_CHECK(!mask.isSampled(200));
+
+        SamplingMask second;
+        dataset.readSamplingMask(1, second);
+        BOOST_CHECK_EQUAL(second.getNumberOfSampledLines(), mask.getNumberOfSampledLines());
+        BOOST_CHECK_EQUAL(second.getNumberOfSampledLines(), 2u * (14 + 13 + 13));
+        // Sized by the encoding limits rather than the lines seen
+        dims = second.getDims();
+        BOOST_CHECK_EQUAL(dims[0], 48u);
+        BOOST_CHECK_EQUAL(dims[2], 6u);
+        BOOST_CHECK_EQUAL(dims[5], 4u);
+    }
+
+    {
+        // Later sessions add to the stored mask
+        Dataset dataset(temp.string().c_str(), "/test", false);
+        dataset.trackSamplingMasks();
+        acq.encoding_space_ref() = 0;
+        acq.idx().kspace_encode_step_1 = 1;
+        acq.idx().slice = 0;
+        acq.idx().repetition = 0;
+        dataset.appendAcquisition(acq);
+        dataset.writeSamplingMasks();
+
+        SamplingMask mask;
+        dataset.readSamplingMask(0, mask);
+        BOOST_CHECK(mask.isSampled(0) && mask.isSampled(1) && !mask.isSampled(2));
+        BOOST_CHECK(mask.isSampled(2, 0, 1, 0, 0, 2));
+
+        // Lines within the encoding limits fit the stored mask
+        acq.encoding_space_ref() = 1;
+        acq.idx().slice = 5;
+        acq.idx().repetition = 3;
+        dataset.appendAcquisition(acq);
+        dataset.writeSamplingMasks();
+        dataset.readSamplingMask(1, mask);
+        BOOST_CHECK(mask.isSampled(1, 0, 5, 0, 0, 3));
+
+        // A mask that no longer fits is refused, also when the dataset is closed, the other
+        // masks are still written
+        acq.encoding_space_ref() = 0;
+        dataset.appendAcquisition(acq);
+        acq.encoding_space_ref() = 1;
+        acq.idx().kspace_encode_step_1 = 2;
+        dataset.appendAcquisition(acq);
+        BOOST_CHECK_THROW(dataset.writeSamplingMasks(), std::runtime_error);
+        NDArray<uint16_t> stored;
+        dataset.readNDArray("sampling_mask_1", 0, stored);
+        mask.setBitmap(stored);
+        BOOST_CHECK(mask.isSampled(2, 0, 5, 0, 0, 3));
+
+        // The stored masks are updated in place
+        BOOST_CHECK_EQUAL(dataset.getNumberOfNDArrays("sampling_mask_0"), 1u);
+        BOOST_CHECK_EQUAL(dataset.getNumberOfNDArrays("sampling_mask_1"), 1u);
+    }
+    char *file = NULL, *func = NULL, *msg = NULL;
+    int line = 0, code = 0;
+    BOOST_CHECK(ismrmrd_pop_error(&file, &line, &func, &code, &msg));
+    BOOST_CHECK_EQUAL(code, ISMRMRD_RUNTIMEERROR);
+
+    boost::filesystem::remove(temp);
+}
+
+BOOST_AUTO_TEST_CASE(test_read_kspace) {
+
+    boost::filesystem::path temp = boost::filesystem::unique_path();
+
+    // Sample value encoding where it belongs
+    struct Value {
+        static complex_float_t at(uint16_t s, uint16_t e1, uint16_t c, uint16_t slice, uint16_t rep) {
+            return complex_float_t(s + 100.0f * e1, c + 10.0f * slice + 100.0f * rep);
+        }
+    };
+
+    for (int backend = 0; backend < 2; backend++) {
+        Dataset dataset = backend == 0 ? Dataset(temp.string().c_str(), "/test", true)
+                                       : Dataset(new MemoryDatasetBackend());
+
+        Acquisition acq(8, 3, 0);
+        acq.setFlag(ISMRMRD_ACQ_IS_NOISE_MEASUREMENT);
+        dataset.appendAcquisition(acq);
+        acq.clearAllFlags();
+        for (uint16_t rep = 0; rep < 2; rep++) {
+            for (uint16_t slice = 0; slice < 3; slice++) {
+                // Every other line, the last line of E1 is never acquired
+                for (uint16_t e1 = slice % 2; e1 < 9; e1 += 2) {
+                    acq.idx().kspace_encode_step_1 = e1;
+                    acq.idx().slice = slice;
+                    acq.idx().repetition = rep;
+                    for (uint16_t c = 0; c < 3; c++)
+                        for (uint16_t s = 0; s < 8; s++)
+                            acq.data(s, c) = Value::at(s, e1, c, slice, rep);
+                    dataset.appendAcquisition(acq);
+                }
+                // A line from another encoding space
+                acq.encoding_space_ref() = 1;
+                dataset.appendAcquisition(acq);
+                acq.encoding_space_ref() = 0;
+            }
+        }
+
+        KSpaceFilter filter;
+        filter.dimensions.push_back(KSPACE_SLICE);
+        filter.values[KSPACE_REPETITION] = 1;
+        filter.matrix_size[1] = 10;
+        filter.threads = 2;
+        NDArray<complex_float_t> kspace = dataset.readKSpace(0, filter);
+
+        BOOST_REQUIRE_EQUAL(kspace.getNDim(), 5);
+        BOOST_CHECK_EQUAL(kspace.getDims()[0], 8u);
+        BOOST_CHECK_EQUAL(kspace.getDims()[1], 10u);
+        BOOST_CHECK_EQUAL(kspace.getDims()[2], 1u);
+        BOOST_CHECK_EQUAL(kspace.getDims()[3], 3u);
+        BOOST_CHECK_EQUAL(kspace.getDims()[4], 3u);
+        for (uint16_t slice = 0; slice < 3; slice++)
+            for (uint16_t c = 0; c < 3; c++)
+                for (uint16_t e1 = 0; e1 < 10; e1++)
+                    for (uint16_t s = 0; s < 8; s++) {
+                        bool sampled = e1 < 9 && e1 % 2 == slice % 2;
+                        complex_float_t expected = sampled ? Value::at(s, e1, c, slice, 1) : complex_float_t(0.0f, 0.0f);
+                        BOOST_CHECK_EQUAL(kspace(s, e1, 0, c, slice), expected);
+                    }
+
+        // Without extra dimensions the lines of all slices and repetitions overlap, the last one wins
+        kspace = dataset.readKSpace(0);
+        BOOST_REQUIRE_EQUAL(kspace.getNDim(), 4);
+        BOOST_CHECK_EQUAL(kspace.getDims()[1], 9u);
+        BOOST_CHECK_EQUAL(kspace(3, 4, 0, 2), Value::at(3, 4, 2, 2, 1));
+        BOOST_CHECK_EQUAL(kspace(3, 5, 0, 2), Value::at(3, 5, 2, 1, 1));
+
+        BOOST_CHECK_THROW(dataset.readKSpace(3), std::runtime_error);
+    }
+
+    boost::filesystem::remove(temp);
+}
+
+#if __cplusplus >= 201103L
+// True when reading the acquisition throws
+static bool read_throws(Dataset &dataset, uint32_t index) {
+    Acquisition acq;
+    try {
+        dataset.readAcquisition(index, acq);
+    } catch (std::runtime_error &) {
+        return true;
+    }
+    return false;
+}
+
+// Reads acquisitions and images in a pseudo random order and counts what does not match
+static void read_concurrently(Dataset &dataset, uint32_t seed, uint32_t count, size_t &failures) {
+    const uint32_t n = dataset.getNumberOfAcquisitions();
+    Acquisition acq;
+    Image<float> im;
+    for (uint32_t k = 0; k < count; k++) {
+        uint32_t i = (seed + k * 7919u) % n;
+        try {
+            dataset.readAcquisition(i, acq);
+            if (acq.scan_counter() != i || acq.data(3, 1) != complex_float_t(float(i), 1.0f))
+                failures++;
+            if (k % 8 == 0) {
+                dataset.readImage("images", i % 16, im);
+                if (im.getImageIndex() != i % 16 || im(2, 2) != float(i % 16))
+                    failures++;
+            }
+        } catch (std::runtime_error &) {
+            // A failed read of another thread must not fail this one
+            failures++;
+        }
+        if (k % 128 == 0 && !read_throws(dataset, n))
+            failures++;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_concurrent_reads) {
+
+    boost::filesystem::path temp = boost::filesystem::unique_path();
+    boost::filesystem::path temp_container = boost::filesystem::unique_path();
+
+    const uint32_t count = 1000;
+    {
+        Dataset dataset(temp.string().c_str(), "/test", true);
+        Dataset container(new ContainerDatasetBackend(temp_container.string().c_str()));
+        Acquisition acq(64, 4, 0);
+        for (uint32_t i = 0; i < count; i++) {
+            acq.scan_counter() = i;
+            std::fill(acq.data_begin(), acq.data_end(), complex_float_t(float(i), 1.0f));
+            dataset.appendAcquisition(acq);
+            container.appendAcquisition(acq);
+        }
+        for (uint16_t i = 0; i < 16; i++) {
+            Image<float> im(8, 8, 1, 1);
+            im.setImageIndex(i);
+            std::fill(im.begin(), im.end(), float(i));
+            dataset.appendImage("images", im);
+            container.appendImage("images", im);
+        }
+    }
+
+    // Worker threads share one dataset per backend, both backends are read at the same time
+    Dataset dataset(temp.string().c_str(), "/test", DATASET_READ_ONLY);
+    Dataset container(new ContainerDatasetBackend(temp_container.string().c_str(), false));
+    const size_t threads = 8;
+    std::vector<size_t> failures(threads, 0);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++) {
+        Dataset &d = t % 2 ? container : dataset;
+        workers.push_back(std::thread(read_concurrently, std::ref(d), uint32_t(t * 101), 400u, std::ref(failures[t])));
+    }
+    for (size_t t = 0; t < threads; t++) {
+        workers[t].join();
+        BOOST_CHECK_EQUAL(failures[t], 0u);
+    }
+
+    boost::filesystem::remove(temp);
+    boost::filesystem::remove(temp_container);
+}
+#endif
+
+// Number of acquisitions another process would find in the file right now, as after a crash
+static uint32_t acquisitions_on_disk(const boost::filesystem::path &file) {
+    boost::filesystem::path copy = boost::filesystem::unique_path();
+    boost::filesystem::copy_file(file, copy);
+    uint32_t count = 0;
+    try {
+        Dataset dataset(copy.string().c_str(), "/test", DATASET_READ_ONLY);
+        count = dataset.getNumberOfAcquisitions();
+    } catch (std::runtime_error &) {
+    }
+    boost::filesystem::remove(copy);
+    return count;
+}
+
+BOOST_AUTO_TEST_CASE(test_flush_policy) {
+
+    boost::filesystem::path temp = boost::filesystem::unique_path();
+
+    HDF5DatasetBackend *backend = new HDF5DatasetBackend(temp.string().c_str(), "/test", true);
+    BOOST_CHECK_EQUAL(backend->getFlushPolicy().elements, 0u);
+    FlushPolicy policy;
+    policy.elements = 10;
+    backend->setFlushPolicy(policy);
+
+    Dataset dataset(backend);
+    Acquisition acq(64, 4, 0);
+    for (uint32_t i = 0; i < 25; i++) {
+        acq.scan_counter() = i;
+        dataset.appendAcquisition(acq);
+    }
+    BOOST_CHECK_EQUAL(acquisitions_on_disk(temp), 20u);
+    dataset.flush();
+    BOOST_CHECK_EQUAL(acquisitions_on_disk(temp), 25u);
+
+#if !defined(_WIN32) && __cplusplus >= 201103L
+    // The background thread flushes while nothing is appended
+    policy.elements = 0;
+    policy.seconds = 0.01;
+    policy.background = true;
+    backend->setFlushPolicy(policy);
+    for (uint32_t i = 0; i < 5; i++) {
+        dataset.appendAcquisition(acq);
+    }
+    uint32_t count = 0;
+    for (int attempt = 0; attempt < 500 && count < 30; attempt++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        count = acquisitions_on_disk(temp);
+    }
+    BOOST_CHECK_EQUAL(count, 30u);
+
+    // An explicit flush starts the count of the background thread over
+    policy.elements = 10;
+    policy.seconds = 0;
+    backend->setFlushPolicy(policy);
+    for (uint32_t i = 0; i < 9; i++) {
+        dataset.appendAcquisition(acq);
+    }
+    dataset.flush();
+    dataset.appendAcquisition(acq);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    BOOST_CHECK_EQUAL(acquisitions_on_disk(temp), 39u);
+    for (uint32_t i = 0; i < 9; i++) {
+        dataset.appendAcquisition(acq);
+    }
+    for (int attempt = 0; attempt < 500 && count < 49; attempt++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        count = acquisitions_on_disk(temp);
+    }
+    BOOST_CHECK_EQUAL(count, 49u);
+#endif
+
+    boost::filesystem::remove(temp);
+}
+
+BOOST_AUTO_TEST_CASE(test_memory_backend) {
+
+    Acquisition acq = Acquisition(32, 4, 2);
+    std::generate((float *)acq.data_begin(), (float *)acq.data_end(), create_random_float);
+    std::generate((float *)acq.traj_begin(), (float *)acq.traj_end(), create_random_float);
+
+    Image<float> im(16, 16, 1, 2);
+    std::generate(im.begin(), im.end(), create_random_float);
+
+    Dataset dataset(new MemoryDatasetBackend());
+
+    BOOST_CHECK_THROW(dataset.readAcquisition(0, acq), std::runtime_error);
+    BOOST_CHECK_EQUAL(dataset.getNumberOfImages("images"), 0u);
+
+    dataset.writeHeader("<ismrmrdHeader/>");
+    dataset.appendAcquisition(acq);
+    dataset.appendImage("images", im);
+
+    std::string xml;
+    dataset.readHeader(xml);
+    BOOST_CHECK_EQUAL(xml, "<ismrmrdHeader/>");
+
+    BOOST_REQUIRE_EQUAL(dataset.getNumberOfAcquisitions(), 1u);
+    Acquisition acq_read;
+    dataset.readAcquisition(0, acq_read);
+    BOOST_CHECK(acq_read.getHead() == acq.getHead());
+    BOOST_CHECK(std::equal(acq.data_begin(), acq.data_end(), acq_read.data_begin()));
+    BOOST_CHECK(std::equal(acq.traj_begin(), acq.traj_end(), acq_read.traj_begin()));
+
+    BOOST_REQUIRE_EQUAL(dataset.getNumberOfImages("images"), 1u);
+    Image<float> im_read;
+    dataset.readImage("images", 0, im_read);
+    BOOST_CHECK(std::equal(im.begin(), im.end(), im_read.begin()));
+
+    Image<float> im_wrong(8, 8, 1, 2);
+    BOOST_CHECK_THROW(dataset.appendImage("images", im_wrong), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_append_views) {
+
+    boost::filesystem::path temp = boost::filesystem::unique_path();
+
+    // Samples and pixels in plain buffers, as they would arrive in a network frame
+    Acquisition acq(32, 4, 2);
+    acq.scan_counter() = 7;
+    std::vector<complex_float_t> samples(acq.getNumberOfDataElements());
+    std::vector<float> traj(acq.getNumberOfTrajElements());
+    MutableAcquisitionView acq_view(acq.getHead(), &samples[0], &traj[0]);
+    for (uint16_t c = 0; c < 4; c++) {
+        for (uint16_t s = 0; s < 32; s++) {
+            acq_view.data(s, c) = complex_float_t(s, c);
+            acq.data(s, c) = complex_float_t(s, c);
+        }
+    }
+    std::generate(acq_view.traj_begin(), acq_view.traj_end(), create_random_float);
+    std::copy(traj.begin(), traj.end(), acq.traj_begin());
+    BOOST_CHECK(samples[33] == complex_float_t(1, 1));
+
+    Image<float> im(16, 8, 1, 2);
+    im.setAttributeString("view");
+    std::vector<float> pixels(im.getNumberOfDataElements());
+    MutableImageView<float> im_view(im.getHead(), &pixels[0], "view", 4);
+    std::generate(im_view.begin(), im_view.end(), create_random_float);
+    im_view(3, 5, 0, 1) = 42.0f;
+    std::copy(pixels.begin(), pixels.end(), im.begin());
+
+    std::vector<size_t> dims(2);
+    dims[0] = 5;
+    dims[1] = 3;
+    NDArray<double> arr(dims);
+    std::generate(arr.begin(), arr.end(), create_random_float);
+
+    Waveform wav(10, 2);
+    std::fill(wav.begin_data(), wav.end_data(), 9u);
+
+    {
+        Dataset dataset(temp.string().c_str(), "/test", true);
+        dataset.appendAcquisition(acq_view);
+        dataset.appendImage("images", im_view);
+        dataset.appendNDArray("arrays", NDArrayView<double>(arr));
+        dataset.appendWaveform(WaveformView(wav));
+    }
+
+    {
+        Dataset dataset(temp.string().c_str(), "/test", DATASET_READ_ONLY);
+        Acquisition acq_read;
+        dataset.readAcquisition(0, acq_read);
+        BOOST_CHECK(acq_read.getHead() == acq.getHead());
+        BOOST_CHECK(std::equal(acq.data_begin(), acq.data_end(), acq_read.data_begin()));
+        BOOST_CHECK(std::equal(acq.traj_begin(), acq.traj_end(), acq_read.traj_begin()));
+
+        Image<float> im_read;
+        dataset.readImage("images", 0, im_read);
+        BOOST_CHECK_EQUAL(std::string(im_read.getAttributeString()), "view");
+        BOOST_CHECK(std::equal(im.begin(), im.end(), im_read.begin()));
+        BOOST_CHECK_EQUAL(im_read(3, 5, 0, 1), 42.0f);
+
+        NDArray<double> arr_read;
+        dataset.readNDArray("arrays", 0, arr_read);
+        BOOST_REQUIRE_EQUAL(arr_read.getNDim(), 2u);
+        BOOST_CHECK(std::equal(arr.begin(), arr.end(), arr_read.begin()));
+
+        Waveform wav_read;
+        dataset.readWaveform(0, wav_read);
+        BOOST_CHECK_EQUAL(wav_read.head.channels, 2u);
+        BOOST_CHECK(std::equal(wav.begin_data(), wav.end_data(), wav_read.begin_data()));
+    }
+
+    boost::filesystem::remove(temp);
+}
+
+#ifndef _WIN32
+BOOST_AUTO_TEST_CASE(test_mapped_dataset) {
+
+    boost::filesystem::path temp = boost::filesystem::unique_path();
+
+    Acquisition acq = Acquisition(32, 4, 2);
+    std::generate((float *)acq.data_begin(), (float *)acq.data_end(), create_random_float);
+
+    std::vector<Image<complex_float_t> > images(3, Image<complex_float_t>(16, 8, 1, 2));
+    for (size_t i = 0; i < images.size(); i++) {
+        std::generate((float *)images[i].begin(), (float *)images[i].end(), create_random_float);
+        images[i].setImageIndex(uint16_t(i));
+    }
+
+    std::vector<size_t> dims(3);
+    dims[0] = 4;
+    dims[1] = 3;
+    dims[2] = 2;
+    NDArray<float> arr(dims);
+    std::generate(arr.begin(), arr.end(), create_random_float);
+
+    {
+        Dataset dataset = Dataset(temp.string().c_str(), "/test", true);
+        dataset.appendAcquisition(acq);
+        for (size_t i = 0; i < images.size(); i++)
+            dataset.appendImage("images", images[i]);
+        dataset.appendNDArray("arrays", arr);
+        dataset.appendNDArray("arrays", arr);
+    }
+
+    {
+        MappedDataset dataset(temp.string().c_str(), "/test");
+
+        BOOST_REQUIRE_EQUAL(dataset.getNumberOfAcquisitions(), 1u);
+        Acquisition acq_read;
+        dataset.readAcquisition(0, acq_read);
+        BOOST_CHECK(acq_read.getHead() == acq.getHead());
+        BOOST_CHECK(std::equal(acq.data_begin(), acq.data_end(), acq_read.data_begin()));
+
+        BOOST_REQUIRE(dataset.canMapImages("images"));
+        BOOST_REQUIRE_EQUAL(dataset.getNumberOfImages("images"), 3u);
+        for (uint32_t i = 0; i < 3; i++) {
+            ImageView<complex_float_t> view = dataset.readImage<complex_float_t>("images", i);
+            BOOST_CHECK_EQUAL(view.getHead().image_index, i);
+            BOOST_CHECK_EQUAL(view.getMatrixSizeY(), 8u);
+            BOOST_REQUIRE_EQUAL(view.getNumberOfDataElements(), images[i].getNumberOfDataElements());
+            BOOST_CHECK(std::equal(view.begin(), view.end(), images[i].begin()));
+            BOOST_CHECK(view(3, 5, 0, 1) == images[i](3, 5, 0, 1));
+        }
+        BOOST_CHECK_THROW(dataset.readImage<complex_float_t>("images", 3), std::runtime_error);
+        BOOST_CHECK_THROW(dataset.readImage<float>("images", 0), std::runtime_error);
+
+        BOOST_REQUIRE(dataset.canMapNDArrays("arrays"));
+        BOOST_REQUIRE_EQUAL(dataset.getNumberOfNDArrays("arrays"), 2u);
+        NDArrayView<float> view = dataset.readNDArray<float>("arrays", 1);
+        BOOST_REQUIRE_EQUAL(view.getNDim(), 3u);
+        BOOST_CHECK_EQUAL(view.getDims()[0], 4u);
+        BOOST_CHECK_EQUAL(view.getDims()[2], 2u);
+        BOOST_CHECK(std::equal(view.begin(), view.end(), arr.begin()));
+        BOOST_CHECK_EQUAL(view(3, 2, 1), arr(3, 2, 1));
+
+        BOOST_CHECK(!dataset.canMapNDArrays("missing"));
+        BOOST_CHECK_THROW(dataset.readNDArray<float>("missing", 0), std::runtime_error);
+    }
+
+    boost::filesystem::remove(temp);
+}
+#endif
+
+#ifndef _WIN32
+BOOST_AUTO_TEST_CASE(test_parallel_reader) {
+
+    boost::filesystem::path temp = boost::filesystem::unique_path();
+
+    std::vector<Acquisition> acqs;
+    for (uint16_t i = 0; i < 500; i++) {
+        Acquisition acq(16 + i % 7, 2, 2);
+        acq.scan_counter() = i;
+        std::generate((float *)acq.data_begin(), (float *)acq.data_end(), create_random_float);
+        std::generate(acq.traj_begin(), acq.traj_end(), create_random_float);
+        acqs.push_back(acq);
+    }
+
+    {
+        Dataset dataset = Dataset(temp.string().c_str(), "/test", true);
+        for (size_t i = 0; i < acqs.size(); i++)
+            dataset.appendAcquisition(acqs[i]);
+    }
+
+    // Small blocks and buffers so that the rings wrap many times
+    ParallelReadOptions options;
+    options.processes = 3;
+    options.block_size = 7;
+    options.buffer_size = 4096;
+
+    {
+        ParallelAcquisitionReader reader(temp.string().c_str(), "/test", options);
+        BOOST_REQUIRE_EQUAL(reader.getNumberOfAcquisitions(), 500u);
+        Acquisition acq;
+        size_t n = 0;
+        while (reader.readNext(acq)) {
+            BOOST_REQUIRE(n < acqs.size());
+            BOOST_REQUIRE(acq.getHead() == acqs[n].getHead());
+            BOOST_CHECK(std::equal(acqs[n].data_begin(), acqs[n].data_end(), acq.data_begin()));
+            BOOST_CHECK(std::equal(acqs[n].traj_begin(), acqs[n].traj_end(), acq.traj_begin()));
+            n++;
+        }
+        BOOST_CHECK_EQUAL(n, acqs.size());
+        BOOST_CHECK(!reader.readNext(acq));
+    }
+
+    // Stopping early must not leave the workers behind
+    {
+        ParallelAcquisitionReader reader(temp.string().c_str(), "/test", options);
+        Acquisition acq;
+        BOOST_REQUIRE(reader.readNext(acq));
+        BOOST_CHECK(acq.getHead() == acqs[0].getHead());
+    }
+
+    // The workers must not inherit the file open in this process
+    {
+        Dataset dataset(temp.string().c_str(), "/test", DATASET_READ_ONLY);
+        BOOST_CHECK_THROW(ParallelAcquisitionReader(temp.string().c_str(), "/test", options), std::runtime_error);
+    }
+
+    boost::filesystem::path missing = boost::filesystem::unique_path();
+    BOOST_CHECK_THROW(ParallelAcquisitionReader(missing.string().c_str(), "/test", options), std::runtime_error);
+    options.processes = 0;
+    BOOST_CHECK_THROW(ParallelAcquisitionReader(temp.string().c_str(), "/test", options), std::runtime_error);
+
+    boost::filesystem::remove(temp);
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -112,6 +112,37 @@ BOOST_AUTO_TEST_CASE(test_image_make_consistent)
     ismrmrd_cleanup_image(&img);
 }
 
+BOOST_AUTO_TEST_CASE(test_image_capacity)
+{
+    Image<float> img(128, 128, 1, 8);
+    img.setAttributeString("<ismrmrdMeta><meta><name>a</name><value>1</value></meta></ismrmrdMeta>");
+    const float *data = img.getDataPtr();
+    const char *attr = img.getAttributeString();
+    BOOST_CHECK_EQUAL(img.getDataCapacity(), 128u * 128 * 8);
+
+    img.resize(64, 64, 1, 8);
+    img.setAttributeString("short");
+    BOOST_CHECK(img.getDataPtr() == data);
+    BOOST_CHECK(img.getAttributeString() == attr);
+    BOOST_CHECK_EQUAL(std::string(img.getAttributeString()), "short");
+    BOOST_CHECK_EQUAL(img.getDataCapacity(), 128u * 128 * 8);
+
+    // A header without attributes leaves an empty attribute string
+    ImageHeader head = img.getHead();
+    head.attribute_string_len = 0;
+    img.setHead(head);
+    BOOST_CHECK_EQUAL(std::string(img.getAttributeString()), "");
+
+    Image<float> copy(32, 32, 1, 1);
+    copy(31, 31) = 3.5f;
+    copy.setAttributeString("copied");
+    img = copy;
+    BOOST_CHECK(img.getDataPtr() == data);
+    BOOST_CHECK(img.getAttributeString() == attr);
+    BOOST_CHECK_EQUAL(img(31, 31), 3.5f);
+    BOOST_CHECK_EQUAL(std::string(img.getAttributeString()), "copied");
+}
+
 static void check_header(ISMRMRD_ImageHeader* chead)
 {
     BOOST_CHECK_EQUAL(chead->version, ISMRMRD_VERSION_MAJOR);
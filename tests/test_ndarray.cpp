@@ -67,4 +67,24 @@ BOOST_AUTO_TEST_CASE(test_ndarray_copy)
     BOOST_CHECK(!cdst.data);
 }
 
+BOOST_AUTO_TEST_CASE(test_ndarray_capacity)
+{
+    std::vector<size_t> dims(3, 16);
+    NDArray<float> arr(dims);
+    const float *data = arr.getDataPtr();
+    BOOST_CHECK_EQUAL(arr.getDataCapacity(), 16u * 16 * 16);
+
+    dims[2] = 4;
+    arr.resize(dims);
+    BOOST_CHECK(arr.getDataPtr() == data);
+    BOOST_CHECK_EQUAL(arr.getNumberOfElements(), 16u * 16 * 4);
+    BOOST_CHECK_EQUAL(arr.getDataCapacity(), 16u * 16 * 16);
+
+    NDArray<float> copy(dims);
+    copy(15, 15, 3) = 2.5f;
+    arr = copy;
+    BOOST_CHECK(arr.getDataPtr() == data);
+    BOOST_CHECK_EQUAL(arr(15, 15, 3), 2.5f);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
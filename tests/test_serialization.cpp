@@ -3,8 +3,18 @@
 #include <fstream>
 #include <sstream>
 
+#include "ismrmrd/decode_pipeline.h"
 #include "ismrmrd/serialization.h"
 #include "ismrmrd/serialization_iostream.h"
+#ifndef _WIN32
+#include "ismrmrd/mapped_stream.h"
+#include "ismrmrd/serialization_fd.h"
+#include "ismrmrd/stream_index.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 using namespace ISMRMRD;
 
@@ -356,4 +366,1363 @@ BOOST_AUTO_TEST_CASE(test_of_protocol_serialization) {
                                   img2.getDataPtr(), img2.getDataPtr() + img2.getNumberOfDataElements());
 }
 
+
+// Writes a stream of messages through buffered views, unbuffered the bytes must be the same
+static void write_messages(WritableStreamView &ws, const std::vector<Acquisition> &acqs, const Waveform &wf,
+                           const Image<float> &img) {
+    ProtocolSerializer serializer(ws);
+    TextMessage txt_msg;
+    txt_msg.message = "before the data";
+    serializer.serialize(txt_msg);
+    for (size_t i = 0; i < acqs.size(); i++) {
+        serializer.serialize(acqs[i]);
+        if (i == acqs.size() / 2) {
+            serializer.serialize(wf);
+            serializer.serialize(img);
+        }
+    }
+    serializer.close();
+}
+
+// Implements only what ReadableStreamView requires
+class ReadOnlyStreamView : public ReadableStreamView {
+public:
+    ReadOnlyStreamView(std::istream &is) : _is(is), reads(0) {}
+
+    virtual void read(char *buffer, size_t count) {
+        _is.read(buffer, count);
+        reads++;
+    }
+
+    virtual bool eof() {
+        return _is.eof();
+    }
+
+private:
+    std::istream &_is;
+
+public:
+    size_t reads;
+};
+
+BOOST_AUTO_TEST_CASE(test_buffered_protocol_serialization) {
+    // Acquisitions smaller and larger than the smaller buffers
+    std::vector<Acquisition> acqs(40);
+    for (size_t n = 0; n < acqs.size(); n++) {
+        acqs[n].resize(uint16_t(1 + 7 * n), uint16_t(1 + n % 4), uint16_t(n % 3));
+        acqs[n].scan_counter() = uint32_t(n);
+        for (size_t i = 0; i < acqs[n].getNumberOfDataElements(); i++) {
+            acqs[n].getDataPtr()[i] = value_from_size_t<std::complex<float> >(i + n);
+        }
+        for (size_t i = 0; i < acqs[n].getNumberOfTrajElements(); i++) {
+            acqs[n].getTrajPtr()[i] = value_from_size_t<float>(i + 2 * n);
+        }
+    }
+    Waveform wf(64, 4);
+    wf.head.time_stamp = 1234567890;
+    Image<float> img;
+    img.resize(16, 16, 1, 2);
+    img.setAttributeString("buffered");
+    for (size_t i = 0; i < img.getNumberOfDataElements(); i++) {
+        img.getDataPtr()[i] = value_from_size_t<float>(i);
+    }
+
+    std::stringstream plain(std::ios::in | std::ios::out | std::ios::binary);
+    OStreamView plain_ws(plain);
+    write_messages(plain_ws, acqs, wf, img);
+
+    const size_t buffer_sizes[] = {1, 64, 1000, 1024 * 1024};
+    for (size_t b = 0; b < sizeof(buffer_sizes) / sizeof(buffer_sizes[0]); b++) {
+        std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+        {
+            OStreamView os_view(ss);
+            BufferedWritableStreamView ws(os_view, buffer_sizes[b]);
+            write_messages(ws, acqs, wf, img);
+            // close() has flushed everything
+            BOOST_CHECK(ss.str() == plain.str());
+        }
+
+        IStreamView is_view(ss);
+        BufferedReadableStreamView rs(is_view, buffer_sizes[(b + 1) % 4]);
+        ProtocolDeserializer deserializer(rs);
+        TextMessage txt_msg;
+        deserializer.deserialize(txt_msg);
+        BOOST_CHECK_EQUAL(txt_msg.message, "before the data");
+        for (size_t n = 0; n < acqs.size(); n++) {
+            Acquisition acq;
+            deserializer.deserialize(acq);
+            BOOST_REQUIRE(acq.getHead() == acqs[n].getHead());
+            BOOST_CHECK_EQUAL_COLLECTIONS(acq.getDataPtr(), acq.getDataPtr() + acq.getNumberOfDataElements(),
+                                          acqs[n].getDataPtr(), acqs[n].getDataPtr() + acqs[n].getNumberOfDataElements());
+            BOOST_CHECK_EQUAL_COLLECTIONS(acq.getTrajPtr(), acq.getTrajPtr() + acq.getNumberOfTrajElements(),
+                                          acqs[n].getTrajPtr(), acqs[n].getTrajPtr() + acqs[n].getNumberOfTrajElements());
+            if (n == acqs.size() / 2) {
+                Waveform wf2;
+                deserializer.deserialize(wf2);
+                BOOST_CHECK_EQUAL(wf2.head.time_stamp, wf.head.time_stamp);
+                BOOST_CHECK_EQUAL(deserializer.peek(), ISMRMRD_MESSAGE_IMAGE);
+                Image<float> img2;
+                deserializer.deserialize(img2);
+                BOOST_CHECK_EQUAL(img2.getAttributeString(), img.getAttributeString());
+                BOOST_CHECK_EQUAL_COLLECTIONS(img.getDataPtr(), img.getDataPtr() + img.getNumberOfDataElements(),
+                                              img2.getDataPtr(), img2.getDataPtr() + img2.getNumberOfDataElements());
+            }
+        }
+        BOOST_CHECK_EQUAL(deserializer.peek(), ISMRMRD_MESSAGE_CLOSE);
+        char extra;
+        rs.read(&extra, 1);
+        BOOST_CHECK(rs.eof());
+    }
+
+    // A stream cut short in the last acquisition
+    std::string truncated = plain.str().substr(0, plain.str().size() - 16);
+    std::stringstream ss(truncated, std::ios::in | std::ios::binary);
+    IStreamView is_view(ss);
+    BufferedReadableStreamView rs(is_view, 256);
+    ProtocolDeserializer deserializer(rs);
+    TextMessage txt_msg;
+    deserializer.deserialize(txt_msg);
+    Acquisition acq;
+    for (size_t n = 0; n + 1 < acqs.size(); n++) {
+        deserializer.deserialize(acq);
+        if (n == acqs.size() / 2) {
+            Waveform wf2;
+            Image<float> img2;
+            deserializer.deserialize(wf2);
+            deserializer.deserialize(img2);
+        }
+    }
+    BOOST_CHECK_THROW(deserializer.deserialize(acq), std::runtime_error);
+
+    // A view with only read and eof keeps the end of the stream through the default read_some
+    for (size_t b = 0; b < sizeof(buffer_sizes) / sizeof(buffer_sizes[0]); b++) {
+        std::stringstream ss(plain.str(), std::ios::in | std::ios::binary);
+        ReadOnlyStreamView read_only(ss);
+        BufferedReadableStreamView rs(read_only, buffer_sizes[b]);
+        ProtocolDeserializer deserializer(rs);
+        TextMessage txt_msg;
+        deserializer.deserialize(txt_msg);
+        for (size_t n = 0; n < acqs.size(); n++) {
+            deserializer.deserialize(acq);
+            BOOST_REQUIRE(acq.getHead() == acqs[n].getHead());
+            BOOST_CHECK_EQUAL_COLLECTIONS(acq.getDataPtr(), acq.getDataPtr() + acq.getNumberOfDataElements(),
+                                          acqs[n].getDataPtr(), acqs[n].getDataPtr() + acqs[n].getNumberOfDataElements());
+            if (n == acqs.size() / 2) {
+                Waveform wf2;
+                Image<float> img2;
+                deserializer.deserialize(wf2);
+                deserializer.deserialize(img2);
+            }
+        }
+        BOOST_CHECK_EQUAL(deserializer.peek(), ISMRMRD_MESSAGE_CLOSE);
+        // It is read directly rather than a byte at a time to fill the buffer
+        BOOST_CHECK_LT(read_only.reads, plain.str().size() / 100);
+    }
+}
+
+
+BOOST_AUTO_TEST_CASE(test_view_serialization) {
+    Acquisition acq(20, 3, 2);
+    for (size_t i = 0; i < acq.getNumberOfDataElements(); i++) {
+        acq.getDataPtr()[i] = value_from_size_t<std::complex<float> >(i);
+    }
+    for (size_t i = 0; i < acq.getNumberOfTrajElements(); i++) {
+        acq.getTrajPtr()[i] = value_from_size_t<float>(i);
+    }
+    Image<int16_t> img(7, 5, 1, 2);
+    img.setAttributeString("attributes");
+    for (size_t i = 0; i < img.getNumberOfDataElements(); i++) {
+        img.getDataPtr()[i] = value_from_size_t<int16_t>(i);
+    }
+    Waveform wf(12, 2);
+    for (size_t i = 0; i < wf.size(); i++) {
+        wf.begin_data()[i] = uint32_t(i);
+    }
+    std::vector<size_t> dims(3, 2);
+    NDArray<std::complex<double> > arr(dims);
+    for (size_t i = 0; i < arr.getNumberOfElements(); i++) {
+        arr.getDataPtr()[i] = value_from_size_t<std::complex<double> >(i);
+    }
+
+    // Views over the same memory serialize to the same bytes as the owning types
+    std::stringstream owned(std::ios::in | std::ios::out | std::ios::binary);
+    {
+        OStreamView ws(owned);
+        serialize(acq, ws);
+        serialize(img, ws);
+        serialize(wf, ws);
+        serialize(arr, ws);
+        ProtocolSerializer serializer(ws);
+        serializer.serialize(acq);
+        serializer.serialize(img);
+        serializer.serialize(wf);
+        serializer.serialize(arr);
+    }
+    std::stringstream viewed(std::ios::in | std::ios::out | std::ios::binary);
+    {
+        OStreamView ws(viewed);
+        serialize(AcquisitionView(acq), ws);
+        serialize(ImageView<int16_t>(img), ws);
+        serialize(WaveformView(wf), ws);
+        serialize(NDArrayView<std::complex<double> >(arr), ws);
+        ProtocolSerializer serializer(ws);
+        serializer.serialize(MutableAcquisitionView(acq));
+        serializer.serialize(MutableImageView<int16_t>(img));
+        serializer.serialize(WaveformView(wf));
+        serializer.serialize(MutableNDArrayView<std::complex<double> >(arr));
+    }
+    BOOST_CHECK(owned.str() == viewed.str());
+
+    // Views over external memory, which the serializer reads in place
+    std::vector<int16_t> pixels(img.getNumberOfDataElements(), 3);
+    MutableImageView<int16_t> pixel_view(img.getHead(), &pixels[0]);
+    pixel_view(6, 4, 0, 1) = 11;
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    OStreamView ws(ss);
+    serialize(pixel_view, ws);
+    IStreamView rs(ss);
+    Image<int16_t> img2;
+    deserialize(img2, rs);
+    BOOST_CHECK_EQUAL(img2.getAttributeStringLength(), 0u);
+    BOOST_CHECK_EQUAL(img2(0, 0, 0, 0), 3);
+    BOOST_CHECK_EQUAL(img2(6, 4, 0, 1), 11);
+}
+
+BOOST_AUTO_TEST_CASE(test_deserialize_reuses_memory) {
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    OStreamView ws(ss);
+    IStreamView rs(ss);
+    ProtocolSerializer serializer(ws);
+    const uint16_t samples[] = {256, 128, 32, 256};
+    for (size_t n = 0; n < 4; n++) {
+        Acquisition acq(samples[n], 4, 2);
+        acq.scan_counter() = uint32_t(n);
+        serializer.serialize(acq);
+        Image<float> img(samples[n], samples[n], 1, 1);
+        img(samples[n] - 1, samples[n] - 1) = float(n);
+        if (n != 2) {
+            img.setAttributeString(n == 0 ? "<ismrmrdMeta>first</ismrmrdMeta>" : "short");
+        }
+        serializer.serialize(img);
+    }
+    serializer.close();
+
+    ProtocolDeserializer deserializer(rs);
+    Acquisition acq;
+    Image<float> img;
+    const complex_float_t *data = NULL;
+    const float *pixels = NULL;
+    const char *attr = NULL;
+    const char *expected_attr[] = {"<ismrmrdMeta>first</ismrmrdMeta>", "short", "", "short"};
+    for (size_t n = 0; n < 4; n++) {
+        deserializer.deserialize(acq);
+        deserializer.deserialize(img);
+        BOOST_CHECK_EQUAL(acq.scan_counter(), n);
+        BOOST_CHECK_EQUAL(acq.number_of_samples(), samples[n]);
+        BOOST_CHECK_EQUAL(img(samples[n] - 1, samples[n] - 1), float(n));
+        BOOST_CHECK_EQUAL(std::string(img.getAttributeString()), expected_attr[n]);
+        BOOST_CHECK_EQUAL(img.getAttributeStringLength(), strlen(expected_attr[n]));
+        if (n == 0) {
+            data = acq.getDataPtr();
+            pixels = img.getDataPtr();
+            attr = img.getAttributeString();
+        }
+        // The first messages are the largest, the later ones fit into their memory
+        BOOST_CHECK(acq.getDataPtr() == data);
+        BOOST_CHECK(img.getDataPtr() == pixels);
+        BOOST_CHECK(img.getAttributeString() == attr);
+    }
+    BOOST_CHECK_EQUAL(acq.getDataCapacity(), 256u * 4);
+    BOOST_CHECK_EQUAL(deserializer.peek(), ISMRMRD_MESSAGE_CLOSE);
+}
+
+BOOST_AUTO_TEST_CASE(test_acquisition_batch_serialization) {
+    std::vector<Acquisition> acqs(7);
+    for (size_t n = 0; n < acqs.size(); n++) {
+        acqs[n].resize(uint16_t(5 + 3 * n), uint16_t(1 + n % 3), uint16_t(n % 2));
+        acqs[n].scan_counter() = uint32_t(n);
+        acqs[n].idx().kspace_encode_step_1 = uint16_t(n);
+        // The first and last words of the header
+        acqs[n].setFlag(ISMRMRD_ACQ_FIRST_IN_SLICE + n % 2);
+        acqs[n].user_float()[ISMRMRD_USER_FLOATS - 1] = float(n);
+        for (size_t i = 0; i < acqs[n].getNumberOfDataElements(); i++) {
+            acqs[n].getDataPtr()[i] = value_from_size_t<std::complex<float> >(i + n);
+        }
+        for (size_t i = 0; i < acqs[n].getNumberOfTrajElements(); i++) {
+            acqs[n].getTrajPtr()[i] = value_from_size_t<float>(i + 2 * n);
+        }
+    }
+    std::vector<Acquisition> first(acqs.begin(), acqs.begin() + 3);
+    std::vector<Acquisition> second(acqs.begin() + 3, acqs.end() - 1);
+
+    // Only the first header is sent in full
+    {
+        std::stringstream batch_ss, single_ss;
+        OStreamView batch_ws(batch_ss), single_ws(single_ss);
+        serialize(second, batch_ws);
+        for (size_t n = 0; n < second.size(); n++) {
+            serialize(second[n], single_ws);
+        }
+        BOOST_CHECK_LT(batch_ss.str().size() + (second.size() - 1) * (sizeof(AcquisitionHeader) - 64),
+                       single_ss.str().size());
+    }
+
+    // Without message id
+    {
+        std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+        OStreamView ws(ss);
+        IStreamView rs(ss);
+        serialize(first, ws);
+        std::vector<Acquisition> read(10);
+        deserialize(read, rs);
+        BOOST_REQUIRE_EQUAL(read.size(), first.size());
+        for (size_t n = 0; n < read.size(); n++) {
+            BOOST_CHECK(read[n].getHead() == first[n].getHead());
+            BOOST_CHECK(std::equal(read[n].data_begin(), read[n].data_end(), first[n].data_begin()));
+        }
+    }
+
+    for (int buffered = 0; buffered < 2; buffered++) {
+        std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+        {
+            OStreamView os_view(ss);
+            BufferedWritableStreamView buffer(os_view, 100);
+            WritableStreamView &ws = buffered ? static_cast<WritableStreamView &>(buffer) : os_view;
+            ProtocolSerializer serializer(ws);
+            serializer.serialize(first);
+            serializer.serialize(std::vector<Acquisition>());
+            serializer.serialize(second);
+            serializer.serialize(acqs.back());
+            serializer.close();
+        }
+
+        IStreamView is_view(ss);
+        BufferedReadableStreamView buffer(is_view, 100);
+        ReadableStreamView &rs = buffered ? static_cast<ReadableStreamView &>(buffer) : is_view;
+        ProtocolDeserializer deserializer(rs);
+
+        // A batch read one acquisition at a time, then the rest of the next batch at once
+        BOOST_CHECK_EQUAL(deserializer.peek(), ISMRMRD_MESSAGE_ACQUISITION_BATCH);
+        std::vector<Acquisition> read;
+        for (size_t n = 0; n < first.size() + 1; n++) {
+            read.push_back(Acquisition());
+            deserializer.deserialize(read.back());
+        }
+        std::vector<Acquisition> rest;
+        deserializer.deserialize(rest);
+        BOOST_CHECK_EQUAL(rest.size(), second.size() - 1);
+        read.insert(read.end(), rest.begin(), rest.end());
+        BOOST_CHECK_EQUAL(deserializer.peek(), ISMRMRD_MESSAGE_ACQUISITION);
+        deserializer.deserialize(rest);
+        BOOST_CHECK_EQUAL(rest.size(), 1u);
+        read.push_back(rest[0]);
+
+        BOOST_REQUIRE_EQUAL(read.size(), acqs.size());
+        for (size_t n = 0; n < acqs.size(); n++) {
+            BOOST_REQUIRE(read[n].getHead() == acqs[n].getHead());
+            BOOST_CHECK(std::equal(acqs[n].data_begin(), acqs[n].data_end(), read[n].data_begin()));
+            BOOST_CHECK(std::equal(acqs[n].traj_begin(), acqs[n].traj_end(), read[n].traj_begin()));
+        }
+        BOOST_CHECK_THROW(deserializer.deserialize(rest), ProtocolStreamClosed);
+    }
+
+    // A batch whose length does not match its acquisitions
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    OStreamView ws(ss);
+    serialize(first, ws);
+    std::string corrupt = ss.str();
+    corrupt[0] = char(corrupt[0] + 4);
+    corrupt.append(4, '\0');
+    std::stringstream corrupt_ss(corrupt, std::ios::in | std::ios::binary);
+    IStreamView rs(corrupt_ss);
+    std::vector<Acquisition> read;
+    BOOST_CHECK_THROW(deserialize(read, rs), std::runtime_error);
+}
+
+// Counts what is read, skips pass through to the source
+class CountingStreamView : public ReadableStreamView {
+public:
+    CountingStreamView(ReadableStreamView &source, bool forward_skip)
+        : _source(source), _forward_skip(forward_skip), bytes_read(0) {}
+
+    virtual void read(char *buffer, size_t count) {
+        _source.read(buffer, count);
+        bytes_read += count;
+    }
+
+    virtual bool eof() {
+        return _source.eof();
+    }
+
+    virtual size_t read_some(char *buffer, size_t count) {
+        size_t n = _source.read_some(buffer, count);
+        bytes_read += n;
+        return n;
+    }
+
+    virtual void skip(size_t count) {
+        if (_forward_skip) {
+            _source.skip(count);
+        } else {
+            ReadableStreamView::skip(count);
+        }
+    }
+
+private:
+    ReadableStreamView &_source;
+    bool _forward_skip;
+
+public:
+    size_t bytes_read;
+};
+
+// One message of each type around two waveforms
+static void write_skip_messages(WritableStreamView &ws, const Waveform &wf) {
+    ProtocolSerializer serializer(ws);
+    ConfigFile cfg;
+    strcpy(cfg.config, "skip.xml");
+    serializer.serialize(cfg);
+    ConfigText cfg_txt;
+    cfg_txt.config_text = "<configuration/>";
+    serializer.serialize(cfg_txt);
+    IsmrmrdHeader h;
+    h.encoding.push_back(Encoding());
+    h.encoding[0].trajectory = TrajectoryType::CARTESIAN;
+    serializer.serialize(h);
+    Acquisition acq(4096, 8, 2);
+    serializer.serialize(acq);
+    serializer.serialize(wf);
+    serializer.serialize(std::vector<Acquisition>(3, acq));
+    Image<int16_t> img(128, 128, 1, 4);
+    img.setAttributeString("skipped");
+    serializer.serialize(img);
+    std::vector<size_t> dims(3, 32);
+    serializer.serialize(NDArray<std::complex<double> >(dims));
+    TextMessage txt;
+    txt.message = "skipped";
+    serializer.serialize(txt);
+    serializer.serialize(acq);
+    serializer.serialize(wf);
+    serializer.close();
+}
+
+// Reads only the waveforms, returns how many there were
+static size_t read_waveforms(ReadableStreamView &rs, const Waveform &wf) {
+    ProtocolDeserializer deserializer(rs);
+    size_t waveforms = 0;
+    while (deserializer.peek() != ISMRMRD_MESSAGE_CLOSE) {
+        if (deserializer.peek() == ISMRMRD_MESSAGE_WAVEFORM) {
+            Waveform wf2;
+            deserializer.deserialize(wf2);
+            BOOST_CHECK_EQUAL(wf2.head.time_stamp, wf.head.time_stamp);
+            BOOST_CHECK(std::equal(wf.begin_data(), wf.end_data(), wf2.begin_data()));
+            waveforms++;
+        } else {
+            deserializer.skip();
+        }
+    }
+    return waveforms;
+}
+
+BOOST_AUTO_TEST_CASE(test_protocol_skip) {
+    Waveform wf(100, 3);
+    wf.head.time_stamp = 42;
+    for (size_t i = 0; i < wf.size(); i++) {
+        wf.begin_data()[i] = uint32_t(7 * i);
+    }
+    std::stringstream out(std::ios::out | std::ios::binary);
+    {
+        OStreamView ws(out);
+        write_skip_messages(ws, wf);
+    }
+    const std::string contents = out.str();
+
+    // Seeking, reading through the default skip, and both through a buffer
+    for (int mode = 0; mode < 4; mode++) {
+        std::stringstream ss(contents, std::ios::in | std::ios::binary);
+        IStreamView is_view(ss);
+        CountingStreamView counting(is_view, mode % 2 == 0);
+        BufferedReadableStreamView buffered(counting, 4096);
+        ReadableStreamView &rs = mode < 2 ? static_cast<ReadableStreamView &>(counting) : buffered;
+        BOOST_CHECK_EQUAL(read_waveforms(rs, wf), 2u);
+        if (mode == 0) {
+            // Only ids, headers and sizes are read
+            BOOST_CHECK_LT(counting.bytes_read, 8000u);
+        } else if (mode == 2) {
+            // Skips past the end of the buffer seek too
+            BOOST_CHECK_LT(counting.bytes_read, contents.size() / 20);
+        } else {
+            BOOST_CHECK_EQUAL(counting.bytes_read, contents.size());
+        }
+    }
+
+    // Partly read batches are skipped to their end
+    {
+        std::stringstream ss(contents, std::ios::in | std::ios::binary);
+        IStreamView rs(ss);
+        ProtocolDeserializer deserializer(rs);
+        for (int n = 0; n < 5; n++) {
+            deserializer.skip();
+        }
+        Acquisition acq;
+        deserializer.deserialize(acq);
+        BOOST_CHECK_EQUAL(deserializer.peek(), ISMRMRD_MESSAGE_ACQUISITION_BATCH);
+        deserializer.skip();
+        BOOST_CHECK_EQUAL(deserializer.peek(), ISMRMRD_MESSAGE_IMAGE);
+    }
+
+    // A stream cut short in a skipped message
+    std::stringstream ss(contents.substr(0, contents.size() - 200000), std::ios::in | std::ios::binary);
+    IStreamView rs(ss);
+    ProtocolDeserializer deserializer(rs);
+    BOOST_CHECK_THROW(
+        while (true) {
+            deserializer.skip();
+        },
+        std::runtime_error);
+}
+
+// Logs what ProtocolDeserializer::dispatch passes on
+class LoggingVisitor : public ProtocolVisitor {
+public:
+    explicit LoggingVisitor(bool skip_images) : skip_images(skip_images) {}
+
+    virtual bool accept(uint16_t message_id, int data_type) {
+        return !(skip_images && message_id == ISMRMRD_MESSAGE_IMAGE && data_type == ISMRMRD_SHORT);
+    }
+
+    virtual void visit(ConfigFile &cf) { log << "config file " << cf.config << ";"; }
+    virtual void visit(ConfigText &ct) { log << "config text " << ct.config_text << ";"; }
+    virtual void visit(TextMessage &tm) { log << "text " << tm.message << ";"; }
+    virtual void visit(IsmrmrdHeader &hdr) { log << "header " << hdr.encoding.size() << ";"; }
+    virtual void visit(Waveform &wfm) { log << "waveform " << wfm.head.time_stamp << ";"; }
+
+    virtual void visit(Acquisition &acq) {
+        log << "acquisition " << acq.number_of_samples() << ";";
+        acquisitions.push_back(&acq);
+    }
+
+    virtual void visit(Image<int16_t> &img) {
+        log << "image " << img.getMatrixSizeX() << " " << img.getAttributeString() << ";";
+    }
+
+    virtual void visit(NDArray<std::complex<double> > &arr) {
+        log << "nd array " << arr.getNumberOfElements() << ";";
+    }
+
+    bool skip_images;
+    std::stringstream log;
+    std::vector<const Acquisition *> acquisitions;
+};
+
+BOOST_AUTO_TEST_CASE(test_protocol_dispatch) {
+    Waveform wf(100, 3);
+    wf.head.time_stamp = 42;
+    std::stringstream out(std::ios::out | std::ios::binary);
+    {
+        OStreamView ws(out);
+        write_skip_messages(ws, wf);
+    }
+    const std::string contents = out.str();
+
+    for (int skip_images = 0; skip_images < 2; skip_images++) {
+        std::stringstream ss(contents, std::ios::in | std::ios::binary);
+        IStreamView rs(ss);
+        ProtocolDeserializer deserializer(rs);
+        LoggingVisitor visitor(skip_images != 0);
+        while (deserializer.dispatch(visitor)) {
+        }
+        BOOST_CHECK_EQUAL(deserializer.peek(), ISMRMRD_MESSAGE_CLOSE);
+        BOOST_CHECK(!deserializer.dispatch(visitor));
+
+        std::string expected = "config file skip.xml;config text <configuration/>;header 1;acquisition 4096;"
+                               "waveform 42;acquisition 4096;acquisition 4096;acquisition 4096;";
+        if (!skip_images) {
+            expected += "image 128 skipped;";
+        }
+        expected += "nd array 32768;text skipped;acquisition 4096;waveform 42;";
+        BOOST_CHECK_EQUAL(visitor.log.str(), expected);
+
+        // Single and batched acquisitions are decoded into the same object
+        BOOST_REQUIRE_EQUAL(visitor.acquisitions.size(), 5u);
+        for (size_t n = 1; n < visitor.acquisitions.size(); n++) {
+            BOOST_CHECK(visitor.acquisitions[n] == visitor.acquisitions[0]);
+        }
+    }
+
+    // The default visit ignores the message
+    std::stringstream ss(contents, std::ios::in | std::ios::binary);
+    IStreamView rs(ss);
+    ProtocolDeserializer deserializer(rs);
+    ProtocolVisitor ignoring;
+    size_t messages = 0;
+    while (deserializer.dispatch(ignoring)) {
+        messages++;
+    }
+    BOOST_CHECK_EQUAL(messages, 13u);
+}
+
+// Everything the pipeline decodes, with an image that has meta attributes
+static void write_pipeline_messages(WritableStreamView &ws, const std::vector<Acquisition> &acqs, const Waveform &wf,
+                                    const Image<float> &img) {
+    ProtocolSerializer serializer(ws);
+    IsmrmrdHeader h;
+    h.encoding.push_back(Encoding());
+    h.encoding[0].trajectory = TrajectoryType::CARTESIAN;
+    serializer.serialize(h);
+    for (size_t n = 0; n < acqs.size(); n++) {
+        if (n % 10 == 5) {
+            serializer.serialize(std::vector<Acquisition>(acqs.begin() + n, acqs.begin() + n + 3));
+            n += 2;
+        } else {
+            serializer.serialize(acqs[n]);
+        }
+        if (n % 7 == 0) {
+            serializer.serialize(wf);
+        }
+    }
+    serializer.serialize(img);
+    std::vector<size_t> dims(2, 5);
+    NDArray<int32_t> arr(dims);
+    for (size_t i = 0; i < arr.getNumberOfElements(); i++) {
+        arr.getDataPtr()[i] = int32_t(i);
+    }
+    serializer.serialize(arr);
+    TextMessage txt;
+    txt.message = "done";
+    serializer.serialize(txt);
+    serializer.close();
+}
+
+BOOST_AUTO_TEST_CASE(test_decode_pipeline) {
+    std::vector<Acquisition> acqs(100);
+    for (size_t n = 0; n < acqs.size(); n++) {
+        acqs[n].resize(uint16_t(16 + n % 5), 2, uint16_t(n % 2));
+        acqs[n].scan_counter() = uint32_t(n);
+        for (size_t i = 0; i < acqs[n].getNumberOfDataElements(); i++) {
+            acqs[n].getDataPtr()[i] = value_from_size_t<std::complex<float> >(i + n);
+        }
+    }
+    Waveform wf(10, 2);
+    for (size_t i = 0; i < wf.size(); i++) {
+        wf.begin_data()[i] = uint32_t(3 * i);
+    }
+    Image<float> img(8, 4, 1, 1);
+    MetaContainer meta;
+    meta.set("series", "pipeline");
+    meta.append("window", 2.5);
+    std::stringstream meta_xml;
+    serialize(meta, meta_xml);
+    img.setAttributeString(meta_xml.str());
+    for (size_t i = 0; i < img.getNumberOfDataElements(); i++) {
+        img.getDataPtr()[i] = value_from_size_t<float>(i);
+    }
+
+    std::stringstream out(std::ios::out | std::ios::binary);
+    {
+        OStreamView ws(out);
+        write_pipeline_messages(ws, acqs, wf, img);
+    }
+    const std::string contents = out.str();
+
+    // On the calling thread, one worker, several workers with short and long queues
+    unsigned int workers[] = {0, 1, 4, 4};
+    size_t queue_sizes[] = {64, 1, 3, 64};
+    for (int mode = 0; mode < 4; mode++) {
+        std::stringstream ss(contents, std::ios::in | std::ios::binary);
+        IStreamView rs(ss);
+        DecodePipelineOptions options;
+        options.workers = workers[mode];
+        options.queue_size = queue_sizes[mode];
+        options.parse_image_meta = true;
+        options.read_ahead = mode % 2 == 0;
+        DecodePipeline pipeline(rs, options);
+
+        DecodedMessage msg;
+        BOOST_REQUIRE(pipeline.readNext(msg));
+        BOOST_REQUIRE_EQUAL(msg.getId(), ISMRMRD_MESSAGE_HEADER);
+        BOOST_CHECK(msg.get<IsmrmrdHeader>().encoding[0].trajectory == TrajectoryType(TrajectoryType::CARTESIAN));
+        BOOST_CHECK_THROW(msg.get<Acquisition>(), std::runtime_error);
+
+        // Messages come out in stream order
+        size_t next = 0, waveforms = 0;
+        while (next < acqs.size()) {
+            BOOST_REQUIRE(pipeline.readNext(msg));
+            std::vector<Acquisition> single;
+            std::vector<Acquisition> *received = &single;
+            if (msg.getId() == ISMRMRD_MESSAGE_WAVEFORM) {
+                BOOST_CHECK_EQUAL_COLLECTIONS(msg.get<Waveform>().begin_data(), msg.get<Waveform>().end_data(),
+                                              wf.begin_data(), wf.end_data());
+                waveforms++;
+                continue;
+            } else if (msg.getId() == ISMRMRD_MESSAGE_ACQUISITION_BATCH) {
+                received = &msg.get<std::vector<Acquisition> >();
+            } else {
+                BOOST_REQUIRE_EQUAL(msg.getId(), ISMRMRD_MESSAGE_ACQUISITION);
+                single.push_back(msg.get<Acquisition>());
+            }
+            for (size_t i = 0; i < received->size(); i++, next++) {
+                const Acquisition &acq = (*received)[i];
+                BOOST_REQUIRE(acq.getHead() == acqs[next].getHead());
+                BOOST_CHECK_EQUAL_COLLECTIONS(acq.data_begin(), acq.data_end(), acqs[next].data_begin(),
+                                              acqs[next].data_end());
+            }
+        }
+        BOOST_CHECK_EQUAL(waveforms, 13u);
+
+        BOOST_REQUIRE(pipeline.readNext(msg));
+        BOOST_REQUIRE_EQUAL(msg.getId(), ISMRMRD_MESSAGE_IMAGE);
+        BOOST_CHECK_EQUAL(msg.getDataType(), ISMRMRD_FLOAT);
+        Image<float> &img2 = msg.get<Image<float> >();
+        BOOST_CHECK_EQUAL_COLLECTIONS(img2.getDataPtr(), img2.getDataPtr() + img2.getNumberOfDataElements(),
+                                      img.getDataPtr(), img.getDataPtr() + img.getNumberOfDataElements());
+        BOOST_CHECK_EQUAL(std::string(msg.getMeta().as_str("series")), "pipeline");
+        BOOST_CHECK_EQUAL(msg.getMeta().as_double("window"), 2.5);
+
+        BOOST_REQUIRE(pipeline.readNext(msg));
+        BOOST_REQUIRE_EQUAL(msg.getId(), ISMRMRD_MESSAGE_NDARRAY);
+        BOOST_CHECK_EQUAL(msg.get<NDArray<int32_t> >().getDataPtr()[24], 24);
+        BOOST_CHECK(msg.getMeta().empty());
+        BOOST_REQUIRE(pipeline.readNext(msg));
+        BOOST_CHECK_EQUAL(msg.get<TextMessage>().message, "done");
+        BOOST_CHECK(!pipeline.readNext(msg));
+        BOOST_CHECK(!pipeline.readNext(msg));
+    }
+
+    // Messages before an error are returned, the error is thrown in its place
+    for (unsigned int w = 0; w < 3; w += 2) {
+        std::stringstream ss(contents.substr(0, contents.size() / 2), std::ios::in | std::ios::binary);
+        IStreamView rs(ss);
+        DecodePipelineOptions options;
+        options.workers = w;
+        options.queue_size = 4;
+        DecodePipeline pipeline(rs, options);
+        DecodedMessage msg;
+        size_t messages = 0;
+        BOOST_CHECK_THROW(
+            while (pipeline.readNext(msg)) {
+                messages++;
+            },
+            std::runtime_error);
+        BOOST_CHECK_GT(messages, 40u);
+        BOOST_CHECK(!pipeline.readNext(msg));
+    }
+
+    // Stopped before the end of the stream
+    {
+        std::stringstream ss(contents, std::ios::in | std::ios::binary);
+        IStreamView rs(ss);
+        DecodePipelineOptions options;
+        options.queue_size = 2;
+        DecodePipeline pipeline(rs, options);
+        DecodedMessage msg;
+        BOOST_CHECK(pipeline.readNext(msg));
+    }
+}
+
+// Messages larger than a block and messages across the end of a block
+BOOST_AUTO_TEST_CASE(test_decode_pipeline_blocks) {
+    std::vector<Acquisition> acqs(60);
+    std::stringstream out(std::ios::out | std::ios::binary);
+    {
+        OStreamView ws(out);
+        ProtocolSerializer serializer(ws);
+        for (size_t n = 0; n < acqs.size(); n++) {
+            acqs[n].resize(uint16_t(n == 30 ? 40000 : 1000 + 997 * n), uint16_t(n == 30 ? 4 : 1));
+            acqs[n].scan_counter() = uint32_t(n);
+            for (size_t i = 0; i < acqs[n].getNumberOfDataElements(); i++) {
+                acqs[n].getDataPtr()[i] = value_from_size_t<std::complex<float> >(i + n);
+            }
+            serializer.serialize(acqs[n]);
+        }
+        serializer.close();
+    }
+    const std::string contents = out.str();
+    BOOST_REQUIRE_GT(contents.size(), 3u * 1024 * 1024);
+
+    unsigned int workers[] = {0, 0, 2, 2};
+    for (int mode = 0; mode < 4; mode++) {
+        std::stringstream ss(contents, std::ios::in | std::ios::binary);
+        IStreamView rs(ss);
+        DecodePipelineOptions options;
+        options.workers = workers[mode];
+        options.queue_size = 3;
+        options.read_ahead = mode % 2 == 0;
+        DecodePipeline pipeline(rs, options);
+        DecodedMessage msg;
+        for (size_t n = 0; n < acqs.size(); n++) {
+            BOOST_REQUIRE(pipeline.readNext(msg));
+            const Acquisition &acq = msg.get<Acquisition>();
+            BOOST_REQUIRE(acq.getHead() == acqs[n].getHead());
+            BOOST_REQUIRE(std::equal(acq.data_begin(), acq.data_end(), acqs[n].data_begin()));
+        }
+        BOOST_CHECK(!pipeline.readNext(msg));
+    }
+}
+
+#ifndef _WIN32
+// Reads back what write_messages wrote
+static void check_messages(ReadableStreamView &rs, const std::vector<Acquisition> &acqs, const Waveform &wf,
+                           const Image<float> &img) {
+    ProtocolDeserializer deserializer(rs);
+    TextMessage txt_msg;
+    deserializer.deserialize(txt_msg);
+    BOOST_CHECK_EQUAL(txt_msg.message, "before the data");
+    for (size_t n = 0; n < acqs.size(); n++) {
+        Acquisition acq;
+        deserializer.deserialize(acq);
+        BOOST_REQUIRE(acq.getHead() == acqs[n].getHead());
+        BOOST_CHECK_EQUAL_COLLECTIONS(acq.getDataPtr(), acq.getDataPtr() + acq.getNumberOfDataElements(),
+                                      acqs[n].getDataPtr(), acqs[n].getDataPtr() + acqs[n].getNumberOfDataElements());
+        BOOST_CHECK_EQUAL_COLLECTIONS(acq.getTrajPtr(), acq.getTrajPtr() + acq.getNumberOfTrajElements(),
+                                      acqs[n].getTrajPtr(), acqs[n].getTrajPtr() + acqs[n].getNumberOfTrajElements());
+        if (n == acqs.size() / 2) {
+            Waveform wf2;
+            deserializer.deserialize(wf2);
+            BOOST_CHECK_EQUAL_COLLECTIONS(wf.begin_data(), wf.end_data(), wf2.begin_data(), wf2.end_data());
+            Image<float> img2;
+            deserializer.deserialize(img2);
+            BOOST_CHECK_EQUAL(img2.getAttributeString(), img.getAttributeString());
+            BOOST_CHECK_EQUAL_COLLECTIONS(img.getDataPtr(), img.getDataPtr() + img.getNumberOfDataElements(),
+                                          img2.getDataPtr(), img2.getDataPtr() + img2.getNumberOfDataElements());
+        }
+    }
+    BOOST_CHECK_EQUAL(deserializer.peek(), ISMRMRD_MESSAGE_CLOSE);
+    char extra;
+    rs.read(&extra, 1);
+    BOOST_CHECK(rs.eof());
+}
+
+// Messages on a pipe are handed out as they arrive, not once a block is full
+BOOST_AUTO_TEST_CASE(test_decode_pipeline_pipe) {
+    Acquisition acq(64, 2);
+    acq.scan_counter() = 7;
+    int fds[2];
+    BOOST_REQUIRE(pipe(fds) == 0);
+    FdWritableStreamView ws(fds[1]);
+    ProtocolSerializer serializer(ws);
+    serializer.serialize(acq);
+
+    for (unsigned int w = 0; w < 2; w++) {
+        FdReadableStreamView rs(fds[0]);
+        DecodePipelineOptions options;
+        options.workers = w;
+        DecodePipeline pipeline(rs, options);
+        DecodedMessage msg;
+        BOOST_REQUIRE(pipeline.readNext(msg));
+        BOOST_CHECK_EQUAL(msg.get<Acquisition>().scan_counter(), 7u);
+        if (w == 0) {
+            serializer.serialize(acq);
+        } else {
+            serializer.close();
+            close(fds[1]);
+            BOOST_CHECK(!pipeline.readNext(msg));
+        }
+    }
+    close(fds[0]);
+}
+
+BOOST_AUTO_TEST_CASE(test_fd_protocol_serialization) {
+    std::vector<Acquisition> acqs(20);
+    for (size_t n = 0; n < acqs.size(); n++) {
+        acqs[n].resize(uint16_t(1 + 31 * n), uint16_t(1 + n % 4), uint16_t(n % 3));
+        acqs[n].scan_counter() = uint32_t(n);
+        for (size_t i = 0; i < acqs[n].getNumberOfDataElements(); i++) {
+            acqs[n].getDataPtr()[i] = value_from_size_t<std::complex<float> >(i + n);
+        }
+        for (size_t i = 0; i < acqs[n].getNumberOfTrajElements(); i++) {
+            acqs[n].getTrajPtr()[i] = value_from_size_t<float>(i + 2 * n);
+        }
+    }
+    Waveform wf(64, 4);
+    for (size_t i = 0; i < wf.size(); i++) {
+        wf.begin_data()[i] = uint32_t(i);
+    }
+    Image<float> img;
+    img.resize(16, 16, 1, 2);
+    img.setAttributeString("fd");
+    for (size_t i = 0; i < img.getNumberOfDataElements(); i++) {
+        img.getDataPtr()[i] = value_from_size_t<float>(i);
+    }
+
+    std::stringstream plain(std::ios::in | std::ios::out | std::ios::binary);
+    OStreamView plain_ws(plain);
+    write_messages(plain_ws, acqs, wf, img);
+
+    // Unbuffered every message is one writev, buffered the large acquisitions go out with the buffer
+    for (int buffered = 0; buffered < 2; buffered++) {
+        char path[] = "/tmp/ismrmrd_fd_test_XXXXXX";
+        int fd = mkstemp(path);
+        BOOST_REQUIRE(fd >= 0);
+        unlink(path);
+        {
+            FdWritableStreamView fd_ws(fd);
+            if (buffered) {
+                BufferedWritableStreamView ws(fd_ws, 1000);
+                write_messages(ws, acqs, wf, img);
+            } else {
+                write_messages(fd_ws, acqs, wf, img);
+            }
+            BOOST_CHECK(!fd_ws.bad());
+        }
+
+        off_t size = lseek(fd, 0, SEEK_CUR);
+        BOOST_REQUIRE_EQUAL(static_cast<size_t>(size), plain.str().size());
+        std::string written(plain.str().size(), '\0');
+        BOOST_REQUIRE_EQUAL(pread(fd, &written[0], written.size(), 0), size);
+        BOOST_CHECK(written == plain.str());
+
+        lseek(fd, 0, SEEK_SET);
+        FdReadableStreamView fd_rs(fd);
+        if (buffered) {
+            BufferedReadableStreamView rs(fd_rs, 1000);
+            check_messages(rs, acqs, wf, img);
+        } else {
+            check_messages(fd_rs, acqs, wf, img);
+        }
+        close(fd);
+    }
+
+    // Write errors are reported by bad(), here writing to the read end of a pipe
+    int fds[2];
+    BOOST_REQUIRE(pipe(fds) == 0);
+    FdWritableStreamView read_end(fds[0]);
+    BOOST_CHECK_THROW(write_messages(read_end, acqs, wf, img), std::runtime_error);
+    BOOST_CHECK(read_end.bad());
+    close(fds[0]);
+    close(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE(test_fd_protocol_skip) {
+    Waveform wf(50, 2);
+    wf.head.time_stamp = 7;
+    char path[] = "/tmp/ismrmrd_skip_XXXXXX";
+    int fd = mkstemp(path);
+    BOOST_REQUIRE(fd >= 0);
+    {
+        FdWritableStreamView ws(fd);
+        write_skip_messages(ws, wf);
+    }
+
+    // A file seeks over the data
+    lseek(fd, 0, SEEK_SET);
+    {
+        FdReadableStreamView fd_view(fd);
+        CountingStreamView rs(fd_view, true);
+        BOOST_CHECK_EQUAL(read_waveforms(rs, wf), 2u);
+        BOOST_CHECK_LT(rs.bytes_read, 8000u);
+    }
+    close(fd);
+
+    // A pipe cannot seek, the skipped data is read
+    int fds[2];
+    BOOST_REQUIRE(pipe(fds) == 0);
+    pid_t pid = fork();
+    BOOST_REQUIRE(pid >= 0);
+    if (pid == 0) {
+        close(fds[0]);
+        int in = open(path, O_RDONLY);
+        char buffer[65536];
+        ssize_t n;
+        while ((n = read(in, buffer, sizeof(buffer))) > 0) {
+            if (write(fds[1], buffer, static_cast<size_t>(n)) != n) {
+                _exit(1);
+            }
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    {
+        FdReadableStreamView fd_view(fds[0]);
+        BufferedReadableStreamView rs(fd_view, 4096);
+        BOOST_CHECK_EQUAL(read_waveforms(rs, wf), 2u);
+        char extra;
+        rs.read(&extra, 1);
+        BOOST_CHECK(rs.eof());
+    }
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    unlink(path);
+}
+
+BOOST_AUTO_TEST_CASE(test_mapped_stream_reader) {
+    // Odd sizes, so that the data of some messages is misaligned in the file
+    std::vector<Acquisition> acqs(9);
+    for (size_t n = 0; n < acqs.size(); n++) {
+        acqs[n].resize(uint16_t(3 + 5 * n), uint16_t(1 + n % 2), uint16_t(n % 3));
+        acqs[n].scan_counter() = uint32_t(n);
+        for (size_t i = 0; i < acqs[n].getNumberOfDataElements(); i++) {
+            acqs[n].getDataPtr()[i] = value_from_size_t<std::complex<float> >(i + n);
+        }
+        for (size_t i = 0; i < acqs[n].getNumberOfTrajElements(); i++) {
+            acqs[n].getTrajPtr()[i] = value_from_size_t<float>(i + 2 * n);
+        }
+    }
+    Waveform wf(7, 3);
+    for (size_t i = 0; i < wf.size(); i++) {
+        wf.begin_data()[i] = uint32_t(i * 3);
+    }
+    Image<double> img;
+    img.resize(5, 3, 1, 2);
+    img.setAttributeString("mapped");
+    for (size_t i = 0; i < img.getNumberOfDataElements(); i++) {
+        img.getDataPtr()[i] = value_from_size_t<double>(i);
+    }
+    std::vector<size_t> dims(2);
+    dims[0] = 3;
+    dims[1] = 4;
+    NDArray<std::complex<double> > arr(dims);
+    for (size_t i = 0; i < arr.getNumberOfElements(); i++) {
+        arr.getDataPtr()[i] = value_from_size_t<std::complex<double> >(i);
+    }
+
+    char path[] = "/tmp/ismrmrd_mapped_stream_XXXXXX";
+    int fd = mkstemp(path);
+    BOOST_REQUIRE(fd >= 0);
+    {
+        FdWritableStreamView ws(fd);
+        ProtocolSerializer serializer(ws);
+        ConfigText cfg;
+        cfg.config_text = "<configuration/>";
+        serializer.serialize(cfg);
+        for (size_t n = 0; n < acqs.size(); n++) {
+            serializer.serialize(acqs[n]);
+            if (n == 4) {
+                serializer.serialize(wf);
+                serializer.serialize(img);
+                serializer.serialize(arr);
+            }
+        }
+        serializer.close();
+    }
+    close(fd);
+
+    {
+        MappedStreamReader reader(path);
+        ConfigText cfg;
+        reader.deserialize(cfg);
+        BOOST_CHECK_EQUAL(cfg.config_text, "<configuration/>");
+        for (size_t n = 0; n < acqs.size(); n++) {
+            AcquisitionView acq;
+            reader.deserialize(acq);
+            BOOST_REQUIRE(acq.getHead() == acqs[n].getHead());
+            BOOST_CHECK_EQUAL(reinterpret_cast<uintptr_t>(acq.getDataPtr()) % sizeof(float), 0u);
+            BOOST_CHECK_EQUAL_COLLECTIONS(acq.data_begin(), acq.data_end(), acqs[n].data_begin(), acqs[n].data_end());
+            BOOST_CHECK_EQUAL_COLLECTIONS(acq.traj_begin(), acq.traj_end(), acqs[n].traj_begin(), acqs[n].traj_end());
+            if (n == 4) {
+                BOOST_CHECK_EQUAL(acq.data(2, 0), acqs[n].data(2, 0));
+                WaveformView wf2;
+                reader.deserialize(wf2);
+                BOOST_CHECK_EQUAL(wf2.getHead().channels, 3);
+                BOOST_CHECK_EQUAL_COLLECTIONS(wf2.begin_data(), wf2.end_data(), wf.begin_data(), wf.end_data());
+
+                BOOST_CHECK_EQUAL(reader.peek(), ISMRMRD_MESSAGE_IMAGE);
+                BOOST_CHECK_EQUAL(reader.peek_image_data_type(), ISMRMRD_DOUBLE);
+                ImageView<float> wrong_type;
+                BOOST_CHECK_THROW(reader.deserialize(wrong_type), std::runtime_error);
+                ImageView<double> img2;
+                reader.deserialize(img2);
+                BOOST_CHECK_EQUAL(reinterpret_cast<uintptr_t>(img2.getDataPtr()) % sizeof(double), 0u);
+                std::string attr;
+                img2.getAttributeString(attr);
+                BOOST_CHECK_EQUAL(attr, "mapped");
+                BOOST_CHECK_EQUAL_COLLECTIONS(img2.begin(), img2.end(), img.begin(), img.end());
+
+                NDArrayView<std::complex<double> > arr2;
+                reader.deserialize(arr2);
+                BOOST_CHECK_EQUAL(arr2.getNDim(), 2);
+                BOOST_CHECK_EQUAL(arr2(2, 3), arr(2, 3));
+                BOOST_CHECK_EQUAL_COLLECTIONS(arr2.begin(), arr2.end(), arr.begin(), arr.end());
+            }
+        }
+        AcquisitionView acq;
+        BOOST_CHECK_THROW(reader.deserialize(acq), ProtocolStreamClosed);
+        reader.skip();
+        BOOST_CHECK_EQUAL(reader.offset(), reader.size());
+        BOOST_CHECK_THROW(reader.peek(), std::runtime_error);
+    }
+
+    // Skipping walks the same messages
+    std::string contents;
+    {
+        MappedStreamReader reader(path);
+        size_t messages = 0;
+        while (reader.peek() != ISMRMRD_MESSAGE_CLOSE) {
+            reader.skip();
+            messages++;
+        }
+        BOOST_CHECK_EQUAL(messages, 1 + acqs.size() + 3);
+        std::ifstream in(path, std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    // A file cut short in the last acquisition
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(contents.data(), contents.size() - 16);
+    }
+    {
+        MappedStreamReader reader(path);
+        size_t messages = 0;
+        BOOST_CHECK_THROW(
+            while (true) {
+                reader.skip();
+                messages++;
+            },
+            std::runtime_error);
+        BOOST_CHECK_EQUAL(messages, acqs.size() + 3);
+    }
+    unlink(path);
+    BOOST_CHECK_THROW(MappedStreamReader missing(path), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_mapped_stream_batches) {
+    std::vector<Acquisition> acqs(5);
+    for (size_t n = 0; n < acqs.size(); n++) {
+        acqs[n].resize(uint16_t(3 + n), 2, uint16_t(n % 2));
+        acqs[n].scan_counter() = uint32_t(n);
+        for (size_t i = 0; i < acqs[n].getNumberOfDataElements(); i++) {
+            acqs[n].getDataPtr()[i] = value_from_size_t<std::complex<float> >(i + n);
+        }
+    }
+    Waveform wf(4, 1);
+
+    char path[] = "/tmp/ismrmrd_mapped_batches_XXXXXX";
+    int fd = mkstemp(path);
+    BOOST_REQUIRE(fd >= 0);
+    {
+        FdWritableStreamView ws(fd);
+        ProtocolSerializer serializer(ws);
+        serializer.serialize(std::vector<Acquisition>(acqs.begin(), acqs.begin() + 2));
+        serializer.serialize(std::vector<Acquisition>());
+        serializer.serialize(wf);
+        serializer.serialize(std::vector<Acquisition>(acqs.begin() + 2, acqs.end()));
+        serializer.close();
+    }
+    close(fd);
+
+    {
+        MappedStreamReader reader(path);
+        AcquisitionView acq;
+        BOOST_CHECK_EQUAL(reader.peek(), ISMRMRD_MESSAGE_ACQUISITION_BATCH);
+        for (size_t n = 0; n < 2; n++) {
+            reader.deserialize(acq);
+            BOOST_REQUIRE(acq.getHead() == acqs[n].getHead());
+            BOOST_CHECK_EQUAL_COLLECTIONS(acq.data_begin(), acq.data_end(), acqs[n].data_begin(), acqs[n].data_end());
+        }
+        // The empty batch is passed over
+        BOOST_CHECK_EQUAL(reader.peek(), ISMRMRD_MESSAGE_WAVEFORM);
+        WaveformView wf2;
+        reader.deserialize(wf2);
+        reader.deserialize(acq);
+        BOOST_CHECK(acq.getHead() == acqs[2].getHead());
+        BOOST_CHECK_THROW(reader.deserialize(wf2), std::runtime_error);
+        // Skips the rest of the batch
+        reader.skip();
+        BOOST_CHECK_EQUAL(reader.peek(), ISMRMRD_MESSAGE_CLOSE);
+        BOOST_CHECK_THROW(reader.deserialize(acq), ProtocolStreamClosed);
+    }
+    {
+        MappedStreamReader reader(path);
+        size_t messages = 0;
+        while (reader.peek() != ISMRMRD_MESSAGE_CLOSE) {
+            reader.skip();
+            messages++;
+        }
+        BOOST_CHECK_EQUAL(messages, 3u);
+    }
+    unlink(path);
+}
+
+BOOST_AUTO_TEST_CASE(test_stream_index) {
+    std::vector<Acquisition> acqs(5);
+    for (size_t n = 0; n < acqs.size(); n++) {
+        acqs[n].resize(uint16_t(4 + 3 * n), uint16_t(1 + n % 2), uint16_t(n % 2));
+        acqs[n].scan_counter() = uint32_t(n);
+        acqs[n].idx().kspace_encode_step_1 = uint16_t(10 + n);
+        for (size_t i = 0; i < acqs[n].getNumberOfDataElements(); i++) {
+            acqs[n].getDataPtr()[i] = value_from_size_t<std::complex<float> >(i + n);
+        }
+    }
+    std::vector<Waveform> wfs(2, Waveform(6, 2));
+    for (size_t n = 0; n < wfs.size(); n++) {
+        wfs[n].head.time_stamp = uint32_t(100 + n);
+        for (size_t i = 0; i < wfs[n].size(); i++) {
+            wfs[n].begin_data()[i] = uint32_t(i + 5 * n);
+        }
+    }
+    Image<float> img(6, 5, 1, 1);
+    img.setAttributeString("indexed");
+    img.setSlice(3);
+    for (size_t i = 0; i < img.getNumberOfDataElements(); i++) {
+        img.getDataPtr()[i] = value_from_size_t<float>(i);
+    }
+
+    char path[] = "/tmp/ismrmrd_stream_index_XXXXXX";
+    int fd = mkstemp(path);
+    BOOST_REQUIRE(fd >= 0);
+    StreamIndex live;
+    {
+        FdWritableStreamView ws(fd);
+        ProtocolSerializer serializer(ws);
+        serializer.setIndex(&live);
+        TextMessage txt;
+        txt.message = "indexed";
+        serializer.serialize(txt);
+        serializer.serialize(acqs[0]);
+        serializer.serialize(wfs[0]);
+        serializer.serialize(std::vector<Acquisition>(acqs.begin() + 1, acqs.begin() + 4));
+        serializer.serialize(img);
+        serializer.serialize(NDArray<double>(std::vector<size_t>(2, 3)));
+        serializer.serialize(wfs[1]);
+        serializer.serialize(acqs[4]);
+        serializer.close();
+    }
+    close(fd);
+
+    // Scanning the file gives the index built while writing it
+    StreamIndex scanned;
+    buildStreamIndex(path, scanned);
+    BOOST_REQUIRE_EQUAL(live.size(), 11u);
+    BOOST_REQUIRE_EQUAL(scanned.size(), live.size());
+    for (size_t n = 0; n < live.size(); n++) {
+        BOOST_CHECK(memcmp(&live[n], &scanned[n], sizeof(StreamIndexEntry)) == 0);
+    }
+    BOOST_CHECK_EQUAL(live[0].offset, 0u);
+    BOOST_CHECK_EQUAL(live[0].message_id, ISMRMRD_MESSAGE_TEXT);
+    BOOST_CHECK_EQUAL(live[4].message_id, ISMRMRD_MESSAGE_ACQUISITION_BATCH);
+    BOOST_CHECK_EQUAL(live[4].idx.kspace_encode_step_1, 12);
+    BOOST_CHECK_EQUAL(live[4].scan_counter, 2u);
+    BOOST_CHECK_EQUAL(live[6].message_id, ISMRMRD_MESSAGE_IMAGE);
+    BOOST_CHECK_EQUAL(live[6].idx.slice, 3);
+    BOOST_CHECK_EQUAL(live[7].data_type, ISMRMRD_DOUBLE);
+    BOOST_CHECK_EQUAL(live[8].time_stamp, 101u);
+    BOOST_CHECK_EQUAL(live[10].message_id, ISMRMRD_MESSAGE_CLOSE);
+
+    std::string index_path = std::string(path) + ".idx";
+    live.write(index_path.c_str());
+    StreamIndex reread;
+    reread.read(index_path.c_str());
+    BOOST_REQUIRE_EQUAL(reread.size(), live.size());
+    BOOST_CHECK(memcmp(&reread[0], &live[0], live.size() * sizeof(StreamIndexEntry)) == 0);
+    BOOST_CHECK_THROW(reread.read(path), std::runtime_error);
+
+    {
+        IndexedStreamReader reader(path, index_path.c_str());
+        BOOST_REQUIRE_EQUAL(reader.getNumberOfAcquisitions(), acqs.size());
+        BOOST_REQUIRE_EQUAL(reader.getNumberOfWaveforms(), wfs.size());
+        // Backwards, so every read seeks, also into the batch
+        Acquisition acq;
+        for (size_t n = acqs.size(); n-- > 0;) {
+            reader.readAcquisition(uint32_t(n), acq);
+            BOOST_REQUIRE(acq.getHead() == acqs[n].getHead());
+            BOOST_CHECK_EQUAL_COLLECTIONS(acq.data_begin(), acq.data_end(), acqs[n].data_begin(), acqs[n].data_end());
+        }
+        Waveform wf;
+        reader.readWaveform(1, wf);
+        BOOST_CHECK_EQUAL_COLLECTIONS(wf.begin_data(), wf.end_data(), wfs[1].begin_data(), wfs[1].end_data());
+        BOOST_CHECK_THROW(reader.readAcquisition(uint32_t(acqs.size()), acq), std::runtime_error);
+
+        ProtocolDeserializer &deserializer = reader.seek(6);
+        BOOST_REQUIRE_EQUAL(deserializer.peek(), ISMRMRD_MESSAGE_IMAGE);
+        Image<float> img2;
+        deserializer.deserialize(img2);
+        BOOST_CHECK_EQUAL(img2.getAttributeString(), img.getAttributeString());
+        BOOST_CHECK_EQUAL_COLLECTIONS(img2.getDataPtr(), img2.getDataPtr() + img2.getNumberOfDataElements(),
+                                      img.getDataPtr(), img.getDataPtr() + img.getNumberOfDataElements());
+        // Reading on from there
+        BOOST_CHECK_EQUAL(deserializer.peek(), ISMRMRD_MESSAGE_NDARRAY);
+        BOOST_CHECK_EQUAL(reader.seek(0).peek(), ISMRMRD_MESSAGE_TEXT);
+        BOOST_CHECK_THROW(reader.seek(4), std::runtime_error);
+    }
+
+    // Without an index file the stream is scanned
+    {
+        IndexedStreamReader reader(path);
+        BOOST_CHECK_EQUAL(reader.getIndex().size(), live.size());
+        Acquisition acq;
+        reader.readAcquisition(2, acq);
+        BOOST_CHECK(acq.getHead() == acqs[2].getHead());
+    }
+
+    // The index of another stream is refused. Collected while writing, the index only knows the size
+    // of the stream, the scanned one also notices a changed byte.
+    std::string scanned_path = std::string(path) + ".scanned.idx";
+    scanned.write(scanned_path.c_str());
+    BOOST_CHECK(live.matches(path));
+    BOOST_CHECK(scanned.matches(path));
+    std::ifstream in(path, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    {
+        std::string changed = contents;
+        changed[static_cast<size_t>(live[1].offset) - 1] ^= 1;
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(changed.data(), changed.size());
+    }
+    BOOST_CHECK(live.matches(path));
+    BOOST_CHECK(!scanned.matches(path));
+    BOOST_CHECK_THROW(IndexedStreamReader(path, scanned_path.c_str()), std::runtime_error);
+
+    // A stream cut short in the middle of the last acquisition
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(contents.data(), live[9].offset + 2 + sizeof(AcquisitionHeader) + 4);
+    }
+    BOOST_CHECK_THROW(buildStreamIndex(path, scanned), std::runtime_error);
+    BOOST_CHECK_THROW(IndexedStreamReader(path, index_path.c_str()), std::runtime_error);
+
+    unlink(scanned_path.c_str());
+    unlink(index_path.c_str());
+    unlink(path);
+}
+
+BOOST_AUTO_TEST_CASE(test_image_size_overflow) {
+    Image<complex_double_t> img(4, 4, 1, 1);
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    {
+        OStreamView ws(ss);
+        ProtocolSerializer serializer(ws);
+        serializer.serialize(img);
+        serializer.close();
+    }
+    BOOST_CHECK_EQUAL(image_data_size(img.getHead()), 4 * 4 * sizeof(complex_double_t));
+
+    // 2^15 in each dimension and channels of 16 byte samples is 2^64 bytes, which wraps to 0
+    ImageHeader head = img.getHead();
+    head.matrix_size[0] = head.matrix_size[1] = head.matrix_size[2] = 32768;
+    head.channels = 32768;
+    BOOST_CHECK_THROW(image_data_size(head), std::runtime_error);
+    std::string contents = ss.str();
+    memcpy(&contents[sizeof(uint16_t)], &head, sizeof(head));
+
+    {
+        std::stringstream corrupt(contents, std::ios::in | std::ios::binary);
+        IStreamView rs(corrupt);
+        ProtocolDeserializer deserializer(rs);
+        BOOST_CHECK_EQUAL(deserializer.peek(), ISMRMRD_MESSAGE_IMAGE);
+        BOOST_CHECK_THROW(deserializer.skip(), std::runtime_error);
+    }
+
+    char path[] = "/tmp/ismrmrd_image_overflow_XXXXXX";
+    int fd = mkstemp(path);
+    BOOST_REQUIRE(fd >= 0);
+    close(fd);
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(contents.data(), contents.size());
+    }
+    {
+        MappedStreamReader reader(path);
+        BOOST_CHECK_THROW(reader.skip(), std::runtime_error);
+        ImageView<complex_double_t> view;
+        BOOST_CHECK_THROW(reader.deserialize(view), std::runtime_error);
+    }
+    StreamIndex index;
+    BOOST_CHECK_THROW(buildStreamIndex(path, index), std::runtime_error);
+    unlink(path);
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -97,6 +97,8 @@ int main(int argc, char** argv)
         //Let's append the data to the file
         //Create if needed
         Dataset d(outfile.c_str(),dataset.c_str(), true);
+        // Lets recons find the undersampling pattern without reading every acquisition
+        d.trackSamplingMasks();
         Acquisition acq;
         uint16_t readout = static_cast<uint16_t>(matrix_size*ros);
         
@@ -0,0 +1,64 @@
+#include "ismrmrd/container.h"
+#include "ismrmrd/dataset.h"
+
+#include <boost/program_options.hpp>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+namespace po = boost::program_options;
+
+int main(int argc, char **argv) {
+
+    // Parse arguments using boost program options
+    po::options_description desc("Converts between ISMRMRD HDF5 files and append-only container files");
+
+    // Arguments
+    std::string input_file;
+    std::string output_file;
+    std::string groupname;
+
+    // clang-format off
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("input,i", po::value<std::string>(&input_file)->required(), "input file, HDF5 or container")
+        ("output,o", po::value<std::string>(&output_file)->required(), "output file, container or HDF5")
+        ("group,g", po::value<std::string>(&groupname)->default_value("dataset"), "group name in the HDF5 file");
+    // clang-format on
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help")) {
+            std::cerr << desc << "\n";
+            return 1;
+        }
+        po::notify(vm);
+    } catch (po::error &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        std::cerr << desc << std::endl;
+        return 1;
+    }
+
+    try {
+        if (ISMRMRD::ContainerDatasetBackend::isContainerFile(input_file.c_str())) {
+            ISMRMRD::ContainerDatasetBackend source(input_file.c_str(), false);
+            ISMRMRD::HDF5DatasetBackend destination(output_file.c_str(), groupname.c_str(), true);
+            ISMRMRD::copyDataset(source, destination);
+        } else {
+            // Container files are appended to, never mix two datasets in one
+            if (std::ifstream(output_file.c_str()).good()) {
+                std::cerr << "Error: Output file " << output_file << " already exists" << std::endl;
+                return 1;
+            }
+            ISMRMRD::HDF5DatasetBackend source(input_file.c_str(), groupname.c_str(), ISMRMRD::DATASET_READ_ONLY);
+            ISMRMRD::ContainerDatasetBackend destination(output_file.c_str(), true);
+            ISMRMRD::copyDataset(source, destination);
+        }
+    } catch (std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,6 +1,8 @@
 #include "ismrmrd/dataset.h"
 #include "ismrmrd/serialization.h"
+#include "ismrmrd/serialization_fd.h"
 #include "ismrmrd/serialization_iostream.h"
+#include "ismrmrd/stream_index.h"
 #include "ismrmrd_io_utils.h"
 
 #include <boost/program_options.hpp>
@@ -10,10 +12,71 @@
 
 namespace po = boost::program_options;
 
-void serialize_to_stream(const std::string &input_file, const std::string &groupname, const std::vector<std::string> &image_series, std::ostream &os, std::string config_file, std::string config_text) {
-    ISMRMRD::Dataset d(input_file.c_str(), groupname.c_str(), false);
-    ISMRMRD::OStreamView ws(os);
+// Sends acquisitions one by one, or collected into batches of the given size. Acquisitions are
+// read with next() straight into their place in the batch, then sent with send().
+class AcquisitionSender {
+public:
+    AcquisitionSender(ISMRMRD::ProtocolSerializer &serializer, unsigned int batch_size)
+        : serializer_(serializer), batch_size_(batch_size), count_(0), pending_(false) {}
+
+    // Where the next acquisition is read to
+    ISMRMRD::Acquisition &next() {
+        pending_ = true;
+        if (batch_size_ <= 1) {
+            return single_;
+        }
+        if (batch_.size() <= count_) {
+            batch_.resize(count_ + 1);
+        }
+        return batch_[count_];
+    }
+
+    // The acquisition read with next() and not sent yet
+    const ISMRMRD::Acquisition &pending() const {
+        return batch_size_ <= 1 ? single_ : batch_[count_];
+    }
+
+    void send() {
+        pending_ = false;
+        if (batch_size_ <= 1) {
+            serializer_.serialize(single_);
+            return;
+        }
+        if (++count_ >= batch_size_) {
+            flush();
+        }
+    }
+
+    // Sends the batch so far. An acquisition read but not sent yet starts the next batch.
+    void flush() {
+        if (count_ == 0) {
+            return;
+        }
+        if (pending_) {
+            single_ = batch_[count_];
+        }
+        batch_.resize(count_);
+        serializer_.serialize(batch_);
+        if (pending_) {
+            batch_[0] = single_;
+        }
+        count_ = 0;
+    }
+
+private:
+    ISMRMRD::ProtocolSerializer &serializer_;
+    unsigned int batch_size_;
+    // The batch keeps its acquisitions between batches, so their buffers are reused
+    std::vector<ISMRMRD::Acquisition> batch_;
+    size_t count_;
+    bool pending_;
+    ISMRMRD::Acquisition single_;
+};
+
+void serialize_to_stream(const std::string &input_file, const std::string &groupname, const std::vector<std::string> &image_series, ISMRMRD::WritableStreamView &ws, std::string config_file, std::string config_text, unsigned int acquisition_batch, ISMRMRD::StreamIndex *index) {
+    ISMRMRD::Dataset d(input_file.c_str(), groupname.c_str(), ISMRMRD::DATASET_READ_ONLY);
     ISMRMRD::ProtocolSerializer serializer(ws);
+    serializer.setIndex(index);
 
     if (config_file.size()) {
         ISMRMRD::ConfigFile cfg;
@@ -86,11 +149,11 @@ void serialize_to_stream(const std::string &input_file, const std::string &group
         unsigned int number_of_acquisitions = d.getNumberOfAcquisitions();
         unsigned int number_of_waveforms = d.getNumberOfWaveforms();
         unsigned int a = 0, a_fetched = number_of_acquisitions, w = 0, w_fetched = number_of_waveforms;
-        ISMRMRD::Acquisition acq;
         ISMRMRD::Waveform wfm;
+        AcquisitionSender sender(serializer, acquisition_batch);
         while (a < number_of_acquisitions || w < number_of_waveforms) {
             if (a < number_of_acquisitions && a_fetched != a) {
-                d.readAcquisition(a, acq);
+                d.readAcquisition(a, sender.next());
                 a_fetched = a;
             }
             if (w < number_of_waveforms && w_fetched != w) {
@@ -101,21 +164,24 @@ void serialize_to_stream(const std::string &input_file, const std::string &group
             // If we have both acquisitions and waveforms, advance the one with the
             // smaller timestamp, otherwise advance the one that exists
             if (a < number_of_acquisitions && w < number_of_waveforms) {
-                if (acq.getHead().acquisition_time_stamp < wfm.head.time_stamp) {
-                    serializer.serialize(acq);
+                if (sender.pending().getHead().acquisition_time_stamp < wfm.head.time_stamp) {
+                    sender.send();
                     a++;
                 } else {
+                    sender.flush();
                     serializer.serialize(wfm);
                     w++;
                 }
             } else if (a < number_of_acquisitions) {
-                serializer.serialize(acq);
+                sender.send();
                 a++;
             } else {
+                sender.flush();
                 serializer.serialize(wfm);
                 w++;
             }
         }
+        sender.flush();
     }
     serializer.close();
 }
@@ -131,7 +197,9 @@ int main(int argc, char **argv) {
     std::string config_text = "";
     std::string input_file;
     std::string output_file = "";
+    std::string index_file = "";
     bool use_stdout = false;
+    unsigned int acquisition_batch = 1;
     std::vector<std::string> image_series;
     std::string groupname;
 
@@ -144,7 +212,9 @@ int main(int argc, char **argv) {
         ("group,g", po::value<std::string>(&groupname)->default_value("dataset"), "group name")
         ("image-series,s", po::value<std::vector<std::string> >(&image_series)->multitoken(), "image series to extract")
         ("config-file,c", po::value<std::string>(&config_file), "Configuration name (aka config file)")
-        ("local-config-file,C", po::value<std::string>(&local_config_file), "Configuration text file");
+        ("local-config-file,C", po::value<std::string>(&local_config_file), "Configuration text file")
+        ("acquisition-batch,b", po::value<unsigned int>(&acquisition_batch)->default_value(1), "Send acquisitions in batches of this size, the receiver must support ISMRMRD_MESSAGE_ACQUISITION_BATCH")
+        ("index", po::value<std::string>(&index_file), "Also write a stream index of the output to this file");
     // clang-format on
 
     po::variables_map vm;
@@ -180,16 +250,38 @@ int main(int argc, char **argv) {
         config_text = buffer.str();
     }
 
+    // Built while writing, so a pipe can be indexed as well
+    ISMRMRD::StreamIndex stream_index;
+    ISMRMRD::StreamIndex *index = index_file.empty() ? NULL : &stream_index;
+
     if (use_stdout) {
+#ifndef _WIN32
+        // Each message goes to the pipe with a single writev, without copying the samples
+        ISMRMRD::FdWritableStreamView ws(STDOUT_FILENO);
+        serialize_to_stream(input_file, groupname, image_series, ws, config_file, config_text, acquisition_batch, index);
+#else
         ISMRMRD::set_binary_io();
-        serialize_to_stream(input_file, groupname, image_series, std::cout, config_file, config_text);
+        ISMRMRD::OStreamView os_view(std::cout);
+        ISMRMRD::BufferedWritableStreamView ws(os_view);
+        serialize_to_stream(input_file, groupname, image_series, ws, config_file, config_text, acquisition_batch, index);
+#endif
     } else if (output_file != "") {
         std::ofstream out(output_file.c_str(), std::ios::out | std::ios::binary);
-        serialize_to_stream(input_file, groupname, image_series, out, config_file, config_text);
+        ISMRMRD::OStreamView os_view(out);
+        ISMRMRD::BufferedWritableStreamView ws(os_view);
+        serialize_to_stream(input_file, groupname, image_series, ws, config_file, config_text, acquisition_batch, index);
     } else {
         std::cerr << "Error: Must specify either output file or use-stdout" << std::endl;
         return 1;
     }
 
+    if (index) {
+        // A pipe is only known by its size, a file gets its checksum too
+        if (!use_stdout) {
+            index->setStream(output_file.c_str());
+        }
+        index->write(index_file.c_str());
+    }
+
     return 0;
 }
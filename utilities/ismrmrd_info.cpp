@@ -1,6 +1,335 @@
 #include <iostream>
 #include "ismrmrd/version.h"
 
+// Inspecting files needs the dataset support and Boost.Program_options
+#ifdef ISMRMRD_INFO_INSPECT
+#include <boost/program_options.hpp>
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "ismrmrd/dataset.h"
+#include "ismrmrd_io_utils.h"
+
+namespace po = boost::program_options;
+
+namespace {
+
+std::string format_bytes(double bytes) {
+    const char *units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    int unit = 0;
+    while (bytes >= 1024.0 && unit < 4) {
+        bytes /= 1024.0;
+        unit++;
+    }
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(unit == 0 ? 0 : 1) << bytes << " " << units[unit];
+    return out.str();
+}
+
+herr_t collect_link_name(hid_t, const char *name, const H5L_info_t *, void *op_data) {
+    static_cast<std::vector<std::string> *>(op_data)->push_back(name);
+    return 0;
+}
+
+// Collects the paths of all datasets below a group
+void find_datasets(hid_t group, const std::string &prefix, std::vector<std::string> &datasets) {
+    std::vector<std::string> names;
+    hsize_t idx = 0;
+    H5Literate(group, H5_INDEX_NAME, H5_ITER_INC, &idx, collect_link_name, &names);
+    for (size_t n = 0; n < names.size(); n++) {
+        hid_t obj = H5Oopen(group, names[n].c_str(), H5P_DEFAULT);
+        if (obj < 0) {
+            continue;
+        }
+        H5I_type_t type = H5Iget_type(obj);
+        if (type == H5I_DATASET) {
+            datasets.push_back(prefix + names[n]);
+        } else if (type == H5I_GROUP) {
+            find_datasets(obj, prefix + names[n] + "/", datasets);
+        }
+        H5Oclose(obj);
+    }
+}
+
+struct VariableInfo {
+    std::string path;
+    std::vector<hsize_t> dims;
+    hsize_t count;
+    hsize_t element_size;
+    hsize_t logical_size;
+    hsize_t storage_size;
+    bool has_vlen;
+    // Estimated from a sample of the elements
+    double vlen_payload;
+    double vlen_overhead;
+};
+
+// Variable length fields of a record, each of which is one object in the global heap
+int count_vlen_fields(hid_t type) {
+    if (H5Tget_class(type) == H5T_VLEN || H5Tis_variable_str(type) > 0) {
+        return 1;
+    }
+    int fields = 0;
+    if (H5Tget_class(type) == H5T_COMPOUND) {
+        int members = H5Tget_nmembers(type);
+        for (int n = 0; n < members; n++) {
+            hid_t member = H5Tget_member_type(type, static_cast<unsigned>(n));
+            fields += count_vlen_fields(member);
+            H5Tclose(member);
+        }
+    }
+    return fields;
+}
+
+// Every global heap object has a 16 byte header and is padded to 8 bytes
+const double HEAP_OBJECT_HEADER = 16;
+const double HEAP_OBJECT_PADDING = 4;
+
+VariableInfo inspect(hid_t file, const std::string &path, hsize_t samples) {
+    VariableInfo info;
+    info.path = path;
+    info.count = 0;
+    info.vlen_payload = 0;
+    info.vlen_overhead = 0;
+
+    hid_t dataset = H5Dopen2(file, path.c_str(), H5P_DEFAULT);
+    hid_t type = H5Dget_type(dataset);
+    hid_t mem_type = H5Tget_native_type(type, H5T_DIR_ASCEND);
+    hid_t space = H5Dget_space(dataset);
+    hid_t dcpl = H5Dget_create_plist(dataset);
+
+    int rank = H5Sget_simple_extent_ndims(space);
+    info.dims.resize(rank > 0 ? rank : 0);
+    if (rank > 0) {
+        H5Sget_simple_extent_dims(space, &info.dims[0], NULL);
+        info.count = info.dims[0];
+    }
+    info.element_size = H5Tget_size(type);
+    for (int n = 1; n < rank; n++) {
+        info.element_size *= info.dims[n];
+    }
+    info.logical_size = info.element_size * (rank > 0 ? info.count : 1);
+    info.storage_size = H5Dget_storage_size(dataset);
+    // Variable length payloads live in the global heap, which is not part of the storage size
+    info.has_vlen = H5Tdetect_class(mem_type, H5T_VLEN) > 0 || H5Tis_variable_str(mem_type) > 0;
+
+    std::cout << path << std::endl;
+    std::cout << "   -- Elements:        " << info.count << std::endl;
+    std::cout << "   -- Element shape:   ";
+    if (rank <= 1) {
+        std::cout << "scalar";
+    }
+    for (int n = 1; n < rank; n++) {
+        std::cout << (n > 1 ? " x " : "") << info.dims[n];
+    }
+    std::cout << (info.has_vlen ? " (variable length)" : "") << std::endl;
+
+    H5D_layout_t layout = H5Pget_layout(dcpl);
+    std::cout << "   -- Layout:          ";
+    if (layout == H5D_CHUNKED) {
+        std::vector<hsize_t> chunk(rank);
+        H5Pget_chunk(dcpl, rank, &chunk[0]);
+        std::cout << "chunked, ";
+        for (int n = 0; n < rank; n++) {
+            std::cout << (n > 0 ? " x " : "") << chunk[n];
+        }
+        if (rank > 0 && chunk[0] == 1 && info.count > 1) {
+            std::cout << " (one element per chunk, consider ismrmrd_repack)";
+        }
+    } else if (layout == H5D_CONTIGUOUS) {
+        std::cout << "contiguous";
+    } else if (layout == H5D_COMPACT) {
+        std::cout << "compact";
+    } else if (layout == H5D_VIRTUAL) {
+        size_t sources = 0;
+        H5Pget_virtual_count(dcpl, &sources);
+        std::cout << "virtual, " << sources << " source(s)";
+    } else {
+        std::cout << "unknown";
+    }
+    std::cout << std::endl;
+
+    int nfilters = H5Pget_nfilters(dcpl);
+    std::cout << "   -- Filters:         ";
+    if (nfilters <= 0) {
+        std::cout << "none";
+    }
+    for (int n = 0; n < nfilters; n++) {
+        unsigned int flags;
+        size_t nelmts = 0;
+        char name[64] = "";
+        unsigned int config;
+        H5Pget_filter2(dcpl, n, &flags, &nelmts, NULL, sizeof(name), name, &config);
+        std::cout << (n > 0 ? ", " : "") << name;
+    }
+    std::cout << std::endl;
+
+    std::cout << "   -- Logical size:    " << format_bytes(double(info.logical_size)) << std::endl;
+    std::cout << "   -- Storage size:    " << format_bytes(double(info.storage_size));
+    if (info.logical_size > 0 && info.storage_size > 0) {
+        std::cout << " (" << std::fixed << std::setprecision(2) << double(info.storage_size) / info.logical_size
+                  << " of logical)";
+    }
+    std::cout << std::endl;
+
+    // The payload of a strided sample of the elements, rather than reading the whole heap
+    if (info.has_vlen && rank > 0 && info.count > 0) {
+        hsize_t sampled = samples < info.count ? samples : info.count;
+        std::vector<hsize_t> start(rank, 0), stride(rank, 1), count(info.dims);
+        stride[0] = info.count / sampled;
+        count[0] = sampled;
+        H5Sselect_hyperslab(space, H5S_SELECT_SET, &start[0], &stride[0], &count[0], NULL);
+        hsize_t vlen_size = 0;
+        H5Dvlen_get_buf_size(dataset, mem_type, space, &vlen_size);
+        info.vlen_payload = double(vlen_size) / sampled * info.count;
+        info.vlen_overhead = double(info.count) * count_vlen_fields(type) * (HEAP_OBJECT_HEADER + HEAP_OBJECT_PADDING);
+        std::cout << "   -- Vlen payload:    ~" << format_bytes(info.vlen_payload) << " (from " << sampled
+                  << " elements)" << std::endl;
+        std::cout << "   -- Heap overhead:   ~" << format_bytes(info.vlen_overhead) << " (";
+        if (info.vlen_payload > 0) {
+            std::cout << std::fixed << std::setprecision(1) << 100.0 * info.vlen_overhead / info.vlen_payload
+                      << "% of payload, ";
+        }
+        std::cout << "heap object headers and padding)" << std::endl;
+    }
+
+    H5Pclose(dcpl);
+    H5Sclose(space);
+    H5Tclose(mem_type);
+    H5Tclose(type);
+    H5Dclose(dataset);
+    return info;
+}
+
+enum AccessPattern { SEQUENTIAL, STRIDED, RANDOM };
+
+// Reads samples elements one at a time and prints the rate
+void profile(hid_t file, const VariableInfo &info, AccessPattern pattern, hsize_t samples) {
+    if (info.dims.empty() || info.count == 0) {
+        return;
+    }
+    if (samples > info.count) {
+        samples = info.count;
+    }
+
+    hid_t dataset = H5Dopen2(file, info.path.c_str(), H5P_DEFAULT);
+    hid_t type = H5Dget_type(dataset);
+    hid_t mem_type = H5Tget_native_type(type, H5T_DIR_ASCEND);
+    hid_t space = H5Dget_space(dataset);
+
+    int rank = static_cast<int>(info.dims.size());
+    std::vector<hsize_t> start(rank, 0);
+    std::vector<hsize_t> count(info.dims);
+    count[0] = 1;
+    hid_t mem_space = H5Screate_simple(rank, &count[0], NULL);
+    std::vector<char> buffer(static_cast<size_t>(H5Tget_size(mem_type) * (info.element_size / H5Tget_size(type))));
+
+    srand(1);
+    hsize_t stride = info.count / samples;
+    double elapsed = 0;
+    double bytes = 0;
+    for (hsize_t n = 0; n < samples; n++) {
+        if (pattern == SEQUENTIAL) {
+            start[0] = n;
+        } else if (pattern == STRIDED) {
+            start[0] = n * stride;
+        } else {
+            start[0] = (hsize_t(rand()) * (hsize_t(RAND_MAX) + 1) + hsize_t(rand())) % info.count;
+        }
+        H5Sselect_hyperslab(space, H5S_SELECT_SET, &start[0], NULL, &count[0], NULL);
+        double begin = ISMRMRD::seconds_now();
+        H5Dread(dataset, mem_type, mem_space, space, H5P_DEFAULT, &buffer[0]);
+        elapsed += ISMRMRD::seconds_now() - begin;
+        bytes += double(info.element_size);
+        if (info.has_vlen) {
+            // Only the element just read, outside the timed read
+            hsize_t vlen_size = 0;
+            H5Dvlen_get_buf_size(dataset, mem_type, space, &vlen_size);
+            bytes += double(vlen_size);
+#if H5_VERSION_GE(1, 12, 0)
+            H5Treclaim(mem_type, mem_space, H5P_DEFAULT, &buffer[0]);
+#else
+            H5Dvlen_reclaim(mem_type, mem_space, H5P_DEFAULT, &buffer[0]);
+#endif
+        }
+    }
+
+    const char *names[] = {"Sequential", "Strided", "Random"};
+    std::cout << "   -- " << std::left << std::setw(17) << (std::string(names[pattern]) + " read:") << std::right
+              << samples << " elements in " << std::fixed << std::setprecision(3) << elapsed * 1000.0 << " ms";
+    if (elapsed > 0) {
+        std::cout << " (" << std::setprecision(0) << samples / elapsed << " elements/s, " << std::setprecision(1)
+                  << bytes / (1024.0 * 1024.0) / elapsed << " MiB/s)";
+    }
+    std::cout << std::endl;
+
+    H5Sclose(mem_space);
+    H5Sclose(space);
+    H5Tclose(mem_type);
+    H5Tclose(type);
+    H5Dclose(dataset);
+}
+
+int inspect_file(const char *filename, const std::string &groupname, bool timing, hsize_t samples) {
+    ISMRMRD::ISMRMRD_Dataset dset;
+    if (ISMRMRD::ismrmrd_init_dataset(&dset, filename, groupname.c_str()) != ISMRMRD::ISMRMRD_NOERROR ||
+        ISMRMRD::ismrmrd_open_dataset_readonly(&dset) != ISMRMRD::ISMRMRD_NOERROR) {
+        std::cerr << "Error: Failed to open " << filename << std::endl;
+        ISMRMRD::ismrmrd_close_dataset(&dset);
+        return 1;
+    }
+
+    std::string group = !groupname.empty() && groupname[0] == '/' ? groupname : "/" + groupname;
+    if (H5Lexists(dset.fileid, group.c_str(), H5P_DEFAULT) <= 0) {
+        std::cerr << "Error: Group " << group << " not found in " << filename << std::endl;
+        ISMRMRD::ismrmrd_close_dataset(&dset);
+        return 1;
+    }
+
+    std::vector<std::string> datasets;
+    hid_t gid = H5Gopen2(dset.fileid, group.c_str(), H5P_DEFAULT);
+    find_datasets(gid, "", datasets);
+    H5Gclose(gid);
+
+    hsize_t file_size = 0;
+    H5Fget_filesize(dset.fileid, &file_size);
+
+    hsize_t storage = 0, logical = 0;
+    double payload = 0, overhead = 0;
+    for (size_t n = 0; n < datasets.size(); n++) {
+        VariableInfo info = inspect(dset.fileid, group + "/" + datasets[n], samples);
+        storage += info.storage_size;
+        logical += info.logical_size;
+        payload += info.vlen_payload;
+        overhead += info.vlen_overhead;
+        if (timing) {
+            profile(dset.fileid, info, SEQUENTIAL, samples);
+            profile(dset.fileid, info, STRIDED, samples);
+            profile(dset.fileid, info, RANDOM, samples);
+        }
+    }
+
+    std::cout << "FILE SUMMARY: " << filename << std::endl;
+    std::cout << "   -- File size:       " << format_bytes(double(file_size)) << std::endl;
+    std::cout << "   -- Dataset storage: " << format_bytes(double(storage)) << std::endl;
+    // Whatever is not raw data is variable length payload in the heaps and metadata
+    if (file_size > storage) {
+        std::cout << "   -- Heap and other:  " << format_bytes(double(file_size - storage)) << std::endl;
+    }
+    if (payload > 0) {
+        std::cout << "   -- Vlen payload:    ~" << format_bytes(payload) << std::endl;
+        std::cout << "   -- Heap overhead:   ~" << format_bytes(overhead) << std::endl;
+    }
+
+    ISMRMRD::ismrmrd_close_dataset(&dset);
+    return 0;
+}
+
+} // namespace
+#endif
+
 int main(int argc, char** argv)
 {
   std::cout << "ISMRMRD VERSION INFO: " << std::endl;
@@ -8,5 +337,45 @@ int main(int argc, char** argv)
         ISMRMRD_VERSION_MINOR << "." << ISMRMRD_VERSION_PATCH << std::endl;
   std::cout << "   -- SHA1:            " << ISMRMRD_GIT_SHA1_HASH << std::endl;
   std::cout << "   -- Dataset support: " << (ISMRMRD_DATASET_SUPPORT ? "yes" : "no") << std::endl;
+
+#ifdef ISMRMRD_INFO_INSPECT
+  std::string filename;
+  std::string groupname;
+  hsize_t samples = 1000;
+
+  po::options_description desc("Allowed options");
+  // clang-format off
+  desc.add_options()
+      ("help,h", "produce help message")
+      ("file,f", po::value<std::string>(&filename), "HDF5 file to inspect, only the version is printed without one")
+      ("group,g", po::value<std::string>(&groupname)->default_value("dataset"), "group name in the HDF5 file")
+      ("profile,p", "time sequential, strided and random reads of every dataset")
+      ("samples,s", po::value<hsize_t>(&samples)->default_value(1000), "elements read per access pattern");
+  // clang-format on
+  po::positional_options_description positional;
+  positional.add("file", 1).add("group", 1);
+
+  po::variables_map vm;
+  try {
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+    if (vm.count("help")) {
+      std::cerr << desc << "\n";
+      return 1;
+    }
+    po::notify(vm);
+  } catch (po::error &e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    std::cerr << desc << std::endl;
+    return 1;
+  }
+
+  if (!filename.empty()) {
+    std::cout << std::endl;
+    return inspect_file(filename.c_str(), groupname, vm.count("profile") > 0, samples > 0 ? samples : 1);
+  }
+#else
+  (void)argc;
+  (void)argv;
+#endif
   return 0;
 }
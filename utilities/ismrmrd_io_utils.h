@@ -4,6 +4,14 @@
 #include <fcntl.h>
 #include <io.h>
 #endif
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <time.h>
+#endif
 
 namespace ISMRMRD {
 void set_binary_io() {
@@ -12,4 +20,18 @@ void set_binary_io() {
     _setmode(_fileno(stdout), _O_BINARY);
 #endif
 }
+
+// Seconds on a monotonic clock, only differences are meaningful
+inline double seconds_now() {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, now;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&now);
+    return double(now.QuadPart) / double(frequency.QuadPart);
+#else
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+#endif
+}
 } // namespace ISMRMRD
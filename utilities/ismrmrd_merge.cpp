@@ -0,0 +1,55 @@
+#include "ismrmrd/dataset.h"
+
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace po = boost::program_options;
+
+int main(int argc, char **argv) {
+
+    // Parse arguments using boost program options
+    po::options_description desc("Concatenates the groups of several ISMRMRD files into one file");
+
+    // Arguments
+    std::vector<std::string> input_files;
+    std::string output_file;
+    std::string groupname;
+    size_t buffer_mb;
+
+    // clang-format off
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("input,i", po::value<std::vector<std::string> >(&input_files)->required()->multitoken(), "input files, in order")
+        ("output,o", po::value<std::string>(&output_file)->required(), "output HDF5 file")
+        ("group,g", po::value<std::string>(&groupname)->default_value("dataset"), "group name in the HDF5 files")
+        ("buffer,b", po::value<size_t>(&buffer_mb)->default_value(64), "copy buffer size in MiB");
+    // clang-format on
+
+    po::positional_options_description positional;
+    positional.add("input", -1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+        if (vm.count("help")) {
+            std::cerr << desc << "\n";
+            return 1;
+        }
+        po::notify(vm);
+    } catch (po::error &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        std::cerr << desc << std::endl;
+        return 1;
+    }
+
+    try {
+        ISMRMRD::mergeDatasets(output_file, groupname, input_files, buffer_mb * 1024 * 1024);
+    } catch (std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
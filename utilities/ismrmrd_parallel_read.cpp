@@ -0,0 +1,114 @@
+#include "ismrmrd/dataset.h"
+#include "ismrmrd/parallel_reader.h"
+#include "ismrmrd_io_utils.h"
+
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <string>
+
+namespace po = boost::program_options;
+using namespace ISMRMRD;
+
+namespace {
+
+double acquisition_bytes(const Acquisition &acq) {
+    return sizeof(AcquisitionHeader) + acq.getNumberOfDataElements() * sizeof(complex_float_t) +
+           acq.getNumberOfTrajElements() * sizeof(float);
+}
+
+// Prints the throughput of one pass and returns its duration
+double report(const char *label, uint32_t count, double bytes, double elapsed) {
+    std::cout << label << ": read " << count << " acquisitions, " << bytes / (1024.0 * 1024.0) << " MiB in "
+              << elapsed << " s";
+    if (elapsed > 0) {
+        std::cout << " (" << count / elapsed << " acquisitions/s, " << bytes / (1024.0 * 1024.0) / elapsed
+                  << " MiB/s)";
+    }
+    std::cout << std::endl;
+    return elapsed;
+}
+
+// The same loop as ismrmrd_read_timing_test
+double read_single(const std::string &filename, const std::string &groupname) {
+    double start = seconds_now();
+    Dataset d(filename.c_str(), groupname.c_str(), DATASET_READ_ONLY);
+    uint32_t count = d.getNumberOfAcquisitions();
+    Acquisition acq;
+    double bytes = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        d.readAcquisition(i, acq);
+        bytes += acquisition_bytes(acq);
+    }
+    return report("Single process", count, bytes, seconds_now() - start);
+}
+
+double read_parallel(const std::string &filename, const std::string &groupname, const ParallelReadOptions &options) {
+    double start = seconds_now();
+    ParallelAcquisitionReader reader(filename.c_str(), groupname.c_str(), options);
+    Acquisition acq;
+    double bytes = 0;
+    uint32_t count = 0;
+    while (reader.readNext(acq)) {
+        bytes += acquisition_bytes(acq);
+        count++;
+    }
+    std::cout << options.processes << " worker processes, blocks of " << options.block_size << " acquisitions"
+              << std::endl;
+    return report("Parallel", count, bytes, seconds_now() - start);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+
+    // Parse arguments using boost program options
+    po::options_description desc("Compares single process and multi-process acquisition reads");
+
+    // Arguments
+    std::string input_file;
+    std::string groupname;
+    ParallelReadOptions options;
+    size_t buffer_mb;
+
+    // clang-format off
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("input,i", po::value<std::string>(&input_file)->required(), "input HDF5 file")
+        ("group,g", po::value<std::string>(&groupname)->default_value("dataset"), "group name in the HDF5 file")
+        ("processes,p", po::value<unsigned int>(&options.processes)->default_value(options.processes), "number of worker processes")
+        ("block,k", po::value<uint32_t>(&options.block_size)->default_value(options.block_size), "consecutive acquisitions per worker block")
+        ("buffer,b", po::value<size_t>(&buffer_mb)->default_value(16), "shared memory buffer of each worker in MiB")
+        ("no-single", "skip the single process read");
+    // clang-format on
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help")) {
+            std::cerr << desc << "\n";
+            return 1;
+        }
+        po::notify(vm);
+    } catch (po::error &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        std::cerr << desc << std::endl;
+        return 1;
+    }
+    options.buffer_size = buffer_mb * 1024 * 1024;
+
+    try {
+        double single = 0;
+        if (vm.count("no-single") == 0) {
+            single = read_single(input_file, groupname);
+        }
+        double parallel = read_parallel(input_file, groupname, options);
+        if (single > 0 && parallel > 0) {
+            std::cout << "Speedup: " << single / parallel << std::endl;
+        }
+    } catch (std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
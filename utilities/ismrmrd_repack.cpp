@@ -0,0 +1,142 @@
+#include "ismrmrd/dataset.h"
+#include "ismrmrd_io_utils.h"
+
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace po = boost::program_options;
+using namespace ISMRMRD;
+
+namespace {
+
+// Reads every element of the group through the library and reports the throughput
+void report_read_throughput(const std::string &filename, const std::string &groupname, const char *label) {
+    double start = seconds_now();
+    double bytes = 0;
+    uint32_t elements = 0;
+
+    HDF5DatasetBackend dataset(filename.c_str(), groupname.c_str(), DATASET_READ_ONLY);
+
+    uint32_t count = dataset.getNumberOfAcquisitions();
+    ISMRMRD_Acquisition acq;
+    ismrmrd_init_acquisition(&acq);
+    for (uint32_t i = 0; i < count; i++) {
+        dataset.readAcquisition(i, &acq);
+        bytes += ismrmrd_size_of_acquisition_data(&acq) + ismrmrd_size_of_acquisition_traj(&acq);
+    }
+    ismrmrd_cleanup_acquisition(&acq);
+    elements += count;
+
+    count = dataset.getNumberOfWaveforms();
+    for (uint32_t i = 0; i < count; i++) {
+        Waveform wav;
+        dataset.readWaveform(i, &wav);
+        bytes += ismrmrd_size_of_waveform_data(&wav);
+    }
+    elements += count;
+
+    std::vector<std::string> variables = dataset.getImageVariables();
+    for (size_t v = 0; v < variables.size(); v++) {
+        count = dataset.getNumberOfImages(variables[v]);
+        ISMRMRD_Image im;
+        ismrmrd_init_image(&im);
+        for (uint32_t i = 0; i < count; i++) {
+            dataset.readImage(variables[v], i, &im);
+            bytes += ismrmrd_size_of_image_data(&im);
+        }
+        ismrmrd_cleanup_image(&im);
+        elements += count;
+    }
+
+    variables = dataset.getNDArrayVariables();
+    for (size_t v = 0; v < variables.size(); v++) {
+        count = dataset.getNumberOfNDArrays(variables[v]);
+        ISMRMRD_NDArray arr;
+        ismrmrd_init_ndarray(&arr);
+        for (uint32_t i = 0; i < count; i++) {
+            dataset.readNDArray(variables[v], i, &arr);
+            bytes += ismrmrd_size_of_ndarray_data(&arr);
+        }
+        ismrmrd_cleanup_ndarray(&arr);
+        elements += count;
+    }
+
+    double elapsed = seconds_now() - start;
+    std::cout << label << ": read " << elements << " elements, " << bytes / (1024.0 * 1024.0) << " MiB in "
+              << elapsed << " s";
+    if (elapsed > 0) {
+        std::cout << " (" << bytes / (1024.0 * 1024.0) / elapsed << " MiB/s)";
+    }
+    std::cout << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+
+    // Parse arguments using boost program options
+    po::options_description desc("Rewrites an ISMRMRD file with new chunking, compression and layout");
+
+    // Arguments
+    std::string input_file;
+    std::string output_file;
+    std::string groupname;
+    ISMRMRD::RepackOptions options;
+    size_t buffer_mb;
+
+    // clang-format off
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("input,i", po::value<std::string>(&input_file)->required(), "input HDF5 file")
+        ("output,o", po::value<std::string>(&output_file)->required(), "output HDF5 file")
+        ("group,g", po::value<std::string>(&groupname)->default_value("dataset"), "group name in the HDF5 file")
+        ("chunk,c", po::value<uint32_t>(&options.chunk_elements)->default_value(0), "elements per chunk, 0 for chunks of about 64 KiB")
+        ("compression,z", po::value<unsigned int>(&options.compression_level)->default_value(0), "deflate level 1-9, 0 for none")
+        ("shuffle,s", po::bool_switch(&options.shuffle), "apply the shuffle filter before compression")
+        ("contiguous", po::bool_switch(&options.contiguous), "store datasets contiguously, the output cannot be appended to")
+        ("buffer,b", po::value<size_t>(&buffer_mb)->default_value(64), "copy buffer size in MiB")
+        ("no-timing", "do not measure the read throughput before and after");
+    // clang-format on
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help")) {
+            std::cerr << desc << "\n";
+            return 1;
+        }
+        po::notify(vm);
+    } catch (po::error &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        std::cerr << desc << std::endl;
+        return 1;
+    }
+    options.buffer_size = buffer_mb * 1024 * 1024;
+
+    bool timing = vm.count("no-timing") == 0;
+    // repackDataset removes what it wrote when it fails
+    try {
+        if (timing) {
+            report_read_throughput(input_file, groupname, "Before");
+        }
+        ISMRMRD::repackDataset(input_file, output_file, groupname, options);
+    } catch (std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    // The output is complete by now, a failed read-back only loses the timing
+    if (timing) {
+        try {
+            report_read_throughput(output_file, groupname, "After");
+        } catch (std::exception &e) {
+            std::cerr << "Error: Failed to time reading " << output_file << ", which was written: " << e.what()
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
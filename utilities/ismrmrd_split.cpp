@@ -0,0 +1,58 @@
+#include "ismrmrd/dataset.h"
+
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace po = boost::program_options;
+
+int main(int argc, char **argv) {
+
+    // Parse arguments using boost program options
+    po::options_description desc("Copies variables or ranges of elements of an ISMRMRD file into a new file");
+
+    // Arguments
+    std::string input_file;
+    std::string output_file;
+    std::string groupname;
+    std::vector<std::string> variables;
+    uint32_t first;
+    uint32_t count;
+    size_t buffer_mb;
+
+    // clang-format off
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("input,i", po::value<std::string>(&input_file)->required(), "input HDF5 file")
+        ("output,o", po::value<std::string>(&output_file)->required(), "output HDF5 file")
+        ("group,g", po::value<std::string>(&groupname)->default_value("dataset"), "group name in the HDF5 files")
+        ("variable,v", po::value<std::vector<std::string> >(&variables), "variable to copy, e.g. data, waveforms or an image series; all if not given")
+        ("first,f", po::value<uint32_t>(&first)->default_value(0), "first element to copy")
+        ("count,n", po::value<uint32_t>(&count)->default_value(0), "number of elements to copy, 0 for all")
+        ("buffer,b", po::value<size_t>(&buffer_mb)->default_value(64), "copy buffer size in MiB");
+    // clang-format on
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help")) {
+            std::cerr << desc << "\n";
+            return 1;
+        }
+        po::notify(vm);
+    } catch (po::error &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        std::cerr << desc << std::endl;
+        return 1;
+    }
+
+    try {
+        ISMRMRD::splitDataset(input_file, output_file, groupname, variables, first, count, buffer_mb * 1024 * 1024);
+    } catch (std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
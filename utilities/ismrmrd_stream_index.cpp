@@ -0,0 +1,87 @@
+#include "ismrmrd/stream_index.h"
+
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <map>
+#include <string>
+
+namespace po = boost::program_options;
+
+const char *message_name(uint16_t id) {
+    switch (id) {
+    case ISMRMRD::ISMRMRD_MESSAGE_CONFIG_FILE:
+        return "config file";
+    case ISMRMRD::ISMRMRD_MESSAGE_CONFIG_TEXT:
+        return "config text";
+    case ISMRMRD::ISMRMRD_MESSAGE_HEADER:
+        return "header";
+    case ISMRMRD::ISMRMRD_MESSAGE_CLOSE:
+        return "close";
+    case ISMRMRD::ISMRMRD_MESSAGE_TEXT:
+        return "text";
+    case ISMRMRD::ISMRMRD_MESSAGE_ACQUISITION:
+        return "acquisition";
+    case ISMRMRD::ISMRMRD_MESSAGE_ACQUISITION_BATCH:
+        return "acquisition (batched)";
+    case ISMRMRD::ISMRMRD_MESSAGE_IMAGE:
+        return "image";
+    case ISMRMRD::ISMRMRD_MESSAGE_WAVEFORM:
+        return "waveform";
+    case ISMRMRD::ISMRMRD_MESSAGE_NDARRAY:
+        return "nd array";
+    default:
+        return "unknown";
+    }
+}
+
+int main(int argc, char **argv) {
+    std::string input_file;
+    std::string output_file;
+
+    po::options_description desc("Allowed options");
+
+    // clang-format off
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("input,i", po::value<std::string>(&input_file)->required(), "Binary stream file")
+        ("output,o", po::value<std::string>(&output_file), "Index file, the input file name with .idx appended by default");
+    // clang-format on
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help")) {
+            std::cerr << desc << "\n";
+            return 1;
+        }
+        po::notify(vm);
+    } catch (po::error &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        std::cerr << desc << std::endl;
+        return 1;
+    }
+
+    if (output_file.empty()) {
+        output_file = input_file + ".idx";
+    }
+
+    try {
+        ISMRMRD::StreamIndex index;
+        ISMRMRD::buildStreamIndex(input_file.c_str(), index);
+        index.write(output_file.c_str());
+
+        std::map<uint16_t, size_t> counts;
+        for (size_t n = 0; n < index.size(); n++) {
+            counts[index[n].message_id]++;
+        }
+        std::cout << index.size() << " messages indexed in " << output_file << std::endl;
+        for (std::map<uint16_t, size_t>::const_iterator it = counts.begin(); it != counts.end(); ++it) {
+            std::cout << "  " << message_name(it->first) << ": " << it->second << std::endl;
+        }
+    } catch (std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "ismrmrd/dataset.h"
+#include "ismrmrd/serialization_fd.h"
 #include "ismrmrd/serialization_iostream.h"
 #include "ismrmrd_io_utils.h"
 #include <boost/program_options.hpp>
@@ -25,117 +26,99 @@ std::string create_nd_array_name(const ISMRMRD::NDArray<T> &arr) {
     return ss.str();
 }
 
-void convert_stream_to_hdf5(std::string output_file, std::string groupname, std::istream &is) {
-    ISMRMRD::Dataset d(output_file.c_str(), groupname.c_str(), true);
-
-    ISMRMRD::IStreamView rs(is);
-    ISMRMRD::ProtocolDeserializer deserializer(rs);
+// Appends the messages of the stream to a dataset
+class DatasetWriter : public ISMRMRD::ProtocolVisitor {
+public:
+    explicit DatasetWriter(ISMRMRD::Dataset &d) : d_(d), first_(true) {}
+
+    // Configurations and a header after the first message are rejected before they are decoded
+    virtual bool accept(uint16_t message_id, int) {
+        bool first = first_;
+        first_ = false;
+        if (message_id == ISMRMRD::ISMRMRD_MESSAGE_CONFIG_FILE || message_id == ISMRMRD::ISMRMRD_MESSAGE_CONFIG_TEXT ||
+            (message_id == ISMRMRD::ISMRMRD_MESSAGE_HEADER && !first)) {
+            unknown(message_id);
+        }
+        return true;
+    }
 
     // Some reconstructions return the header but it is not required.
-    if (deserializer.peek() == ISMRMRD::ISMRMRD_MESSAGE_HEADER) {
-        ISMRMRD::IsmrmrdHeader hdr;
-        deserializer.deserialize(hdr);
-
+    virtual void visit(ISMRMRD::IsmrmrdHeader &hdr) {
         // We will convert the XML header to a string and write it to the HDF5 file
         std::stringstream xmlstream(std::ios::out | std::ios::binary);
         ISMRMRD::serialize(hdr, xmlstream);
-        d.writeHeader(xmlstream.str());
+        d_.writeHeader(xmlstream.str());
     }
 
-    while (deserializer.peek() != ISMRMRD::ISMRMRD_MESSAGE_CLOSE) {
-        if (deserializer.peek() == ISMRMRD::ISMRMRD_MESSAGE_ACQUISITION) {
-            ISMRMRD::Acquisition acq;
-            deserializer.deserialize(acq);
-            d.appendAcquisition(acq);
-        } else if (deserializer.peek() == ISMRMRD::ISMRMRD_MESSAGE_IMAGE) {
-            if (deserializer.peek_image_data_type() == ISMRMRD::ISMRMRD_USHORT) {
-                ISMRMRD::Image<unsigned short> img;
-                deserializer.deserialize(img);
-                d.appendImage(create_image_series_name(img), img);
-            } else if (deserializer.peek_image_data_type() == ISMRMRD::ISMRMRD_SHORT) {
-                ISMRMRD::Image<short> img;
-                deserializer.deserialize(img);
-                d.appendImage(create_image_series_name(img), img);
-            } else if (deserializer.peek_image_data_type() == ISMRMRD::ISMRMRD_UINT) {
-                ISMRMRD::Image<unsigned int> img;
-                deserializer.deserialize(img);
-                d.appendImage(create_image_series_name(img), img);
-            } else if (deserializer.peek_image_data_type() == ISMRMRD::ISMRMRD_INT) {
-                ISMRMRD::Image<int> img;
-                deserializer.deserialize(img);
-                d.appendImage(create_image_series_name(img), img);
-            } else if (deserializer.peek_image_data_type() == ISMRMRD::ISMRMRD_FLOAT) {
-                ISMRMRD::Image<float> img;
-                deserializer.deserialize(img);
-                d.appendImage(create_image_series_name(img), img);
-            } else if (deserializer.peek_image_data_type() == ISMRMRD::ISMRMRD_DOUBLE) {
-                ISMRMRD::Image<double> img;
-                deserializer.deserialize(img);
-                d.appendImage(create_image_series_name(img), img);
-            } else if (deserializer.peek_image_data_type() == ISMRMRD::ISMRMRD_CXFLOAT) {
-                ISMRMRD::Image<std::complex<float> > img;
-                deserializer.deserialize(img);
-                d.appendImage(create_image_series_name(img), img);
-            } else if (deserializer.peek_image_data_type() == ISMRMRD::ISMRMRD_CXDOUBLE) {
-                ISMRMRD::Image<std::complex<double> > img;
-                deserializer.deserialize(img);
-                d.appendImage(create_image_series_name(img), img);
-            } else {
-                throw std::runtime_error("Unknown image type");
-            }
-        } else if (deserializer.peek() == ISMRMRD::ISMRMRD_MESSAGE_WAVEFORM) {
-            ISMRMRD::Waveform wfm;
-            deserializer.deserialize(wfm);
-            d.appendWaveform(wfm);
-        } else if (deserializer.peek() == ISMRMRD::ISMRMRD_MESSAGE_NDARRAY) {
-            if (deserializer.peek_ndarray_data_type() == ISMRMRD::ISMRMRD_USHORT) {
-                ISMRMRD::NDArray<unsigned short> arr;
-                deserializer.deserialize(arr);
-                d.appendNDArray(create_nd_array_name(arr), arr);
-            } else if (deserializer.peek_ndarray_data_type() == ISMRMRD::ISMRMRD_SHORT) {
-                ISMRMRD::NDArray<short> arr;
-                deserializer.deserialize(arr);
-                d.appendNDArray(create_nd_array_name(arr), arr);
-            } else if (deserializer.peek_ndarray_data_type() == ISMRMRD::ISMRMRD_UINT) {
-                ISMRMRD::NDArray<unsigned int> arr;
-                deserializer.deserialize(arr);
-                d.appendNDArray(create_nd_array_name(arr), arr);
-            } else if (deserializer.peek_ndarray_data_type() == ISMRMRD::ISMRMRD_INT) {
-                ISMRMRD::NDArray<int> arr;
-                deserializer.deserialize(arr);
-                d.appendNDArray(create_nd_array_name(arr), arr);
-            } else if (deserializer.peek_ndarray_data_type() == ISMRMRD::ISMRMRD_FLOAT) {
-                ISMRMRD::NDArray<float> arr;
-                deserializer.deserialize(arr);
-                d.appendNDArray(create_nd_array_name(arr), arr);
-            } else if (deserializer.peek_ndarray_data_type() == ISMRMRD::ISMRMRD_DOUBLE) {
-                ISMRMRD::NDArray<double> arr;
-                deserializer.deserialize(arr);
-                d.appendNDArray(create_nd_array_name(arr), arr);
-            } else if (deserializer.peek_ndarray_data_type() == ISMRMRD::ISMRMRD_CXFLOAT) {
-                ISMRMRD::NDArray<std::complex<float> > arr;
-                deserializer.deserialize(arr);
-                d.appendNDArray(create_nd_array_name(arr), arr);
-            } else if (deserializer.peek_ndarray_data_type() == ISMRMRD::ISMRMRD_CXDOUBLE) {
-                ISMRMRD::NDArray<std::complex<double> > arr;
-                deserializer.deserialize(arr);
-                d.appendNDArray(create_nd_array_name(arr), arr);
-            } else {
-                throw std::runtime_error("Unknown nd array type");
-            }
-        } else if (deserializer.peek() == ISMRMRD::ISMRMRD_MESSAGE_TEXT) {
-            ISMRMRD::TextMessage txt;
-            deserializer.deserialize(txt);
-            std::cerr << "TEXT MESSAGE: " << txt.message << std::endl;
-        } else {
-            std::stringstream ss;
-            ss << "Unknown message type " << deserializer.peek();
-            throw std::runtime_error(ss.str());
-        }
+    virtual void visit(ISMRMRD::TextMessage &txt) {
+        std::cerr << "TEXT MESSAGE: " << txt.message << std::endl;
+    }
+
+    virtual void visit(ISMRMRD::Acquisition &acq) {
+        d_.appendAcquisition(acq);
+    }
+
+    virtual void visit(ISMRMRD::Waveform &wfm) {
+        d_.appendWaveform(wfm);
+    }
+
+    virtual void visit(ISMRMRD::Image<unsigned short> &img) { append(img); }
+    virtual void visit(ISMRMRD::Image<short> &img) { append(img); }
+    virtual void visit(ISMRMRD::Image<unsigned int> &img) { append(img); }
+    virtual void visit(ISMRMRD::Image<int> &img) { append(img); }
+    virtual void visit(ISMRMRD::Image<float> &img) { append(img); }
+    virtual void visit(ISMRMRD::Image<double> &img) { append(img); }
+    virtual void visit(ISMRMRD::Image<std::complex<float> > &img) { append(img); }
+    virtual void visit(ISMRMRD::Image<std::complex<double> > &img) { append(img); }
+
+    virtual void visit(ISMRMRD::NDArray<unsigned short> &arr) { append(arr); }
+    virtual void visit(ISMRMRD::NDArray<short> &arr) { append(arr); }
+    virtual void visit(ISMRMRD::NDArray<unsigned int> &arr) { append(arr); }
+    virtual void visit(ISMRMRD::NDArray<int> &arr) { append(arr); }
+    virtual void visit(ISMRMRD::NDArray<float> &arr) { append(arr); }
+    virtual void visit(ISMRMRD::NDArray<double> &arr) { append(arr); }
+    virtual void visit(ISMRMRD::NDArray<std::complex<float> > &arr) { append(arr); }
+    virtual void visit(ISMRMRD::NDArray<std::complex<double> > &arr) { append(arr); }
+
+private:
+    template <typename T>
+    void append(const ISMRMRD::Image<T> &img) {
+        d_.appendImage(create_image_series_name(img), img);
+    }
+
+    template <typename T>
+    void append(const ISMRMRD::NDArray<T> &arr) {
+        d_.appendNDArray(create_nd_array_name(arr), arr);
+    }
+
+    void unknown(uint16_t id) {
+        std::stringstream ss;
+        ss << "Unknown message type " << id;
+        throw std::runtime_error(ss.str());
+    }
+
+    ISMRMRD::Dataset &d_;
+    bool first_;
+};
+
+void convert_stream_to_hdf5(std::string output_file, std::string groupname, ISMRMRD::ReadableStreamView &source,
+                            const ISMRMRD::FlushPolicy &flush_policy) {
+    ISMRMRD::HDF5DatasetBackend *backend = new ISMRMRD::HDF5DatasetBackend(output_file.c_str(), groupname.c_str(), true);
+    ISMRMRD::Dataset d(backend);
+    backend->setFlushPolicy(flush_policy);
+
+    ISMRMRD::BufferedReadableStreamView rs(source);
+    ISMRMRD::ProtocolDeserializer deserializer(rs);
+
+    // Each message is decoded into an object of the writer that is reused by the next one of its type
+    DatasetWriter writer(d);
+    while (deserializer.dispatch(writer)) {
     }
 
     // If we can read any more at this point, it is an error
-    if (is.get() != EOF) {
+    char extra;
+    rs.read(&extra, 1);
+    if (!rs.eof()) {
         throw std::runtime_error("Extra data after ISMRMRD_CLOSE");
     }
 }
@@ -146,6 +129,7 @@ int main(int argc, char **argv) {
     std::string output_file;
     std::string groupname;
     bool use_stdin = false;
+    ISMRMRD::FlushPolicy flush_policy;
 
     // Parse arguments using boost program options
     po::options_description desc("Allowed options");
@@ -156,7 +140,10 @@ int main(int argc, char **argv) {
         ("input,i", po::value<std::string>(&input_file),"Binary input file")
         ("output,o", po::value<std::string>(&output_file)->required(),"ISMRMRD HDF5 output file")
         ("use-stdin", po::bool_switch(&use_stdin), "Use stdout for output")
-        ("group,g", po::value<std::string>(&groupname)->default_value("dataset"), "group name");
+        ("group,g", po::value<std::string>(&groupname)->default_value("dataset"), "group name")
+        ("flush-elements", po::value<uint32_t>(&flush_policy.elements)->default_value(0), "flush the output after this many elements, 0 for only at the end")
+        ("flush-seconds", po::value<double>(&flush_policy.seconds)->default_value(0), "flush the output at least this often, 0 for only at the end")
+        ("flush-background", po::bool_switch(&flush_policy.background), "flush on a background thread");
     // clang-format on
 
     po::variables_map vm;
@@ -185,10 +172,17 @@ int main(int argc, char **argv) {
             std::cerr << "Error: Could not open input file " << input_file << std::endl;
             return 1;
         }
-        convert_stream_to_hdf5(output_file, groupname, is);
+        ISMRMRD::IStreamView is_view(is);
+        convert_stream_to_hdf5(output_file, groupname, is_view, flush_policy);
     } else if (use_stdin) {
+#ifndef _WIN32
+        // Takes whatever the pipe holds instead of waiting for a full buffer
+        ISMRMRD::FdReadableStreamView is_view(STDIN_FILENO);
+#else
         ISMRMRD::set_binary_io();
-        convert_stream_to_hdf5(output_file, groupname, std::cin);
+        ISMRMRD::IStreamView is_view(std::cin);
+#endif
+        convert_stream_to_hdf5(output_file, groupname, is_view, flush_policy);
     } else {
         std::cerr << "Error: Must specify either input file or use-stdin" << std::endl;
         return 1;
@@ -0,0 +1,53 @@
+#include "ismrmrd/dataset.h"
+
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace po = boost::program_options;
+
+int main(int argc, char **argv) {
+
+    // Parse arguments using boost program options
+    po::options_description desc("Presents several ISMRMRD files as one dataset without copying the data");
+
+    // Arguments
+    std::vector<std::string> input_files;
+    std::string output_file;
+    std::string groupname;
+
+    // clang-format off
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("input,i", po::value<std::vector<std::string> >(&input_files)->required()->multitoken(), "input files, in acquisition order")
+        ("output,o", po::value<std::string>(&output_file)->required(), "output HDF5 file with the virtual dataset")
+        ("group,g", po::value<std::string>(&groupname)->default_value("dataset"), "group name in the HDF5 files");
+    // clang-format on
+
+    po::positional_options_description positional;
+    positional.add("input", -1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+        if (vm.count("help")) {
+            std::cerr << desc << "\n";
+            return 1;
+        }
+        po::notify(vm);
+    } catch (po::error &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        std::cerr << desc << std::endl;
+        return 1;
+    }
+
+    try {
+        ISMRMRD::createVirtualDataset(output_file, groupname, input_files);
+    } catch (std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
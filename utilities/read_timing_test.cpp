@@ -72,7 +72,7 @@ int main(int argc, char** argv)
 
   {
     Timer t("READ TIMER");
-    ISMRMRD::Dataset d(argv[1],"dataset", false);
+    ISMRMRD::Dataset d(argv[1], "dataset", ISMRMRD::DATASET_READ_ONLY);
     uint32_t number_of_acquisitions = d.getNumberOfAcquisitions();
     ISMRMRD::Acquisition acq;
     for (uint32_t i = 0; i < number_of_acquisitions; i++) {
@@ -46,7 +46,7 @@ int main(int argc, char** argv)
     std::cout << "   - filename: " << datafile << std::endl;
 
     //Let's open the existing dataset
-    ISMRMRD::Dataset d(datafile.c_str(),"dataset", false);
+    ISMRMRD::Dataset d(datafile.c_str(), "dataset", ISMRMRD::DATASET_READ_ONLY);
 
     std::string xml;
     d.readHeader(xml);
@@ -88,25 +88,25 @@ int main(int argc, char** argv)
     std::cout << "Number of Channels          : " << nCoils << std::endl;
     std::cout << "Number of acquisitions      : " << d.getNumberOfAcquisitions() << std::endl;
 
-    //Allocate a buffer for the data
+    //Assemble k-space directly from the file, lines outside the matrix are left zero
+    ISMRMRD::KSpaceFilter filter;
+    filter.matrix_size[0] = nX;
+    filter.matrix_size[1] = nY;
+    filter.matrix_size[2] = 1;
+    ISMRMRD::NDArray<complex_float_t> buffer = d.readKSpace(0, filter);
+
+    if (buffer.getDims()[0] != nX || buffer.getDims()[1] != nY || buffer.getDims()[2] != 1) {
+        std::cout << "The acquired k-space does not fit the encoding matrix" << std::endl;
+        return -1;
+    }
+
+    //Drop the singleton E2 dimension, the data order is unchanged
     std::vector<size_t> dims;
     dims.push_back(nX);
     dims.push_back(nY);
-    dims.push_back(nCoils);
-    ISMRMRD::NDArray<complex_float_t> buffer(dims);
-    std::fill(buffer.begin(), buffer.end(), complex_float_t(0.0f, 0.0f));
-    
-    //Now loop through and copy data
-    unsigned int number_of_acquisitions = d.getNumberOfAcquisitions();
-    for (unsigned int i = 0; i < number_of_acquisitions; i++) {
-        //Read one acquisition at a time
-        d.readAcquisition(i, acq);
-
-        //Copy data, we should probably be more careful here and do more tests....
-        for (uint16_t c=0; c<nCoils; c++) {
-            memcpy(&buffer(0,acq.idx().kspace_encode_step_1,c), &acq.data(0, c), sizeof(complex_float_t)*nX);
-        }
-    }
+    dims.push_back(buffer.getDims()[3]);
+    buffer.resize(dims);
+    nCoils = static_cast<uint16_t>(dims[2]);
 
     // Do the recon one slice at a time
     for (uint16_t c=0; c<nCoils; c++) {
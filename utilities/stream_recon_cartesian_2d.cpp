@@ -1,5 +1,6 @@
 #include "fftw3.h"
 #include "ismrmrd/meta.h"
+#include "ismrmrd/serialization_fd.h"
 #include "ismrmrd/serialization_iostream.h"
 #include "ismrmrd_io_utils.h"
 #include <boost/program_options.hpp>
@@ -21,9 +22,44 @@ void circshift(complex_float_t *out, const complex_float_t *in, int xdim, int yd
 
 #define fftshift(out, in, x, y) circshift(out, in, x, y, (x / 2), (y / 2))
 
-void reconstruct(std::istream &in, std::ostream &out, bool magnitude = false) {
-    ISMRMRD::IStreamView rs(in);
-    ISMRMRD::OStreamView ws(out);
+// Copies the readouts of the acquisitions into a k-space buffer
+class KSpaceFiller : public ISMRMRD::ProtocolVisitor {
+public:
+    KSpaceFiller(uint16_t nX, uint16_t nY) : nX(nX), nY(nY), nCoils(0) {}
+
+    virtual bool accept(uint16_t message_id, int) {
+        return message_id == ISMRMRD::ISMRMRD_MESSAGE_ACQUISITION;
+    }
+
+    virtual void visit(ISMRMRD::Acquisition &acq) {
+        if (!nCoils) {
+            nCoils = acq.active_channels();
+            acqhdr = acq.getHead();
+
+            // Allocate a buffer for the data
+            std::vector<size_t> dims;
+            dims.push_back(nX);
+            dims.push_back(nY);
+            dims.push_back(nCoils);
+            buffer = ISMRMRD::NDArray<complex_float_t>(dims);
+            std::fill(buffer.begin(), buffer.end(), complex_float_t(0.0f, 0.0f));
+        }
+
+        for (uint16_t c = 0; c < nCoils; c++) {
+            memcpy(&buffer(0, acq.idx().kspace_encode_step_1, c), &acq.data(0, c), sizeof(complex_float_t) * nX);
+        }
+    }
+
+    uint16_t nX;
+    uint16_t nY;
+    uint16_t nCoils;
+    ISMRMRD::NDArray<complex_float_t> buffer;
+    ISMRMRD::AcquisitionHeader acqhdr;
+};
+
+void reconstruct(ISMRMRD::ReadableStreamView &rs, std::ostream &out, bool magnitude = false) {
+    ISMRMRD::OStreamView out_view(out);
+    ISMRMRD::BufferedWritableStreamView ws(out_view);
 
     ISMRMRD::ProtocolDeserializer deserializer(rs);
     ISMRMRD::ProtocolSerializer serializer(ws);
@@ -57,36 +93,15 @@ void reconstruct(std::istream &in, std::ostream &out, bool magnitude = false) {
         throw std::runtime_error("This simple reconstruction application only supports 2D encoding spaces");
     }
 
-    uint16_t nX = e_space.matrixSize.x;
-    uint16_t nY = e_space.matrixSize.y;
-    uint16_t nCoils = 0;
-    ISMRMRD::NDArray<complex_float_t> buffer;
-    ISMRMRD::AcquisitionHeader acqhdr;
-    while (std::cin) {
-        ISMRMRD::Acquisition acq;
-        try {
-            deserializer.deserialize(acq);
-        } catch (ISMRMRD::ProtocolStreamClosed &) {
-            break;
-        }
-
-        if (!nCoils) {
-            nCoils = acq.active_channels();
-            acqhdr = acq.getHead();
-
-            // Allocate a buffer for the data
-            std::vector<size_t> dims;
-            dims.push_back(nX);
-            dims.push_back(nY);
-            dims.push_back(nCoils);
-            buffer = ISMRMRD::NDArray<complex_float_t>(dims);
-            std::fill(buffer.begin(), buffer.end(), complex_float_t(0.0f, 0.0f));
-        }
-
-        for (uint16_t c = 0; c < nCoils; c++) {
-            memcpy(&buffer(0, acq.idx().kspace_encode_step_1, c), &acq.data(0, c), sizeof(complex_float_t) * nX);
-        }
+    // Waveforms and other messages are not used, they are skipped without reading their data
+    KSpaceFiller filler(e_space.matrixSize.x, e_space.matrixSize.y);
+    while (deserializer.dispatch(filler)) {
     }
+    uint16_t nX = filler.nX;
+    uint16_t nY = filler.nY;
+    uint16_t nCoils = filler.nCoils;
+    ISMRMRD::NDArray<complex_float_t> &buffer = filler.buffer;
+    const ISMRMRD::AcquisitionHeader &acqhdr = filler.acqhdr;
 
     for (uint16_t c = 0; c < nCoils; c++) {
         fftwf_complex *tmp = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * (nX * nY));
@@ -164,6 +179,24 @@ void reconstruct(std::istream &in, std::ostream &out, bool magnitude = false) {
     serializer.close();
 }
 
+void reconstruct(std::istream &in, std::ostream &out, bool magnitude) {
+    ISMRMRD::IStreamView in_view(in);
+    ISMRMRD::BufferedReadableStreamView rs(in_view);
+    reconstruct(rs, out, magnitude);
+}
+
+// Reads the messages on stdin as they arrive instead of waiting for a full buffer
+void reconstruct_stdin(std::ostream &out, bool magnitude) {
+#ifndef _WIN32
+    ISMRMRD::FdReadableStreamView in_view(STDIN_FILENO);
+    ISMRMRD::BufferedReadableStreamView rs(in_view);
+    reconstruct(rs, out, magnitude);
+#else
+    ISMRMRD::IStreamView rs(std::cin);
+    reconstruct(rs, out, magnitude);
+#endif
+}
+
 int main(int argc, char **argv) {
     // Parse arguments using boost program options
     po::options_description desc("Allowed options");
@@ -205,7 +238,7 @@ int main(int argc, char **argv) {
 
     if (use_stdin && use_stdout) {
         ISMRMRD::set_binary_io();
-        reconstruct(std::cin, std::cout, output_magnitude);
+        reconstruct_stdin(std::cout, output_magnitude);
     } else if (input_file.size() && output_file.size()) {
         std::ifstream input(input_file.c_str(), std::ios::in | std::ios::binary);
         std::ofstream output(output_file.c_str(), std::ios::out | std::ios::binary);
@@ -217,7 +250,7 @@ int main(int argc, char **argv) {
     } else if (output_file.size() && use_stdin) {
         ISMRMRD::set_binary_io();
         std::ofstream output(output_file.c_str(), std::ios::out | std::ios::binary);
-        reconstruct(std::cin, output, output_magnitude);
+        reconstruct_stdin(output, output_magnitude);
     } else {
         std::cerr << "Error: Must specify either input file and output file or use-stdin and use-stdout" << std::endl;
         return 1;